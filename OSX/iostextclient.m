@@ -556,6 +556,20 @@ textclient_getc (text_data *d)
 }
 
 
+int
+textclient_read (text_data *d, char *buf, int n)
+{
+  int i = 0;
+  while (i < n) {
+    int c = textclient_getc (d);
+    if (c < 0) break;
+    if (c)			/* NULs would end the string early */
+      buf[i++] = c;
+  }
+  return i;
+}
+
+
 Bool
 textclient_putc (text_data *d, XKeyEvent *k)
 {
@@ -29,6 +29,8 @@
 "*visualID:		default",
 "*captureStderr: 	True",
 "*ignoreUninstalledPrograms: False",
+"*warmSpawn:		False",
+"*singleProcess:		False",
 "*textMode:		file",
 "*textLiteral:		XScreenSaver",
 "*textFile:		",
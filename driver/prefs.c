@@ -275,6 +275,8 @@ static const char * const prefs[] = {
   "captureStdout",		/* not saved -- obsolete */
   "logFile",			/* not saved */
   "ignoreUninstalledPrograms",
+  "warmSpawn",
+  "singleProcess",
   "font",
   "dpmsEnabled",
   "dpmsQuickOff",
@@ -815,6 +817,8 @@ write_init_file (Display *dpy,
       CHECK("logFile")		continue;  /* don't save */
       CHECK("ignoreUninstalledPrograms")
                                 type = pref_bool, b = p->ignore_uninstalled_p;
+      CHECK("warmSpawn")	type = pref_bool, b = p->warm_spawn_p;
+      CHECK("singleProcess")	type = pref_bool, b = p->single_process_p;
 
       CHECK("font")		type = pref_str,  s =    stderr_font;
 
@@ -1062,6 +1066,9 @@ load_init_file (Display *dpy, saver_preferences *p)
   p->ignore_uninstalled_p = get_boolean_resource (dpy, 
                                                   "ignoreUninstalledPrograms",
                                                   "Boolean");
+  p->warm_spawn_p   = get_boolean_resource (dpy, "warmSpawn", "Boolean");
+  p->single_process_p = get_boolean_resource (dpy, "singleProcess",
+                                              "Boolean");
 
   p->initial_delay   = 1000 * get_seconds_resource (dpy, "initialDelay", "Time");
   p->splash_duration = 1000 * get_seconds_resource (dpy, "splashDuration", "Time");
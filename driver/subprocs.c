@@ -35,6 +35,10 @@
 # include <sys/resource.h>	/* for setrlimit() and RLIMIT_AS */
 #endif
 
+#ifdef HAVE_FCNTL
+# include <fcntl.h>		/* for FD_CLOEXEC */
+#endif
+
 #ifdef VMS
 # include <processes.h>
 # include <unixio.h>		/* for close */
@@ -707,6 +711,8 @@ describe_dead_child (saver_info *si, pid_t kid, int wait_status)
 	saver_screen_info *ssi = &si->screens[i];
 	if (kid == ssi->pid)
 	  ssi->pid = 0;
+	if (kid == ssi->prefork_pid)
+	  ssi->prefork_pid = 0;
       }
 }
 
@@ -832,9 +838,19 @@ print_path_error (const char *program)
    If successful, the pid of the other process is returned.
    Otherwise, -1 is returned and an error may have been
    printed to stderr.
+
+   If prefork_fd is not -1, the process is being launched ahead of time:
+   instead of a window, it gets $XSCREENSAVER_PREFORK, the fd from which
+   it will read the ID of its window when it's time for it to start.
+
+   If ack_fd is not -1, it goes in $XSCREENSAVER_ACK (see check_ack().)
+
+   If windows is not null, it goes in $XSCREENSAVER_WINDOWS: the IDs of
+   all the windows that this one process should draw on.
  */
-pid_t
-fork_and_exec (saver_screen_info *ssi, const char *command)
+static pid_t
+fork_and_exec_1 (saver_screen_info *ssi, const char *command, int prefork_fd,
+                 int ack_fd, const char *windows)
 {
   saver_info *si = ssi->global;
   saver_preferences *p = &si->prefs;
@@ -853,12 +869,51 @@ fork_and_exec (saver_screen_info *ssi, const char *command)
     case 0:
       close (ConnectionNumber (si->dpy));	/* close display fd */
       limit_subproc_memory (p->inferior_memory_limit, p->verbose_p);
-      hack_subproc_environment (ssi->screen, ssi->screensaver_window);
+
+      if (prefork_fd == -1)
+        {
+          hack_subproc_environment (ssi->screen, ssi->screensaver_window);
+# ifdef HAVE_PUTENV
+          if (windows)
+            {
+              char *nssws = (char *) malloc (strlen (windows) + 40);
+              sprintf (nssws, "XSCREENSAVER_WINDOWS=%s", windows);
+              if (putenv (nssws))
+                abort ();
+            }
+# endif /* HAVE_PUTENV */
+        }
+      else
+        {
+          /* Only hacks that have acknowledged $XSCREENSAVER_ACK get here,
+             but in case one of them doesn't look at $XSCREENSAVER_PREFORK
+             after all, it gets a BadWindow rather than drawing somewhere. */
+          hack_subproc_environment (ssi->screen, 0);
+# ifdef HAVE_PUTENV
+          {
+            char *npf = (char *) malloc (40);
+            sprintf (npf, "XSCREENSAVER_PREFORK=%d", prefork_fd);
+            if (putenv (npf))
+              abort ();
+          }
+# endif /* HAVE_PUTENV */
+        }
+
+# ifdef HAVE_PUTENV
+      if (ack_fd != -1)
+        {
+          char *nack = (char *) malloc (40);
+          sprintf (nack, "XSCREENSAVER_ACK=%d", ack_fd);
+          if (putenv (nack))
+            abort ();
+        }
+# endif /* HAVE_PUTENV */
 
       if (p->verbose_p)
-        fprintf (stderr, "%s: %d: spawning \"%s\" in pid %lu.\n",
-                 blurb(), ssi->number, command,
-                 (unsigned long) getpid ());
+        fprintf (stderr, "%s: %d: %s \"%s\" in pid %lu.\n",
+                 blurb(), ssi->number,
+                 (prefork_fd == -1 ? "spawning" : "pre-launching"),
+                 command, (unsigned long) getpid ());
 
       exec_command (p->shell, command, p->nice_inferior);
 
@@ -879,6 +934,345 @@ fork_and_exec (saver_screen_info *ssi, const char *command)
   return forked;
 }
 
+pid_t
+fork_and_exec (saver_screen_info *ssi, const char *command)
+{
+  return fork_and_exec_1 (ssi, command, -1, -1, 0);
+}
+
+
+/* Only hacks built on the xscreensaver framework (hacks/screenhack.c)
+   know how to wait for $XSCREENSAVER_PREFORK, and there's no telling
+   them apart from other programs by their command lines.  So each hack
+   that we haven't heard from yet is run with $XSCREENSAVER_ACK naming a
+   pipe, and the framework writes a byte down it as the hack starts up.
+   Hacks that have done that are remembered in si->acked_commands, and
+   only those are ever launched ahead of time.
+ */
+static Bool
+acked_command_p (saver_info *si, const char *command)
+{
+  int i;
+  for (i = 0; i < si->acked_commands_count; i++)
+    if (!strcmp (si->acked_commands[i], command))
+      return True;
+  return False;
+}
+
+
+/* Makes the pipe for $XSCREENSAVER_ACK, and returns the end to pass to
+   the hack (which the caller closes after forking), or -1.
+ */
+static int
+open_ack (saver_screen_info *ssi, const char *command)
+{
+# if defined(HAVE_FCNTL) && defined(FD_CLOEXEC) && defined(O_NONBLOCK)
+  int fds[2];
+
+  if (ssi->ack_command || pipe (fds) != 0)
+    return -1;
+
+  /* Our end mustn't leak into the hack, and we mustn't wait on it. */
+  if (fcntl (fds[0], F_SETFD, FD_CLOEXEC) != 0 ||
+      fcntl (fds[0], F_SETFL, O_NONBLOCK) != 0)
+    {
+      perror ("fcntl");
+      close (fds[0]);
+      close (fds[1]);
+      return -1;
+    }
+
+  ssi->ack_command = strdup (command);
+  ssi->ack_fd = fds[0];
+  return fds[1];
+# else  /* !HAVE_FCNTL */
+  return -1;
+# endif /* !HAVE_FCNTL */
+}
+
+
+/* Closes the $XSCREENSAVER_ACK pipe of the hack that ran on this screen,
+   and remembers the hack if it wrote to it.  Called when the hack is
+   being killed, by which time it has long since started up.
+ */
+static void
+check_ack (saver_screen_info *ssi)
+{
+  saver_info *si = ssi->global;
+  char c;
+
+  if (!ssi->ack_command) return;
+
+  if (read (ssi->ack_fd, &c, 1) == 1 &&
+      !acked_command_p (si, ssi->ack_command))
+    {
+      char **list = (char **)
+        realloc (si->acked_commands,
+                 (si->acked_commands_count + 1) * sizeof(*list));
+      if (list)
+        {
+          si->acked_commands = list;
+          list[si->acked_commands_count++] = ssi->ack_command;
+          if (si->prefs.verbose_p)
+            fprintf (stderr, "%s: %d: \"%s\" can be pre-launched.\n",
+                     blurb(), ssi->number, ssi->ack_command);
+          ssi->ack_command = 0;
+        }
+    }
+
+  close (ssi->ack_fd);
+  if (ssi->ack_command) free (ssi->ack_command);
+  ssi->ack_command = 0;
+}
+
+
+/* Single-process mode: with the singleProcess preference, when all the
+   screens are going to run the same hack, the copy launched for screen 0
+   draws on the windows of the others as well, and those screens' `pid'
+   is the same as screen 0's.  This saves a process, an X connection, and
+   all of the hack's data for every additional monitor.
+
+   Other programs would ignore $XSCREENSAVER_WINDOWS and leave the other
+   screens black, so as with warm spawning, this is only done for hacks
+   that have acknowledged $XSCREENSAVER_ACK.  Until then, each screen
+   gets its own copy.
+ */
+static Bool
+single_process_p (saver_info *si)
+{
+  saver_preferences *p = &si->prefs;
+  return (p->single_process_p &&
+          si->nscreens > 1 &&
+          (p->mode == ONE_HACK || p->mode == RANDOM_HACKS_SAME));
+}
+
+
+/* Whether some other screen is being drawn on by this screen's process.
+ */
+static Bool
+shared_pid_p (saver_screen_info *ssi)
+{
+  saver_info *si = ssi->global;
+  int i;
+  if (!ssi->pid) return False;
+  for (i = 0; i < si->nscreens; i++)
+    if (&si->screens[i] != ssi && si->screens[i].pid == ssi->pid)
+      return True;
+  return False;
+}
+
+
+/* Picks a visual for the hack on each of the other idle screens, and
+   returns the list of window IDs for $XSCREENSAVER_WINDOWS, starting
+   with this screen's.  The screens that are included are marked in
+   `joined'.  Returns 0 if there are none besides this one.
+ */
+static char *
+shared_windows (saver_screen_info *ssi, screenhack *hack, Bool *joined)
+{
+  saver_info *si = ssi->global;
+  char *windows = (char *) malloc (si->nscreens * 20 + 1);
+  int i, n = 0;
+
+  if (!windows) return 0;
+  sprintf (windows, "0x%lX", (unsigned long) ssi->screensaver_window);
+
+  for (i = 0; i < si->nscreens; i++)
+    {
+      saver_screen_info *ssi2 = &si->screens[i];
+      joined[i] = False;
+      if (ssi2 == ssi || ssi2->pid)
+        continue;
+      if (! select_visual_of_hack (ssi2, hack))
+        continue;
+
+      discard_prefork (ssi2);
+      joined[i] = True;
+      n++;
+      sprintf (windows + strlen (windows), " 0x%lX",
+               (unsigned long) ssi2->screensaver_window);
+
+      if (si->prefs.verbose_p)
+        fprintf (stderr, "%s: %d: also drawing on screen %d (0x%lx).\n",
+                 blurb(), ssi->number, ssi2->number,
+                 (unsigned long) ssi2->screensaver_window);
+    }
+
+  if (n == 0)
+    {
+      free (windows);
+      return 0;
+    }
+  return windows;
+}
+
+
+/* Warm spawning: with the warmSpawn preference, the hack that will run
+   next on each screen is launched as soon as the current one is, and it
+   gets as far as connecting to the display and parsing its resources.
+   Then it waits (see wait_for_window() in hacks/screenhack.c) until we
+   write the ID of its window down a pipe.  So on slow machines, a new
+   hack can start drawing right away instead of after a second or three
+   of black screen.  This only applies to the random modes.
+ */
+
+void
+discard_prefork (saver_screen_info *ssi)
+{
+  if (!ssi->prefork_command) return;
+  if (ssi->prefork_pid)
+    kill_job (ssi->global, ssi->prefork_pid, SIGTERM);
+  close (ssi->prefork_fd);
+  free (ssi->prefork_command);
+  ssi->prefork_command = 0;
+  ssi->prefork_pid = 0;
+}
+
+
+/* Whether the pre-launched hack is still alive, and is still the same
+   program that's at its position in the list (which might have been
+   edited since.)
+ */
+static Bool
+prefork_usable_p (saver_screen_info *ssi)
+{
+  saver_preferences *p = &ssi->global->prefs;
+  struct screenhack_job *job;
+
+  if (!ssi->prefork_command || !ssi->prefork_pid) return False;
+  if (!p->warm_spawn_p) return False;
+  if (ssi->prefork_hack >= p->screenhacks_count) return False;
+  if (strcmp (ssi->prefork_command,
+              p->screenhacks[ssi->prefork_hack]->command))
+    return False;
+
+  clean_job_list();
+  job = find_job (ssi->prefork_pid);
+  return (job && job->status == job_running);
+}
+
+
+void
+prefork_screenhack (saver_screen_info *ssi)
+{
+  saver_info *si = ssi->global;
+  saver_preferences *p = &si->prefs;
+  screenhack *hack;
+  int new_hack;
+  int retry_count = 0;
+  int fds[2];
+  pid_t forked;
+
+  if (ssi->prefork_command ||
+      !p->warm_spawn_p ||
+      (single_process_p (si) && ssi != &si->screens[0]) ||
+      p->screenhacks_count < 1 ||
+      (p->mode != RANDOM_HACKS && p->mode != RANDOM_HACKS_SAME))
+    return;
+
+  if (p->mode == RANDOM_HACKS_SAME && ssi->number != 0)
+    {
+      /* Pre-launch whatever screen 0 is going to run next. */
+      if (! si->screens[0].prefork_command) return;
+      new_hack = si->screens[0].prefork_hack;
+    }
+  else
+    while (1)
+      {
+        if (p->screenhacks_count == 1)
+          new_hack = 0;
+        else
+          while ((new_hack = random () % p->screenhacks_count)
+                 == ssi->current_hack)
+            ;
+        hack = p->screenhacks[new_hack];
+        if (hack->enabled_p && on_path_p (hack->command))
+          break;
+        if (++retry_count > (p->screenhacks_count*4))
+          return;
+      }
+
+  hack = p->screenhacks[new_hack];
+
+  /* If we don't know that it will wait for its window, don't launch it
+     now.  But don't pick another one instead, either: that would favor
+     the hacks that can be pre-launched.  It'll be started the usual way
+     (and perhaps acknowledge $XSCREENSAVER_ACK) if it's chosen. */
+  if (! acked_command_p (si, hack->command))
+    return;
+
+  if (pipe (fds) != 0)
+    {
+      char buf [255];
+      sprintf (buf, "%s: couldn't create pipe", blurb());
+      perror (buf);
+      return;
+    }
+
+# if defined(HAVE_FCNTL) && defined(FD_CLOEXEC)
+  /* Don't leak our end into the other hacks, or they would keep this
+     one waiting after we're gone. */
+  if (fcntl (fds[1], F_SETFD, FD_CLOEXEC) != 0)
+    perror ("fcntl: CLOEXEC:");
+# endif
+
+  forked = fork_and_exec_1 (ssi, hack->command, fds[0], -1, 0);
+  close (fds[0]);
+  if (forked <= 0)
+    {
+      close (fds[1]);
+      return;
+    }
+
+  ssi->prefork_command = strdup (hack->command);
+  ssi->prefork_hack = new_hack;
+  ssi->prefork_pid = forked;
+  ssi->prefork_fd = fds[1];
+}
+
+
+/* Tells the pre-launched hack which window to draw on (or windows, if
+   it's not null.)  Returns its pid, or 0 if it couldn't be woken up.
+ */
+static pid_t
+wake_prefork (saver_screen_info *ssi, const char *windows)
+{
+  saver_info *si = ssi->global;
+  pid_t pid = ssi->prefork_pid;
+  char *buf = (char *) malloc ((windows ? strlen (windows) : 0) + 40);
+  int L;
+
+  if (!buf) return 0;
+  if (windows)
+    sprintf (buf, "%s\n", windows);
+  else
+    sprintf (buf, "0x%lX\n", (unsigned long) ssi->screensaver_window);
+  L = strlen (buf);
+
+  block_sigchld();	/* and SIGPIPE, in case it just died */
+  if (write (ssi->prefork_fd, buf, L) != L)
+    pid = 0;
+  unblock_sigchld();
+  free (buf);
+
+  if (!pid)
+    {
+      discard_prefork (ssi);
+      return 0;
+    }
+
+  if (si->prefs.verbose_p)
+    fprintf (stderr, "%s: %d: starting pre-launched pid %lu on 0x%lx.\n",
+             blurb(), ssi->number, (unsigned long) pid,
+             (unsigned long) ssi->screensaver_window);
+
+  close (ssi->prefork_fd);
+  free (ssi->prefork_command);
+  ssi->prefork_command = 0;
+  ssi->prefork_pid = 0;
+  return pid;
+}
+
 
 void
 spawn_screenhack (saver_screen_info *ssi)
@@ -896,6 +1290,15 @@ spawn_screenhack (saver_screen_info *ssi)
       return;
     }
 
+  if (shared_pid_p (ssi))
+    /* Screen 0's process is already drawing on this one. */
+    return;
+
+  check_ack (ssi);
+
+  if (ssi->prefork_command && !prefork_usable_p (ssi))
+    discard_prefork (ssi);
+
   if (p->screenhacks_count)
     {
       screenhack *hack;
@@ -904,6 +1307,8 @@ spawn_screenhack (saver_screen_info *ssi)
       int new_hack = -1;
       int retry_count = 0;
       Bool force = False;
+      char *windows = 0;
+      Bool *joined = 0;
 
     AGAIN:
 
@@ -956,6 +1361,11 @@ spawn_screenhack (saver_screen_info *ssi)
            */
           new_hack = si->screens[0].current_hack;
 	}
+      else if (ssi->prefork_command)
+        {
+          /* Use the random hack that we launched ahead of time. */
+          new_hack = ssi->prefork_hack;
+        }
       else  /* (p->mode == RANDOM_HACKS) */
 	{
 	  /* Select a random hack (but not the one we just ran.) */
@@ -966,6 +1376,7 @@ spawn_screenhack (saver_screen_info *ssi)
 
       if (new_hack < 0)   /* don't run a hack */
         {
+          discard_prefork (ssi);
           ssi->current_hack = -1;
           if (si->selection_mode < 0)
             si->selection_mode = 0;
@@ -988,6 +1399,8 @@ spawn_screenhack (saver_screen_info *ssi)
 	   !on_path_p (hack->command) ||
 	   !select_visual_of_hack (ssi, hack)))
 	{
+          if (ssi->prefork_command && new_hack == ssi->prefork_hack)
+            discard_prefork (ssi);
 	  if (++retry_count > (p->screenhacks_count*4))
 	    {
 	      /* Uh, oops.  Odds are, there are no suitable visuals,
@@ -1011,7 +1424,34 @@ spawn_screenhack (saver_screen_info *ssi)
       if (si->selection_mode < 0)
 	si->selection_mode = 0;
 
-      forked = fork_and_exec (ssi, hack->command);
+      /* If we're running something other than what was launched ahead of
+         time (because of "next", "demo", a missing visual, or screen 0
+         having done so in random-same mode) then get rid of that, or it
+         would sit there forever and nothing else would be pre-launched. */
+      if (ssi->prefork_command && new_hack != ssi->prefork_hack)
+        discard_prefork (ssi);
+
+      if (ssi == &si->screens[0] && single_process_p (si) &&
+          acked_command_p (si, hack->command))
+        {
+          joined = (Bool *) calloc (si->nscreens, sizeof(*joined));
+          if (joined)
+            windows = shared_windows (ssi, hack, joined);
+        }
+
+      forked = 0;
+      if (ssi->prefork_command)
+        forked = wake_prefork (ssi, windows);
+      if (forked <= 0)
+        {
+          int ack_fd = -1;
+          if ((p->warm_spawn_p || single_process_p (si)) &&
+              !acked_command_p (si, hack->command))
+            ack_fd = open_ack (ssi, hack->command);
+          forked = fork_and_exec_1 (ssi, hack->command, -1, ack_fd, windows);
+          if (ack_fd != -1)
+            close (ack_fd);
+        }
       switch ((int) forked)
 	{
 	case -1: /* fork failed */
@@ -1024,8 +1464,23 @@ spawn_screenhack (saver_screen_info *ssi)
 
 	default:
 	  ssi->pid = forked;
+          if (windows)
+            {
+              int i;
+              for (i = 0; i < si->nscreens; i++)
+                if (joined[i])
+                  {
+                    si->screens[i].pid = forked;
+                    si->screens[i].current_hack = new_hack;
+                  }
+            }
 	  break;
 	}
+
+      if (windows) free (windows);
+      if (joined) free (joined);
+
+      prefork_screenhack (ssi);
     }
 
   store_saver_status (si);  /* store current hack number */
@@ -1036,7 +1491,11 @@ void
 kill_screenhack (saver_screen_info *ssi)
 {
   saver_info *si = ssi->global;
-  if (ssi->pid)
+  check_ack (ssi);
+
+  /* If the process is drawing on other screens too, leave it running
+     for them: the last screen to let go of it kills it. */
+  if (ssi->pid && !shared_pid_p (ssi))
     kill_job (si, ssi->pid, SIGTERM);
   ssi->pid = 0;
 }
@@ -1067,9 +1526,12 @@ emergency_kill_subproc (saver_info *si)
       saver_screen_info *ssi = &si->screens[i];
       if (ssi->pid)
 	{
-	  kill_job (si, ssi->pid, SIGTERM);
+          if (!shared_pid_p (ssi))
+            kill_job (si, ssi->pid, SIGTERM);
 	  ssi->pid = 0;
 	}
+      discard_prefork (ssi);
+      check_ack (ssi);
     }
 }
 
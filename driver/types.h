@@ -93,6 +93,10 @@ struct saver_preferences {
   Bool capture_stderr_p;	/* whether to redirect stdout/stderr  */
   Bool ignore_uninstalled_p;	/* whether to avoid displaying or complaining
                                    about hacks that are not on $PATH */
+  Bool warm_spawn_p;		/* whether to launch the next hack ahead of
+				   time, and leave it waiting for its window */
+  Bool single_process_p;	/* whether one process should run the hack on
+				   all screens, when they're all the same */
   Bool debug_p;			/* pay no mind to the man behind the curtain */
   Bool xsync_p;			/* whether XSynchronize has been called */
 
@@ -244,6 +248,10 @@ struct saver_info {
                                    (if currently blanked) or unblanked (if
                                    not blanked.) */
 
+  char **acked_commands;	/* Hacks that have answered $XSCREENSAVER_ACK,
+				   and so can be launched ahead of time. */
+  int acked_commands_count;
+
 
   /* =======================================================================
      locking and runtime privileges
@@ -424,6 +432,17 @@ struct saver_screen_info {
   int current_hack;		/* Index into `prefs.screenhacks' */
   pid_t pid;
 
+  char *prefork_command;	/* If warm_spawn_p, the hack that will run
+				   next, which has already been launched and
+				   is waiting to be told its window. */
+  int prefork_hack;		/* Index into `prefs.screenhacks' */
+  pid_t prefork_pid;		/* 0 once it has died */
+  int prefork_fd;		/* Its window ID gets written here */
+
+  char *ack_command;		/* The running hack, if we're waiting to hear
+				   whether it understands the above. */
+  int ack_fd;			/* Where it will say so */
+
   int stderr_text_x;
   int stderr_text_y;
   int stderr_line_height;
@@ -1467,6 +1467,7 @@ resize_screensaver_window (saver_info *si)
       saver_screen_info *ssi = &si->screens[i];
       if (ssi->pid)
         kill_screenhack (ssi);
+      discard_prefork (ssi);
       if (ssi->screensaver_window)
         {
           XUnmapWindow (si->dpy, ssi->screensaver_window);
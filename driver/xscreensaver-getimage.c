@@ -75,6 +75,32 @@
 #endif
 
 
+/* If USE_IMAGE_CACHE is defined, images loaded from files are saved on
+   disk after they have been scaled to fit, and the next time that file
+   is wanted at that size, it is mapped back in instead of decoded.
+ */
+#if defined(HAVE_MMAP) && \
+    (defined(HAVE_GDK_PIXBUF) || defined(HAVE_JPEGLIB))
+# define USE_IMAGE_CACHE
+#endif
+
+/* If USE_IMAGE_INDEX is defined, image files are chosen from a list of
+   them that is kept on disk, instead of by running
+   xscreensaver-getimage-file, which searches the whole directory tree
+   every time.  See index_random_file().
+ */
+#ifdef HAVE_MMAP
+# define USE_IMAGE_INDEX
+#endif
+
+#if defined(USE_IMAGE_CACHE) || defined(USE_IMAGE_INDEX)
+# include <fcntl.h>
+# include <dirent.h>
+# include <utime.h>
+# include <sys/mman.h>
+#endif
+
+
 #ifdef __GNUC__
  __extension__     /* shut up about "string length is greater than the length
                       ISO C89 compilers are required to support" when including
@@ -83,6 +109,8 @@
 
 static char *defaults[] = {
 #include "../driver/XScreenSaver_ad.h"
+ "*useSHM: True",
+ "*imageCacheSize: 256",
  0
 };
 
@@ -141,16 +169,6 @@ ignore_all_errors_ehandler (Display *dpy, XErrorEvent *error)
   return 0;
 }
 
-#ifndef USE_EXTERNAL_SCREEN_GRABBER
-static int
-ignore_badmatch_ehandler (Display *dpy, XErrorEvent *error)
-{
-  if (error->error_code == BadMatch)
-    return ignore_all_errors_ehandler (dpy, error);
-  else
-    return x_ehandler (dpy, error);
-}
-#endif /* ! USE_EXTERNAL_SCREEN_GRABBER */
 
 
 /* Returns True if the given Drawable is a Window; False if it's a Pixmap.
@@ -297,15 +315,229 @@ compute_image_scaling (int src_w, int src_h,
 }
 
 
-/* Scales an XImage, modifying it in place.
-   This doesn't do dithering or smoothing, so it might have artifacts.
-   If out of memory, returns False, and the XImage will have been
-   destroyed and freed.
- */
 #if !defined(USE_EXTERNAL_SCREEN_GRABBER) || defined(HAVE_JPEGLIB)
+
+/* For scaling n1 pixels to n2 pixels by averaging: which source pixels
+   each destination pixel covers, and how much of each.  The weights are
+   in units of 1/n2 of a source pixel, so they add up to n1 for every
+   destination pixel.
+ */
+typedef struct {
+  int *first;			/* first source pixel of each dest pixel */
+  int *count;			/* how many source pixels */
+  int *offset;			/* index of the first one's weight */
+  unsigned long *weight;
+} scale_table;
+
+
+static void
+free_scale_table (scale_table *t)
+{
+  if (t->first)  free (t->first);
+  if (t->count)  free (t->count);
+  if (t->offset) free (t->offset);
+  if (t->weight) free (t->weight);
+}
+
+
 static Bool
-scale_ximage (Screen *screen, Visual *visual,
-              XImage *ximage, int new_width, int new_height)
+make_scale_table (int n1, int n2, scale_table *t)
+{
+  int i, j, k = 0;
+  t->first  = (int *) malloc (n2 * sizeof(*t->first));
+  t->count  = (int *) malloc (n2 * sizeof(*t->count));
+  t->offset = (int *) malloc (n2 * sizeof(*t->offset));
+  t->weight = (unsigned long *) malloc ((n1 + n2) * sizeof(*t->weight));
+  if (!t->first || !t->count || !t->offset || !t->weight)
+    {
+      free_scale_table (t);
+      return False;
+    }
+
+  for (i = 0; i < n2; i++)
+    {
+      /* Source pixel j spans [j*n2, (j+1)*n2); this one spans [lo, hi). */
+      long lo = (long) i * n1;
+      long hi = lo + n1;
+      int s = lo / n2;
+      int e = (hi - 1) / n2;
+      t->first[i]  = s;
+      t->count[i]  = e - s + 1;
+      t->offset[i] = k;
+      for (j = s; j <= e; j++)
+        {
+          long a = (long) j * n2;
+          long b = a + n2;
+          if (a < lo) a = lo;
+          if (b > hi) b = hi;
+          t->weight[k++] = b - a;
+        }
+    }
+  return True;
+}
+
+
+/* Copies a row of pixels out of an XImage, or into one.
+   Only the common formats avoid XGetPixel and XPutPixel.
+ */
+static void
+get_image_row (XImage *image, int y, unsigned long *out)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  const char *row = image->data + y * image->bytes_per_line;
+  int x;
+  u.i = 1;
+  if (image->byte_order == (u.c[0] ? LSBFirst : MSBFirst) &&
+      image->bits_per_pixel == 32 && sizeof(unsigned int) == 4)
+    for (x = 0; x < image->width; x++)
+      out[x] = ((const unsigned int *) row)[x];
+  else if (image->byte_order == (u.c[0] ? LSBFirst : MSBFirst) &&
+           image->bits_per_pixel == 16 && sizeof(unsigned short) == 2)
+    for (x = 0; x < image->width; x++)
+      out[x] = ((const unsigned short *) row)[x];
+  else
+    for (x = 0; x < image->width; x++)
+      out[x] = XGetPixel (image, x, y);
+}
+
+static void
+put_image_row (XImage *image, int y, const unsigned long *in)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  char *row = image->data + y * image->bytes_per_line;
+  int x;
+  u.i = 1;
+  if (image->byte_order == (u.c[0] ? LSBFirst : MSBFirst) &&
+      image->bits_per_pixel == 32 && sizeof(unsigned int) == 4)
+    for (x = 0; x < image->width; x++)
+      ((unsigned int *) row)[x] = in[x];
+  else if (image->byte_order == (u.c[0] ? LSBFirst : MSBFirst) &&
+           image->bits_per_pixel == 16 && sizeof(unsigned short) == 2)
+    for (x = 0; x < image->width; x++)
+      ((unsigned short *) row)[x] = in[x];
+  else
+    for (x = 0; x < image->width; x++)
+      XPutPixel (image, x, y, in[x]);
+}
+
+
+/* Scales one row horizontally, averaging each of the three color fields
+   separately.  The results are 8.8 fixed point.
+ */
+static void
+scale_row (const unsigned long *in, unsigned long *out, int n1, int n2,
+           const scale_table *t, const unsigned long masks[3],
+           const int shifts[3])
+{
+  int x, c, k;
+  for (x = 0; x < n2; x++)
+    {
+      const unsigned long *p = in + t->first[x];
+      const unsigned long *w = t->weight + t->offset[x];
+      for (c = 0; c < 3; c++)
+        {
+          unsigned long sum = 0;
+          for (k = 0; k < t->count[x]; k++)
+            sum += ((p[k] & masks[c]) >> shifts[c]) * w[k];
+          out[x*3+c] = (sum * 256 + n1/2) / n1;
+        }
+    }
+}
+
+
+/* Scales by averaging all of the source pixels that fall in each
+   destination pixel, weighted by how much of it they cover.  This
+   only makes sense if the pixels are RGB values, not colormap indexes.
+   Returns False if out of memory.
+ */
+static Bool
+area_scale_ximage (XImage *from, XImage *to)
+{
+  int w1 = from->width,  h1 = from->height;
+  int w2 = to->width,    h2 = to->height;
+  unsigned long masks[3];
+  int shifts[3];
+  scale_table xt, yt;
+  unsigned long *in, *out, *acc, *rows[2];
+  int row_y[2];
+  int x, y, c, k;
+  Bool ok = False;
+
+  masks[0] = from->red_mask;
+  masks[1] = from->green_mask;
+  masks[2] = from->blue_mask;
+  for (c = 0; c < 3; c++)
+    for (shifts[c] = 0;
+         shifts[c] < 32 && !(masks[c] & (1L << shifts[c]));
+         shifts[c]++)
+      ;
+
+  memset (&xt, 0, sizeof(xt));
+  memset (&yt, 0, sizeof(yt));
+  in     = (unsigned long *) malloc (w1 * sizeof(*in));
+  out    = (unsigned long *) malloc (w2 * sizeof(*out));
+  acc    = (unsigned long *) malloc (w2 * 3 * sizeof(*acc));
+  rows[0] = (unsigned long *) malloc (w2 * 3 * sizeof(**rows));
+  rows[1] = (unsigned long *) malloc (w2 * 3 * sizeof(**rows));
+  row_y[0] = row_y[1] = -1;
+
+  if (!in || !out || !acc || !rows[0] || !rows[1] ||
+      !make_scale_table (w1, w2, &xt) ||
+      !make_scale_table (h1, h2, &yt))
+    goto DONE;
+
+  for (y = 0; y < h2; y++)
+    {
+      memset (acc, 0, w2 * 3 * sizeof(*acc));
+      for (k = 0; k < yt.count[y]; k++)
+        {
+          /* Source rows are shared by at most two destination rows in a
+             row, so keep the last one of each parity around. */
+          int sy = yt.first[y] + k;
+          unsigned long wy = yt.weight[yt.offset[y] + k];
+          unsigned long *row = rows[sy & 1];
+          if (row_y[sy & 1] != sy)
+            {
+              get_image_row (from, sy, in);
+              scale_row (in, row, w1, w2, &xt, masks, shifts);
+              row_y[sy & 1] = sy;
+            }
+          for (x = 0; x < w2 * 3; x++)
+            acc[x] += row[x] * wy;
+        }
+
+      for (x = 0; x < w2; x++)
+        {
+          unsigned long p = 0;
+          for (c = 0; c < 3; c++)
+            p |= (((acc[x*3+c] + h1 * 128) / (h1 * 256)) << shifts[c]) &
+              masks[c];
+          out[x] = p;
+        }
+      put_image_row (to, y, out);
+    }
+  ok = True;
+
+ DONE:
+  free_scale_table (&xt);
+  free_scale_table (&yt);
+  if (in)      free (in);
+  if (out)     free (out);
+  if (acc)     free (acc);
+  if (rows[0]) free (rows[0]);
+  if (rows[1]) free (rows[1]);
+  return ok;
+}
+
+
+/* Returns a new XImage scaled from the given one, which is unchanged.
+   On TrueColor visuals, this averages; otherwise, it just picks the
+   nearest pixel, so it might have artifacts.
+   If out of memory, returns 0.
+ */
+static XImage *
+scaled_ximage (Screen *screen, Visual *visual,
+               XImage *ximage, int new_width, int new_height)
 {
   Display *dpy = DisplayOfScreen (screen);
   int depth = visual_depth (screen, visual);
@@ -323,15 +555,15 @@ scale_ximage (Screen *screen, Visual *visual,
                progname,
                ximage->width, ximage->height,
                ximage2->width, ximage2->height);
-      if (ximage->data) free (ximage->data);
-      if (ximage2->data) free (ximage2->data);
-      ximage->data = 0;
-      ximage2->data = 0;
-      XDestroyImage (ximage);
       XDestroyImage (ximage2);
-      return False;
+      return 0;
     }
 
+  if (visual_class (screen, visual) == TrueColor &&
+      ximage->red_mask && ximage->green_mask && ximage->blue_mask &&
+      area_scale_ximage (ximage, ximage2))
+    return ximage2;
+
   /* Brute force scaling... */
   xscale = (double) ximage->width  / ximage2->width;
   yscale = (double) ximage->height / ximage2->height;
@@ -340,6 +572,28 @@ scale_ximage (Screen *screen, Visual *visual,
       XPutPixel (ximage2, x, y,
                  XGetPixel (ximage, x * xscale, y * yscale));
 
+  return ximage2;
+}
+
+
+/* Scales an XImage, modifying it in place.
+   If out of memory, returns False, and the XImage will have been
+   destroyed and freed.
+ */
+static Bool
+scale_ximage (Screen *screen, Visual *visual,
+              XImage *ximage, int new_width, int new_height)
+{
+  XImage *ximage2 = scaled_ximage (screen, visual, ximage,
+                                   new_width, new_height);
+  if (!ximage2)
+    {
+      if (ximage->data) free (ximage->data);
+      ximage->data = 0;
+      XDestroyImage (ximage);
+      return False;
+    }
+
   free (ximage->data);
   ximage->data = 0;
 
@@ -353,778 +607,1843 @@ scale_ximage (Screen *screen, Visual *visual,
 #endif /* !USE_EXTERNAL_SCREEN_GRABBER || HAVE_JPEGLIB */
 
 
-#ifdef HAVE_GDK_PIXBUF
+#if defined(HAVE_JPEGLIB) || defined(USE_IMAGE_CACHE)
 
-/* Reads the given image file and renders it on the Drawable, using GDK.
-   Returns False if it fails.
+/* Puts an image that has been scaled to fit on the window or pixmap,
+   centered as compute_image_scaling() said.
  */
-static Bool
-read_file_gdk (Screen *screen, Window window, Drawable drawable,
-               const char *filename, Bool verbose_p,
-               XRectangle *geom_ret)
+static void
+put_scaled_image (Screen *screen, Window window, Drawable drawable,
+                  XImage *ximage, int srcx, int srcy, int destx, int desty)
 {
-  GdkPixbuf *pb;
   Display *dpy = DisplayOfScreen (screen);
-  unsigned int win_width, win_height, win_depth;
-# ifdef HAVE_GTK2
-  GError *gerr = 0;
-# endif /* HAVE_GTK2 */
-
-  /* Find the size of the Drawable. */
-  {
-    Window root;
-    int x, y;
-    unsigned int bw;
-    XGetGeometry (dpy, drawable,
-                  &root, &x, &y, &win_width, &win_height, &bw, &win_depth);
-  }
-
-  gdk_pixbuf_xlib_init_with_depth (dpy, screen_number (screen), win_depth);
-# ifdef HAVE_GTK2
-  g_type_init();
-# else  /* !HAVE_GTK2 */
-  xlib_rgb_init (dpy, screen);
-# endif /* !HAVE_GTK2 */
-
-  pb = gdk_pixbuf_new_from_file (filename
-# ifdef HAVE_GTK2
-                                 , &gerr
-# endif /* HAVE_GTK2 */
-                                 );
+  GC gc;
+  XGCValues gcv;
 
-  if (!pb)
+  /* If we're rendering onto the root window (and it's not the xscreensaver
+     pseudo-root) then put the image in the window's background.  Otherwise,
+     just paint the image onto the window.
+   */
+  if (window == drawable && root_window_p (screen, window))
     {
-      fprintf (stderr, "%s: unable to load \"%s\"\n", progname, filename);
-#  ifdef HAVE_GTK2
-      if (gerr && gerr->message && *gerr->message)
-        fprintf (stderr, "%s: reason: %s\n", progname, gerr->message);
-#  endif /* HAVE_GTK2 */
-      return False;
+      Window root;
+      int x, y;
+      unsigned int win_width, win_height, bw, win_depth;
+      Pixmap bg;
+      XGetGeometry (dpy, drawable,
+                    &root, &x, &y, &win_width, &win_height, &bw, &win_depth);
+      bg = XCreatePixmap (dpy, window, win_width, win_height, win_depth);
+      gcv.foreground = BlackPixelOfScreen (screen);
+      gc = XCreateGC (dpy, drawable, GCForeground, &gcv);
+      XFillRectangle (dpy, bg, gc, 0, 0, win_width, win_height);
+      XPutImage (dpy, bg, gc, ximage,
+                 srcx, srcy, destx, desty, ximage->width, ximage->height);
+      XSetWindowBackgroundPixmap (dpy, window, bg);
+      XClearWindow (dpy, window);
     }
   else
     {
-      int w = gdk_pixbuf_get_width (pb);
-      int h = gdk_pixbuf_get_height (pb);
-      int srcx, srcy, destx, desty, w2, h2;
-      Bool bg_p = False;
+      gc = XCreateGC (dpy, drawable, 0, &gcv);
+      clear_drawable (screen, drawable);
+      XPutImage (dpy, drawable, gc, ximage,
+                 srcx, srcy, destx, desty, ximage->width, ximage->height);
+    }
 
-# ifdef HAVE_GDK_PIXBUF_APPLY_EMBEDDED_ORIENTATION
-      {
-        int ow = w, oh = h;
-        GdkPixbuf *opb = pb;
-        pb = gdk_pixbuf_apply_embedded_orientation (opb);
-        g_object_unref (opb);
-        w = gdk_pixbuf_get_width (pb);
-        h = gdk_pixbuf_get_height (pb);
-        if (verbose_p && (w != ow || h != oh))
-          fprintf (stderr, "%s: rotated %dx%d to %dx%d\n",
-                   progname, ow, oh, w, h);
-      }
-# endif
+  XFreeGC (dpy, gc);
+}
 
-      compute_image_scaling (w, h, win_width, win_height, verbose_p,
-                             &srcx, &srcy, &destx, &desty, &w2, &h2);
-      if (w != w2 || h != h2)
-        {
-          GdkPixbuf *pb2 = gdk_pixbuf_scale_simple (pb, w2, h2,
-                                                    GDK_INTERP_BILINEAR);
-          if (pb2)
-            {
-              g_object_unref (pb);
-              pb = pb2;
-              w = w2;
-              h = h2;
-            }
-          else
-            fprintf (stderr, "%s: out of memory when scaling?\n", progname);
-        }
+#endif /* HAVE_JPEGLIB || USE_IMAGE_CACHE */
 
-      /* If we're rendering onto the root window (and it's not the
-         xscreensaver pseudo-root) then put the image in the window's
-         background.  Otherwise, just paint the image onto the window.
-       */
-      bg_p = (window == drawable && root_window_p (screen, window));
 
-      if (bg_p)
-        {
-          XGCValues gcv;
-          GC gc;
-          drawable = XCreatePixmap (dpy, window,
-                                    win_width, win_height, win_depth);
-          gcv.foreground = BlackPixelOfScreen (screen);
-          gc = XCreateGC (dpy, drawable, GCForeground, &gcv);
-          XFillRectangle (dpy, drawable, gc, 0, 0, win_width, win_height);
-          XFreeGC (dpy, gc);
-        }
-      else
-        clear_drawable (screen, drawable);
+#if defined(USE_IMAGE_CACHE) || defined(USE_IMAGE_INDEX)
 
-      /* #### Note that this always uses the default colormap!  Morons!
-         Owen says that in Gnome 2.0, I should try using
-         gdk_pixbuf_render_pixmap_and_mask_for_colormap() instead.
-         But I haven't tried.
-       */
-      gdk_pixbuf_xlib_render_to_drawable_alpha (pb, drawable,
-                                                srcx, srcy, destx, desty,
-                                                w, h,
-                                                GDK_PIXBUF_ALPHA_FULL, 127,
-                                                XLIB_RGB_DITHER_NORMAL,
-                                                0, 0);
-      if (bg_p)
-        {
-          XSetWindowBackgroundPixmap (dpy, window, drawable);
-          XClearWindow (dpy, window);
-        }
+/* Returns the name of a file in ~/.cache/xscreensaver/, creating that
+   directory if necessary; or, if there is no ~/.cache/, a dot-file in
+   the home directory.  Free the string when done.  Returns 0 if there's
+   no home directory.
+ */
+static char *
+cache_file_name (const char *xdg_name, const char *home_name)
+{
+  const char *home = getenv ("HOME");
+  struct stat st;
+  char *file;
 
-      if (geom_ret)
-        {
-          geom_ret->x = destx;
-          geom_ret->y = desty;
-          geom_ret->width  = w;
-          geom_ret->height = h;
-        }
-    }
+  if (!home || !*home) return 0;
 
-  XSync (dpy, False);
-  return True;
+  file = (char *) malloc (strlen (home) + strlen (xdg_name) +
+                          strlen (home_name) + 40);
+  sprintf (file, "%s/.cache", home);
+  if (!stat (file, &st) && S_ISDIR (st.st_mode))   /* FreeDesktop location */
+    {
+      strcat (file, "/xscreensaver");
+      mkdir (file, 0700);
+      strcat (file, "/");
+      strcat (file, xdg_name);
+    }
+  else
+    sprintf (file, "%s/%s", home, home_name);
+  return file;
 }
 
-#endif /* HAVE_GDK_PIXBUF */
+#endif /* USE_IMAGE_CACHE || USE_IMAGE_INDEX */
 
 
+#ifdef USE_IMAGE_CACHE
 
-#ifdef HAVE_JPEGLIB
+/* The image cache is a directory of files, one per image and screen size,
+   each holding this header, the file name, and then the image data in
+   the X server's format, ready to be mapped and handed to XPutImage.
+   They are only good on the machine that wrote them, which is fine.
+ */
 
-/* Allocates a colormap that makes a PseudoColor or DirectColor
-   visual behave like a TrueColor visual of the same depth.
+#define IMAGE_CACHE_MAGIC "xsgimg03"
 
-   #### Duplicated in utils/grabscreen.c
+typedef struct {
+  char magic[8];
+  /* The key: */
+  time_t mtime;				/* of the image file */
+  long size;
+  int win_width, win_height;		/* of the drawable it was scaled for */
+  int depth, bits_per_pixel, byte_order;
+  unsigned long red_mask, green_mask, blue_mask;
+  int name_length;			/* the name follows the header */
+  /* The image: */
+  int width, height, bytes_per_line;
+  int srcx, srcy, destx, desty;		/* from compute_image_scaling() */
+  int geom_width, geom_height;		/* the scaled image's full size, which
+                                           may be bigger than what's stored */
+  long data_offset;
+} image_cache_header;
+
+
+/* Returns the directory to keep cached images in, creating it if
+   necessary, or 0 if there's no home directory.
  */
-static void
-allocate_cubic_colormap (Screen *screen, Visual *visual, Colormap cmap,
-                         Bool verbose_p)
+static const char *
+image_cache_dir (void)
 {
-  Display *dpy = DisplayOfScreen (screen);
-  int nr, ng, nb, cells;
-  int r, g, b;
-  int depth;
-  XColor colors[4097];
-  int i;
-
-  depth = visual_depth (screen, visual);
-
-  switch (depth)
+  static char *dir = 0;
+  if (!dir)
     {
-    case 8:  nr = 3; ng = 3; nb = 2; cells = 256;  break;
-    case 12: nr = 4; ng = 4; nb = 4; cells = 4096; break;
-    default: abort(); break;
+      dir = cache_file_name ("images", ".xscreensaver-images");
+      if (dir) mkdir (dir, 0700);
     }
+  return dir;
+}
 
-  memset(colors, 0, sizeof(colors));
-  for (r = 0; r < (1 << nr); r++)
-    for (g = 0; g < (1 << ng); g++)
-      for (b = 0; b < (1 << nb); b++)
-	{
-	  i = (r | (g << nr) | (b << (nr + ng)));
-	  colors[i].pixel = i;
-          colors[i].flags = DoRed|DoGreen|DoBlue;
-	  if (depth == 8)
-	    {
-	      colors[i].red   = ((r << 13) | (r << 10) | (r << 7) |
-				 (r <<  4) | (r <<  1));
-	      colors[i].green = ((g << 13) | (g << 10) | (g << 7) |
-				 (g <<  4) | (g <<  1));
-	      colors[i].blue  = ((b << 14) | (b << 12) | (b << 10) |
-				 (b <<  8) | (b <<  6) | (b <<  4) |
-				 (b <<  2) | b);
-	    }
-	  else
-	    {
-	      colors[i].red   = (r << 12) | (r << 8) | (r << 4) | r;
-	      colors[i].green = (g << 12) | (g << 8) | (g << 4) | g;
-	      colors[i].blue  = (b << 12) | (b << 8) | (b << 4) | b;
-	    }
-	}
-
-  {
-    int j;
-    int allocated = 0;
-    int interleave = cells / 8;  /* skip around, rather than allocating in
-                                    order, so that we get better coverage if
-                                    we can't allocated all of them. */
-    for (j = 0; j < interleave; j++)
-      for (i = 0; i < cells; i += interleave)
-        if (XAllocColor (dpy, cmap, &colors[i + j]))
-          allocated++;
 
-    if (verbose_p)
-      fprintf (stderr, "%s: allocated %d of %d colors for cubic map\n",
-               progname, allocated, cells);
-  }
+/* Fills in the key part of the header, and returns the name of the file
+   that would hold it.  Different keys may map to the same file: the
+   header says which one it is.  Returns 0 if the image file is missing.
+ */
+static char *
+image_cache_file (Screen *screen, const char *filename,
+                  int win_width, int win_height, image_cache_header *h)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  const char *dir = image_cache_dir ();
+  Visual *visual = DefaultVisualOfScreen (screen);
+  unsigned long hash = 2166136261UL;	/* FNV-1a */
+  struct stat st;
+  const unsigned char *s;
+  char *file;
+  char buf[100];
+
+  if (!dir || stat (filename, &st))
+    return 0;
+
+  memset (h, 0, sizeof(*h));
+  memcpy (h->magic, IMAGE_CACHE_MAGIC, sizeof(h->magic));
+  h->mtime       = st.st_mtime;
+  h->size        = st.st_size;
+  h->win_width   = win_width;
+  h->win_height  = win_height;
+  h->depth       = visual_depth (screen, visual);
+  h->byte_order  = ImageByteOrder (dpy);
+  h->red_mask    = visual->red_mask;
+  h->green_mask  = visual->green_mask;
+  h->blue_mask   = visual->blue_mask;
+  h->name_length = strlen (filename);
+
+  sprintf (buf, "\n%ld %ld %d %d %d",
+           (long) h->mtime, h->size, win_width, win_height, h->depth);
+  for (s = (const unsigned char *) filename; *s; s++)
+    hash = ((hash ^ *s) * 16777619UL) & 0xFFFFFFFFUL;
+  for (s = (const unsigned char *) buf; *s; s++)
+    hash = ((hash ^ *s) * 16777619UL) & 0xFFFFFFFFUL;
+
+  file = (char *) malloc (strlen (dir) + 20);
+  sprintf (file, "%s/%08lx.img", dir, hash);
+  return file;
 }
 
-/* Find the pixel index that is closest to the given color
-   (using linear distance in RGB space -- which is far from the best way.)
 
-   #### Duplicated in utils/grabscreen.c
+/* Whether two headers have the same key.
  */
-static unsigned long
-find_closest_pixel (XColor *colors, int ncolors,
-                    unsigned long r, unsigned long g, unsigned long b)
+static Bool
+image_cache_key_match_p (const image_cache_header *a,
+                         const image_cache_header *b)
 {
-  unsigned long distance = ~0;
-  int i, found = 0;
-
-  if (ncolors == 0)
-    abort();
-  for (i = 0; i < ncolors; i++)
-    {
-      unsigned long d;
-      int rd, gd, bd;
-
-      rd = r - colors[i].red;
-      gd = g - colors[i].green;
-      bd = b - colors[i].blue;
-      if (rd < 0) rd = -rd;
-      if (gd < 0) gd = -gd;
-      if (bd < 0) bd = -bd;
-      d = (rd << 1) + (gd << 2) + bd;
-      
-      if (d < distance)
-	{
-	  distance = d;
-	  found = i;
-          if (distance == 0)
-              break;
-	}
-    }
-
-  return found;
+  return (!memcmp (a->magic, b->magic, sizeof(a->magic)) &&
+          a->mtime       == b->mtime &&
+          a->size        == b->size &&
+          a->win_width   == b->win_width &&
+          a->win_height  == b->win_height &&
+          a->depth       == b->depth &&
+          a->byte_order  == b->byte_order &&
+          a->red_mask    == b->red_mask &&
+          a->green_mask  == b->green_mask &&
+          a->blue_mask   == b->blue_mask &&
+          a->name_length == b->name_length);
 }
 
 
-/* Given an XImage with 8-bit or 12-bit RGB data, convert it to be 
-   displayable with the given X colormap.  The farther from a perfect
-   color cube the contents of the colormap are, the lossier the 
-   transformation will be.  No dithering is done.
-
-   #### Duplicated in utils/grabscreen.c
+/* Deletes the least recently used images until the cache is no bigger
+   than the imageCacheSize resource, in megabytes.
  */
 static void
-remap_image (Screen *screen, Colormap cmap, XImage *image, Bool verbose_p)
+prune_image_cache (Display *dpy, Bool verbose_p)
 {
-  Display *dpy = DisplayOfScreen (screen);
-  unsigned long map[4097];
-  int x, y, i;
-  int cells;
-  XColor colors[4097];
-
-  if (image->depth == 8)
-    cells = 256;
-  else if (image->depth == 12)
-    cells = 4096;
-  else
-    abort();
-
-  memset(map,    -1, sizeof(*map));
-  memset(colors, -1, sizeof(*colors));
-
-  for (i = 0; i < cells; i++)
-    colors[i].pixel = i;
-  XQueryColors (dpy, cmap, colors, cells);
-
-  if (verbose_p)
-    fprintf(stderr, "%s: building color cube for %d bit image\n",
-            progname, image->depth);
-
-  for (i = 0; i < cells; i++)
+  const char *dir = image_cache_dir ();
+  long max = get_integer_resource (dpy, "imageCacheSize", "ImageCacheSize");
+  DIR *d;
+  struct dirent *de;
+  struct { char *file; time_t mtime; long size; } *files = 0;
+  int nfiles = 0, files_size = 0;
+  long total = 0;
+
+  max *= 1024L * 1024L;
+  if (!dir || !(d = opendir (dir)))
+    return;
+
+  while ((de = readdir (d)))
     {
-      unsigned short r, g, b;
-
-      if (cells == 256)
+      struct stat st;
+      char *file;
+      int L = strlen (de->d_name);
+      if (L < 5 || strcmp (de->d_name + L - 4, ".img"))
+        continue;
+      file = (char *) malloc (strlen (dir) + L + 2);
+      sprintf (file, "%s/%s", dir, de->d_name);
+      if (stat (file, &st))
         {
-          /* "RRR GGG BB" In an 8 bit map.  Convert that to
-             "RRR RRR RR" "GGG GGG GG" "BB BB BB BB" to give
-             an even spread. */
-          r = (i & 0x07);
-          g = (i & 0x38) >> 3;
-          b = (i & 0xC0) >> 6;
-
-          r = ((r << 13) | (r << 10) | (r << 7) | (r <<  4) | (r <<  1));
-          g = ((g << 13) | (g << 10) | (g << 7) | (g <<  4) | (g <<  1));
-          b = ((b << 14) | (b << 12) | (b << 10) | (b <<  8) |
-               (b <<  6) | (b <<  4) | (b <<  2) | b);
+          free (file);
+          continue;
         }
-      else
+      if (nfiles >= files_size)
         {
-          /* "RRRR GGGG BBBB" In a 12 bit map.  Convert that to
-             "RRRR RRRR" "GGGG GGGG" "BBBB BBBB" to give an even
-             spread. */
-          r = (i & 0x00F);
-          g = (i & 0x0F0) >> 4;
-          b = (i & 0xF00) >> 8;
-
-          r = (r << 12) | (r << 8) | (r << 4) | r;
-          g = (g << 12) | (g << 8) | (g << 4) | g;
-          b = (b << 12) | (b << 8) | (b << 4) | b;
+          files_size = (files_size + 10) * 2;
+          files = realloc (files, files_size * sizeof(*files));
+          if (!files)
+            {
+              fprintf (stderr, "%s: out of memory (%d files)\n",
+                       progname, files_size);
+              exit (1);
+            }
         }
-
-      map[i] = find_closest_pixel (colors, cells, r, g, b);
+      files[nfiles].file  = file;
+      files[nfiles].mtime = st.st_mtime;
+      files[nfiles].size  = st.st_size;
+      total += st.st_size;
+      nfiles++;
     }
+  closedir (d);
 
-  if (verbose_p)
-    fprintf(stderr, "%s: remapping colors in %d bit image\n",
-            progname, image->depth);
+  while (total > max && nfiles > 0)
+    {
+      int i, oldest = 0;
+      for (i = 1; i < nfiles; i++)
+        if (files[i].file &&
+            (!files[oldest].file || files[i].mtime < files[oldest].mtime))
+          oldest = i;
+      if (!files[oldest].file)
+        break;
+      if (verbose_p)
+        fprintf (stderr, "%s: pruning %s\n", progname, files[oldest].file);
+      unlink (files[oldest].file);
+      total -= files[oldest].size;
+      free (files[oldest].file);
+      files[oldest].file = 0;
+    }
 
-  for (y = 0; y < image->height; y++)
-    for (x = 0; x < image->width; x++)
-      {
-        unsigned long pixel = XGetPixel(image, x, y);
-        if (pixel >= cells) abort();
-        XPutPixel(image, x, y, map[pixel]);
-      }
+  while (nfiles > 0)
+    if (files[--nfiles].file)
+      free (files[nfiles].file);
+  if (files) free (files);
 }
 
 
-/* If the file has a PPM (P6) on it, read it and return an XImage.
-   Otherwise, rewind the fd back to the beginning, and return 0.
+/* Writes a scaled image to the cache.  Errors are not fatal: it just
+   won't be there next time.
  */
-static XImage *
-maybe_read_ppm (Screen *screen, Visual *visual,
-                const char *filename, FILE *in, Bool verbose_p)
+static void
+save_cached_image (Screen *screen, const char *filename,
+                   int win_width, int win_height, XImage *ximage,
+                   int srcx, int srcy, int destx, int desty,
+                   int geom_width, int geom_height, Bool verbose_p)
 {
   Display *dpy = DisplayOfScreen (screen);
-  int depth = visual_depth (screen, visual);
-  struct stat st;
-  char *buf = 0;
-  int bufsiz = 0;
-  char *s, dummy;
-  int i, j;
-  int x, y, w, h, maxval;
-  XImage *ximage = 0;
-
-  if (fstat (fileno (in), &st))
-    goto FAIL;
-
-  bufsiz = st.st_size;
-  buf = (char *) malloc (bufsiz + 1);
-  if (!buf)
+  image_cache_header h;
+  char *file, *tmp;
+  FILE *out;
+  long pad;
+  static const char zeros[16] = { 0, };
+  Bool ok;
+
+  if (get_integer_resource (dpy, "imageCacheSize", "ImageCacheSize") <= 0)
+    return;
+  file = image_cache_file (screen, filename, win_width, win_height, &h);
+  if (!file) return;
+
+  h.bits_per_pixel = ximage->bits_per_pixel;
+  h.byte_order     = ximage->byte_order;
+  h.width          = ximage->width;
+  h.height         = ximage->height;
+  h.bytes_per_line = ximage->bytes_per_line;
+  h.srcx  = srcx;
+  h.srcy  = srcy;
+  h.destx = destx;
+  h.desty = desty;
+  h.geom_width  = geom_width;
+  h.geom_height = geom_height;
+  h.data_offset = sizeof(h) + h.name_length;
+  pad = (16 - (h.data_offset % 16)) % 16;
+  h.data_offset += pad;
+
+  /* Write it under another name and then rename it, so that another
+     xscreensaver-getimage never sees half of it. */
+  tmp = (char *) malloc (strlen (file) + 20);
+  sprintf (tmp, "%s.%lu", file, (unsigned long) getpid());
+  out = fopen (tmp, "wb");
+  if (!out)
     {
-      fprintf (stderr, "%s: out of memory loading %d byte PPM file %s\n",
-               progname, bufsiz, filename);
-      goto FAIL;
+      free (tmp);
+      free (file);
+      return;
     }
 
-  if (! (s = fgets (buf, bufsiz, in)))   /* line 1 */
-    goto FAIL;
+  ok = (fwrite (&h, sizeof(h), 1, out) == 1 &&
+        fwrite (filename, 1, h.name_length, out) == h.name_length &&
+        fwrite (zeros, 1, pad, out) == pad &&
+        fwrite (ximage->data, ximage->bytes_per_line, ximage->height, out)
+        == ximage->height);
+  if (fclose (out)) ok = False;
 
-  if (!strncmp (buf, "\107\111", 2))
-    {
-      fprintf (stderr, "%s: %s: sorry, GIF files not supported"
-               " when compiled with JPEGlib instead of GDK_Pixbuf.\n",
-               progname, filename);
-      goto FAIL;
-    }
-  else if (!strncmp (buf, "\211\120", 2))
+  if (ok && !rename (tmp, file))
     {
-      fprintf (stderr, "%s: %s: sorry, PNG files not supported"
-               " when compiled with JPEGlib instead of GDK_Pixbuf.\n",
-               progname, filename);
-      goto FAIL;
+      if (verbose_p)
+        fprintf (stderr, "%s: cached %dx%d image as %s\n",
+                 progname, ximage->width, ximage->height, file);
+      prune_image_cache (dpy, verbose_p);
     }
+  else
+    unlink (tmp);
 
-  if (strncmp (s, "P6", 2))
-    goto FAIL;
+  free (tmp);
+  free (file);
+}
 
-  if (! (s = fgets (buf, bufsiz, in)))   /* line 2 */
-    goto FAIL;
-  if (2 != sscanf (s, " %d %d %c", &w, &h, &dummy))
-    {
-      fprintf (stderr, "%s: %s: invalid PPM (line 2)\n", progname, filename);
-      goto FAIL;
-    }
 
-  if (! (s = fgets (buf, bufsiz, in)))   /* line 3 */
-    goto FAIL;
-  if (1 != sscanf (s, " %d %c", &maxval, &dummy))
-    {
-      fprintf (stderr, "%s: %s: invalid PPM (line 3)\n", progname, filename);
-      goto FAIL;
-    }
-  if (maxval != 255)
+/* If the given file has been loaded at this size before, puts it on the
+   window straight out of the cache.  Returns False if it's not there.
+ */
+static Bool
+display_cached_file (Screen *screen, Window window, Drawable drawable,
+                     const char *filename, Bool verbose_p,
+                     XRectangle *geom_ret)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  Visual *visual;
+  image_cache_header key, h;
+  unsigned int win_width, win_height, win_depth;
+  struct stat st;
+  char *file;
+  char *map = 0;
+  XImage *ximage = 0;
+  Bool ok = False;
+  int fd;
+
+  if (get_integer_resource (dpy, "imageCacheSize", "ImageCacheSize") <= 0)
+    return False;
+
+  {
+    Window root;
+    int x, y;
+    unsigned int bw;
+    XWindowAttributes xgwa;
+    XGetWindowAttributes (dpy, window, &xgwa);
+    visual = xgwa.visual;
+    XGetGeometry (dpy, drawable,
+                  &root, &x, &y, &win_width, &win_height, &bw, &win_depth);
+    if (visual_class (screen, visual) != TrueColor ||
+        visual != DefaultVisualOfScreen (screen))
+      return False;
+  }
+
+  file = image_cache_file (screen, filename, win_width, win_height, &key);
+  if (!file) return False;
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
     {
-      fprintf (stderr, "%s: %s: unparsable PPM: maxval is %d\n",
-               progname, filename, maxval);
-      goto FAIL;
+      free (file);
+      return False;
     }
 
-  ximage = XCreateImage (dpy, visual, depth, ZPixmap, 0, 0,
-                         w, h, 8, 0);
-  if (ximage)
-    ximage->data = (char *) calloc (ximage->height, ximage->bytes_per_line);
-  if (!ximage || !ximage->data)
+  if (fstat (fd, &st) || st.st_size < sizeof(h))
+    goto DONE;
+  map = (char *) mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == (char *) MAP_FAILED)
     {
-      fprintf (stderr, "%s: out of memory loading %dx%d PPM file %s\n",
-               progname, ximage->width, ximage->height, filename);
-      goto FAIL;
+      map = 0;
+      goto DONE;
     }
 
-  s = buf;
-  j = bufsiz;
-  while ((i = fread (s, 1, j, in)) > 0)
-    s += i, j -= i;
-
-  i = 0;
-  for (y = 0; y < ximage->height; y++)
-    for (x = 0; x < ximage->width; x++)
-      {
-        unsigned char r = buf[i++];
-        unsigned char g = buf[i++];
-        unsigned char b = buf[i++];
-        unsigned long pixel;
+  memcpy (&h, map, sizeof(h));
+  key.byte_order = h.byte_order;   /* checked against XCreateImage below */
+  if (!image_cache_key_match_p (&key, &h) ||
+      h.data_offset < sizeof(h) + h.name_length ||
+      memcmp (map + sizeof(h), filename, h.name_length) ||
+      h.width <= 0 || h.height <= 0 ||
+      st.st_size < h.data_offset + (long) h.bytes_per_line * h.height)
+    goto DONE;
+
+  ximage = XCreateImage (dpy, visual, h.depth, ZPixmap, 0,
+                         map + h.data_offset, h.width, h.height,
+                         8, h.bytes_per_line);
+  if (!ximage ||
+      ximage->bits_per_pixel != h.bits_per_pixel ||
+      ximage->byte_order != h.byte_order ||
+      ximage->bytes_per_line != h.bytes_per_line)
+    goto DONE;
 
-        if (depth > 16)
-          pixel = (r << 16) | (g << 8) | b;
-        else if (depth == 8)
-          pixel = ((r >> 5) | ((g >> 5) << 3) | ((b >> 6) << 6));
-        else if (depth == 12)
-          pixel = ((r >> 4) | ((g >> 4) << 4) | ((b >> 4) << 8));
-        else if (depth == 16 || depth == 15)
-          pixel = (((r >> 3) << 10) | ((g >> 3) << 5) | ((b >> 3)));
-        else
-          abort();
+  if (verbose_p)
+    fprintf (stderr, "%s: loading %dx%d image from %s\n",
+             progname, h.width, h.height, file);
+
+  /* This must end up the same as when the file is decoded: on the real
+     root window, that means the image becomes the window's background
+     (so that it survives Expose), which put_scaled_image() does just as
+     read_file_gdk() does.  And the geometry is that of the whole scaled
+     image, not just the part of it that was stored. */
+  put_scaled_image (screen, window, drawable, ximage,
+                    h.srcx, h.srcy, h.destx, h.desty);
+  XSync (dpy, False);
 
-        XPutPixel (ximage, x, y, pixel);
-      }
+  if (geom_ret)
+    {
+      geom_ret->x = h.destx;
+      geom_ret->y = h.desty;
+      geom_ret->width  = h.geom_width;
+      geom_ret->height = h.geom_height;
+    }
 
-  free (buf);
-  return ximage;
+  utime (file, 0);   /* recently used: prune it last */
+  ok = True;
 
- FAIL:
-  if (buf) free (buf);
-  if (ximage && ximage->data)
+ DONE:
+  if (ximage)
     {
-      free (ximage->data);
       ximage->data = 0;
+      XDestroyImage (ximage);
     }
-  if (ximage) XDestroyImage (ximage);
-  fseek (in, 0, SEEK_SET);
-  return 0;
+  if (map) munmap (map, st.st_size);
+  close (fd);
+  free (file);
+  return ok;
 }
 
+#endif /* USE_IMAGE_CACHE */
 
-typedef struct {
-  struct jpeg_error_mgr pub;   /* this is what passes for subclassing in C */
-  const char *filename;
-  Screen *screen;
-  Visual *visual;
-  Drawable drawable;
-  Colormap cmap;
-} getimg_jpg_error_mgr;
 
+#ifdef HAVE_GDK_PIXBUF
 
-static void
-jpg_output_message (j_common_ptr cinfo)
+/* Reads the given image file and renders it on the Drawable, using GDK.
+   Returns False if it fails.
+ */
+static Bool
+read_file_gdk (Screen *screen, Window window, Drawable drawable,
+               const char *filename, Bool verbose_p,
+               XRectangle *geom_ret)
 {
-  getimg_jpg_error_mgr *err = (getimg_jpg_error_mgr *) cinfo->err;
-  char buf[JMSG_LENGTH_MAX];
-  cinfo->err->format_message (cinfo, buf);
-  fprintf (stderr, "%s: %s: %s\n", progname, err->filename, buf);
-}
-
+  GdkPixbuf *pb;
+  Display *dpy = DisplayOfScreen (screen);
+  unsigned int win_width, win_height, win_depth;
+# ifdef HAVE_GTK2
+  GError *gerr = 0;
+# endif /* HAVE_GTK2 */
 
-static void
-jpg_error_exit (j_common_ptr cinfo)
-{
-  getimg_jpg_error_mgr *err = (getimg_jpg_error_mgr *) cinfo->err;
-  cinfo->err->output_message (cinfo);
-  draw_colorbars (err->screen, err->visual, err->drawable, err->cmap,
-                  0, 0, 0, 0);
-  XSync (DisplayOfScreen (err->screen), False);
-  exit (1);
+  /* Find the size of the Drawable. */
+  {
+    Window root;
+    int x, y;
+    unsigned int bw;
+    XGetGeometry (dpy, drawable,
+                  &root, &x, &y, &win_width, &win_height, &bw, &win_depth);
+  }
+
+  gdk_pixbuf_xlib_init_with_depth (dpy, screen_number (screen), win_depth);
+# ifdef HAVE_GTK2
+  g_type_init();
+# else  /* !HAVE_GTK2 */
+  xlib_rgb_init (dpy, screen);
+# endif /* !HAVE_GTK2 */
+
+  pb = gdk_pixbuf_new_from_file (filename
+# ifdef HAVE_GTK2
+                                 , &gerr
+# endif /* HAVE_GTK2 */
+                                 );
+
+  if (!pb)
+    {
+      fprintf (stderr, "%s: unable to load \"%s\"\n", progname, filename);
+#  ifdef HAVE_GTK2
+      if (gerr && gerr->message && *gerr->message)
+        fprintf (stderr, "%s: reason: %s\n", progname, gerr->message);
+#  endif /* HAVE_GTK2 */
+      return False;
+    }
+  else
+    {
+      int w = gdk_pixbuf_get_width (pb);
+      int h = gdk_pixbuf_get_height (pb);
+      int srcx, srcy, destx, desty, w2, h2;
+      Bool bg_p = False;
+
+# ifdef HAVE_GDK_PIXBUF_APPLY_EMBEDDED_ORIENTATION
+      {
+        int ow = w, oh = h;
+        GdkPixbuf *opb = pb;
+        pb = gdk_pixbuf_apply_embedded_orientation (opb);
+        g_object_unref (opb);
+        w = gdk_pixbuf_get_width (pb);
+        h = gdk_pixbuf_get_height (pb);
+        if (verbose_p && (w != ow || h != oh))
+          fprintf (stderr, "%s: rotated %dx%d to %dx%d\n",
+                   progname, ow, oh, w, h);
+      }
+# endif
+
+      compute_image_scaling (w, h, win_width, win_height, verbose_p,
+                             &srcx, &srcy, &destx, &desty, &w2, &h2);
+      if (w != w2 || h != h2)
+        {
+          GdkPixbuf *pb2 = gdk_pixbuf_scale_simple (pb, w2, h2,
+                                                    GDK_INTERP_BILINEAR);
+          if (pb2)
+            {
+              g_object_unref (pb);
+              pb = pb2;
+              w = w2;
+              h = h2;
+            }
+          else
+            fprintf (stderr, "%s: out of memory when scaling?\n", progname);
+        }
+
+      /* If we're rendering onto the root window (and it's not the
+         xscreensaver pseudo-root) then put the image in the window's
+         background.  Otherwise, just paint the image onto the window.
+       */
+      bg_p = (window == drawable && root_window_p (screen, window));
+
+      if (bg_p)
+        {
+          XGCValues gcv;
+          GC gc;
+          drawable = XCreatePixmap (dpy, window,
+                                    win_width, win_height, win_depth);
+          gcv.foreground = BlackPixelOfScreen (screen);
+          gc = XCreateGC (dpy, drawable, GCForeground, &gcv);
+          XFillRectangle (dpy, drawable, gc, 0, 0, win_width, win_height);
+          XFreeGC (dpy, gc);
+        }
+      else
+        clear_drawable (screen, drawable);
+
+      /* #### Note that this always uses the default colormap!  Morons!
+         Owen says that in Gnome 2.0, I should try using
+         gdk_pixbuf_render_pixmap_and_mask_for_colormap() instead.
+         But I haven't tried.
+       */
+      gdk_pixbuf_xlib_render_to_drawable_alpha (pb, drawable,
+                                                srcx, srcy, destx, desty,
+                                                w, h,
+                                                GDK_PIXBUF_ALPHA_FULL, 127,
+                                                XLIB_RGB_DITHER_NORMAL,
+                                                0, 0);
+# ifdef USE_IMAGE_CACHE
+      /* Read back what GDK drew, and save it for next time.  Only from
+         a Pixmap, since parts of a Window might not be visible. */
+      if (visual_class (screen, DefaultVisualOfScreen (screen)) ==
+          TrueColor &&
+          !drawable_window_p (dpy, drawable))
+        {
+          int cw = (w - srcx < (int) win_width  - destx
+                    ? w - srcx : (int) win_width  - destx);
+          int ch = (h - srcy < (int) win_height - desty
+                    ? h - srcy : (int) win_height - desty);
+          XImage *ximage = (cw > 0 && ch > 0
+                            ? XGetImage (dpy, drawable, destx, desty, cw, ch,
+                                         ~0L, ZPixmap)
+                            : 0);
+          if (ximage)
+            {
+              save_cached_image (screen, filename, win_width, win_height,
+                                 ximage, 0, 0, destx, desty, w, h,
+                                 verbose_p);
+              XDestroyImage (ximage);
+            }
+        }
+# endif /* USE_IMAGE_CACHE */
+
+      if (bg_p)
+        {
+          XSetWindowBackgroundPixmap (dpy, window, drawable);
+          XClearWindow (dpy, window);
+        }
+
+      if (geom_ret)
+        {
+          geom_ret->x = destx;
+          geom_ret->y = desty;
+          geom_ret->width  = w;
+          geom_ret->height = h;
+        }
+    }
+
+  XSync (dpy, False);
+  return True;
 }
 
+#endif /* HAVE_GDK_PIXBUF */
 
-/* Reads a JPEG file, returns an RGB XImage of it.
+
+
+#ifdef HAVE_JPEGLIB
+
+/* Allocates a colormap that makes a PseudoColor or DirectColor
+   visual behave like a TrueColor visual of the same depth.
+
+   #### Duplicated in utils/grabscreen.c
+ */
+static void
+allocate_cubic_colormap (Screen *screen, Visual *visual, Colormap cmap,
+                         Bool verbose_p)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  int nr, ng, nb, cells;
+  int r, g, b;
+  int depth;
+  XColor colors[4097];
+  int i;
+
+  depth = visual_depth (screen, visual);
+
+  switch (depth)
+    {
+    case 8:  nr = 3; ng = 3; nb = 2; cells = 256;  break;
+    case 12: nr = 4; ng = 4; nb = 4; cells = 4096; break;
+    default: abort(); break;
+    }
+
+  memset(colors, 0, sizeof(colors));
+  for (r = 0; r < (1 << nr); r++)
+    for (g = 0; g < (1 << ng); g++)
+      for (b = 0; b < (1 << nb); b++)
+	{
+	  i = (r | (g << nr) | (b << (nr + ng)));
+	  colors[i].pixel = i;
+          colors[i].flags = DoRed|DoGreen|DoBlue;
+	  if (depth == 8)
+	    {
+	      colors[i].red   = ((r << 13) | (r << 10) | (r << 7) |
+				 (r <<  4) | (r <<  1));
+	      colors[i].green = ((g << 13) | (g << 10) | (g << 7) |
+				 (g <<  4) | (g <<  1));
+	      colors[i].blue  = ((b << 14) | (b << 12) | (b << 10) |
+				 (b <<  8) | (b <<  6) | (b <<  4) |
+				 (b <<  2) | b);
+	    }
+	  else
+	    {
+	      colors[i].red   = (r << 12) | (r << 8) | (r << 4) | r;
+	      colors[i].green = (g << 12) | (g << 8) | (g << 4) | g;
+	      colors[i].blue  = (b << 12) | (b << 8) | (b << 4) | b;
+	    }
+	}
+
+  {
+    int j;
+    int allocated = 0;
+    int interleave = cells / 8;  /* skip around, rather than allocating in
+                                    order, so that we get better coverage if
+                                    we can't allocated all of them. */
+    for (j = 0; j < interleave; j++)
+      for (i = 0; i < cells; i += interleave)
+        if (XAllocColor (dpy, cmap, &colors[i + j]))
+          allocated++;
+
+    if (verbose_p)
+      fprintf (stderr, "%s: allocated %d of %d colors for cubic map\n",
+               progname, allocated, cells);
+  }
+}
+
+/* If the file has a PPM (P6) on it, read it and return an XImage.
+   Otherwise, rewind the fd back to the beginning, and return 0.
  */
 static XImage *
-read_jpeg_ximage (Screen *screen, Visual *visual, Drawable drawable,
-                  Colormap cmap, const char *filename, Bool verbose_p)
+maybe_read_ppm (Screen *screen, Visual *visual,
+                const char *filename, FILE *in, Bool verbose_p)
 {
   Display *dpy = DisplayOfScreen (screen);
   int depth = visual_depth (screen, visual);
-
-  FILE *in = 0;
+  struct stat st;
+  char *buf = 0;
+  int bufsiz = 0;
+  char *s, dummy;
+  int i, j;
+  int x, y, w, h, maxval;
   XImage *ximage = 0;
-  struct jpeg_decompress_struct cinfo;
-  getimg_jpg_error_mgr jerr;
-  JSAMPARRAY scanbuf = 0;
-  int y;
 
-  jerr.filename = filename;
-  jerr.screen = screen;
-  jerr.visual = visual;
-  jerr.drawable = drawable;
-  jerr.cmap = cmap;
+  if (fstat (fileno (in), &st))
+    goto FAIL;
 
-  if (! (depth >= 15 || depth == 12 || depth == 8))
+  bufsiz = st.st_size;
+  buf = (char *) malloc (bufsiz + 1);
+  if (!buf)
+    {
+      fprintf (stderr, "%s: out of memory loading %d byte PPM file %s\n",
+               progname, bufsiz, filename);
+      goto FAIL;
+    }
+
+  if (! (s = fgets (buf, bufsiz, in)))   /* line 1 */
+    goto FAIL;
+
+  if (!strncmp (buf, "\107\111", 2))
+    {
+      fprintf (stderr, "%s: %s: sorry, GIF files not supported"
+               " when compiled with JPEGlib instead of GDK_Pixbuf.\n",
+               progname, filename);
+      goto FAIL;
+    }
+  else if (!strncmp (buf, "\211\120", 2))
+    {
+      fprintf (stderr, "%s: %s: sorry, PNG files not supported"
+               " when compiled with JPEGlib instead of GDK_Pixbuf.\n",
+               progname, filename);
+      goto FAIL;
+    }
+
+  if (strncmp (s, "P6", 2))
+    goto FAIL;
+
+  if (! (s = fgets (buf, bufsiz, in)))   /* line 2 */
+    goto FAIL;
+  if (2 != sscanf (s, " %d %d %c", &w, &h, &dummy))
+    {
+      fprintf (stderr, "%s: %s: invalid PPM (line 2)\n", progname, filename);
+      goto FAIL;
+    }
+
+  if (! (s = fgets (buf, bufsiz, in)))   /* line 3 */
+    goto FAIL;
+  if (1 != sscanf (s, " %d %c", &maxval, &dummy))
+    {
+      fprintf (stderr, "%s: %s: invalid PPM (line 3)\n", progname, filename);
+      goto FAIL;
+    }
+  if (maxval != 255)
+    {
+      fprintf (stderr, "%s: %s: unparsable PPM: maxval is %d\n",
+               progname, filename, maxval);
+      goto FAIL;
+    }
+
+  ximage = XCreateImage (dpy, visual, depth, ZPixmap, 0, 0,
+                         w, h, 8, 0);
+  if (ximage)
+    ximage->data = (char *) calloc (ximage->height, ximage->bytes_per_line);
+  if (!ximage || !ximage->data)
+    {
+      fprintf (stderr, "%s: out of memory loading %dx%d PPM file %s\n",
+               progname, ximage->width, ximage->height, filename);
+      goto FAIL;
+    }
+
+  s = buf;
+  j = bufsiz;
+  while ((i = fread (s, 1, j, in)) > 0)
+    s += i, j -= i;
+
+  i = 0;
+  for (y = 0; y < ximage->height; y++)
+    for (x = 0; x < ximage->width; x++)
+      {
+        unsigned char r = buf[i++];
+        unsigned char g = buf[i++];
+        unsigned char b = buf[i++];
+        unsigned long pixel;
+
+        if (depth > 16)
+          pixel = (r << 16) | (g << 8) | b;
+        else if (depth == 8)
+          pixel = ((r >> 5) | ((g >> 5) << 3) | ((b >> 6) << 6));
+        else if (depth == 12)
+          pixel = ((r >> 4) | ((g >> 4) << 4) | ((b >> 4) << 8));
+        else if (depth == 16 || depth == 15)
+          pixel = (((r >> 3) << 10) | ((g >> 3) << 5) | ((b >> 3)));
+        else
+          abort();
+
+        XPutPixel (ximage, x, y, pixel);
+      }
+
+  free (buf);
+  return ximage;
+
+ FAIL:
+  if (buf) free (buf);
+  if (ximage && ximage->data)
+    {
+      free (ximage->data);
+      ximage->data = 0;
+    }
+  if (ximage) XDestroyImage (ximage);
+  fseek (in, 0, SEEK_SET);
+  return 0;
+}
+
+
+typedef struct {
+  struct jpeg_error_mgr pub;   /* this is what passes for subclassing in C */
+  const char *filename;
+  Screen *screen;
+  Visual *visual;
+  Drawable drawable;
+  Colormap cmap;
+} getimg_jpg_error_mgr;
+
+
+static void
+jpg_output_message (j_common_ptr cinfo)
+{
+  getimg_jpg_error_mgr *err = (getimg_jpg_error_mgr *) cinfo->err;
+  char buf[JMSG_LENGTH_MAX];
+  cinfo->err->format_message (cinfo, buf);
+  fprintf (stderr, "%s: %s: %s\n", progname, err->filename, buf);
+}
+
+
+static void
+jpg_error_exit (j_common_ptr cinfo)
+{
+  getimg_jpg_error_mgr *err = (getimg_jpg_error_mgr *) cinfo->err;
+  cinfo->err->output_message (cinfo);
+  draw_colorbars (err->screen, err->visual, err->drawable, err->cmap,
+                  0, 0, 0, 0);
+  XSync (DisplayOfScreen (err->screen), False);
+  exit (1);
+}
+
+
+/* Reads a JPEG file, returns an RGB XImage of it.
+   If the image is much bigger than dest_w x dest_h, the size that it
+   will be displayed at, libjpeg shrinks it by a power of 2 while
+   decoding, which is a lot faster than decoding it all and scaling it.
+ */
+static XImage *
+read_jpeg_ximage (Screen *screen, Visual *visual, Drawable drawable,
+                  Colormap cmap, const char *filename,
+                  int dest_w, int dest_h, Bool verbose_p)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  int depth = visual_depth (screen, visual);
+
+  FILE *in = 0;
+  XImage *ximage = 0;
+  struct jpeg_decompress_struct cinfo;
+  getimg_jpg_error_mgr jerr;
+  JSAMPARRAY scanbuf = 0;
+  unsigned long *pixels = 0;
+  int y;
+
+  jerr.filename = filename;
+  jerr.screen = screen;
+  jerr.visual = visual;
+  jerr.drawable = drawable;
+  jerr.cmap = cmap;
+
+  if (! (depth >= 15 || depth == 12 || depth == 8))
+    {
+      fprintf (stderr, "%s: unsupported depth: %d\n", progname, depth);
+      goto FAIL;
+    }
+
+  in = fopen (filename, "rb");
+  if (!in)
+    {
+      fprintf (stderr, "%s: %s: unreadable\n", progname, filename);
+      goto FAIL;
+    }
+
+  /* Check to see if it's a PPM, and if so, read that instead of using
+     the JPEG library.  Yeah, this is all modular and stuff.
+   */
+  if ((ximage = maybe_read_ppm (screen, visual, filename, in, verbose_p)))
+    {
+      fclose (in);
+      return ximage;
+    }
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.output_message = jpg_output_message;
+  jerr.pub.error_exit = jpg_error_exit;
+
+  jpeg_create_decompress (&cinfo);
+  jpeg_stdio_src (&cinfo, in);
+  jpeg_read_header (&cinfo, TRUE);
+
+  /* set some decode parameters */
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.quantize_colors = FALSE;
+
+  /* Decode at the smallest of 1/1, 1/2, 1/4 or 1/8 size that is still no
+     smaller than what compute_image_scaling() will scale it to.
+   */
+  if (dest_w > 0 && dest_h > 0)
+    {
+      double rw = (double) dest_w / cinfo.image_width;
+      double rh = (double) dest_h / cinfo.image_height;
+      double r = (rw < rh ? rw : rh);
+      int denom = 1;
+      while (denom < 8 && r * denom * 2 <= 1.0)
+        denom *= 2;
+      cinfo.scale_num = 1;
+      cinfo.scale_denom = denom;
+      if (verbose_p && denom > 1)
+        fprintf (stderr, "%s: decoding %dx%d image at 1/%d size\n",
+                 progname, (int) cinfo.image_width, (int) cinfo.image_height,
+                 denom);
+    }
+
+  jpeg_start_decompress (&cinfo);
+
+  ximage = XCreateImage (dpy, visual, depth, ZPixmap, 0, 0,
+                         cinfo.output_width, cinfo.output_height,
+                         8, 0);
+  if (ximage)
+    ximage->data = (char *) calloc (ximage->height, ximage->bytes_per_line);
+
+  if (ximage && ximage->data)
+    scanbuf = (*cinfo.mem->alloc_sarray) ((j_common_ptr) &cinfo, JPOOL_IMAGE,
+                                          cinfo.rec_outbuf_height *
+                                          cinfo.output_width *
+                                          cinfo.output_components,
+                                          1);
+  if (scanbuf)
+    pixels = (unsigned long *) malloc (ximage->width * sizeof(*pixels));
+  if (!ximage || !ximage->data || !scanbuf || !pixels)
+    {
+      fprintf (stderr, "%s: out of memory loading %dx%d file %s\n",
+               progname, ximage->width, ximage->height, filename);
+      goto FAIL;
+    }
+
+  y = 0;
+  while (cinfo.output_scanline < cinfo.output_height)
+    {
+      int n = jpeg_read_scanlines (&cinfo, scanbuf, 1);
+      int i;
+      for (i = 0; i < n; i++)
+        {
+          int x;
+          for (x = 0; x < ximage->width; x++)
+            {
+              int j = x * cinfo.output_components;
+              unsigned char r = scanbuf[i][j];
+              unsigned char g = scanbuf[i][j+1];
+              unsigned char b = scanbuf[i][j+2];
+              unsigned long pixel;
+
+              if (depth > 16)
+                pixel = (r << 16) | (g << 8) | b;
+              else if (depth == 8)
+                pixel = ((r >> 5) | ((g >> 5) << 3) | ((b >> 6) << 6));
+              else if (depth == 12)
+                pixel = ((r >> 4) | ((g >> 4) << 4) | ((b >> 4) << 8));
+              else if (depth == 15)
+                /* Gah! I don't understand why these are in the other
+                   order. */
+                pixel = (((r >> 3) << 10) | ((g >> 3) << 5) | ((b >> 3)));
+              else if (depth == 16)
+                pixel = (((r >> 3) << 11) | ((g >> 2) << 5) | ((b >> 3)));
+              else
+                abort();
+
+              pixels[x] = pixel;
+            }
+          put_image_row (ximage, y, pixels);
+          y++;
+        }
+    }
+
+  if (cinfo.output_scanline < cinfo.output_height)
+    /* don't goto FAIL -- we might have viewable partial data. */
+    jpeg_abort_decompress (&cinfo);
+  else
+    jpeg_finish_decompress (&cinfo);
+
+  jpeg_destroy_decompress (&cinfo);
+  fclose (in);
+  in = 0;
+  free (pixels);
+
+  return ximage;
+
+ FAIL:
+  if (in) fclose (in);
+  if (ximage && ximage->data)
+    {
+      free (ximage->data);
+      ximage->data = 0;
+    }
+  if (ximage) XDestroyImage (ximage);
+  if (scanbuf) free (scanbuf);
+  if (pixels) free (pixels);
+  return 0;
+}
+
+
+/* Reads the given image file and renders it on the Drawable, using JPEG lib.
+   Returns False if it fails.
+ */
+static Bool
+read_file_jpeglib (Screen *screen, Window window, Drawable drawable,
+                   const char *filename, Bool verbose_p,
+                   XRectangle *geom_ret)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  XImage *ximage;
+  Visual *visual;
+  int class, depth;
+  Colormap cmap;
+  unsigned int win_width, win_height, win_depth;
+  int srcx, srcy, destx, desty, w2, h2;
+
+  /* Find the size of the Drawable, and the Visual/Colormap of the Window. */
+  {
+    Window root;
+    int x, y;
+    unsigned int bw;
+    XWindowAttributes xgwa;
+    XGetWindowAttributes (dpy, window, &xgwa);
+    visual = xgwa.visual;
+    cmap = xgwa.colormap;
+    XGetGeometry (dpy, drawable,
+                  &root, &x, &y, &win_width, &win_height, &bw, &win_depth);
+  }
+
+  /* Make sure we're not on some weirdo visual...
+   */
+  class = visual_class (screen, visual);
+  depth = visual_depth (screen, visual);
+  if ((class == PseudoColor || class == DirectColor) &&
+      (depth != 8 && depth != 12))
+    {
+      fprintf (stderr, "%s: Pseudo/DirectColor depth %d unsupported\n",
+               progname, depth);
+      return False;
+    }
+
+  /* Read the file...
+   */
+  ximage = read_jpeg_ximage (screen, visual, drawable, cmap,
+                             filename, win_width, win_height, verbose_p);
+  if (!ximage) return False;
+
+  /* Scale it, if necessary...
+   */
+  compute_image_scaling (ximage->width, ximage->height,
+                         win_width, win_height, verbose_p,
+                         &srcx, &srcy, &destx, &desty, &w2, &h2);
+  if (ximage->width != w2 || ximage->height != h2)
+    if (! scale_ximage (screen, visual, ximage, w2, h2))
+      return False;
+
+  /* Allocate a colormap, if we need to...
+   */
+  if (class == PseudoColor || class == DirectColor)
+    {
+      allocate_cubic_colormap (screen, visual, cmap, verbose_p);
+      remap_image_to_colormap (dpy, cmap, ximage, verbose_p);
+    }
+
+  /* Save it for next time, and then put it on the window.
+   */
+# ifdef USE_IMAGE_CACHE
+  if (class == TrueColor && visual == DefaultVisualOfScreen (screen))
+    save_cached_image (screen, filename, win_width, win_height, ximage,
+                       srcx, srcy, destx, desty,
+                       ximage->width, ximage->height, verbose_p);
+# endif /* USE_IMAGE_CACHE */
+
+  put_scaled_image (screen, window, drawable, ximage,
+                    srcx, srcy, destx, desty);
+
+  if (geom_ret)
+    {
+      geom_ret->x = destx;
+      geom_ret->y = desty;
+      geom_ret->width  = ximage->width;
+      geom_ret->height = ximage->height;
+    }
+
+  free (ximage->data);
+  ximage->data = 0;
+  XDestroyImage (ximage);
+  XSync (dpy, False);
+  return True;
+}
+
+#endif /* HAVE_JPEGLIB */
+
+
+/* Reads the given image file and renders it on the Drawable.
+   Returns False if it fails.
+ */
+static Bool
+display_file (Screen *screen, Window window, Drawable drawable,
+              const char *filename, Bool verbose_p,
+              XRectangle *geom_ret)
+{
+  if (verbose_p)
+    fprintf (stderr, "%s: loading \"%s\"\n", progname, filename);
+
+# ifdef USE_IMAGE_CACHE
+  if (display_cached_file (screen, window, drawable, filename, verbose_p,
+                           geom_ret))
+    return True;
+# endif /* USE_IMAGE_CACHE */
+
+# if defined(HAVE_GDK_PIXBUF)
+  if (read_file_gdk (screen, window, drawable, filename, verbose_p, geom_ret))
+    return True;
+# elif defined(HAVE_JPEGLIB)
+  if (read_file_jpeglib (screen, window, drawable, filename, verbose_p,
+                         geom_ret))
+    return True;
+# else  /* !(HAVE_GDK_PIXBUF || HAVE_JPEGLIB) */
+  /* shouldn't get here if we have no image-loading methods available. */
+  abort();
+# endif /* !(HAVE_GDK_PIXBUF || HAVE_JPEGLIB) */
+
+  return False;
+}
+
+
+#ifdef USE_IMAGE_INDEX
+
+/* The image index is a list of every image file under imageDirectory,
+   so that choosing one at random is just picking a number.  It lives
+   in one file, which is mapped read-only, and is replaced by renaming a
+   new one over it, so any number of xscreensaver-getimage processes can
+   be reading it at once.  Rebuilding it is done under a lock, so that
+   only one of them at a time walks the file system.
+
+   It also remembers the modification time of every directory.  When the
+   index gets old, only the directories whose mtime has changed (that is,
+   that have had files added, removed or renamed) are read again; for the
+   rest, the old list of files and subdirectories is reused, so checking
+   a big tree that hasn't changed costs one stat() per directory.
+ */
+
+#define INDEX_MAGIC   "xsgidx01"
+#define INDEX_MAX_AGE (60 * 60)	/* re-check the directories this often */
+
+/* Files smaller than this are rejected, so that you can use an image
+   directory that contains both big images and thumbnails, and have it
+   only select the big versions.  (Same as xscreensaver-getimage-file.)
+ */
+#define MIN_IMAGE_WIDTH  255
+#define MIN_IMAGE_HEIGHT 255
+
+typedef struct {
+  char magic[8];
+  time_t built;
+  long root;			/* string: the directory that was indexed */
+  int ndirs, nfiles;
+  long dirs_offset;		/* these are all 16-byte aligned */
+  long files_offset;
+  long strings_offset;
+  long strings_size;
+} index_header;
+
+typedef struct {
+  time_t mtime;
+  unsigned long dev, ino;
+  long name;			/* string: path relative to the root */
+  int parent;			/* -1 for the root itself */
+  int first_file, nfiles;
+} index_dir;
+
+/* An index that has been read, or one that is being built.  The files
+   are string offsets, of their paths relative to the root. */
+typedef struct {
+  index_header h;
+  index_dir *dirs;
+  long *files;
+  char *strings;
+
+  char *map;			/* if read: the mapped file */
+  long map_size;
+  int *first_child, *next_sibling;
+
+  int dirs_size, files_size;	/* if building: allocated sizes */
+  long strings_alloc;
+  unsigned long *seen;		/* dev/ino pairs, to break symlink loops */
+  int seen_size, nseen;
+  int stat_count;
+} image_index;
+
+
+static void
+free_image_index (image_index *idx)
+{
+  if (idx->map)
+    munmap (idx->map, idx->map_size);
+  else
+    {
+      if (idx->dirs)    free (idx->dirs);
+      if (idx->files)   free (idx->files);
+      if (idx->strings) free (idx->strings);
+    }
+  if (idx->first_child)  free (idx->first_child);
+  if (idx->next_sibling) free (idx->next_sibling);
+  if (idx->seen) free (idx->seen);
+  memset (idx, 0, sizeof(*idx));
+}
+
+
+static void *
+index_grow (void *array, int *size, int count, size_t elt)
+{
+  if (count < *size) return array;
+  *size = (*size + 100) * 2;
+  array = realloc (array, *size * elt);
+  if (!array)
+    {
+      fprintf (stderr, "%s: out of memory (indexing %d items)\n",
+               progname, *size);
+      exit (1);
+    }
+  return array;
+}
+
+
+static long
+index_add_string (image_index *idx, const char *str)
+{
+  long L = strlen (str) + 1;
+  long pos = idx->h.strings_size;
+  while (idx->h.strings_size + L > idx->strings_alloc)
+    {
+      idx->strings_alloc = (idx->strings_alloc + 1024) * 2;
+      idx->strings = (char *) realloc (idx->strings, idx->strings_alloc);
+      if (!idx->strings)
+        {
+          fprintf (stderr, "%s: out of memory (indexing %ld bytes)\n",
+                   progname, idx->strings_alloc);
+          exit (1);
+        }
+    }
+  memcpy (idx->strings + pos, str, L);
+  idx->h.strings_size += L;
+  return pos;
+}
+
+
+/* Returns True if this dev/ino has been seen before, and remembers it.
+ */
+static Bool
+index_seen_p (image_index *idx, struct stat *st)
+{
+  unsigned long dev = st->st_dev, ino = st->st_ino;
+  int i;
+  if (idx->nseen * 2 >= idx->seen_size)
+    {
+      unsigned long *old = idx->seen;
+      int old_size = idx->seen_size;
+      idx->seen_size = (idx->seen_size + 256) * 2;
+      idx->seen = (unsigned long *)
+        calloc (idx->seen_size * 2, sizeof(*idx->seen));
+      if (!idx->seen)
+        {
+          fprintf (stderr, "%s: out of memory (indexing %d dirs)\n",
+                   progname, idx->nseen);
+          exit (1);
+        }
+      idx->nseen = 0;
+      for (i = 0; i < old_size; i++)
+        if (old[i*2] || old[i*2+1])
+          {
+            struct stat st2;
+            st2.st_dev = old[i*2];
+            st2.st_ino = old[i*2+1];
+            index_seen_p (idx, &st2);
+          }
+      if (old) free (old);
+    }
+
+  /* Open addressing.  dev and ino can't both be 0. */
+  i = (int) ((dev * 31 + ino) % idx->seen_size);
+  while (idx->seen[i*2] || idx->seen[i*2+1])
+    {
+      if (idx->seen[i*2] == dev && idx->seen[i*2+1] == ino)
+        return True;
+      i = (i + 1) % idx->seen_size;
+    }
+  idx->seen[i*2]   = dev;
+  idx->seen[i*2+1] = ino;
+  idx->nseen++;
+  return False;
+}
+
+
+/* Whether the file name ends with one of the extensions.
+ */
+static Bool
+has_extension_p (const char *file, const char * const *exts)
+{
+  const char *dot = strrchr (file, '.');
+  if (!dot) return False;
+  for (dot++; *exts; exts++)
+    if (!strcasecmp (dot, *exts))
+      return True;
+  return False;
+}
+
+/* Files we are allowed to use as images.  Anything else is ignored. */
+static const char * const good_extensions[] = {
+  "jpg", "jpeg", "pjpeg", "pjpg", "png", "gif", "tif", "tiff", "xbm", "xpm",
+  0 };
+
+/* Files that might occur in an image directory, and that are never the
+   names of subdirectories, so they don't need to be stat()ed. */
+static const char * const nondir_extensions[] = {
+  "ai", "bmp", "bz2", "cr2", "crw", "db", "dmg", "eps", "gz", "hqx", "htm",
+  "html", "icns", "ilbm", "mov", "nef", "pbm", "pdf", "pl", "ppm", "ps",
+  "psd", "sea", "sh", "shtml", "tar", "tgz", "thb", "txt", "xcf", "xmp",
+  "Z", "zip", 0 };
+
+
+/* Adds the directory `rel' (relative to `root') to the index, and the
+   images in it, and then its subdirectories.  If `old_d' is a directory
+   in the old index that is still up to date, its contents are copied
+   from there instead of being read again.
+ */
+static void
+index_directory (image_index *idx, const image_index *old, int old_d,
+                 const char *root, const char *rel, int parent,
+                 Bool verbose_p)
+{
+  char *path = (char *) malloc (strlen (root) + strlen (rel) + 2);
+  struct subdir { char *name; int old; } *subdirs = 0;
+  int nsubdirs = 0, subdirs_size = 0;
+  struct stat st;
+  index_dir *dir;
+  int d, i;
+
+  if (*rel)
+    sprintf (path, "%s/%s", root, rel);
+  else
+    strcpy (path, root);
+
+  idx->stat_count++;
+  if (stat (path, &st) || !S_ISDIR (st.st_mode) || index_seen_p (idx, &st))
+    {
+      free (path);
+      return;
+    }
+
+  idx->dirs = (index_dir *)
+    index_grow (idx->dirs, &idx->dirs_size, idx->h.ndirs, sizeof(*idx->dirs));
+  d = idx->h.ndirs++;
+  dir = &idx->dirs[d];
+  dir->mtime  = st.st_mtime;
+  dir->dev    = st.st_dev;
+  dir->ino    = st.st_ino;
+  dir->name   = index_add_string (idx, rel);
+  dir->parent = parent;
+  dir->first_file = idx->h.nfiles;
+  dir->nfiles = 0;
+
+  if (old_d >= 0 && old->dirs[old_d].mtime == st.st_mtime)
+    {
+      /* Unchanged: copy the files, and check the subdirectories. */
+      const index_dir *od = &old->dirs[old_d];
+      for (i = 0; i < od->nfiles; i++)
+        {
+          long s = index_add_string (idx, old->strings +
+                                     old->files[od->first_file + i]);
+          idx->files = (long *) index_grow (idx->files, &idx->files_size,
+                                            idx->h.nfiles, sizeof(long));
+          idx->files[idx->h.nfiles++] = s;
+        }
+      for (i = old->first_child[old_d]; i >= 0; i = old->next_sibling[i])
+        {
+          subdirs = (struct subdir *)
+            index_grow (subdirs, &subdirs_size, nsubdirs, sizeof(*subdirs));
+          subdirs[nsubdirs].name = strdup (old->strings + old->dirs[i].name);
+          subdirs[nsubdirs++].old = i;
+        }
+    }
+  else
+    {
+      DIR *dd = opendir (path);
+      struct dirent *de;
+
+      if (verbose_p)
+        fprintf (stderr, "%s:  + reading dir %s/\n", progname, path);
+
+      while (dd && (de = readdir (dd)))
+        {
+          const char *name = de->d_name;
+          int L = strlen (name);
+          char *file;
+
+          if (*name == '.')			/* ignore dot files/dirs */
+            continue;
+          if (name[L-1] == '~' || name[L-1] == '%' || name[L-1] == '#')
+            continue;				/* and backup files */
+          if (has_extension_p (name, nondir_extensions))
+            continue;
+
+          file = (char *) malloc (strlen (rel) + L + 2);
+          if (*rel)
+            sprintf (file, "%s/%s", rel, name);
+          else
+            strcpy (file, name);
+
+          if (has_extension_p (name, good_extensions))
+            {
+              /* Assume that files ending in .jpg are not directories. */
+              long s = index_add_string (idx, file);
+              idx->files = (long *) index_grow (idx->files, &idx->files_size,
+                                                idx->h.nfiles, sizeof(long));
+              idx->files[idx->h.nfiles++] = s;
+              free (file);
+            }
+          else
+            {
+              /* Maybe a subdirectory: index_directory() will stat it. */
+              int od = -1;
+              if (old_d >= 0)
+                for (i = old->first_child[old_d]; i >= 0;
+                     i = old->next_sibling[i])
+                  if (!strcmp (old->strings + old->dirs[i].name, file))
+                    {
+                      od = i;
+                      break;
+                    }
+              subdirs = (struct subdir *)
+                index_grow (subdirs, &subdirs_size, nsubdirs,
+                            sizeof(*subdirs));
+              subdirs[nsubdirs].name = file;
+              subdirs[nsubdirs++].old = od;
+            }
+        }
+      if (dd) closedir (dd);
+    }
+
+  /* idx->dirs may have moved. */
+  idx->dirs[d].nfiles = idx->h.nfiles - idx->dirs[d].first_file;
+
+  for (i = 0; i < nsubdirs; i++)
+    {
+      index_directory (idx, old, subdirs[i].old, root, subdirs[i].name, d,
+                       verbose_p);
+      free (subdirs[i].name);
+    }
+
+  if (subdirs) free (subdirs);
+  free (path);
+}
+
+
+/* Maps the index file.  Returns False if it's not there or is damaged.
+ */
+static Bool
+read_image_index (const char *file, image_index *idx)
+{
+  struct stat st;
+  int fd, i;
+
+  memset (idx, 0, sizeof(*idx));
+  fd = open (file, O_RDONLY);
+  if (fd < 0) return False;
+  if (fstat (fd, &st) || st.st_size < sizeof(idx->h))
+    {
+      close (fd);
+      return False;
+    }
+
+  idx->map_size = st.st_size;
+  idx->map = (char *) mmap (0, idx->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (idx->map == (char *) MAP_FAILED)
+    {
+      idx->map = 0;
+      return False;
+    }
+
+  memcpy (&idx->h, idx->map, sizeof(idx->h));
+  if (memcmp (idx->h.magic, INDEX_MAGIC, sizeof(idx->h.magic)) ||
+      idx->h.ndirs < 1 || idx->h.nfiles < 0 ||
+      idx->h.dirs_offset  < sizeof(idx->h) ||
+      idx->h.files_offset < idx->h.dirs_offset +
+                            (long) idx->h.ndirs * sizeof(index_dir) ||
+      idx->h.strings_offset < idx->h.files_offset +
+                              (long) idx->h.nfiles * sizeof(long) ||
+      idx->h.strings_offset + idx->h.strings_size > idx->map_size ||
+      idx->h.strings_size < 1 ||
+      idx->map[idx->h.strings_offset + idx->h.strings_size - 1] != 0)
+    {
+      free_image_index (idx);
+      return False;
+    }
+
+  idx->dirs    = (index_dir *) (idx->map + idx->h.dirs_offset);
+  idx->files   = (long *)      (idx->map + idx->h.files_offset);
+  idx->strings =                idx->map + idx->h.strings_offset;
+
+  /* Where each directory's subdirectories are. */
+  idx->first_child  = (int *) malloc (idx->h.ndirs * sizeof(int));
+  idx->next_sibling = (int *) malloc (idx->h.ndirs * sizeof(int));
+  if (!idx->first_child || !idx->next_sibling)
+    {
+      free_image_index (idx);
+      return False;
+    }
+  for (i = 0; i < idx->h.ndirs; i++)
+    idx->first_child[i] = idx->next_sibling[i] = -1;
+  for (i = idx->h.ndirs-1; i >= 0; i--)
     {
-      fprintf (stderr, "%s: unsupported depth: %d\n", progname, depth);
-      goto FAIL;
+      const index_dir *d = &idx->dirs[i];
+      int p = d->parent;
+      if ((i == 0 ? p != -1 : (p < 0 || p >= i)) ||  /* parents come first */
+          d->name < 0 || d->name >= idx->h.strings_size ||
+          d->first_file < 0 || d->nfiles < 0 ||
+          d->first_file + d->nfiles > idx->h.nfiles)
+        {
+          free_image_index (idx);
+          return False;
+        }
+      if (i > 0)
+        {
+          idx->next_sibling[i] = idx->first_child[p];
+          idx->first_child[p] = i;
+        }
     }
-
-  in = fopen (filename, "rb");
-  if (!in)
+  for (i = 0; i < idx->h.nfiles; i++)
+    if (idx->files[i] < 0 || idx->files[i] >= idx->h.strings_size)
+      {
+        free_image_index (idx);
+        return False;
+      }
+  if (idx->h.root < 0 || idx->h.root >= idx->h.strings_size)
     {
-      fprintf (stderr, "%s: %s: unreadable\n", progname, filename);
-      goto FAIL;
+      free_image_index (idx);
+      return False;
     }
 
-  /* Check to see if it's a PPM, and if so, read that instead of using
-     the JPEG library.  Yeah, this is all modular and stuff.
-   */
-  if ((ximage = maybe_read_ppm (screen, visual, filename, in, verbose_p)))
+  return True;
+}
+
+
+/* Writes the index under another name, and then renames it, so that
+   readers never see half of it.
+ */
+static Bool
+write_image_index (const char *file, image_index *idx)
+{
+  char *tmp = (char *) malloc (strlen (file) + 20);
+  static const char zeros[16] = { 0, };
+  FILE *out;
+  long pos;
+  Bool ok;
+
+# define ALIGN(N) (((N) + 15) & ~15L)
+  idx->h.dirs_offset    = ALIGN (sizeof(idx->h));
+  idx->h.files_offset   = ALIGN (idx->h.dirs_offset +
+                                 idx->h.ndirs * sizeof(index_dir));
+  idx->h.strings_offset = ALIGN (idx->h.files_offset +
+                                 idx->h.nfiles * sizeof(long));
+
+  sprintf (tmp, "%s.%lu", file, (unsigned long) getpid());
+  out = fopen (tmp, "wb");
+  if (!out)
     {
-      fclose (in);
-      return ximage;
+      free (tmp);
+      return False;
     }
 
-  cinfo.err = jpeg_std_error (&jerr.pub);
-  jerr.pub.output_message = jpg_output_message;
-  jerr.pub.error_exit = jpg_error_exit;
-
-  jpeg_create_decompress (&cinfo);
-  jpeg_stdio_src (&cinfo, in);
-  jpeg_read_header (&cinfo, TRUE);
+  pos = sizeof(idx->h);
+  ok = (fwrite (&idx->h, sizeof(idx->h), 1, out) == 1);
+  ok = ok && fwrite (zeros, 1, idx->h.dirs_offset - pos, out) ==
+    idx->h.dirs_offset - pos;
+  pos = idx->h.dirs_offset + idx->h.ndirs * sizeof(index_dir);
+  ok = ok && fwrite (idx->dirs, sizeof(index_dir), idx->h.ndirs, out) ==
+    idx->h.ndirs;
+  ok = ok && fwrite (zeros, 1, idx->h.files_offset - pos, out) ==
+    idx->h.files_offset - pos;
+  pos = idx->h.files_offset + idx->h.nfiles * sizeof(long);
+  ok = ok && fwrite (idx->files, sizeof(long), idx->h.nfiles, out) ==
+    idx->h.nfiles;
+  ok = ok && fwrite (zeros, 1, idx->h.strings_offset - pos, out) ==
+    idx->h.strings_offset - pos;
+  ok = ok && fwrite (idx->strings, 1, idx->h.strings_size, out) ==
+    idx->h.strings_size;
+# undef ALIGN
+
+  if (fclose (out)) ok = False;
+  if (ok && rename (tmp, file)) ok = False;
+  if (!ok) unlink (tmp);
+  free (tmp);
+  return ok;
+}
 
-  /* set some decode parameters */
-  cinfo.out_color_space = JCS_RGB;
-  cinfo.quantize_colors = FALSE;
 
-  jpeg_start_decompress (&cinfo);
+/* Reads the first part of an image file, and returns its size, if it's
+   a GIF, JPEG or PNG.  Returns False if it couldn't tell.
+ */
+static Bool
+image_file_size (const char *file, int *w_ret, int *h_ret)
+{
+  unsigned char buf[1024 * 50];   /* the first 50k should be enough */
+  FILE *in = fopen (file, "rb");
+  int L, i;
+  if (!in) return False;
+  L = fread (buf, 1, sizeof(buf), in);
+  fclose (in);
+  if (L < 24) return False;
 
-  ximage = XCreateImage (dpy, visual, depth, ZPixmap, 0, 0,
-                         cinfo.output_width, cinfo.output_height,
-                         8, 0);
-  if (ximage)
-    ximage->data = (char *) calloc (ximage->height, ximage->bytes_per_line);
+  if (!memcmp (buf, "GIF87a", 6) || !memcmp (buf, "GIF89a", 6))
+    {
+      *w_ret = buf[6] | (buf[7] << 8);
+      *h_ret = buf[8] | (buf[9] << 8);
+      return True;
+    }
 
-  if (ximage && ximage->data)
-    scanbuf = (*cinfo.mem->alloc_sarray) ((j_common_ptr) &cinfo, JPOOL_IMAGE,
-                                          cinfo.rec_outbuf_height *
-                                          cinfo.output_width *
-                                          cinfo.output_components,
-                                          1);
-  if (!ximage || !ximage->data || !scanbuf)
+  if (!memcmp (buf, "\211PNG\r", 5) && !memcmp (buf + 12, "IHDR", 4))
     {
-      fprintf (stderr, "%s: out of memory loading %dx%d file %s\n",
-               progname, ximage->width, ximage->height, filename);
-      goto FAIL;
+      *w_ret = (buf[16] << 24) | (buf[17] << 16) | (buf[18] << 8) | buf[19];
+      *h_ret = (buf[20] << 24) | (buf[21] << 16) | (buf[22] << 8) | buf[23];
+      return True;
     }
 
-  y = 0;
-  while (cinfo.output_scanline < cinfo.output_height)
+  if (buf[0] == 0xFF && buf[1] == 0xD8)   /* JPEG: look for a SOFn marker */
     {
-      int n = jpeg_read_scanlines (&cinfo, scanbuf, 1);
-      int i;
-      for (i = 0; i < n; i++)
+      i = 2;
+      while (i < L)
         {
-          int x;
-          for (x = 0; x < ximage->width; x++)
+          int marker;
+          while (i < L && buf[i] != 0xFF) i++;
+          while (i < L && buf[i] == 0xFF) i++;   /* padding */
+          if (i >= L) break;
+          marker = buf[i++];
+          if (marker == 0xDA)   /* start of scan */
+            break;
+          if (marker >= 0xC0 && marker <= 0xCF &&
+              marker != 0xC4 && marker != 0xCC)
             {
-              int j = x * cinfo.output_components;
-              unsigned char r = scanbuf[i][j];
-              unsigned char g = scanbuf[i][j+1];
-              unsigned char b = scanbuf[i][j+2];
-              unsigned long pixel;
-
-              if (depth > 16)
-                pixel = (r << 16) | (g << 8) | b;
-              else if (depth == 8)
-                pixel = ((r >> 5) | ((g >> 5) << 3) | ((b >> 6) << 6));
-              else if (depth == 12)
-                pixel = ((r >> 4) | ((g >> 4) << 4) | ((b >> 4) << 8));
-              else if (depth == 15)
-                /* Gah! I don't understand why these are in the other
-                   order. */
-                pixel = (((r >> 3) << 10) | ((g >> 3) << 5) | ((b >> 3)));
-              else if (depth == 16)
-                pixel = (((r >> 3) << 11) | ((g >> 2) << 5) | ((b >> 3)));
-              else
-                abort();
-
-              XPutPixel (ximage, x, y, pixel);
+              if (i + 7 > L) break;
+              *h_ret = (buf[i+3] << 8) | buf[i+4];
+              *w_ret = (buf[i+5] << 8) | buf[i+6];
+              return True;
             }
-          y++;
+          if (i + 2 > L) break;
+          {
+            int len = (buf[i] << 8) | buf[i+1];
+            if (len < 2) break;
+            i += len;
+          }
         }
     }
 
-  if (cinfo.output_scanline < cinfo.output_height)
-    /* don't goto FAIL -- we might have viewable partial data. */
-    jpeg_abort_decompress (&cinfo);
-  else
-    jpeg_finish_decompress (&cinfo);
+  return False;
+}
 
-  jpeg_destroy_decompress (&cinfo);
-  fclose (in);
-  in = 0;
 
-  return ximage;
+static Bool
+large_enough_p (const char *file, Bool verbose_p)
+{
+  int w, h;
+  FILE *in;
 
- FAIL:
-  if (in) fclose (in);
-  if (ximage && ximage->data)
+  if (image_file_size (file, &w, &h))
     {
-      free (ximage->data);
-      ximage->data = 0;
+      if (w < MIN_IMAGE_WIDTH || h < MIN_IMAGE_HEIGHT)
+        {
+          if (verbose_p)
+            fprintf (stderr, "%s: %s: too small (%d x %d)\n",
+                     progname, file, w, h);
+          return False;
+        }
+      if (verbose_p)
+        fprintf (stderr, "%s: %s: %d x %d\n", progname, file, w, h);
+      return True;
     }
-  if (ximage) XDestroyImage (ximage);
-  if (scanbuf) free (scanbuf);
-  return 0;
+
+  /* Nonexistent files are obviously too small!  But assume that files
+     of unknown types are of good sizes: we don't have code to parse
+     them (or they're junk.) */
+  in = fopen (file, "rb");
+  if (!in) return False;
+  fclose (in);
+  if (verbose_p)
+    fprintf (stderr, "%s: %s: unable to determine image size\n",
+             progname, file);
+  return True;
 }
 
 
-/* Reads the given image file and renders it on the Drawable, using JPEG lib.
-   Returns False if it fails.
+/* Returns the name of a random image file under the directory, relative
+   to it, as xscreensaver-getimage-file would.  Free the string when done.
+   Returns 0 if there aren't any, or if the index can't be used.
  */
-static Bool
-read_file_jpeglib (Screen *screen, Window window, Drawable drawable,
-                   const char *filename, Bool verbose_p,
-                   XRectangle *geom_ret)
+static char *
+index_random_file (const char *directory, Bool verbose_p)
 {
-  Display *dpy = DisplayOfScreen (screen);
-  XImage *ximage;
-  Visual *visual;
-  int class, depth;
-  Colormap cmap;
-  unsigned int win_width, win_height, win_depth;
-  int srcx, srcy, destx, desty, w2, h2;
+  char *file = cache_file_name ("getimage.index",
+                                ".xscreensaver-getimage.index");
+  char *lock_file = 0;
+  char *dir = 0;
+  char *ret = 0;
+  image_index idx, old;
+  int lock_fd = -1;
+  int tries;
+  struct stat st;
 
-  /* Find the size of the Drawable, and the Visual/Colormap of the Window. */
-  {
-    Window root;
-    int x, y;
-    unsigned int bw;
-    XWindowAttributes xgwa;
-    XGetWindowAttributes (dpy, window, &xgwa);
-    visual = xgwa.visual;
-    cmap = xgwa.colormap;
-    XGetGeometry (dpy, drawable,
-                  &root, &x, &y, &win_width, &win_height, &bw, &win_depth);
-  }
+  memset (&idx, 0, sizeof(idx));
+  memset (&old, 0, sizeof(old));
+  if (!file) goto DONE;
 
-  /* Make sure we're not on some weirdo visual...
-   */
-  class = visual_class (screen, visual);
-  depth = visual_depth (screen, visual);
-  if ((class == PseudoColor || class == DirectColor) &&
-      (depth != 8 && depth != 12))
+  /* Allow "~/", and omit trailing slashes. */
+  if (!strncmp (directory, "~/", 2) && getenv ("HOME"))
     {
-      fprintf (stderr, "%s: Pseudo/DirectColor depth %d unsupported\n",
-               progname, depth);
-      return False;
+      dir = (char *) malloc (strlen (getenv ("HOME")) + strlen (directory));
+      sprintf (dir, "%s%s", getenv ("HOME"), directory + 1);
     }
+  else
+    dir = strdup (directory);
+  while (strlen (dir) > 1 && dir[strlen(dir)-1] == '/')
+    dir[strlen(dir)-1] = 0;
 
-  /* Read the file...
-   */
-  ximage = read_jpeg_ximage (screen, visual, drawable, cmap,
-                             filename, verbose_p);
-  if (!ximage) return False;
+  if (stat (dir, &st) || !S_ISDIR (st.st_mode))
+    {
+      fprintf (stderr, "%s: %s: not a directory\n", progname, dir);
+      goto DONE;
+    }
 
-  /* Scale it, if necessary...
-   */
-  compute_image_scaling (ximage->width, ximage->height,
-                         win_width, win_height, verbose_p,
-                         &srcx, &srcy, &destx, &desty, &w2, &h2);
-  if (ximage->width != w2 || ximage->height != h2)
-    if (! scale_ximage (screen, visual, ximage, w2, h2))
-      return False;
+  /* If the index is for this directory, and is recent, just use it. */
+# define USABLE_P(I) \
+    (!strcmp ((I).strings + (I).h.root, dir) && \
+     (I).h.built + INDEX_MAX_AGE > time ((time_t *) 0))
 
-  /* Allocate a colormap, if we need to...
-   */
-  if (class == PseudoColor || class == DirectColor)
+  if (! (read_image_index (file, &idx) && USABLE_P (idx)))
     {
-      allocate_cubic_colormap (screen, visual, cmap, verbose_p);
-      remap_image (screen, cmap, ximage, verbose_p);
-    }
+      struct flock lock;
+      free_image_index (&idx);
+
+      /* Only one process at a time rebuilds it; the others wait, and
+         then use the one it built. */
+      lock_file = (char *) malloc (strlen (file) + 10);
+      sprintf (lock_file, "%s.lock", file);
+      lock_fd = open (lock_file, O_RDWR | O_CREAT, 0600);
+      if (lock_fd < 0) goto DONE;
+      memset (&lock, 0, sizeof(lock));
+      lock.l_type = F_WRLCK;
+      lock.l_whence = SEEK_SET;
+      if (verbose_p)
+        fprintf (stderr, "%s: awaiting lock: %s\n", progname, lock_file);
+      if (fcntl (lock_fd, F_SETLKW, &lock) < 0) goto DONE;
 
-  /* Finally, put the resized image on the window.
-   */
-  {
-    GC gc;
-    XGCValues gcv;
-
-    /* If we're rendering onto the root window (and it's not the xscreensaver
-       pseudo-root) then put the image in the window's background.  Otherwise,
-       just paint the image onto the window.
-     */
-    if (window == drawable && root_window_p (screen, window))
-      {
-        Pixmap bg = XCreatePixmap (dpy, window,
-                                   win_width, win_height, win_depth);
-        gcv.foreground = BlackPixelOfScreen (screen);
-        gc = XCreateGC (dpy, drawable, GCForeground, &gcv);
-        XFillRectangle (dpy, bg, gc, 0, 0, win_width, win_height);
-        XPutImage (dpy, bg, gc, ximage,
-                   srcx, srcy, destx, desty, ximage->width, ximage->height);
-        XSetWindowBackgroundPixmap (dpy, window, bg);
-        XClearWindow (dpy, window);
-      }
-    else
-      {
-        gc = XCreateGC (dpy, drawable, 0, &gcv);
-        clear_drawable (screen, drawable);
-        XPutImage (dpy, drawable, gc, ximage,
-                   srcx, srcy, destx, desty, ximage->width, ximage->height);
-      }
+      if (! (read_image_index (file, &old) && USABLE_P (old)))
+        {
+          int old_root = -1;
+          if (old.map && !strcmp (old.strings + old.h.root, dir))
+            old_root = 0;
 
-    XFreeGC (dpy, gc);
-  }
+          if (verbose_p)
+            fprintf (stderr, "%s: %s %s...\n", progname,
+                     (old_root >= 0 ? "refreshing index of" : "indexing"),
+                     dir);
 
-  if (geom_ret)
-    {
-      geom_ret->x = destx;
-      geom_ret->y = desty;
-      geom_ret->width  = ximage->width;
-      geom_ret->height = ximage->height;
-    }
+          memcpy (idx.h.magic, INDEX_MAGIC, sizeof(idx.h.magic));
+          idx.h.built = time ((time_t *) 0);
+          idx.h.root = index_add_string (&idx, dir);
+          index_directory (&idx, &old, old_root, dir, "", -1, verbose_p);
 
-  free (ximage->data);
-  ximage->data = 0;
-  XDestroyImage (ximage);
-  XSync (dpy, False);
-  return True;
-}
+          if (verbose_p)
+            fprintf (stderr, "%s: f=%d; d=%d; s=%d.\n", progname,
+                     idx.h.nfiles, idx.h.ndirs, idx.stat_count);
 
-#endif /* HAVE_JPEGLIB */
+          if (idx.h.ndirs < 1 || !write_image_index (file, &idx))
+            goto DONE;
+          free_image_index (&idx);
+        }
+      free_image_index (&old);
+      if (! read_image_index (file, &idx))
+        goto DONE;
+    }
+# undef USABLE_P
 
+  if (idx.h.nfiles <= 0)
+    {
+      fprintf (stderr, "%s: no files in %s\n", progname, dir);
+      goto DONE;
+    }
 
-/* Reads the given image file and renders it on the Drawable.
-   Returns False if it fails.
- */
-static Bool
-display_file (Screen *screen, Window window, Drawable drawable,
-              const char *filename, Bool verbose_p,
-              XRectangle *geom_ret)
-{
-  if (verbose_p)
-    fprintf (stderr, "%s: loading \"%s\"\n", progname, filename);
+  for (tries = 0; tries < 50; tries++)
+    {
+      const char *f = idx.strings + idx.files[random() % idx.h.nfiles];
+      char *path = (char *) malloc (strlen (dir) + strlen (f) + 2);
+      Bool ok;
+      sprintf (path, "%s/%s", dir, f);
+      ok = large_enough_p (path, verbose_p);
+      free (path);
+      if (ok)
+        {
+          ret = strdup (f);
+          break;
+        }
+    }
 
-# if defined(HAVE_GDK_PIXBUF)
-  if (read_file_gdk (screen, window, drawable, filename, verbose_p, geom_ret))
-    return True;
-# elif defined(HAVE_JPEGLIB)
-  if (read_file_jpeglib (screen, window, drawable, filename, verbose_p,
-                         geom_ret))
-    return True;
-# else  /* !(HAVE_GDK_PIXBUF || HAVE_JPEGLIB) */
-  /* shouldn't get here if we have no image-loading methods available. */
-  abort();
-# endif /* !(HAVE_GDK_PIXBUF || HAVE_JPEGLIB) */
+  if (!ret)
+    {
+      fprintf (stderr, "%s: no suitable images in %s (after %d tries)\n",
+               progname, dir, tries);
+      /* Maybe the index is stale: rebuild it all next time. */
+      unlink (file);
+    }
 
-  return False;
+ DONE:
+  free_image_index (&idx);
+  free_image_index (&old);
+  if (lock_fd >= 0) close (lock_fd);   /* releases the lock */
+  if (lock_file) free (lock_file);
+  if (file) free (file);
+  if (dir) free (dir);
+  return ret;
 }
 
+#endif /* USE_IMAGE_INDEX */
+
 
 /* Invokes a sub-process and returns its output (presumably, a file to
    load.)  Free the string when done.  'grab_type' controls which program
@@ -1274,6 +2593,14 @@ get_filename_1 (Screen *screen, const char *directory, grab_type type,
 static char *
 get_filename (Screen *screen, const char *directory, Bool verbose_p)
 {
+# ifdef USE_IMAGE_INDEX
+  /* Feeds still need xscreensaver-getimage-file, to download them. */
+  if (!strstr (directory, "://") && strncmp (directory, "feed:", 5))
+    {
+      char *file = index_random_file (directory, verbose_p);
+      if (file) return file;
+    }
+# endif /* USE_IMAGE_INDEX */
   return get_filename_1 (screen, directory, GRAB_FILE, verbose_p);
 }
 
@@ -1426,42 +2753,22 @@ display_desktop (Screen *screen, Window window, Drawable drawable,
   else  /* size mismatch -- must scale client-side images to fit drawable */
     {
       GC gc;
-      XImage *ximage = 0;
-      XErrorHandler old_handler;
-
-      XSync (dpy, False);
-      old_handler = XSetErrorHandler (ignore_badmatch_ehandler);
-      error_handler_hit_p = False;
-
-      /* This can return BadMatch if the window is not fully on screen.
-         Trap that error and return color bars in that case.
-         (Note that this only happens with XGetImage, not with XCopyArea:
-         yet another totally gratuitous inconsistency in X, thanks.)
-       */
-      ximage = XGetImage (dpy, window, 0, 0, xgwa.width, xgwa.height,
-                          ~0L, ZPixmap);
-
-      XSync (dpy, False);
-      XSetErrorHandler (old_handler);
-      XSync (dpy, False);
+      XImage *ximage, *ximage2;
 
-      if (error_handler_hit_p)
-        {
-          ximage = 0;
-          if (verbose_p)
-            fprintf (stderr, "%s: BadMatch reading window 0x%x contents!\n",
-                     progname, (unsigned int) window);
-        }
+      ximage = grab_window_ximage (screen, window);
+      if (!ximage)
+        return False;
 
-      if (!ximage ||
-          !scale_ximage (xgwa.screen, xgwa.visual, ximage, w2, h2))
+      ximage2 = scaled_ximage (xgwa.screen, xgwa.visual, ximage, w2, h2);
+      free_window_ximage (dpy, ximage);
+      if (!ximage2)
         return False;
 
       gc = XCreateGC (dpy, drawable, 0, &gcv);
       clear_drawable (screen, drawable);
-      XPutImage (dpy, drawable, gc, ximage, 
-                 srcx, srcy, destx, desty, ximage->width, ximage->height);
-      XDestroyImage (ximage);
+      XPutImage (dpy, drawable, gc, ximage2,
+                 srcx, srcy, destx, desty, ximage2->width, ximage2->height);
+      XDestroyImage (ximage2);
       XFreeGC (dpy, gc);
     }
 
@@ -1534,6 +1534,10 @@ main (int argc, char **argv)
   select_events (si);
   init_sigchld ();
 
+  /* With warmSpawn, get the first hacks going before we need them. */
+  for (i = 0; i < si->nscreens; i++)
+    prefork_screenhack (&si->screens[i]);
+
   disable_builtin_screensaver (si, True);
   sync_server_dpms_settings (si->dpy,
                              (p->dpms_enabled_p  &&
@@ -156,6 +156,8 @@ extern void hack_subproc_environment (Screen *, Window saver_window);
 extern void init_sigchld (void);
 extern void spawn_screenhack (saver_screen_info *ssi);
 extern pid_t fork_and_exec (saver_screen_info *ssi, const char *command);
+extern void prefork_screenhack (saver_screen_info *ssi);
+extern void discard_prefork (saver_screen_info *ssi);
 extern void kill_screenhack (saver_screen_info *ssi);
 extern void suspend_screenhack (saver_screen_info *ssi, Bool suspend_p);
 extern Bool screenhack_running_p (saver_info *si);
@@ -65,6 +65,16 @@
 #include "yarandom.h"
 #include "grabscreen.h"
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+#ifdef __SSE4_1__
+# include <smmintrin.h>
+#endif
+#ifdef __AVX__
+# include <immintrin.h>
+#endif
+
 /* #define DEBUG 1 */
 
 #ifdef DEBUG
@@ -95,10 +105,16 @@ do { \
 
 #define FASTRND (fastrnd = fastrnd*1103515245+12345)
 
-static void analogtv_ntsc_to_yiq(analogtv *it, int lineno, double *signal,
+struct analogtv_yiq_s {
+  float y,i,q;
+};
+
+static void analogtv_ntsc_to_yiq(const analogtv *it, int lineno,
+                                 const analogtv_sample *signal,
+                                 struct analogtv_yiq_s *yiq,
                                  int start, int end);
 
-static double puramp(analogtv *it, double tc, double start, double over)
+static double puramp(const analogtv *it, double tc, double start, double over)
 {
   double pt=it->powerup-start;
   double ret;
@@ -402,6 +418,12 @@ analogtv_allocate(Display *dpy, Window window)
 
   it->n_colors=0;
 
+  it->threads=threadpool_create(get_boolean_resource(dpy, "useThreads",
+                                                     "Boolean") ? 0 : 1);
+  if (!it->threads) goto fail;
+
+  it->incremental=get_boolean_resource(dpy, "incrementalDraw", "Boolean");
+
 #ifdef HAVE_XSHM_EXTENSION
   it->use_shm=1;
 #else
@@ -479,7 +501,10 @@ analogtv_allocate(Display *dpy, Window window)
   return it;
 
  fail:
-  if (it) free(it);
+  if (it) {
+    threadpool_destroy(it->threads);
+    free(it);
+  }
   return NULL;
 }
 
@@ -500,6 +525,7 @@ analogtv_release(analogtv *it)
   it->gc=NULL;
   if (it->n_colors) XFreeColors(it->dpy, it->colormap, it->colors, it->n_colors, 0L);
   it->n_colors=0;
+  threadpool_destroy(it->threads);
   free(it);
 }
 
@@ -609,31 +635,84 @@ analogtv_set_demod(analogtv *it)
   return 0;
 }
 
-#if 0
-unsigned int
-analogtv_line_signature(analogtv_input *input, int lineno)
+/* Signatures for incremental redraw.  When it->incremental is set, each
+   received line gets a signature of everything that went into it except
+   the random noise: the noise level, and the input samples and reception
+   parameters of each analogtv_add_signal().  analogtv_draw() combines
+   that with the sync and colorburst state of each displayed line, and
+   only demodulates and sends the lines whose signature has changed since
+   they were last drawn.  So on a static picture, the snow freezes.
+ */
+
+#define SIG_MIX(h,v) (((h) ^ (unsigned int)(v)) * 0x01000193u & 0xffffffffu)
+
+static unsigned int
+analogtv_sig_double(unsigned int hash, double d)
 {
+  unsigned char b[sizeof(d)];
   int i;
-  char *origsignal=&input->signal[(lineno+input->vsync)
-                                  %ANALOGTV_V][input->line_hsync[lineno]];
-  unsigned int hash=0;
+  memcpy(b, &d, sizeof(d));
+  for (i=0; i<(int)sizeof(d); i++)
+    hash=SIG_MIX(hash, b[i]);
+  return hash;
+}
 
-  /* probably lame */
-  for (i=0; i<ANALOGTV_PIC_LEN; i++) {
-    int c=origsignal[i];
-    hash = hash + (hash<<17) + c;
+/* The signature of the n input samples starting at ofs, which add_signal
+   turns into one received line. */
+static unsigned int
+analogtv_line_signature(const analogtv_input *input, unsigned int ofs, int n)
+{
+  const signed char *ss=&input->signal[0][0];
+  const signed char *s=ss + ofs%ANALOGTV_SIGNAL_LEN;
+  const signed char *se=ss + ANALOGTV_SIGNAL_LEN;
+  unsigned int hash=0x811c9dc5u;
+
+  while (n-- > 0) {
+    hash=SIG_MIX(hash, (unsigned char)*s);
+    if (++s>=se) s=ss;
   }
+  return hash;
+}
 
-  hash += input->line_hsync[lineno];
-  hash ^= hash >> 2;
-  /*
-  hash += input->hashnoise_times[lineno];
-  hash ^= hash >> 2;
-  */
+static void
+analogtv_init_signatures(analogtv *it, double noiselevel)
+{
+  int i;
+  unsigned int hash;
+  if (!it->incremental) return;
+  hash=analogtv_sig_double(0x811c9dc5u, noiselevel);
+  for (i=0; i<ANALOGTV_V; i++)
+    it->rx_signature[i]=hash;
+}
 
-  return hash;
+static void
+analogtv_add_signatures(analogtv *it, const analogtv_reception *rec)
+{
+  enum {HIST=16}; /* the ghosting FIR looks back this far */
+  unsigned int ofs=(unsigned)rec->ofs % ANALOGTV_SIGNAL_LEN;
+  unsigned int rhash=0x811c9dc5u;
+  int i,lineno;
+
+  if (!it->incremental) return;
+
+  /* The big noisy transition isn't worth keeping track of */
+  if (it->channel_change_cycles)
+    it->redraw_all=1;
+
+  rhash=analogtv_sig_double(rhash, rec->level);
+  rhash=analogtv_sig_double(rhash, rec->hfloss);
+  for (i=0; i<ANALOGTV_GHOSTFIR_LEN; i++)
+    rhash=analogtv_sig_double(rhash, rec->ghostfir[i]);
+
+  for (lineno=0; lineno<ANALOGTV_V; lineno++) {
+    unsigned int lofs=ofs + lineno*ANALOGTV_H + ANALOGTV_SIGNAL_LEN - HIST;
+    unsigned int hash=it->rx_signature[lineno];
+    hash=SIG_MIX(hash, rhash);
+    hash=SIG_MIX(hash, analogtv_line_signature(rec->input, lofs,
+                                               ANALOGTV_H + HIST));
+    it->rx_signature[lineno]=hash;
+  }
 }
-#endif
 
 
 /* Here we model the analog circuitry of an NTSC television.
@@ -655,39 +734,29 @@ analogtv_line_signature(analogtv_input *input, int lineno)
 
 */
 
-static void
-analogtv_ntsc_to_yiq(analogtv *it, int lineno, double *signal,
-                     int start, int end)
+/* Looks at the colorburst phase of the given line, and returns whether
+   there's any color in it, and if so, the I and Q multipliers for each
+   of the 4 dot clock phases. */
+static int
+analogtv_line_colormode(const analogtv *it, int lineno, int phasecorr,
+                        double multiq2[4])
 {
-  enum {MAXDELAY=32};
-  int i;
-  double *sp;
-  int phasecorr=(signal-it->rx_signal)&3;
-  struct analogtv_yiq_s *yiq;
   int colormode;
-  double agclevel=it->agclevel;
-  double brightadd=it->brightness_control*100.0 - ANALOGTV_BLACK_LEVEL;
-  double delay[MAXDELAY+ANALOGTV_PIC_LEN], *dp;
-  double multiq2[4];
-
-  {
-
-    double cb_i=(it->line_cb_phase[lineno][(2+phasecorr)&3]-
-                 it->line_cb_phase[lineno][(0+phasecorr)&3])/16.0;
-    double cb_q=(it->line_cb_phase[lineno][(3+phasecorr)&3]-
-                 it->line_cb_phase[lineno][(1+phasecorr)&3])/16.0;
+  double cb_i=(it->line_cb_phase[lineno][(2+phasecorr)&3]-
+               it->line_cb_phase[lineno][(0+phasecorr)&3])/16.0;
+  double cb_q=(it->line_cb_phase[lineno][(3+phasecorr)&3]-
+               it->line_cb_phase[lineno][(1+phasecorr)&3])/16.0;
 
-    colormode = (cb_i * cb_i + cb_q * cb_q) > 2.8;
+  colormode = (cb_i * cb_i + cb_q * cb_q) > 2.8;
 
-    if (colormode) {
-      double tint_i = -cos((103 + it->color_control)*3.1415926/180);
-      double tint_q = sin((103 + it->color_control)*3.1415926/180);
+  if (colormode) {
+    double tint_i = -cos((103 + it->color_control)*3.1415926/180);
+    double tint_q = sin((103 + it->color_control)*3.1415926/180);
 
-      multiq2[0] = (cb_i*tint_i - cb_q*tint_q) * it->color_control;
-      multiq2[1] = (cb_q*tint_i + cb_i*tint_q) * it->color_control;
-      multiq2[2]=-multiq2[0];
-      multiq2[3]=-multiq2[1];
-    }
+    multiq2[0] = (cb_i*tint_i - cb_q*tint_q) * it->color_control;
+    multiq2[1] = (cb_q*tint_i + cb_i*tint_q) * it->color_control;
+    multiq2[2]=-multiq2[0];
+    multiq2[3]=-multiq2[1];
   }
 
 #if 0
@@ -702,6 +771,29 @@ analogtv_ntsc_to_yiq(analogtv *it, int lineno, double *signal,
   }
 #endif
 
+  return colormode;
+}
+
+#ifndef ANALOGTV_FLOAT_SIGNAL
+
+static void
+analogtv_ntsc_to_yiq(const analogtv *it, int lineno,
+                     const analogtv_sample *signal,
+                     struct analogtv_yiq_s *it_yiq, int start, int end)
+{
+  enum {MAXDELAY=32};
+  int i;
+  const double *sp;
+  int phasecorr=(signal-it->rx_signal)&3;
+  struct analogtv_yiq_s *yiq;
+  int colormode;
+  double agclevel=it->agclevel;
+  double brightadd=it->brightness_control*100.0 - ANALOGTV_BLACK_LEVEL;
+  double delay[MAXDELAY+ANALOGTV_PIC_LEN], *dp;
+  double multiq2[4];
+
+  colormode=analogtv_line_colormode(it, lineno, phasecorr, multiq2);
+
   dp=delay+ANALOGTV_PIC_LEN-MAXDELAY;
   for (i=0; i<5; i++) dp[i]=0.0;
 
@@ -710,7 +802,7 @@ analogtv_ntsc_to_yiq(analogtv *it, int lineno, double *signal,
 
   dp=delay+ANALOGTV_PIC_LEN-MAXDELAY;
   for (i=0; i<24; i++) dp[i]=0.0;
-  for (i=start, yiq=it->yiq+start, sp=signal+start;
+  for (i=start, yiq=it_yiq+start, sp=signal+start;
        i<end;
        i++, dp--, yiq++, sp++) {
 
@@ -744,7 +836,7 @@ analogtv_ntsc_to_yiq(analogtv *it, int lineno, double *signal,
     dp=delay+ANALOGTV_PIC_LEN-MAXDELAY;
     for (i=0; i<27; i++) dp[i]=0.0;
 
-    for (i=start, yiq=it->yiq+start, sp=signal+start;
+    for (i=start, yiq=it_yiq+start, sp=signal+start;
          i<end;
          i++, dp--, yiq++, sp++) {
       double sig=*sp;
@@ -768,12 +860,125 @@ analogtv_ntsc_to_yiq(analogtv *it, int lineno, double *signal,
                        -0.3333333333 * dp[24+2]);
     }
   } else {
-    for (i=start, yiq=it->yiq+start; i<end; i++, yiq++) {
+    for (i=start, yiq=it_yiq+start; i<end; i++, yiq++) {
       yiq->i = yiq->q = 0.0;
     }
   }
 }
 
+#else /* ANALOGTV_FLOAT_SIGNAL */
+
+/* y[k] = sum of taps[j]*x[k-j], for k in [0, n).  x must have ntaps-1
+   samples of history before it. */
+static void
+analogtv_fir(const float *x, float *y, int n, const float *taps, int ntaps)
+{
+  int j,k=0;
+
+#ifdef __SSE2__
+  for (; k+4<=n; k+=4) {
+    __m128 acc=_mm_mul_ps(_mm_set1_ps(taps[0]), _mm_loadu_ps(x+k));
+    for (j=1; j<ntaps; j++)
+      acc=_mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps[j]),
+                                     _mm_loadu_ps(x+k-j)));
+    _mm_storeu_ps(y+k, acc);
+  }
+#endif
+  for (; k<n; k++) {
+    float acc=0.0f;
+    for (j=0; j<ntaps; j++) acc+=taps[j]*x[k-j];
+    y[k]=acc;
+  }
+}
+
+/* The same filters as the double precision version below, but split up
+   into the feed-forward part, which is done 4 samples at a time by
+   analogtv_fir, and the short recursive part, which isn't. */
+static void
+analogtv_ntsc_to_yiq(const analogtv *it, int lineno,
+                     const analogtv_sample *signal,
+                     struct analogtv_yiq_s *it_yiq, int start, int end)
+{
+  enum {MAXDELAY=8, LEN=ANALOGTV_PIC_LEN+10};
+  int i,k,n=end-start;
+  int phasecorr=(signal-it->rx_signal)&3;
+  struct analogtv_yiq_s *yiq=it_yiq+start;
+  const float *sp=signal+start;
+  int colormode;
+  float brightadd=it->brightness_control*100.0 - ANALOGTV_BLACK_LEVEL;
+  float xbuf[MAXDELAY+LEN], fbuf[LEN], qxbuf[MAXDELAY+LEN], qfbuf[LEN];
+  float *x=xbuf+MAXDELAY, *qx=qxbuf+MAXDELAY;
+  float taps[7];
+  double multiq2[4];
+
+  assert(start>=0);
+  assert(end < ANALOGTV_PIC_LEN+10);
+
+  colormode=analogtv_line_colormode(it, lineno, phasecorr, multiq2);
+
+  /* the history before start is zero, as the delay lines are below */
+  memset(xbuf, 0, sizeof(xbuf));
+  memset(qxbuf, 0, sizeof(qxbuf));
+
+  /* Filter Y with a 4-pole low-pass Butterworth filter at 3.5 MHz
+     with an extra zero at 3.5 MHz, from
+     mkfilter -Bu -Lp -o 4 -a 2.1428571429e-01 0 -Z 2.5e-01 -l
+     Delay about 2 */
+  {
+    double g=0.0469904257251935 * it->agclevel;
+    float y1=0.0f, y2=0.0f, y3=0.0f, y4=0.0f;
+
+    taps[0]=taps[6]=1.0*g;
+    taps[1]=taps[5]=4.0*g;
+    taps[2]=taps[4]=7.0*g;
+    taps[3]=8.0*g;
+    for (k=0; k<n; k++) x[k]=sp[k];
+    analogtv_fir(x, fbuf, n, taps, 7);
+
+    for (k=0; k<n; k++) {
+      float y0=fbuf[k] - 0.0176648f*y4 - 0.4860288f*y2;
+      y4=y3; y3=y2; y2=y1; y1=y0;
+      yiq[k].y=y0 + brightadd;
+    }
+  }
+
+  if (colormode) {
+    /* Filter I and Q with a 3-pole low-pass Butterworth filter at
+       1.5 MHz with an extra zero at 3.5 MHz, from
+       mkfilter -Bu -Lp -o 3 -a 1.0714285714e-01 0 -Z 2.5000000000e-01 -l
+       Delay about 3.
+    */
+    float mi[4];
+    float i1=0.0f, i2=0.0f, q1=0.0f, q2=0.0f;
+
+    for (i=0; i<4; i++) mi[i]=multiq2[i];
+    for (k=0, i=start; k<n; k++, i++) {
+      x[k]=sp[k]*mi[i&3];
+      qx[k]=sp[k]*mi[(i+3)&3];
+    }
+    taps[0]=taps[5]=1.0*0.0833333333333;
+    taps[1]=taps[4]=3.0*0.0833333333333;
+    taps[2]=taps[3]=4.0*0.0833333333333;
+    analogtv_fir(x, fbuf, n, taps, 6);
+    analogtv_fir(qx, qfbuf, n, taps, 6);
+
+    for (k=0; k<n; k++) {
+      float i0=fbuf[k] - 0.3333333333f*i2;
+      float q0=qfbuf[k] - 0.3333333333f*q2;
+      i2=i1; i1=i0;
+      q2=q1; q1=q0;
+      yiq[k].i=i0;
+      yiq[k].q=q0;
+    }
+  } else {
+    for (k=0; k<n; k++) {
+      yiq[k].i = yiq[k].q = 0.0;
+    }
+  }
+}
+
+#endif /* ANALOGTV_FLOAT_SIGNAL */
+
 void
 analogtv_setup_teletext(analogtv_input *input)
 {
@@ -798,8 +1003,6 @@ analogtv_setup_frame(analogtv *it)
 {
   int i,x,y;
 
-  it->redraw_all=0;
-
   if (it->flutter_horiz_desync) {
     /* Horizontal sync during vertical sync instability. */
     it->horiz_desync += -0.10*(it->horiz_desync-3.0) +
@@ -903,7 +1106,7 @@ analogtv_sync(analogtv *it)
   int lineno = 0;
   int i,j;
   double osc,filt;
-  double *sp;
+  analogtv_sample *sp;
   double cbfc=1.0/128.0;
 
 /*  sp = it->rx_signal + lineno*ANALOGTV_H + cur_hsync;*/
@@ -983,14 +1186,14 @@ analogtv_sync(analogtv *it)
 }
 
 static double
-analogtv_levelmult(analogtv *it, int level)
+analogtv_levelmult(const analogtv *it, int level)
 {
   static const double levelfac[3]={-7.5, 5.5, 24.5};
   return (40.0 + levelfac[level]*puramp(it, 3.0, 6.0, 1.0))/256.0;
 }
 
 static int
-analogtv_level(analogtv *it, int y, int ytop, int ybot)
+analogtv_level(const analogtv *it, int y, int ytop, int ybot)
 {
   int level;
   if (ybot-ytop>=7) {
@@ -1052,23 +1255,106 @@ analogtv_setup_levels(analogtv *it, double avgheight)
   }
 }
 
+/* Scales the RGB intensities of one scanline by levelmult, and turns them
+   into indexes into red_values[] &c: truncated, and clamped to
+   ANALOGTV_CV_MAX-1.  Red, green and blue are all treated the same, so
+   this just runs down the whole interleaved array.
+ */
 static void
-analogtv_blast_imagerow(analogtv *it,
-                        float *rgbf, float *rgbf_end,
+analogtv_rgb_to_cv(const float *rpf, const float *rgbf_end,
+                   double levelmult, int *cvi)
+{
+#if defined(__AVX__)
+  const __m256d lm=_mm256_set1_pd(levelmult);
+  const __m256d cvmax=_mm256_set1_pd(ANALOGTV_CV_MAX-1);
+  for (; rgbf_end-rpf >= 4; rpf+=4, cvi+=4) {
+    __m256d v=_mm256_cvtps_pd(_mm_loadu_ps(rpf));
+    v=_mm256_min_pd(_mm256_mul_pd(v, lm), cvmax);
+    _mm_storeu_si128((__m128i *)cvi, _mm256_cvttpd_epi32(v));
+  }
+#elif defined(__SSE2__)
+  const __m128d lm=_mm_set1_pd(levelmult);
+  const __m128d cvmax=_mm_set1_pd(ANALOGTV_CV_MAX-1);
+  for (; rgbf_end-rpf >= 4; rpf+=4, cvi+=4) {
+    __m128 f=_mm_loadu_ps(rpf);
+    __m128d lo=_mm_cvtps_pd(f);
+    __m128d hi=_mm_cvtps_pd(_mm_movehl_ps(f, f));
+    lo=_mm_min_pd(_mm_mul_pd(lo, lm), cvmax);
+    hi=_mm_min_pd(_mm_mul_pd(hi, lm), cvmax);
+    _mm_storeu_si128((__m128i *)cvi,
+                     _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo),
+                                        _mm_cvttpd_epi32(hi)));
+  }
+#endif
+  for (; rpf!=rgbf_end; rpf++, cvi++) {
+    int cv=*rpf*levelmult;
+    if (cv>=ANALOGTV_CV_MAX) cv=ANALOGTV_CV_MAX-1;
+    *cvi=cv;
+  }
+}
+
+/* The same, but rounding instead of truncating, and wrapping instead of
+   clamping, by way of the float_low8_ofs trick.  This is what 16 bit
+   visuals have always used when float_extraction_works. */
+static void
+analogtv_rgb_to_cv_fe(const float *rpf, const float *rgbf_end,
+                      double levelmult, int *cvi)
+{
+#if defined(__AVX__)
+  const __m256d lm=_mm256_set1_pd(levelmult);
+  const __m256d ofs=_mm256_set1_pd(float_low8_ofs);
+  const __m128i mask=_mm_set1_epi32(0x3ff);
+  for (; rgbf_end-rpf >= 4; rpf+=4, cvi+=4) {
+    __m256d v=_mm256_cvtps_pd(_mm_loadu_ps(rpf));
+    __m128 f=_mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(v, lm), ofs));
+    _mm_storeu_si128((__m128i *)cvi, _mm_and_si128(_mm_castps_si128(f), mask));
+  }
+#elif defined(__SSE2__)
+  const __m128d lm=_mm_set1_pd(levelmult);
+  const __m128d ofs=_mm_set1_pd(float_low8_ofs);
+  const __m128i mask=_mm_set1_epi32(0x3ff);
+  for (; rgbf_end-rpf >= 4; rpf+=4, cvi+=4) {
+    __m128 f=_mm_loadu_ps(rpf);
+    __m128d lo=_mm_cvtps_pd(f);
+    __m128d hi=_mm_cvtps_pd(_mm_movehl_ps(f, f));
+    lo=_mm_add_pd(_mm_mul_pd(lo, lm), ofs);
+    hi=_mm_add_pd(_mm_mul_pd(hi, lm), ofs);
+    f=_mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+    _mm_storeu_si128((__m128i *)cvi, _mm_and_si128(_mm_castps_si128(f), mask));
+  }
+#endif
+  for (; rpf!=rgbf_end; rpf++, cvi++) {
+    float_extract_t fe;
+    fe.f=*rpf*levelmult+float_low8_ofs;
+    *cvi=fe.i & 0x3ff;
+  }
+}
+
+/* cvi is scratch space, the same size as rgbf. */
+static void
+analogtv_blast_imagerow(const analogtv *it,
+                        float *rgbf, float *rgbf_end, int *cvi,
                         int ytop, int ybot)
 {
-  int i,j,x,y;
-  float *rpf;
+  int j,x,y;
   char *level_copyfrom[3];
   int xrepl=it->xrepl;
-  for (i=0; i<3; i++) level_copyfrom[i]=NULL;
+  int npix=(rgbf_end-rgbf)/3;
+  const int *cvp, *cvp_end=cvi+npix*3;
+  const XImage *image=it->image;
+  int use_fe=(image->format==ZPixmap &&
+              image->bits_per_pixel==16 &&
+              sizeof(unsigned short)==2 &&
+              float_extraction_works &&
+              image->byte_order==localbyteorder);
+  for (j=0; j<3; j++) level_copyfrom[j]=NULL;
 
   for (y=ytop; y<ybot; y++) {
     int level=it->leveltable[ybot-ytop][y-ytop].index;
     double levelmult=it->leveltable[ybot-ytop][y-ytop].value;
     char *rowdata;
 
-    rowdata=it->image->data + y*it->image->bytes_per_line;
+    rowdata=image->data + y*image->bytes_per_line;
 
     /* Fast special cases to avoid the slow XPutPixel. Ugh. It goes to show
        why standard graphics sw has to be fast, or else people will have to
@@ -1076,128 +1362,533 @@ analogtv_blast_imagerow(analogtv *it,
        understood this. The other answer would be for X11 to have fewer
        formats for bitm.. oh, never mind. If neither of these cases work
        (they probably cover 99% of setups) it falls back on the Xlib
-       routines. */
+       routines.
+
+       The intensities are first turned into table indexes for the whole
+       row at once (which vectorizes nicely), and then looked up and
+       packed straight into the image data. */
 
     if (level_copyfrom[level]) {
-      memcpy(rowdata, level_copyfrom[level], it->image->bytes_per_line);
+      memcpy(rowdata, level_copyfrom[level], image->bytes_per_line);
+      continue;
     }
-    else {
-      level_copyfrom[level] = rowdata;
-
-      if (0) {
-      }
-      else if (it->image->format==ZPixmap &&
-               it->image->bits_per_pixel==32 &&
-               sizeof(unsigned int)==4 &&
-               it->image->byte_order==localbyteorder) {
-        /* int is more likely to be 32 bits than long */
-        unsigned int *pixelptr=(unsigned int *)rowdata;
-        unsigned int pix;
-
-        for (rpf=rgbf; rpf!=rgbf_end; rpf+=3) {
-          int ntscri=rpf[0]*levelmult;
-          int ntscgi=rpf[1]*levelmult;
-          int ntscbi=rpf[2]*levelmult;
-          if (ntscri>=ANALOGTV_CV_MAX) ntscri=ANALOGTV_CV_MAX-1;
-          if (ntscgi>=ANALOGTV_CV_MAX) ntscgi=ANALOGTV_CV_MAX-1;
-          if (ntscbi>=ANALOGTV_CV_MAX) ntscbi=ANALOGTV_CV_MAX-1;
-          pix = (it->red_values[ntscri] |
-                 it->green_values[ntscgi] |
-                 it->blue_values[ntscbi]);
-          pixelptr[0] = pix;
-          if (xrepl>=2) {
-            pixelptr[1] = pix;
-            if (xrepl>=3) pixelptr[2] = pix;
-          }
-          pixelptr+=xrepl;
+    level_copyfrom[level] = rowdata;
+
+    if (use_fe)
+      analogtv_rgb_to_cv_fe(rgbf, rgbf_end, levelmult, cvi);
+    else
+      analogtv_rgb_to_cv(rgbf, rgbf_end, levelmult, cvi);
+
+    if (image->format==ZPixmap &&
+        image->bits_per_pixel==32 &&
+        sizeof(unsigned int)==4 &&
+        image->byte_order==localbyteorder) {
+      /* int is more likely to be 32 bits than long */
+      unsigned int *pixelptr=(unsigned int *)rowdata;
+      unsigned int pix;
+
+      for (cvp=cvi; cvp!=cvp_end; cvp+=3) {
+        pix = (it->red_values[cvp[0]] |
+               it->green_values[cvp[1]] |
+               it->blue_values[cvp[2]]);
+        pixelptr[0] = pix;
+        if (xrepl>=2) {
+          pixelptr[1] = pix;
+          if (xrepl>=3) pixelptr[2] = pix;
         }
+        pixelptr+=xrepl;
       }
-      else if (it->image->format==ZPixmap &&
-               it->image->bits_per_pixel==16 &&
-               sizeof(unsigned short)==2 &&
-               float_extraction_works &&
-               it->image->byte_order==localbyteorder) {
-        unsigned short *pixelptr=(unsigned short *)rowdata;
-        double r2,g2,b2;
-        float_extract_t r1,g1,b1;
-        unsigned short pix;
-
-        for (rpf=rgbf; rpf!=rgbf_end; rpf+=3) {
-          r2=rpf[0]; g2=rpf[1]; b2=rpf[2];
-          r1.f=r2 * levelmult+float_low8_ofs;
-          g1.f=g2 * levelmult+float_low8_ofs;
-          b1.f=b2 * levelmult+float_low8_ofs;
-          pix = (it->red_values[r1.i & 0x3ff] |
-                 it->green_values[g1.i & 0x3ff] |
-                 it->blue_values[b1.i & 0x3ff]);
-          pixelptr[0] = pix;
-          if (xrepl>=2) {
-            pixelptr[1] = pix;
-            if (xrepl>=3) pixelptr[2] = pix;
-          }
-          pixelptr+=xrepl;
+    }
+    else if (image->format==ZPixmap &&
+             image->bits_per_pixel==16 &&
+             sizeof(unsigned short)==2 &&
+             image->byte_order==localbyteorder) {
+      unsigned short *pixelptr=(unsigned short *)rowdata;
+      unsigned short pix;
+
+      for (cvp=cvi; cvp!=cvp_end; cvp+=3) {
+        pix = (it->red_values[cvp[0]] |
+               it->green_values[cvp[1]] |
+               it->blue_values[cvp[2]]);
+        pixelptr[0] = pix;
+        if (xrepl>=2) {
+          pixelptr[1] = pix;
+          if (xrepl>=3) pixelptr[2] = pix;
         }
+        pixelptr+=xrepl;
       }
-      else if (it->image->format==ZPixmap &&
-               it->image->bits_per_pixel==16 &&
-               sizeof(unsigned short)==2 &&
-               it->image->byte_order==localbyteorder) {
-        unsigned short *pixelptr=(unsigned short *)rowdata;
-        unsigned short pix;
-
-        for (rpf=rgbf; rpf!=rgbf_end; rpf+=3) {
-          int r1=rpf[0] * levelmult;
-          int g1=rpf[1] * levelmult;
-          int b1=rpf[2] * levelmult;
-          if (r1>=ANALOGTV_CV_MAX) r1=ANALOGTV_CV_MAX-1;
-          if (g1>=ANALOGTV_CV_MAX) g1=ANALOGTV_CV_MAX-1;
-          if (b1>=ANALOGTV_CV_MAX) b1=ANALOGTV_CV_MAX-1;
-          pix = it->red_values[r1] | it->green_values[g1] | it->blue_values[b1];
-          pixelptr[0] = pix;
-          if (xrepl>=2) {
-            pixelptr[1] = pix;
-            if (xrepl>=3) pixelptr[2] = pix;
-          }
-          pixelptr+=xrepl;
+    }
+    else if (image->format==ZPixmap &&
+             (image->bits_per_pixel==16 ||
+              image->bits_per_pixel==24 ||
+              image->bits_per_pixel==32)) {
+      /* Packed 24 bit, or the other byte order: store it a byte at a
+         time, which is still a lot faster than XPutPixel. */
+      int bytes=image->bits_per_pixel/8;
+      int msb=(image->byte_order==MSBFirst);
+      unsigned char *p=(unsigned char *)rowdata;
+
+      for (cvp=cvi; cvp!=cvp_end; cvp+=3) {
+        unsigned long pix = (it->red_values[cvp[0]] |
+                             it->green_values[cvp[1]] |
+                             it->blue_values[cvp[2]]);
+        for (j=0; j<xrepl; j++) {
+          int b;
+          for (b=0; b<bytes; b++)
+            *p++ = (pix >> (8 * (msb ? bytes-1-b : b))) & 0xff;
         }
       }
-      else {
-        for (x=0, rpf=rgbf; rpf!=rgbf_end ; x++, rpf+=3) {
-          int ntscri=rpf[0]*levelmult;
-          int ntscgi=rpf[1]*levelmult;
-          int ntscbi=rpf[2]*levelmult;
-          if (ntscri>=ANALOGTV_CV_MAX) ntscri=ANALOGTV_CV_MAX-1;
-          if (ntscgi>=ANALOGTV_CV_MAX) ntscgi=ANALOGTV_CV_MAX-1;
-          if (ntscbi>=ANALOGTV_CV_MAX) ntscbi=ANALOGTV_CV_MAX-1;
-          for (j=0; j<xrepl; j++) {
-            XPutPixel(it->image, x*xrepl + j, y,
-                      it->red_values[ntscri] | it->green_values[ntscgi] |
-                      it->blue_values[ntscbi]);
-          }
+    }
+    else {
+      for (x=0, cvp=cvi; cvp!=cvp_end; x++, cvp+=3) {
+        for (j=0; j<xrepl; j++) {
+          XPutPixel(it->image, x*xrepl + j, y,
+                    it->red_values[cvp[0]] | it->green_values[cvp[1]] |
+                    it->blue_values[cvp[2]]);
         }
       }
     }
   }
 }
 
-void
-analogtv_draw(analogtv *it)
+/* Figures out which screen rows [ytop, ybot) the given scanline lands on,
+   and where its signal starts.  Returns 0 if it's not visible at all.
+ */
+static int
+analogtv_get_line(const analogtv *it, int lineno, int *slineno,
+                  int *ytop, int *ybot, const analogtv_sample **signal)
+{
+  *slineno=lineno-ANALOGTV_TOP;
+  *ytop=(int)((*slineno*it->useheight/ANALOGTV_VISLINES -
+               it->useheight/2)*it->puheight) + it->useheight/2;
+  *ybot=(int)(((*slineno+1)*it->useheight/ANALOGTV_VISLINES -
+               it->useheight/2)*it->puheight) + it->useheight/2;
+  *signal=(it->rx_signal + ((lineno + it->cur_vsync +
+                             ANALOGTV_V)%ANALOGTV_V) * ANALOGTV_H +
+           it->line_hsync[lineno]);
+
+  if (*ytop==*ybot) return 0;
+  if (*ybot<0 || *ytop>it->useheight) return 0;
+  if (*ytop<0) *ytop=0;
+  if (*ybot>it->useheight) *ybot=it->useheight;
+
+  if (*ybot > *ytop+ANALOGTV_MAX_LINEHEIGHT) *ybot=*ytop+ANALOGTV_MAX_LINEHEIGHT;
+  return 1;
+}
+
+/* Interpolates the YIQ signal at dot clock position i (16.16 fixed point)
+   and converts it to linear RGB.
+ */
+static void
+analogtv_yiq_to_rgb(const struct analogtv_yiq_s *yiq, int i,
+                    double pixbright, float *rrp)
+{
+  double pixfrac=(i&0xffff)/65536.0;
+  double invpixfrac=1.0-pixfrac;
+  int pati=i>>16;
+  double r,g,b;
+
+  double interpy=(yiq[pati].y*invpixfrac + yiq[pati+1].y*pixfrac);
+  double interpi=(yiq[pati].i*invpixfrac + yiq[pati+1].i*pixfrac);
+  double interpq=(yiq[pati].q*invpixfrac + yiq[pati+1].q*pixfrac);
+
+  /*
+    According to the NTSC spec, Y,I,Q are generated as:
+
+    y=0.30 r + 0.59 g + 0.11 b
+    i=0.60 r - 0.28 g - 0.32 b
+    q=0.21 r - 0.52 g + 0.31 b
+
+    So if you invert the implied 3x3 matrix you get what standard
+    televisions implement with a bunch of resistors (or directly in the
+    CRT -- don't ask):
+
+    r = y + 0.948 i + 0.624 q
+    g = y - 0.276 i - 0.639 q
+    b = y - 1.105 i + 1.729 q
+  */
+
+  r=(interpy + 0.948*interpi + 0.624*interpq) * pixbright;
+  g=(interpy - 0.276*interpi - 0.639*interpq) * pixbright;
+  b=(interpy - 1.105*interpi + 1.729*interpq) * pixbright;
+  if (r<0.0) r=0.0;
+  if (g<0.0) g=0.0;
+  if (b<0.0) b=0.0;
+  rrp[0]=r;
+  rrp[1]=g;
+  rrp[2]=b;
+}
+
+#ifdef __SSE2__
+/* The same as analogtv_yiq_to_rgb, for two pixels at once, one in each
+   half of the SSE2 registers.  It does exactly the same double precision
+   arithmetic in the same order, so the results are identical. */
+static void
+analogtv_yiq_to_rgb2(const struct analogtv_yiq_s *yiq, int ia, int ib,
+                     double brighta, double brightb, float *rrp)
 {
-  int i,j,x,y,lineno;
+  const struct analogtv_yiq_s *pa=&yiq[ia>>16], *pb=&yiq[ib>>16];
+  const __m128d zero=_mm_setzero_pd();
+  __m128d frac=_mm_set_pd((ib&0xffff)/65536.0, (ia&0xffff)/65536.0);
+  __m128d inv=_mm_sub_pd(_mm_set1_pd(1.0), frac);
+  __m128d bright=_mm_set_pd(brightb, brighta);
+  __m128d y,i,q,r,g,b;
+  __m128 rg,bx;
+
+  y=_mm_add_pd(_mm_mul_pd(_mm_set_pd(pb[0].y, pa[0].y), inv),
+               _mm_mul_pd(_mm_set_pd(pb[1].y, pa[1].y), frac));
+  i=_mm_add_pd(_mm_mul_pd(_mm_set_pd(pb[0].i, pa[0].i), inv),
+               _mm_mul_pd(_mm_set_pd(pb[1].i, pa[1].i), frac));
+  q=_mm_add_pd(_mm_mul_pd(_mm_set_pd(pb[0].q, pa[0].q), inv),
+               _mm_mul_pd(_mm_set_pd(pb[1].q, pa[1].q), frac));
+
+  r=_mm_add_pd(_mm_add_pd(y, _mm_mul_pd(_mm_set1_pd(0.948), i)),
+               _mm_mul_pd(_mm_set1_pd(0.624), q));
+  g=_mm_sub_pd(_mm_sub_pd(y, _mm_mul_pd(_mm_set1_pd(0.276), i)),
+               _mm_mul_pd(_mm_set1_pd(0.639), q));
+  b=_mm_add_pd(_mm_sub_pd(y, _mm_mul_pd(_mm_set1_pd(1.105), i)),
+               _mm_mul_pd(_mm_set1_pd(1.729), q));
+
+  /* Zero first, so that -0.0 and NaN pass through as they do above */
+  r=_mm_max_pd(zero, _mm_mul_pd(r, bright));
+  g=_mm_max_pd(zero, _mm_mul_pd(g, bright));
+  b=_mm_max_pd(zero, _mm_mul_pd(b, bright));
+
+  /* rg = ra ga rb gb, bx = ba bb */
+  rg=_mm_movelh_ps(_mm_cvtpd_ps(_mm_unpacklo_pd(r, g)),
+                   _mm_cvtpd_ps(_mm_unpackhi_pd(r, g)));
+  bx=_mm_cvtpd_ps(b);
+  _mm_storel_pi((__m64 *)&rrp[0], rg);
+  _mm_store_ss(&rrp[2], bx);
+  _mm_storeh_pi((__m64 *)&rrp[3], rg);
+  _mm_store_ss(&rrp[5], _mm_shuffle_ps(bx, bx, 1));
+}
+#endif /* __SSE2__ */
+
+/* Demodulates one scanline and draws it into rows [ytop, ybot) of the
+   image.  This only reads the shared state, and only writes its own rows,
+   so any number of these can run at once.  raw_rgb_start is scratch space
+   of 3*subwidth floats, zeroed by the caller, and cvi is 3*subwidth ints. */
+static void
+analogtv_draw_line(const analogtv *it, int lineno, int slineno,
+                   int ytop, int ybot, const analogtv_sample *signal,
+                   float *raw_rgb_start, float *raw_rgb_end, int *cvi)
+{
+  int i,j,x,y;
   int scanstart_i,scanend_i,squishright_i,squishdiv,pixrate;
   float *rgb_start, *rgb_end;
   double pixbright;
   int pixmultinc;
-  int /*bigloadchange,*/drawcount;
-  double baseload;
-  double puheight;
-  int overall_top, overall_bot;
+  float *rrp;
+  struct analogtv_yiq_s yiq[ANALOGTV_PIC_LEN+10];
+
+  /*
+    Interpolate the 600-dotclock line into however many horizontal
+    screen pixels we're using, and convert to RGB.
+
+    We add some 'bloom', variations in the horizontal scan width with
+    the amount of brightness, extremely common on period TV sets. They
+    had a single oscillator which generated both the horizontal scan and
+    (during the horizontal retrace interval) the high voltage for the
+    electron beam. More brightness meant more load on the oscillator,
+    which caused an decrease in horizontal deflection. Look for
+    (bloomthisrow).
+
+    Also, the A2 did a bad job of generating horizontal sync pulses
+    during the vertical blanking interval. This, and the fact that the
+    horizontal frequency was a bit off meant that TVs usually went a bit
+    out of sync during the vertical retrace, and the top of the screen
+    would be bent a bit to the left or right. Look for (shiftthisrow).
+
+    We also add a teeny bit of left overscan, just enough to be
+    annoying, but you can still read the left column of text.
+
+    We also simulate compression & brightening on the right side of the
+    screen. Most TVs do this, but you don't notice because they overscan
+    so it's off the right edge of the CRT. But the A2 video system used
+    so much of the horizontal scan line that you had to crank the
+    horizontal width down in order to not lose the right few characters,
+    and you'd see the compression on the right edge. Associated with
+    compression is brightening; since the electron beam was scanning
+    slower, the same drive signal hit the phosphor harder. Look for
+    (squishright_i) and (squishdiv).
+  */
+
+  {
+    double bloomthisrow,shiftthisrow;
+    double viswidth,middle;
+    double scanwidth;
+    int scw,scl,scr;
+
+    bloomthisrow = -10.0 * it->crtload[lineno];
+    if (bloomthisrow<-10.0) bloomthisrow=-10.0;
+    if (bloomthisrow>2.0) bloomthisrow=2.0;
+    if (slineno<16) {
+      shiftthisrow=it->horiz_desync * (exp(-0.17*slineno) *
+                                       (0.7+cos(slineno*0.6)));
+    } else {
+      shiftthisrow=0.0;
+    }
+
+    viswidth=ANALOGTV_PIC_LEN * 0.79 - 5.0*bloomthisrow;
+    middle=ANALOGTV_PIC_LEN/2 - shiftthisrow;
+
+    scanwidth=it->width_control * puramp(it, 0.5, 0.3, 1.0);
+
+    scw=it->subwidth*scanwidth;
+    if (scw>it->subwidth) scw=it->usewidth;
+    scl=it->subwidth/2 - scw/2;
+    scr=it->subwidth/2 + scw/2;
+
+    pixrate=(int)((viswidth*65536.0*1.0)/it->subwidth)/scanwidth;
+    scanstart_i=(int)((middle-viswidth*0.5)*65536.0);
+    scanend_i=(ANALOGTV_PIC_LEN-1)*65536;
+    squishright_i=(int)((middle+viswidth*(0.25 + 0.25*puramp(it, 2.0, 0.0, 1.1)
+                                          - it->squish_control)) *65536.0);
+    squishdiv=it->subwidth/15;
+
+    rgb_start=raw_rgb_start+scl*3;
+    rgb_end=raw_rgb_start+scr*3;
+
+    assert(scanstart_i>=0);
+
+#ifdef DEBUG
+    if (0) printf("scan %d: %0.3f %0.3f %0.3f scl=%d scr=%d scw=%d\n",
+                  lineno,
+                  scanstart_i/65536.0,
+                  squishright_i/65536.0,
+                  scanend_i/65536.0,
+                  scl,scr,scw);
+#endif
+  }
+
+  analogtv_ntsc_to_yiq(it, lineno, signal, yiq,
+                       (scanstart_i>>16)-10, (scanend_i>>16)+10);
+
+  if (it->use_cmap) {
+    for (y=ytop; y<ybot; y++) {
+      int level=analogtv_level(it, y, ytop, ybot);
+      double levelmult=analogtv_levelmult(it, level);
+      double levelmult_y = levelmult * it->contrast_control
+        * puramp(it, 1.0, 0.0, 1.0) / (0.5+0.5*it->puheight) * 0.070;
+      double levelmult_iq = levelmult * 0.090;
+
+      pixmultinc=pixrate;
+
+      x=0;
+      i=scanstart_i;
+      while (i<0 && x<it->usewidth) {
+        XPutPixel(it->image, x, y, it->colors[0]);
+        i+=pixmultinc;
+        x++;
+      }
+
+      while (i<scanend_i && x<it->usewidth) {
+        double pixfrac=(i&0xffff)/65536.0;
+        double invpixfrac=(1.0-pixfrac);
+        int pati=i>>16;
+        int yli,ili,qli,cmi;
+
+        double interpy=(yiq[pati].y*invpixfrac
+                        + yiq[pati+1].y*pixfrac) * levelmult_y;
+        double interpi=(yiq[pati].i*invpixfrac
+                        + yiq[pati+1].i*pixfrac) * levelmult_iq;
+        double interpq=(yiq[pati].q*invpixfrac
+                        + yiq[pati+1].q*pixfrac) * levelmult_iq;
+
+        yli = (int)(interpy * it->cmap_y_levels);
+        ili = (int)((interpi+0.5) * it->cmap_i_levels);
+        qli = (int)((interpq+0.5) * it->cmap_q_levels);
+        if (yli<0) yli=0;
+        if (yli>=it->cmap_y_levels) yli=it->cmap_y_levels-1;
+        if (ili<0) ili=0;
+        if (ili>=it->cmap_i_levels) ili=it->cmap_i_levels-1;
+        if (qli<0) qli=0;
+        if (qli>=it->cmap_q_levels) qli=it->cmap_q_levels-1;
+
+        cmi=qli + it->cmap_i_levels*(ili + it->cmap_q_levels*yli);
+
+#ifdef DEBUG
+        if ((random()%65536)==0) {
+          printf("%0.3f %0.3f %0.3f => %d %d %d => %d\n",
+                 interpy, interpi, interpq,
+                 yli, ili, qli,
+                 cmi);
+        }
+#endif
+
+        for (j=0; j<it->xrepl; j++) {
+          XPutPixel(it->image, x, y,
+                    it->colors[cmi]);
+          x++;
+        }
+        if (i >= squishright_i) {
+          pixmultinc += pixmultinc/squishdiv;
+        }
+        i+=pixmultinc;
+      }
+      while (x<it->usewidth) {
+        XPutPixel(it->image, x, y, it->colors[0]);
+        x++;
+      }
+    }
+  }
+  else {
+    pixbright=it->contrast_control * puramp(it, 1.0, 0.0, 1.0)
+      / (0.5+0.5*it->puheight) * 1024.0/100.0;
+    pixmultinc=pixrate;
+    i=scanstart_i; rrp=rgb_start;
+    while (i<0 && rrp!=rgb_end) {
+      rrp[0]=rrp[1]=rrp[2]=0;
+      i+=pixmultinc;
+      rrp+=3;
+    }
+    while (i<scanend_i && rrp!=rgb_end) {
+#ifdef __SSE2__
+      /* Two pixels at a time, if there's room for the second one. */
+      int ia=i;
+      double brighta=pixbright;
+      if (i>=squishright_i) {
+        pixmultinc += pixmultinc/squishdiv;
+        pixbright += pixbright/squishdiv/2;
+      }
+      i+=pixmultinc;
+      if (i<scanend_i && rrp+3!=rgb_end) {
+        analogtv_yiq_to_rgb2(yiq, ia, i, brighta, pixbright, rrp);
+        rrp+=3;
+        if (i>=squishright_i) {
+          pixmultinc += pixmultinc/squishdiv;
+          pixbright += pixbright/squishdiv/2;
+        }
+        i+=pixmultinc;
+      } else {
+        analogtv_yiq_to_rgb(yiq, ia, brighta, rrp);
+      }
+      rrp+=3;
+#else /* !__SSE2__ */
+      analogtv_yiq_to_rgb(yiq, i, pixbright, rrp);
+      if (i>=squishright_i) {
+        pixmultinc += pixmultinc/squishdiv;
+        pixbright += pixbright/squishdiv/2;
+      }
+      i+=pixmultinc;
+      rrp+=3;
+#endif /* !__SSE2__ */
+    }
+    while (rrp != rgb_end) {
+      rrp[0]=rrp[1]=rrp[2]=0.0;
+      rrp+=3;
+    }
+
+    analogtv_blast_imagerow(it, raw_rgb_start, raw_rgb_end, cvi,
+                            ytop,ybot);
+  }
+}
 
+/* One band of scanlines, for threadpool_run(). */
+static void
+analogtv_thread_draw_lines(void *closure, unsigned index, unsigned count)
+{
+  const analogtv *it=(const analogtv *)closure;
+  int lineno;
+  int top=ANALOGTV_TOP + ANALOGTV_VISLINES*index/count;
+  int bot=ANALOGTV_TOP + ANALOGTV_VISLINES*(index+1)/count;
   float *raw_rgb_start=(float *)calloc(it->subwidth*3, sizeof(float));
   float *raw_rgb_end=raw_rgb_start+3*it->subwidth;
-  float *rrp;
+  int *cvi=(int *)malloc(it->subwidth*3*sizeof(int));
+
+  if (! raw_rgb_start || ! cvi) {
+    free(raw_rgb_start);
+    free(cvi);
+    return;
+  }
+
+  for (lineno=top; lineno<bot; lineno++) {
+    int slineno,ytop,ybot;
+    const analogtv_sample *signal;
+    if (it->line_dirty[lineno] &&
+        analogtv_get_line(it, lineno, &slineno, &ytop, &ybot, &signal))
+      analogtv_draw_line(it, lineno, slineno, ytop, ybot, signal,
+                         raw_rgb_start, raw_rgb_end, cvi);
+  }
+
+  free(raw_rgb_start);
+  free(cvi);
+}
+
+/* The signature of everything that's the same for all lines of the frame */
+static unsigned int
+analogtv_frame_signature(const analogtv *it)
+{
+  unsigned int hash=0x811c9dc5u;
+  hash=analogtv_sig_double(hash, it->puheight);
+  hash=analogtv_sig_double(hash, puramp(it, 0.5, 0.3, 1.0));
+  hash=analogtv_sig_double(hash, puramp(it, 2.0, 0.0, 1.1));
+  hash=analogtv_sig_double(hash, puramp(it, 1.0, 0.0, 1.0));
+  hash=analogtv_sig_double(hash, it->agclevel);
+  hash=analogtv_sig_double(hash, it->tint_control);
+  hash=analogtv_sig_double(hash, it->color_control);
+  hash=analogtv_sig_double(hash, it->brightness_control);
+  hash=analogtv_sig_double(hash, it->contrast_control);
+  hash=analogtv_sig_double(hash, it->width_control);
+  hash=analogtv_sig_double(hash, it->squish_control);
+  hash=SIG_MIX(hash, it->usewidth);
+  hash=SIG_MIX(hash, it->useheight);
+  hash=SIG_MIX(hash, it->use_cmap);
+  return hash;
+}
+
+/* The signature of one displayed line, as it would be drawn now.  The
+   colorburst phase and CRT load are rounded off, since the noise keeps
+   them wandering slightly. */
+static unsigned int
+analogtv_draw_signature(const analogtv *it, int lineno, int slineno,
+                        int ytop, int ybot)
+{
+  int rxline=(lineno + it->cur_vsync + ANALOGTV_V)%ANALOGTV_V;
+  unsigned int hash=it->frame_signature;
+  int i;
+
+  hash=SIG_MIX(hash, it->rx_signature[rxline]);
+  hash=SIG_MIX(hash, it->rx_signature[(rxline+1)%ANALOGTV_V]);
+  hash=SIG_MIX(hash, it->line_hsync[lineno]);
+  hash=SIG_MIX(hash, ytop);
+  hash=SIG_MIX(hash, ybot);
+  for (i=0; i<4; i++)
+    hash=SIG_MIX(hash, (int)it->line_cb_phase[lineno][i]);
+  hash=SIG_MIX(hash, (int)(it->crtload[lineno]*1024.0));
+  if (slineno<16)
+    hash=analogtv_sig_double(hash, it->horiz_desync);
+  return hash;
+}
+
+static void
+analogtv_put_rows(analogtv *it, int top, int bot)
+{
+  if (it->use_shm) {
+#ifdef HAVE_XSHM_EXTENSION
+    XShmPutImage(it->dpy, it->window, it->gc, it->image,
+                 0, top,
+                 it->screen_xo, it->screen_yo+top,
+                 it->usewidth, bot - top,
+                 False);
+#endif
+  } else {
+    XPutImage(it->dpy, it->window, it->gc, it->image,
+              0, top,
+              it->screen_xo, it->screen_yo+top,
+              it->usewidth, bot - top);
+  }
+}
+
+void
+analogtv_draw(analogtv *it)
+{
+  int i,lineno;
+  double baseload;
+  int overall_top, overall_bot;
+  int full=1;
 
-  if (! raw_rgb_start) return;
   analogtv_setup_frame(it);
   analogtv_set_demod(it);
 
@@ -1214,36 +1905,32 @@ analogtv_draw(analogtv *it)
   /* if (it->hashnoise_on) baseload=0.5; */
 
   /*bigloadchange=1;*/
-  drawcount=0;
   it->crtload[ANALOGTV_TOP-1]=baseload;
-  puheight = puramp(it, 2.0, 1.0, 1.3) * it->height_control *
+  it->puheight = puramp(it, 2.0, 1.0, 1.3) * it->height_control *
     (1.125 - 0.125*puramp(it, 2.0, 2.0, 1.1));
 
-  analogtv_setup_levels(it, puheight * (double)it->useheight/(double)ANALOGTV_VISLINES);
+  analogtv_setup_levels(it, it->puheight * (double)it->useheight/(double)ANALOGTV_VISLINES);
+
+  if (it->incremental) {
+    unsigned int fsig=analogtv_frame_signature(it);
+    full=(it->redraw_all || it->need_clear || fsig != it->frame_signature);
+    it->frame_signature=fsig;
+  }
 
   overall_top=it->useheight;
   overall_bot=0;
 
-  for (lineno=ANALOGTV_TOP; lineno<ANALOGTV_BOT; lineno++) {
-    int slineno=lineno-ANALOGTV_TOP;
-    int ytop=(int)((slineno*it->useheight/ANALOGTV_VISLINES -
-                    it->useheight/2)*puheight) + it->useheight/2;
-    int ybot=(int)(((slineno+1)*it->useheight/ANALOGTV_VISLINES -
-                    it->useheight/2)*puheight) + it->useheight/2;
-#if 0
-    int linesig=analogtv_line_signature(input,lineno)
-      + it->hashnoise_times[lineno];
-#endif
-    double *signal=(it->rx_signal + ((lineno + it->cur_vsync +
-                                      ANALOGTV_V)%ANALOGTV_V) * ANALOGTV_H +
-                    it->line_hsync[lineno]);
+  /* The load on the flyback transformer carries over from each line to
+     the next, so that has to be worked out in order before the lines
+     themselves can be drawn in parallel.  It's cheap. */
 
-    if (ytop==ybot) continue;
-    if (ybot<0 || ytop>it->useheight) continue;
-    if (ytop<0) ytop=0;
-    if (ybot>it->useheight) ybot=it->useheight;
+  for (lineno=ANALOGTV_TOP; lineno<ANALOGTV_BOT; lineno++) {
+    int slineno,ytop,ybot;
+    const analogtv_sample *signal;
 
-    if (ybot > ytop+ANALOGTV_MAX_LINEHEIGHT) ybot=ytop+ANALOGTV_MAX_LINEHEIGHT;
+    it->line_dirty[lineno]=0;
+    if (! analogtv_get_line(it, lineno, &slineno, &ytop, &ybot, &signal))
+      continue;
 
     if (ytop < overall_top) overall_top=ytop;
     if (ybot > overall_bot) overall_bot=ybot;
@@ -1254,52 +1941,6 @@ analogtv_draw(analogtv *it)
       it->shrinkpulse=-1;
     }
 
-#if 0
-    if (it->hashnoise_rpm>0.0 &&
-        !(bigloadchange ||
-          it->redraw_all ||
-          (slineno<20 && it->flutter_horiz_desync) ||
-          it->gaussiannoise_level>30 ||
-          ((it->gaussiannoise_level>2.0 ||
-            it->multipath) && random()%4) ||
-          linesig != it->onscreen_signature[lineno])) {
-      continue;
-    }
-    it->onscreen_signature[lineno] = linesig;
-#endif
-    drawcount++;
-
-    /*
-      Interpolate the 600-dotclock line into however many horizontal
-      screen pixels we're using, and convert to RGB.
-
-      We add some 'bloom', variations in the horizontal scan width with
-      the amount of brightness, extremely common on period TV sets. They
-      had a single oscillator which generated both the horizontal scan and
-      (during the horizontal retrace interval) the high voltage for the
-      electron beam. More brightness meant more load on the oscillator,
-      which caused an decrease in horizontal deflection. Look for
-      (bloomthisrow).
-
-      Also, the A2 did a bad job of generating horizontal sync pulses
-      during the vertical blanking interval. This, and the fact that the
-      horizontal frequency was a bit off meant that TVs usually went a bit
-      out of sync during the vertical retrace, and the top of the screen
-      would be bent a bit to the left or right. Look for (shiftthisrow).
-
-      We also add a teeny bit of left overscan, just enough to be
-      annoying, but you can still read the left column of text.
-
-      We also simulate compression & brightening on the right side of the
-      screen. Most TVs do this, but you don't notice because they overscan
-      so it's off the right edge of the CRT. But the A2 video system used
-      so much of the horizontal scan line that you had to crank the
-      horizontal width down in order to not lose the right few characters,
-      and you'd see the compression on the right edge. Associated with
-      compression is brightening; since the electron beam was scanning
-      slower, the same drive signal hit the phosphor harder. Look for
-      (squishright_i) and (squishdiv).
-    */
 
     {
       int totsignal=0;
@@ -1319,192 +1960,17 @@ analogtv_draw(analogtv *it)
       it->crtload[lineno]=ncl;
     }
 
-    {
-      double bloomthisrow,shiftthisrow;
-      double viswidth,middle;
-      double scanwidth;
-      int scw,scl,scr;
-
-      bloomthisrow = -10.0 * it->crtload[lineno];
-      if (bloomthisrow<-10.0) bloomthisrow=-10.0;
-      if (bloomthisrow>2.0) bloomthisrow=2.0;
-      if (slineno<16) {
-        shiftthisrow=it->horiz_desync * (exp(-0.17*slineno) *
-                                         (0.7+cos(slineno*0.6)));
-      } else {
-        shiftthisrow=0.0;
-      }
-
-      viswidth=ANALOGTV_PIC_LEN * 0.79 - 5.0*bloomthisrow;
-      middle=ANALOGTV_PIC_LEN/2 - shiftthisrow;
-
-      scanwidth=it->width_control * puramp(it, 0.5, 0.3, 1.0);
-
-      scw=it->subwidth*scanwidth;
-      if (scw>it->subwidth) scw=it->usewidth;
-      scl=it->subwidth/2 - scw/2;
-      scr=it->subwidth/2 + scw/2;
-
-      pixrate=(int)((viswidth*65536.0*1.0)/it->subwidth)/scanwidth;
-      scanstart_i=(int)((middle-viswidth*0.5)*65536.0);
-      scanend_i=(ANALOGTV_PIC_LEN-1)*65536;
-      squishright_i=(int)((middle+viswidth*(0.25 + 0.25*puramp(it, 2.0, 0.0, 1.1)
-                                            - it->squish_control)) *65536.0);
-      squishdiv=it->subwidth/15;
-
-      rgb_start=raw_rgb_start+scl*3;
-      rgb_end=raw_rgb_start+scr*3;
-
-      assert(scanstart_i>=0);
-
-#ifdef DEBUG
-      if (0) printf("scan %d: %0.3f %0.3f %0.3f scl=%d scr=%d scw=%d\n",
-                    lineno,
-                    scanstart_i/65536.0,
-                    squishright_i/65536.0,
-                    scanend_i/65536.0,
-                    scl,scr,scw);
-#endif
-    }
-
-    if (it->use_cmap) {
-      for (y=ytop; y<ybot; y++) {
-        int level=analogtv_level(it, y, ytop, ybot);
-        double levelmult=analogtv_levelmult(it, level);
-        double levelmult_y = levelmult * it->contrast_control
-          * puramp(it, 1.0, 0.0, 1.0) / (0.5+0.5*puheight) * 0.070;
-        double levelmult_iq = levelmult * 0.090;
-
-        struct analogtv_yiq_s *yiq=it->yiq;
-        analogtv_ntsc_to_yiq(it, lineno, signal,
-                             (scanstart_i>>16)-10, (scanend_i>>16)+10);
-        pixmultinc=pixrate;
-
-        x=0;
-        i=scanstart_i;
-        while (i<0 && x<it->usewidth) {
-          XPutPixel(it->image, x, y, it->colors[0]);
-          i+=pixmultinc;
-          x++;
-        }
-
-        while (i<scanend_i && x<it->usewidth) {
-          double pixfrac=(i&0xffff)/65536.0;
-          double invpixfrac=(1.0-pixfrac);
-          int pati=i>>16;
-          int yli,ili,qli,cmi;
-
-          double interpy=(yiq[pati].y*invpixfrac
-                          + yiq[pati+1].y*pixfrac) * levelmult_y;
-          double interpi=(yiq[pati].i*invpixfrac
-                          + yiq[pati+1].i*pixfrac) * levelmult_iq;
-          double interpq=(yiq[pati].q*invpixfrac
-                          + yiq[pati+1].q*pixfrac) * levelmult_iq;
-
-          yli = (int)(interpy * it->cmap_y_levels);
-          ili = (int)((interpi+0.5) * it->cmap_i_levels);
-          qli = (int)((interpq+0.5) * it->cmap_q_levels);
-          if (yli<0) yli=0;
-          if (yli>=it->cmap_y_levels) yli=it->cmap_y_levels-1;
-          if (ili<0) ili=0;
-          if (ili>=it->cmap_i_levels) ili=it->cmap_i_levels-1;
-          if (qli<0) qli=0;
-          if (qli>=it->cmap_q_levels) qli=it->cmap_q_levels-1;
-
-          cmi=qli + it->cmap_i_levels*(ili + it->cmap_q_levels*yli);
-
-#ifdef DEBUG
-          if ((random()%65536)==0) {
-            printf("%0.3f %0.3f %0.3f => %d %d %d => %d\n",
-                   interpy, interpi, interpq,
-                   yli, ili, qli,
-                   cmi);
-          }
-#endif
-
-          for (j=0; j<it->xrepl; j++) {
-            XPutPixel(it->image, x, y,
-                      it->colors[cmi]);
-            x++;
-          }
-          if (i >= squishright_i) {
-            pixmultinc += pixmultinc/squishdiv;
-          }
-          i+=pixmultinc;
-        }
-        while (x<it->usewidth) {
-          XPutPixel(it->image, x, y, it->colors[0]);
-          x++;
-        }
-      }
-    }
-    else {
-      struct analogtv_yiq_s *yiq=it->yiq;
-      analogtv_ntsc_to_yiq(it, lineno, signal,
-                           (scanstart_i>>16)-10, (scanend_i>>16)+10);
-
-      pixbright=it->contrast_control * puramp(it, 1.0, 0.0, 1.0)
-        / (0.5+0.5*puheight) * 1024.0/100.0;
-      pixmultinc=pixrate;
-      i=scanstart_i; rrp=rgb_start;
-      while (i<0 && rrp!=rgb_end) {
-        rrp[0]=rrp[1]=rrp[2]=0;
-        i+=pixmultinc;
-        rrp+=3;
-      }
-      while (i<scanend_i && rrp!=rgb_end) {
-        double pixfrac=(i&0xffff)/65536.0;
-        double invpixfrac=1.0-pixfrac;
-        int pati=i>>16;
-        double r,g,b;
-
-        double interpy=(yiq[pati].y*invpixfrac + yiq[pati+1].y*pixfrac);
-        double interpi=(yiq[pati].i*invpixfrac + yiq[pati+1].i*pixfrac);
-        double interpq=(yiq[pati].q*invpixfrac + yiq[pati+1].q*pixfrac);
-
-        /*
-          According to the NTSC spec, Y,I,Q are generated as:
-
-          y=0.30 r + 0.59 g + 0.11 b
-          i=0.60 r - 0.28 g - 0.32 b
-          q=0.21 r - 0.52 g + 0.31 b
-
-          So if you invert the implied 3x3 matrix you get what standard
-          televisions implement with a bunch of resistors (or directly in the
-          CRT -- don't ask):
-
-          r = y + 0.948 i + 0.624 q
-          g = y - 0.276 i - 0.639 q
-          b = y - 1.105 i + 1.729 q
-        */
-
-        r=(interpy + 0.948*interpi + 0.624*interpq) * pixbright;
-        g=(interpy - 0.276*interpi - 0.639*interpq) * pixbright;
-        b=(interpy - 1.105*interpi + 1.729*interpq) * pixbright;
-        if (r<0.0) r=0.0;
-        if (g<0.0) g=0.0;
-        if (b<0.0) b=0.0;
-        rrp[0]=r;
-        rrp[1]=g;
-        rrp[2]=b;
-
-        if (i>=squishright_i) {
-          pixmultinc += pixmultinc/squishdiv;
-          pixbright += pixbright/squishdiv/2;
-        }
-        i+=pixmultinc;
-        rrp+=3;
-      }
-      while (rrp != rgb_end) {
-        rrp[0]=rrp[1]=rrp[2]=0.0;
-        rrp+=3;
-      }
-
-      analogtv_blast_imagerow(it, raw_rgb_start, raw_rgb_end,
-                              ytop,ybot);
+    it->line_dirty[lineno]=1;
+    if (it->incremental) {
+      unsigned int linesig=analogtv_draw_signature(it, lineno, slineno,
+                                                   ytop, ybot);
+      if (!full && linesig == it->onscreen_signature[lineno])
+        it->line_dirty[lineno]=0;
+      it->onscreen_signature[lineno]=linesig;
     }
   }
-  free(raw_rgb_start);
+
+  threadpool_run(it->threads, analogtv_thread_draw_lines, it);
 
 #if 0
   /* poor attempt at visible retrace */
@@ -1523,39 +1989,48 @@ analogtv_draw(analogtv *it)
   }
 #endif
 
-  if (it->need_clear) {
-    XClearWindow(it->dpy, it->window);
-    it->need_clear=0;
-  }
+  if (full) {
+    if (it->need_clear) {
+      XClearWindow(it->dpy, it->window);
+      it->need_clear=0;
+    }
 
-  if (overall_top>0) {
-    XClearArea(it->dpy, it->window,
-               it->screen_xo, it->screen_yo,
-               it->usewidth, overall_top, 0);
-  }
-  if (it->useheight > overall_bot) {
-    XClearArea(it->dpy, it->window,
-               it->screen_xo, it->screen_yo+overall_bot,
-               it->usewidth, it->useheight-overall_bot, 0);
-  }
+    if (overall_top>0) {
+      XClearArea(it->dpy, it->window,
+                 it->screen_xo, it->screen_yo,
+                 it->usewidth, overall_top, 0);
+    }
+    if (it->useheight > overall_bot) {
+      XClearArea(it->dpy, it->window,
+                 it->screen_xo, it->screen_yo+overall_bot,
+                 it->usewidth, it->useheight-overall_bot, 0);
+    }
 
-  if (overall_bot > overall_top) {
-    if (it->use_shm) {
-#ifdef HAVE_XSHM_EXTENSION
-      XShmPutImage(it->dpy, it->window, it->gc, it->image,
-                   0, overall_top,
-                   it->screen_xo, it->screen_yo+overall_top,
-                   it->usewidth, overall_bot - overall_top,
-                   False);
-#endif
-    } else {
-      XPutImage(it->dpy, it->window, it->gc, it->image,
-                0, overall_top,
-                it->screen_xo, it->screen_yo+overall_top,
-                it->usewidth, overall_bot - overall_top);
+    if (overall_bot > overall_top)
+      analogtv_put_rows(it, overall_top, overall_bot);
+  }
+  else {
+    /* Only send the runs of rows that were redrawn */
+    int span_top=0, span_bot=0;
+    for (lineno=ANALOGTV_TOP; lineno<ANALOGTV_BOT; lineno++) {
+      int slineno,ytop,ybot;
+      const analogtv_sample *signal;
+      if (!it->line_dirty[lineno] ||
+          !analogtv_get_line(it, lineno, &slineno, &ytop, &ybot, &signal))
+        continue;
+      if (ytop != span_bot) {
+        if (span_bot > span_top)
+          analogtv_put_rows(it, span_top, span_bot);
+        span_top=ytop;
+      }
+      span_bot=ybot;
     }
+    if (span_bot > span_top)
+      analogtv_put_rows(it, span_top, span_bot);
   }
 
+  it->redraw_all=0;
+
 #ifdef DEBUG
   if (0) {
     struct timeval tv;
@@ -1720,6 +2195,8 @@ void analogtv_channel_noise(analogtv_input *it, analogtv_input *s2)
 #endif
 
 
+#ifndef ANALOGTV_FLOAT_SIGNAL
+
 void analogtv_add_signal(analogtv *it, analogtv_reception *rec)
 {
   analogtv_input *inp=rec->input;
@@ -1742,6 +2219,8 @@ void analogtv_add_signal(analogtv *it, analogtv_reception *rec)
   memcpy(inp->signal[ANALOGTV_V], inp->signal[0],
          ANALOGTV_H * sizeof(inp->signal[0][0]));
 
+  analogtv_add_signatures(it, rec);
+
   for (i=0; i<8; i++) dp[i]=0.0;
 
   if (ec) {
@@ -1815,6 +2294,145 @@ void analogtv_add_signal(analogtv *it, analogtv_reception *rec)
 
 }
 
+#else /* ANALOGTV_FLOAT_SIGNAL */
+
+/* A counter-based noise generator: the Nth noise sample is just a hash
+   of the seed plus N, so there's no serial dependency between them, and
+   they can be made 4 at a time. */
+static unsigned int
+analogtv_noise_hash(unsigned int x)
+{
+  x = (x ^ (x >> 16)) * 0x7feb352du;
+  x = (x ^ (x >> 15)) * 0x846ca68bu;
+  x = x ^ (x >> 16);
+  return x & 0xffffffffu;
+}
+
+#ifdef __SSE2__
+static __m128i
+analogtv_mullo_epi32(__m128i a, __m128i b)
+{
+# ifdef __SSE4_1__
+  return _mm_mullo_epi32(a, b);
+# else
+  __m128i ev=_mm_mul_epu32(a, b);
+  __m128i od=_mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(ev, _MM_SHUFFLE(0,0,2,0)),
+                            _mm_shuffle_epi32(od, _MM_SHUFFLE(0,0,2,0)));
+# endif
+}
+
+static __m128i
+analogtv_noise_hash4(__m128i x)
+{
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+  x = analogtv_mullo_epi32(x, _mm_set1_epi32(0x7feb352d));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+  x = analogtv_mullo_epi32(x, _mm_set1_epi32((int)0x846ca68b));
+  return _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+}
+#endif /* __SSE2__ */
+
+void analogtv_add_signal(analogtv *it, analogtv_reception *rec)
+{
+  analogtv_input *inp=rec->input;
+  float *ps=it->rx_signal;
+  float *pe=it->rx_signal + ANALOGTV_SIGNAL_LEN;
+  float *p=ps;
+  signed char *ss=&inp->signal[0][0];
+  signed char *se=&inp->signal[0][0] + ANALOGTV_SIGNAL_LEN;
+  signed char *s=ss + ((unsigned)rec->ofs % ANALOGTV_SIGNAL_LEN);
+  int ec=it->channel_change_cycles;
+  float level=rec->level;
+  float hfloss=rec->hfloss;
+  float g0=rec->ghostfir[0], g1=rec->ghostfir[1];
+  float g2=rec->ghostfir[2], g3=rec->ghostfir[3];
+  unsigned int seed=random();
+  float dp1=0.0f, dp2=0.0f, dp3=0.0f, dp4=0.0f;
+
+  /* duplicate the first line into the Nth line to ease wraparound computation */
+  memcpy(inp->signal[ANALOGTV_V], inp->signal[0],
+         ANALOGTV_H * sizeof(inp->signal[0][0]));
+
+  analogtv_add_signatures(it, rec);
+
+  if (ec) {
+    /* The big noisy channel change transition, as below.  This only
+       happens for a few frames, so it's not worth vectorizing. */
+    float noise_ampl = 1.3f;
+    float noisemul = 50.0/(double)0x7fffffff;
+    unsigned int n;
+
+    for (n=0; p!=pe && ec>0; n++) {
+      float noise = (int)analogtv_noise_hash(seed+n) * noisemul;
+
+      p[0] += s[0] * level * (1.0f - noise_ampl) + noise * noise_ampl;
+
+      noise_ampl *= 0.99995f;
+
+      p++;
+      s++;
+      if (s>=se) s=ss;
+      ec--;
+    }
+  }
+
+  {
+#ifdef __SSE2__
+    const __m128 levelv=_mm_set1_ps(level);
+    const __m128 hflossv=_mm_set1_ps(hfloss);
+#endif
+
+    while (p != pe) {
+      float sigr;
+
+      /* The ghosting FIR, as below, on the sum of each group of 4 */
+      sigr=dp1*g0 + dp2*g1 + dp3*g2 + dp4*g3;
+      dp4=dp3; dp3=dp2; dp2=dp1;
+      dp1=s[0]+s[1]+s[2]+s[3];
+
+#ifdef __SSE2__
+      {
+        /* sign-extend the 4 input bytes to ints, then floats */
+        int s4;
+        __m128i si;
+        __m128 sig,swapped,v;
+        memcpy(&s4, s, 4);
+        si=_mm_cvtsi32_si128(s4);
+        si=_mm_unpacklo_epi8(si, si);
+        si=_mm_srai_epi32(_mm_unpacklo_epi16(si, si), 24);
+        sig=_mm_cvtepi32_ps(si);
+        swapped=_mm_shuffle_ps(sig, sig, _MM_SHUFFLE(1,0,3,2));
+        v=_mm_add_ps(_mm_add_ps(sig, _mm_set1_ps(sigr)),
+                     _mm_mul_ps(swapped, hflossv));
+        _mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p),
+                                    _mm_mul_ps(v, levelv)));
+      }
+#else  /* !__SSE2__ */
+      p[0] += (s[0]+sigr + s[2]*hfloss) * level;
+      p[1] += (s[1]+sigr + s[3]*hfloss) * level;
+      p[2] += (s[2]+sigr + s[0]*hfloss) * level;
+      p[3] += (s[3]+sigr + s[1]*hfloss) * level;
+#endif /* !__SSE2__ */
+
+      p += 4;
+      s += 4;
+      if (s>=se) s = ss + (s-se);
+    }
+  }
+
+  it->rx_signal_level =
+    sqrt(it->rx_signal_level * it->rx_signal_level +
+         (level * level * (1.0 + 4.0*(rec->ghostfir[0] + rec->ghostfir[1] +
+                                      rec->ghostfir[2] + rec->ghostfir[3]))));
+
+
+  it->channel_change_cycles=0;
+
+}
+
+#endif /* ANALOGTV_FLOAT_SIGNAL */
+
 #ifdef FIXME
 /* add hash */
   if (it->hashnoise_times[lineno]) {
@@ -1840,6 +2458,8 @@ void analogtv_add_signal(analogtv *it, analogtv_reception *rec)
 #endif
 
 
+#ifndef ANALOGTV_FLOAT_SIGNAL
+
 void analogtv_init_signal(analogtv *it, double noiselevel)
 {
   double *ps=it->rx_signal;
@@ -1857,8 +2477,50 @@ void analogtv_init_signal(analogtv *it, double noiselevel)
   }
 
   it->rx_signal_level = noiselevel;
+  analogtv_init_signatures(it, noiselevel);
 }
 
+#else /* ANALOGTV_FLOAT_SIGNAL */
+
+void analogtv_init_signal(analogtv *it, double noiselevel)
+{
+  float *p=it->rx_signal;
+  float *pe=it->rx_signal + ANALOGTV_SIGNAL_LEN;
+  unsigned int n=random();
+  float noisemul = sqrt(noiselevel*150)/(double)0x7fffffff;
+  float nm1 = (int)analogtv_noise_hash(n-1) * noisemul;
+
+#ifdef __SSE2__
+  {
+    __m128i ctr=_mm_add_epi32(_mm_set1_epi32((int)n), _mm_set_epi32(3,2,1,0));
+    __m128 nmul=_mm_set1_ps(noisemul);
+    __m128 prev=_mm_set1_ps(nm1);
+
+    for (; pe-p >= 4; p+=4, n+=4) {
+      __m128 cur=_mm_mul_ps(_mm_cvtepi32_ps(analogtv_noise_hash4(ctr)), nmul);
+      /* the previous sample of each: prev[3] cur[0] cur[1] cur[2] */
+      __m128 t=_mm_shuffle_ps(prev, cur, _MM_SHUFFLE(0,0,3,3));
+      __m128 last=_mm_shuffle_ps(t, cur, _MM_SHUFFLE(2,1,2,0));
+      _mm_storeu_ps(p, _mm_mul_ps(cur, last));
+      prev=cur;
+      ctr=_mm_add_epi32(ctr, _mm_set1_epi32(4));
+    }
+    _mm_store_ss(&nm1, _mm_shuffle_ps(prev, prev, _MM_SHUFFLE(3,3,3,3)));
+  }
+#endif /* __SSE2__ */
+
+  for (; p != pe; p++, n++) {
+    float nm0 = (int)analogtv_noise_hash(n) * noisemul;
+    *p = nm0*nm1;
+    nm1 = nm0;
+  }
+
+  it->rx_signal_level = noiselevel;
+  analogtv_init_signatures(it, noiselevel);
+}
+
+#endif /* ANALOGTV_FLOAT_SIGNAL */
+
 void
 analogtv_reception_update(analogtv_reception *rec)
 {
@@ -13,6 +13,7 @@
 #define _XSCREENSAVER_ANALOGTV_H
 
 #include "xshm.h"
+#include "thread_util.h"
 
 /*
   You'll need these to generate standard NTSC TV signals
@@ -73,6 +74,20 @@ enum {
 
 };
 
+/* The received signal, and the filters that demodulate it, are normally
+   double precision.  Configuring --with-analogtv-float (which defines
+   ANALOGTV_FLOAT_SIGNAL) makes them single precision instead, with SSE2
+   versions of the inner loops and a noise generator that can make 4
+   samples at once.  That's a lot faster, especially with several
+   receptions per frame, but the picture is not bit-for-bit the same as
+   the double precision one.
+ */
+#ifdef ANALOGTV_FLOAT_SIGNAL
+typedef float analogtv_sample;
+#else
+typedef double analogtv_sample;
+#endif
+
 typedef struct analogtv_input_s {
   signed char signal[ANALOGTV_V+1][ANALOGTV_H];
 
@@ -118,9 +133,12 @@ typedef struct analogtv_s {
   Screen *screen;
   XWindowAttributes xgwa;
 
-#if 0
+  /* For incremental redraw: see analogtv_line_signature */
+  int incremental;
+  unsigned int rx_signature[ANALOGTV_V];
+  unsigned int frame_signature;
   unsigned int onscreen_signature[ANALOGTV_V];
-#endif
+  char line_dirty[ANALOGTV_V];
 
   int n_colors;
 
@@ -139,6 +157,12 @@ typedef struct analogtv_s {
   /* internal cache */
   int blur_mult;
 
+  /* Scanlines are demodulated and drawn in parallel by these, in bands.
+     Everything that carries over from one line to the next (crtload) is
+     computed up front, so each band can be drawn independently. */
+  threadpool *threads;
+  double puheight;
+
   /* For fast display, set fakeit_top, fakeit_bot to
      the scanlines (0..ANALOGTV_V) that can be preserved on screen.
      fakeit_scroll is the number of scan lines to scroll it up,
@@ -195,10 +219,6 @@ typedef struct analogtv_s {
   unsigned int green_values[ANALOGTV_CV_MAX];
   unsigned int blue_values[ANALOGTV_CV_MAX];
 
-  struct analogtv_yiq_s {
-    float y,i,q;
-  } yiq[ANALOGTV_PIC_LEN+10];
-
   unsigned long colors[256];
   int cmap_y_levels;
   int cmap_i_levels;
@@ -212,7 +232,7 @@ typedef struct analogtv_s {
 
   int channel_change_cycles;
   double rx_signal_level;
-  double rx_signal[ANALOGTV_SIGNAL_LEN + 2*ANALOGTV_H];
+  analogtv_sample rx_signal[ANALOGTV_SIGNAL_LEN + 2*ANALOGTV_H];
 
   struct {
     int index;
@@ -300,9 +320,14 @@ int analogtv_handle_events (analogtv *it);
   "*use_cmap:        0",  \
   "*geometry:	     800x600", \
   "*fpsSolid:	     True", \
-  ANALOGTV_DEFAULTS_SHM
+  "*incrementalDraw: False", \
+  ANALOGTV_DEFAULTS_SHM \
+  THREAD_DEFAULTS
 
 #define ANALOGTV_OPTIONS \
+  THREAD_OPTIONS \
+  { "-incremental",     ".incrementalDraw", XrmoptionNoArg, "True" }, \
+  { "-no-incremental",  ".incrementalDraw", XrmoptionNoArg, "False" }, \
   { "-use-cmap",        ".use_cmap",     XrmoptionSepArg, 0 }, \
   { "-tv-color",        ".TVColor",      XrmoptionSepArg, 0 }, \
   { "-tv-tint",         ".TVTint",       XrmoptionSepArg, 0 }, \
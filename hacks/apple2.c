@@ -581,11 +581,7 @@ apple2_start(Display *dpy, Window window, int delay,
   sim->next_actiontime=sim->curtime;
   sim->controller (sim, &sim->stepno, &sim->next_actiontime);
 
-# ifdef GETTIMEOFDAY_TWO_ARGS
-  gettimeofday(&sim->basetime_tv, NULL);
-# else
-  gettimeofday(&sim->basetime_tv);
-# endif
+  fps_gettimeofday(&sim->basetime_tv);
 
   return sim;
 }
@@ -602,12 +598,7 @@ apple2_one_frame (apple2_sim_t *sim)
 
     {
       struct timeval curtime_tv;
-# ifdef GETTIMEOFDAY_TWO_ARGS
-      struct timezone tzp;
-      gettimeofday(&curtime_tv, &tzp);
-# else
-      gettimeofday(&curtime_tv);
-# endif
+      fps_gettimeofday(&curtime_tv);
       sim->curtime=(curtime_tv.tv_sec - sim->basetime_tv.tv_sec) +
         0.000001*(curtime_tv.tv_usec - sim->basetime_tv.tv_usec);
       if (sim->curtime > sim->dec->powerup)
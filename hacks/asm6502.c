@@ -208,30 +208,43 @@ static int memReadByte( machine_6502 *machine, int addr ) {
   return machine->memory[addr];
 }
 
-static void updateDisplayPixel(machine_6502 *machine, Bit16 addr){
-  Bit8 idx = memReadByte(machine,addr) & 0x0f;
-  Bit8 x,y;
-  addr -= 0x200;
-  x = addr & 0x1f;
-  y = (addr >> 5);
-  if (machine->plot) {
-    machine->plot(x,y,idx,machine->plotterState);
-  }
-}
-
 /*
  * memStoreByte() - Poke a byte, don't touch any registers
  *
+ * Stores into the video buffer only mark the pixel as dirty (if its
+ * color changed); the plotter gets called from flushDisplay().
  */
 
 static void memStoreByte( machine_6502 *machine, int addr, int value ) {
+  if( (addr >= 0x200) && (addr<=0x5ff) &&
+      ((machine->memory[ addr ] ^ value) & 0x0f) ) {
+    int offset = addr - 0x200;
+    machine->dirty[offset >> 5] |= (Bit32) 1 << (offset & 0x1f);
+  }
   machine->memory[ addr ] = (value & 0xff);
-  if( (addr >= 0x200) && (addr<=0x5ff) )
-    updateDisplayPixel(machine, addr );
 }
 
+/*
+ * flushDisplay() - Plot every pixel that changed since the last flush
+ *
+ */
+
+static void flushDisplay(machine_6502 *machine){
+  Bit8 x,y;
+  for (y = 0; y < 32; y++){
+    Bit32 bits = machine->dirty[y];
+    if (! bits) continue;
+    machine->dirty[y] = 0;
+    if (! machine->plot) continue;
+    for (x = 0; bits; x++, bits >>= 1)
+      if (bits & 1)
+        machine->plot(x,y,memReadByte(machine,0x200 + (y << 5) + x) & 0x0f,
+                      machine->plotterState);
+  }
+}
+
+
 
-
 /* EMULATION CODE */
 
 static Bit8 bitOn(Bit8 value,Flags bit){
@@ -1130,6 +1143,150 @@ static int opIndex(machine_6502 *machine, Bit8 opcode, m6502_AddrMode *adm){
   return machine->opcache[opcode].index;
 }
 
+
+/* DISPATCH */
+
+/* Every (instruction, addressing mode) pair that the assembler can
+   produce gets its own handler, so that the addressing mode is a
+   constant and the compiler can fold the switch in getValue() into
+   each one. The opcode byte indexes machine->dispatch directly. */
+
+#define M6502_HANDLERS \
+  H(ADC, IMMEDIATE_VALUE) H(ADC, ZERO) H(ADC, ZERO_X) H(ADC, ABS_VALUE) \
+  H(ADC, ABS_X) H(ADC, ABS_Y) H(ADC, INDIRECT_X) H(ADC, INDIRECT_Y) \
+  H(AND, IMMEDIATE_VALUE) H(AND, ZERO) H(AND, ZERO_X) H(AND, ZERO_Y) \
+  H(AND, ABS_VALUE) H(AND, ABS_X) H(AND, ABS_Y) \
+  H(ASL, ZERO) H(ASL, ZERO_X) H(ASL, ABS_VALUE) H(ASL, ABS_X) \
+  H(ASL, SINGLE) \
+  H(BIT, ZERO) H(BIT, ABS_VALUE) \
+  H(BPL, ABS_OR_BRANCH) \
+  H(BMI, ABS_OR_BRANCH) \
+  H(BVC, ABS_OR_BRANCH) \
+  H(BVS, ABS_OR_BRANCH) \
+  H(BCC, ABS_OR_BRANCH) \
+  H(BCS, ABS_OR_BRANCH) \
+  H(BNE, ABS_OR_BRANCH) \
+  H(BEQ, ABS_OR_BRANCH) \
+  H(CMP, IMMEDIATE_VALUE) H(CMP, ZERO) H(CMP, ZERO_X) H(CMP, ABS_VALUE) \
+  H(CMP, ABS_X) H(CMP, ABS_Y) H(CMP, INDIRECT_X) H(CMP, INDIRECT_Y) \
+  H(CPX, IMMEDIATE_VALUE) H(CPX, ZERO) H(CPX, ABS_VALUE) \
+  H(CPY, IMMEDIATE_VALUE) H(CPY, ZERO) H(CPY, ABS_VALUE) \
+  H(DEC, ZERO) H(DEC, ZERO_X) H(DEC, ABS_VALUE) H(DEC, ABS_X) \
+  H(EOR, IMMEDIATE_VALUE) H(EOR, ZERO) H(EOR, ZERO_X) H(EOR, ABS_VALUE) \
+  H(EOR, ABS_X) H(EOR, ABS_Y) H(EOR, INDIRECT_X) H(EOR, INDIRECT_Y) \
+  H(CLC, SINGLE) \
+  H(SEC, SINGLE) \
+  H(CLI, SINGLE) \
+  H(SEI, SINGLE) \
+  H(CLV, SINGLE) \
+  H(CLD, SINGLE) \
+  H(SED, SINGLE) \
+  H(INC, ZERO) H(INC, ZERO_X) H(INC, ABS_VALUE) H(INC, ABS_X) \
+  H(JMP, ABS_VALUE) \
+  H(JSR, ABS_VALUE) \
+  H(LDA, IMMEDIATE_VALUE) H(LDA, ZERO) H(LDA, ZERO_X) H(LDA, ABS_VALUE) \
+  H(LDA, ABS_X) H(LDA, ABS_Y) H(LDA, INDIRECT_X) H(LDA, INDIRECT_Y) \
+  H(LDX, IMMEDIATE_VALUE) H(LDX, ZERO) H(LDX, ZERO_Y) H(LDX, ABS_VALUE) \
+  H(LDX, ABS_Y) \
+  H(LDY, IMMEDIATE_VALUE) H(LDY, ZERO) H(LDY, ZERO_X) H(LDY, ABS_VALUE) \
+  H(LDY, ABS_X) \
+  H(LSR, ZERO) H(LSR, ZERO_X) H(LSR, ABS_VALUE) H(LSR, ABS_X) \
+  H(LSR, SINGLE) \
+  H(NOP, SINGLE) \
+  H(ORA, IMMEDIATE_VALUE) H(ORA, ZERO) H(ORA, ZERO_X) H(ORA, ABS_VALUE) \
+  H(ORA, ABS_X) H(ORA, ABS_Y) H(ORA, INDIRECT_X) H(ORA, INDIRECT_Y) \
+  H(TAX, SINGLE) \
+  H(TXA, SINGLE) \
+  H(DEX, SINGLE) \
+  H(INX, SINGLE) \
+  H(TAY, SINGLE) \
+  H(TYA, SINGLE) \
+  H(DEY, SINGLE) \
+  H(INY, SINGLE) \
+  H(ROR, ZERO) H(ROR, ZERO_X) H(ROR, ABS_VALUE) H(ROR, ABS_X) \
+  H(ROR, SINGLE) \
+  H(ROL, ZERO) H(ROL, ZERO_X) H(ROL, ABS_VALUE) H(ROL, ABS_X) \
+  H(ROL, SINGLE) \
+  H(RTI, SINGLE) \
+  H(RTS, SINGLE) \
+  H(SBC, IMMEDIATE_VALUE) H(SBC, ZERO) H(SBC, ZERO_X) H(SBC, ABS_VALUE) \
+  H(SBC, ABS_X) H(SBC, ABS_Y) H(SBC, INDIRECT_X) H(SBC, INDIRECT_Y) \
+  H(STA, ZERO) H(STA, ZERO_X) H(STA, ABS_VALUE) H(STA, ABS_X) \
+  H(STA, ABS_Y) H(STA, INDIRECT_X) H(STA, INDIRECT_Y) \
+  H(TXS, SINGLE) \
+  H(TSX, SINGLE) \
+  H(PHA, SINGLE) \
+  H(PLA, SINGLE) \
+  H(PHP, SINGLE) \
+  H(PLP, SINGLE) \
+  H(STX, ZERO) H(STX, ZERO_Y) H(STX, ABS_VALUE) \
+  H(STY, ZERO) H(STY, ZERO_X) H(STY, ABS_VALUE)
+
+#define H(op, mode) \
+static void op##_##mode(machine_6502 *machine){ jmp##op(machine, mode); }
+M6502_HANDLERS
+#undef H
+
+static const struct {
+  void (*func) (machine_6502*, m6502_AddrMode);
+  m6502_AddrMode adm;
+  m6502_Handler handler;
+} handlers[] = {
+#define H(op, mode) { jmp##op, mode, op##_##mode },
+  M6502_HANDLERS
+#undef H
+};
+
+/* Opcode $00 stops the program. */
+static void opStop(machine_6502 *machine){
+  machine->codeRunning = FALSE;
+}
+
+/* Anything that isn't a real opcode goes through the index cache, and
+   ends up wherever it always did. */
+static void opUnknown(machine_6502 *machine){
+  m6502_AddrMode adm;
+  int opidx = opIndex(machine, machine->memory[(Bit16)(machine->regPC - 1)],
+                      &adm);
+  machine->opcodes[opidx].func(machine, adm);
+}
+
+static void buildDispatch(machine_6502 *machine){
+  unsigned int i, j;
+  for (i = 0; i < 0x100; i++) {
+    m6502_OpcodeIndex *oc = &machine->opcache[i];
+    machine->dispatch[i] = opUnknown;
+    for (j = 0; j < sizeof(handlers)/sizeof(*handlers); j++)
+      if (handlers[j].func == machine->opcodes[oc->index].func &&
+          handlers[j].adm == oc->adm) {
+        machine->dispatch[i] = handlers[j].handler;
+        break;
+      }
+  }
+  machine->dispatch[0x00] = opStop;
+}
+
+/* Base clock cycles of each opcode on an NMOS 6502, not counting the
+   extra cycle for taken branches and page crossings. */
+static const Bit8 opCycles[0x100] = {
+  7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,  /* 00 */
+  2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  /* 10 */
+  6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,  /* 20 */
+  2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  /* 30 */
+  6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,  /* 40 */
+  2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  /* 50 */
+  6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,  /* 60 */
+  2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  /* 70 */
+  2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,  /* 80 */
+  2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,  /* 90 */
+  2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,  /* a0 */
+  2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,  /* b0 */
+  2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,  /* c0 */
+  2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  /* d0 */
+  2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,  /* e0 */
+  2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7   /* f0 */
+};
+
 
 /* Assembly parser */
 
@@ -1720,6 +1877,10 @@ static void reset(machine_6502 *machine){
   for(x=0; x < MEM_64K; x++)
     machine->memory[x] = 0;
 
+  for(y=0; y < 32; y++)
+    machine->dirty[y] = 0;
+  machine->cycles = 0;
+
   machine->codeCompiledOK = FALSE;
   machine->regA = 0;
   machine->regX = 0;
@@ -2077,22 +2238,10 @@ static BOOL compileCode(machine_6502 *machine, const char *code){
  */
 
 static void execute(machine_6502 *machine){
-  Bit8 opcode;
-  m6502_AddrMode adm;
-  int opidx;
-
   if(!machine->codeRunning) return;
 
-  opcode = popByte(machine);
-  if (opcode == 0x00)
-    machine->codeRunning = FALSE;
-  else {
-    opidx = opIndex(machine,opcode,&adm);
-    if(opidx > -1)
-      machine->opcodes[opidx].func(machine, adm);
-    else
-      fprintf(stderr,"Invalid opcode!\n");
-  }
+  machine->dispatch[popByte(machine)](machine);
+
   if( (machine->regPC == 0) || 
       (!machine->codeRunning) ) {
     machine->codeRunning = FALSE;
@@ -2104,6 +2253,7 @@ machine_6502 *m6502_build(void){
   machine = ecalloc(1, sizeof(machine_6502));
   assignOpCodes(machine->opcodes);
   buildIndexCache(machine);
+  buildDispatch(machine);
   reset(machine);
   return machine;
 }
@@ -2196,6 +2346,7 @@ void m6502_eval_file(machine_6502 *machine, const char *filename, m6502_Plotter
 #endif
     execute(machine);
   }while(machine->codeRunning);
+  flushDisplay(machine);
 }
 
 void m6502_start_eval_file(machine_6502 *machine, const char *filename, m6502_Plotter plot, void *plotterState){
@@ -2214,6 +2365,7 @@ void m6502_start_eval_file(machine_6502 *machine, const char *filename, m6502_Pl
   machine->defaultCodePC = machine->regPC = PROG_START;
   machine->codeRunning = TRUE;
   execute(machine);
+  flushDisplay(machine);
 }
 #endif /* READ_FILES */
 
@@ -2231,6 +2383,7 @@ void m6502_start_eval_string(machine_6502 *machine, const char *code,
   machine->defaultCodePC = machine->regPC = PROG_START;
   machine->codeRunning = TRUE;
   execute(machine);
+  flushDisplay(machine);
 }
 
 /* void start_eval_binary(machine_6502 *machine, Bit8 *program, */
@@ -2264,5 +2417,17 @@ void m6502_next_eval(machine_6502 *machine, int insno){
     else
       break;
   }
+  flushDisplay(machine);
+}
+
+void m6502_next_eval_cycles(machine_6502 *machine, int cycles){
+  machine->cycles += cycles;
+  while (machine->cycles > 0 && machine->codeRunning){
+    machine->cycles -= opCycles[machine->memory[machine->regPC]];
+    execute(machine);
+  }
+  if (! machine->codeRunning)
+    machine->cycles = 0;
+  flushDisplay(machine);
 }
   
@@ -60,6 +60,10 @@ typedef enum{
 
 typedef struct machine_6502 machine_6502;
 
+/* A handler executes one opcode in one addressing mode. The opcode
+   byte itself has already been read. */
+typedef void (*m6502_Handler) (machine_6502*);
+
 typedef struct {
   char name[MAX_CMD_LEN];
   Bit8 Imm;
@@ -82,9 +86,10 @@ typedef struct {
   m6502_AddrMode adm;
 } m6502_OpcodeIndex;
 
-/* Plotter is a function that will be called everytime a pixel
-   needs to be updated. The first two parameter are the x and y
-   values. The third parameter is the color index:
+/* Plotter is a function that will be called for every pixel whose
+   color has changed, once per call to next_eval. The first two
+   parameter are the x and y values. The third parameter is the color
+   index:
 
    Color Index Table
    00 black      #000000
@@ -127,7 +132,10 @@ struct machine_6502 {
   m6502_Opcodes opcodes[NUM_OPCODES];
   int screen[32][32];
   int codeLen;
-  m6502_OpcodeIndex opcache[0xff];
+  m6502_OpcodeIndex opcache[0x100];
+  m6502_Handler dispatch[0x100]; /* indexed by opcode */
+  Bit32 dirty[32]; /* one bit per display pixel, one word per row */
+  int cycles; /* left of the cycle budget; negative if it overran */
   m6502_Plotter plot;
   void *plotterState;
 };
@@ -161,6 +169,11 @@ void m6502_start_eval_string(machine_6502 *machine, const char *code,
 /* next_eval() - Execute the next insno of machine instructions */
 void m6502_next_eval(machine_6502 *machine, int insno);
 
+/* next_eval_cycles() - Execute as many instructions as fit in the
+   given number of clock cycles. Whatever the last instruction runs
+   over is taken out of the next budget. */
+void m6502_next_eval_cycles(machine_6502 *machine, int cycles);
+
 /* hexDump() - Dumps memory to output */
 void m6502_hexDump(machine_6502 *machine, Bit16 start, 
 	     Bit16 numbytes, FILE *output);
@@ -0,0 +1,107 @@
+#!/bin/sh
+# benchmark.sh --- xscreensaver, Copyright (c) 2026 Jamie Zawinski <jwz@jwz.org>
+#
+# Runs every hack found in the given build directories with "-benchmark",
+# and prints one line per hack with its frame rate, CPU time and peak
+# memory use.  Keep the output from one release and diff it against the
+# next to spot regressions.
+#
+# With "-hashes DIR", each hack also checksums every frame it draws and
+# compares them with the ones saved in DIR/HACK.hashes by an earlier run,
+# or saves them there if that file doesn't exist yet.  Hacks that differ
+# are listed, and the exit status is 1.  The hacks in $UNHASHABLE are
+# skipped then: they still read the real clock rather than the one that
+# "-frame-hashes" keeps (fps_gettimeofday), so their frames change from
+# run to run.
+#
+# Usage: benchmark.sh [-frames N] [-seed N] [-timeout secs] [-geometry WxH]
+#                     [-hashes DIR] dir ... [-- hack-args]
+#
+# If $DISPLAY is not set, an Xvfb server is started to draw on.
+
+FRAMES=500
+SEED=1
+TIMEOUT=120
+GEOM=1024x768
+HACK_ARGS=
+HASHES=
+STATUS=0
+
+UNHASHABLE="abstractile barcode blitspin bouboule bsod bumps decayscreen
+  distort eruption fluidballs interference juggle metaballs pong ripples
+  shadebobs slidescreen speedmine spotlight starfish t3d twang
+  whirlwindwarp xrayswarm zoom
+  carousel crackberg flurry glcells gleidescope glhanoi glknots glmatrix
+  glslideshow glsnake gltext juggler3d mirrorblob molecule photopile
+  polyhedra sonar timetunnel tronbit voronoi"
+
+while [ $# -gt 0 ]; do
+  case "$1" in
+    -frames)  FRAMES="$2";  shift 2 ;;
+    -seed)    SEED="$2";    shift 2 ;;
+    -timeout) TIMEOUT="$2"; shift 2 ;;
+    -geometry) GEOM="$2";   shift 2 ;;
+    -hashes)  HASHES="$2";  shift 2 ;;
+    --)       shift ; HACK_ARGS="$*" ; set -- ; break ;;
+    -*)       echo "usage: $0 [-frames N] [-seed N] [-timeout secs]" \
+                   "[-geometry WxH] [-hashes DIR] dir ... [-- hack-args]" >&2
+              exit 1 ;;
+    *)        DIRS="$DIRS $1" ; shift ;;
+  esac
+done
+
+if [ -z "$DIRS" ]; then DIRS="." ; fi
+if [ -n "$HASHES" ]; then mkdir -p "$HASHES" || exit 1 ; fi
+
+XVFB_PID=
+if [ -z "$DISPLAY" ]; then
+  DPYNUM=99
+  while [ -e /tmp/.X$DPYNUM-lock ]; do DPYNUM=`expr $DPYNUM + 1`; done
+  Xvfb :$DPYNUM -screen 0 ${GEOM}x24 -nolisten tcp >/dev/null 2>&1 &
+  XVFB_PID=$!
+  DISPLAY=:$DPYNUM
+  export DISPLAY
+  sleep 2
+  trap 'kill $XVFB_PID 2>/dev/null' 0 1 2 15
+fi
+
+if ( timeout --version ) >/dev/null 2>&1 ; then
+  TIMEOUT_CMD="timeout $TIMEOUT"
+else
+  TIMEOUT_CMD=
+fi
+
+# A hack is anything executable that has an XML description, which
+# leaves out the utilities like xscreensaver-getimage.
+#
+CONFIG=`dirname "$0"`/config
+
+for dir in $DIRS ; do
+  for xml in "$CONFIG"/*.xml ; do
+    hack=`basename "$xml" .xml`
+    exe="$dir/$hack"
+    [ -f "$exe" -a -x "$exe" ] || continue
+
+    hash_args=
+    if [ -n "$HASHES" ]; then
+      case " `echo $UNHASHABLE` " in
+        *" $hack "*)
+          echo "$hack: frame-hashes: skipped (reads the real clock)"
+          continue ;;
+      esac
+      hash_args="-frame-hashes $HASHES/$hack.hashes"
+    fi
+
+    out=`$TIMEOUT_CMD "$exe" -geometry $GEOM -benchmark $FRAMES \
+                             -seed $SEED $hash_args $HACK_ARGS 2>/dev/null |
+         grep ': benchmark: \|: frame-hashes: '`
+    if [ -z "$out" ]; then
+      echo "$hack: benchmark: failed"
+    else
+      echo "$out"
+      case "$out" in *" differ from "*) STATUS=1 ;; esac
+    fi
+  done
+done
+
+exit $STATUS
@@ -1469,14 +1469,9 @@ fontglide_draw (Display *dpy, Window window, void *closure)
 static void
 drain_input (state *s)
 {
-  while (s->buf_tail < sizeof(s->buf) - 2)
-    {
-      int c = textclient_getc (s->tc);
-      if (c > 0)
-        s->buf[s->buf_tail++] = (char) c;
-      else
-        break;
-    }
+  int room = sizeof(s->buf) - 2 - s->buf_tail;
+  if (room > 0)
+    s->buf_tail += textclient_read (s->tc, s->buf + s->buf_tail, room);
 }
 
 
@@ -14,9 +14,26 @@
 # include "config.h"
 #endif /* HAVE_CONFIG_H */
 
+#include <time.h>
+
+#ifndef HAVE_COCOA
+# include <signal.h>
+#endif
+
 #include "screenhackI.h"
 #include "fpsI.h"
 
+#ifndef HAVE_COCOA
+static volatile sig_atomic_t fps_dump_requested = 0;
+
+static void
+fps_sigusr1 (int sig)
+{
+  fps_dump_requested = 1;
+}
+#endif /* !HAVE_COCOA */
+
+
 fps_state *
 fps_init (Display *dpy, Window window)
 {
@@ -24,10 +41,29 @@ fps_init (Display *dpy, Window window)
   const char *font;
   XFontStruct *f;
 
-  if (! get_boolean_resource (dpy, "doFPS", "DoFPS"))
+  Bool timing_p = get_boolean_resource (dpy, "fpsTiming", "FPSTiming");
+
+  if (! timing_p && ! get_boolean_resource (dpy, "doFPS", "DoFPS"))
     return 0;
 
   st = (fps_state *) calloc (1, sizeof(*st));
+  st->timing_p = timing_p;
+
+#ifndef HAVE_COCOA
+  if (timing_p)
+    {
+# ifdef HAVE_SIGACTION
+      struct sigaction a;
+      memset (&a, 0, sizeof(a));
+      a.sa_handler = fps_sigusr1;
+      sigemptyset (&a.sa_mask);
+      a.sa_flags = SA_RESTART;
+      sigaction (SIGUSR1, &a, 0);
+# else
+      signal (SIGUSR1, fps_sigusr1);
+# endif
+    }
+#endif /* !HAVE_COCOA */
 
   st->dpy = dpy;
   st->window = window;
@@ -67,6 +103,8 @@ fps_init (Display *dpy, Window window)
 void
 fps_free (fps_state *st)
 {
+  if (st->timing_p)
+    fps_dump_timing (st, stderr);
   if (st->draw_gc)  XFreeGC (st->dpy, st->draw_gc);
   if (st->erase_gc) XFreeGC (st->dpy, st->erase_gc);
   if (st->font) XFreeFont (st->dpy, st->font);
@@ -78,6 +116,175 @@ void
 fps_slept (fps_state *st, unsigned long usecs)
 {
   st->slept += usecs;
+  st->phase_acc[FPS_PHASE_SLEEP] += usecs * 0.000001;
+}
+
+
+double
+fps_clock (void)
+{
+# if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec * 0.000000001;
+# endif
+  {
+    struct timeval now;
+# ifdef GETTIMEOFDAY_TWO_ARGS
+    struct timezone tzp;
+    gettimeofday (&now, &tzp);
+# else
+    gettimeofday (&now);
+# endif
+    return now.tv_sec + now.tv_usec * 0.000001;
+  }
+}
+
+
+static Bool virtual_clock_p = False;
+static struct timeval virtual_clock;
+
+void
+fps_gettimeofday (struct timeval *tv)
+{
+  if (virtual_clock_p)
+    *tv = virtual_clock;
+  else
+    {
+# ifdef GETTIMEOFDAY_TWO_ARGS
+      struct timezone tzp;
+      gettimeofday (tv, &tzp);
+# else
+      gettimeofday (tv);
+# endif
+    }
+}
+
+
+void
+fps_advance_clock (unsigned long usecs)
+{
+  if (! virtual_clock_p)
+    {
+      /* Always start at the same time of day, too. */
+      virtual_clock_p = True;
+      virtual_clock.tv_sec  = 1000000000;
+      virtual_clock.tv_usec = 0;
+    }
+  virtual_clock.tv_usec += usecs % 1000000;
+  virtual_clock.tv_sec  += usecs / 1000000 + virtual_clock.tv_usec / 1000000;
+  virtual_clock.tv_usec %= 1000000;
+}
+
+
+void
+fps_phase_time (fps_state *st, fps_phase phase, double secs)
+{
+  if (! st || ! st->timing_p) return;
+
+  /* GL programs call do_fps just before swapping buffers, so whatever
+     time draw_cb spent after that goes to the swap instead. */
+  if (phase == FPS_PHASE_DRAW && st->swap_start > 0)
+    {
+      double swap = fps_clock() - st->swap_start;
+      if (swap > secs) swap = secs;
+      if (swap < 0)    swap = 0;
+      st->phase_acc[FPS_PHASE_SWAP] += swap;
+      secs -= swap;
+      st->swap_start = 0;
+      st->swap_seen = True;
+    }
+
+  st->phase_acc[phase] += secs;
+}
+
+
+void
+fps_frame_done (fps_state *st)
+{
+  int i;
+  if (! st || ! st->timing_p) return;
+
+  for (i = 0; i < FPS_PHASES; i++)
+    {
+      st->phase_times[i][st->timing_pos] = st->phase_acc[i];
+      st->phase_acc[i] = 0;
+    }
+  st->timing_pos = (st->timing_pos + 1) % FPS_TIMING_FRAMES;
+  if (st->timing_count < FPS_TIMING_FRAMES)
+    st->timing_count++;
+  st->total_frames++;
+
+#ifndef HAVE_COCOA
+  if (fps_dump_requested)
+    {
+      fps_dump_requested = 0;
+      fps_dump_timing (st, stderr);
+    }
+#endif
+}
+
+
+static int
+cmp_floats (const void *a, const void *b)
+{
+  float fa = *(const float *) a;
+  float fb = *(const float *) b;
+  return (fa < fb ? -1 : fa > fb ? 1 : 0);
+}
+
+
+/* Min, average, 95th and 99th percentile and max, in milliseconds. */
+static void
+phase_stats (fps_state *st, fps_phase phase, double stats[5])
+{
+  float sorted[FPS_TIMING_FRAMES];
+  int n = st->timing_count;
+  double total = 0;
+  int i;
+
+  if (n == 0)
+    {
+      for (i = 0; i < 5; i++) stats[i] = 0;
+      return;
+    }
+
+  memcpy (sorted, st->phase_times[phase], n * sizeof(*sorted));
+  qsort (sorted, n, sizeof(*sorted), cmp_floats);
+  for (i = 0; i < n; i++)
+    total += sorted[i];
+
+  stats[0] = sorted[0] * 1000;
+  stats[1] = total / n * 1000;
+  stats[2] = sorted[(n * 95) / 100] * 1000;
+  stats[3] = sorted[(n * 99) / 100] * 1000;
+  stats[4] = sorted[n-1] * 1000;
+}
+
+
+static const char * const phase_names[FPS_PHASES] = {
+  "draw", "swap", "sync", "sleep"
+};
+
+
+/* One line per phase, in a form that's easy to parse.
+ */
+void
+fps_dump_timing (fps_state *st, FILE *out)
+{
+  int i;
+  if (! st || ! st->timing_p) return;
+  for (i = 0; i < FPS_PHASES; i++)
+    {
+      double stats[5];
+      phase_stats (st, i, stats);
+      fprintf (out,
+               "%s: timing: phase=%s frames=%lu n=%d"
+               " min=%.3f avg=%.3f p95=%.3f p99=%.3f max=%.3f ms\n",
+               progname, phase_names[i], st->total_frames, st->timing_count,
+               stats[0], stats[1], stats[2], stats[3], stats[4]);
+    }
+  fflush (out);
 }
 
 
@@ -162,6 +369,23 @@ fps_compute (fps_state *st, unsigned long polys, double depth)
           if (s[L-2] == '.' && s[L-1] == '0')
             s[L-2] = 0;
         }
+
+      if (st->timing_p && st->timing_count > 0)
+        {
+          int i;
+          strcat (st->string, "\nms     min   avg   p95   p99 ");
+          for (i = 0; i < FPS_PHASES; i++)
+            {
+              double stats[5];
+              /* The swap line is only interesting for GL programs. */
+              if (i == FPS_PHASE_SWAP && !st->swap_seen) continue;
+              phase_stats (st, i, stats);
+              sprintf (st->string + strlen(st->string),
+                       "\n%-5s %5.1f %5.1f %5.1f %5.1f ",
+                       phase_names[i], stats[0], stats[1], stats[2],
+                       stats[3]);
+            }
+        }
     }
 
   return st->last_fps;
@@ -19,12 +19,43 @@
 
 typedef struct fps_state fps_state;
 
+/* With -fps-timing (which implies -fps), the time spent in each of these
+   parts of every frame is kept track of, and the min, average, 95th and
+   99th percentile of the last few hundred frames are shown under the
+   frame rate.  They are also printed to stderr on exit, or on SIGUSR1.
+ */
+typedef enum {
+  FPS_PHASE_DRAW,	/* in draw_cb, not counting the swap */
+  FPS_PHASE_SWAP,	/* GL: from do_fps to the end of draw_cb */
+  FPS_PHASE_SYNC,	/* waiting for XSync */
+  FPS_PHASE_SLEEP,	/* idle until the next frame, as per fps_slept */
+  FPS_PHASES
+} fps_phase;
+
 extern fps_state *fps_init (Display *, Window);
 extern void fps_free (fps_state *);
 extern void fps_slept (fps_state *, unsigned long usecs);
 extern double fps_compute (fps_state *, unsigned long polys, double depth);
 extern void fps_draw (fps_state *);
 
+/* Adds time to the given phase of the current frame. */
+extern void fps_phase_time (fps_state *, fps_phase, double secs);
+/* Called at the end of each frame, after the sleep. */
+extern void fps_frame_done (fps_state *);
+/* Prints the timing statistics, one line per phase. */
+extern void fps_dump_timing (fps_state *, FILE *);
+/* Seconds, from a clock that doesn't jump if the time of day is reset. */
+extern double fps_clock (void);
+
+/* The time of day, for hacks that animate by the clock: use this instead
+   of gettimeofday() or time().  With -frame-hashes, it is a virtual clock
+   that only moves forward by each frame's delay, so that every run draws
+   the same frames. */
+struct timeval;
+extern void fps_gettimeofday (struct timeval *);
+/* Switches fps_gettimeofday() to the virtual clock, and advances it. */
+extern void fps_advance_clock (unsigned long usecs);
+
 /* Doesn't really belong here, but close enough. */
 #ifdef USE_IPHONE
   extern double current_device_rotation (void);
@@ -15,6 +15,8 @@
 
 #include "fps.h"
 
+#define FPS_TIMING_FRAMES 512
+
 struct fps_state {
   Display *dpy;
   Window window;
@@ -37,6 +39,14 @@ struct fps_state {
   int frame_count;
   unsigned long slept;
   struct timeval prev_frame_end, this_frame_end;
+
+  /* For -fps-timing: a ring of the phase times of the last few frames. */
+  Bool timing_p, swap_seen;
+  double swap_start;
+  double phase_acc[FPS_PHASES];
+  float phase_times[FPS_PHASES][FPS_TIMING_FRAMES];
+  int timing_count, timing_pos;
+  unsigned long total_frames;
 };
 
 #endif /* __XSCREENSAVER_FPSI_H__ */
@@ -109,5 +109,8 @@ xlockmore_gl_draw_fps (ModeInfo *mi)
 # endif /* !HAVE_GLBITMAP */
                        xgwa.width, xgwa.height,
                        st->x, y, st->string, st->clear_p);
+
+      if (st->timing_p)
+        st->swap_start = fps_clock();
     }
 }
@@ -23,6 +23,11 @@ struct gllist{
 	struct gllist *next;
 };
 
+/* Sends the model's vertex arrays to the server.  Models are static, so
+   hacks that draw one more than once should call this inside glNewList
+   once, and then use glCallList: that way the vertexes only cross the
+   bus once (and with jwzgles, they end up in a buffer object.)
+ */
 void renderList(const struct gllist *list, int wire_p);
 
 #endif
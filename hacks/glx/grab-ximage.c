@@ -60,12 +60,31 @@
 */
 #define REFORMAT_IMAGE_DATA
 
+/* If BACKGROUND_TEXTURE_LOADING is defined, load_texture_async() does
+   the conversion and mipmapping in another thread.  See
+   start_texture_thread().
+ */
+#if defined(HAVE_PTHREAD) && defined(REFORMAT_IMAGE_DATA) && \
+    !defined(HAVE_COCOA)
+# define BACKGROUND_TEXTURE_LOADING
+#endif
+
 
 #ifdef HAVE_XSHM_EXTENSION
 # include "resources.h"
 # include "xshm.h"
 #endif /* HAVE_XSHM_EXTENSION */
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#ifdef BACKGROUND_TEXTURE_LOADING
+# include <pthread.h>
+# include <unistd.h>
+# include <X11/Intrinsic.h>	/* for XtAppAddInput() */
+#endif
+
 extern char *progname;
 
 #include <sys/time.h>
@@ -135,18 +154,182 @@ spread_bits (unsigned char value, unsigned char width)
 }
 
 
-static XImage *
-convert_ximage_to_rgba32 (Screen *screen, XImage *image)
+/* Fast paths for the most common TrueColor layouts, which read and write
+   whole rows directly instead of going through XGetPixel / XPutPixel.
+ */
+
+#ifdef __SSE2__
+/* RGBA in little-endian order, from 32 bpp xRGB: swap R and B. */
+static int
+convert_row_xrgb_sse2 (const unsigned int *in, unsigned int *out, int n)
+{
+  const __m128i gmask = _mm_set1_epi32 (0x0000FF00);
+  const __m128i bmask = _mm_set1_epi32 (0x000000FF);
+  const __m128i alpha = _mm_set1_epi32 ((int) 0xFF000000);
+  int x = 0;
+  for (; x+4 <= n; x += 4)
+    {
+      __m128i p = _mm_loadu_si128 ((const __m128i *) (in + x));
+      __m128i r = _mm_and_si128 (_mm_srli_epi32 (p, 16), bmask);
+      __m128i g = _mm_and_si128 (p, gmask);
+      __m128i b = _mm_slli_epi32 (_mm_and_si128 (p, bmask), 16);
+      p = _mm_or_si128 (_mm_or_si128 (r, g), _mm_or_si128 (b, alpha));
+      _mm_storeu_si128 ((__m128i *) (out + x), p);
+    }
+  return x;
+}
+
+/* RGBA in little-endian order, from 16 bpp 565. */
+static int
+convert_row_565_sse2 (const unsigned short *in, unsigned int *out, int n)
+{
+  const __m128i m5    = _mm_set1_epi16 (0x1F);
+  const __m128i m6    = _mm_set1_epi16 (0x3F);
+  const __m128i alpha = _mm_set1_epi16 ((short) 0xFF00);
+  int x = 0;
+  for (; x+8 <= n; x += 8)
+    {
+      __m128i p = _mm_loadu_si128 ((const __m128i *) (in + x));
+      __m128i r = _mm_srli_epi16 (p, 11);
+      __m128i g = _mm_and_si128 (_mm_srli_epi16 (p, 5), m6);
+      __m128i b = _mm_and_si128 (p, m5);
+      __m128i rg, ba;
+      /* Same as spread_bits(). */
+      r = _mm_or_si128 (_mm_slli_epi16 (r, 3), _mm_srli_epi16 (r, 2));
+      g = _mm_or_si128 (_mm_slli_epi16 (g, 2), _mm_srli_epi16 (g, 4));
+      b = _mm_or_si128 (_mm_slli_epi16 (b, 3), _mm_srli_epi16 (b, 2));
+      rg = _mm_or_si128 (r, _mm_slli_epi16 (g, 8));
+      ba = _mm_or_si128 (b, alpha);
+      _mm_storeu_si128 ((__m128i *) (out + x),
+                        _mm_unpacklo_epi16 (rg, ba));
+      _mm_storeu_si128 ((__m128i *) (out + x + 4),
+                        _mm_unpackhi_epi16 (rg, ba));
+    }
+  return x;
+}
+#endif /* __SSE2__ */
+
+
+/* Packs in "RGBA" order in client endianness. */
+#define PACK_RGBA(R,G,B) (bigendian()					\
+                          ? (((R) << 24) | ((G) << 16) | ((B) << 8) | 0xFF) \
+                          : ((R) | ((G) << 8) | ((B) << 16) | 0xFF000000))
+
+/* Returns False if the image isn't in a layout that we have a fast path
+   for, in which case `to' is untouched.
+ */
+static Bool
+convert_ximage_fast (XImage *from, XImage *to,
+                     unsigned long rmsk, unsigned long gmsk, unsigned long bmsk)
+{
+  Bool native_p = (from->byte_order == (bigendian() ? MSBFirst : LSBFirst));
+  Bool rgb888_p = (rmsk == 0xFF0000 && gmsk == 0x00FF00 && bmsk == 0x0000FF);
+  Bool rgb565_p = (rmsk == 0xF800   && gmsk == 0x07E0   && bmsk == 0x001F);
+  int y;
+
+  if (sizeof(unsigned int) != 4 || sizeof(unsigned short) != 2)
+    return False;
+
+  if (from->bits_per_pixel == 32 && rgb888_p && native_p)
+    for (y = 0; y < from->height; y++)
+      {
+        const unsigned int *in = (const unsigned int *)
+          (from->data + y * from->bytes_per_line);
+        unsigned int *out = (unsigned int *)
+          (to->data + y * to->bytes_per_line);
+        int x = 0;
+# ifdef __SSE2__
+        x = convert_row_xrgb_sse2 (in, out, from->width);
+# endif
+        for (; x < from->width; x++)
+          {
+            unsigned int p = in[x];
+            out[x] = PACK_RGBA ((p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF);
+          }
+      }
+
+  else if (from->bits_per_pixel == 24 && rgb888_p)
+    for (y = 0; y < from->height; y++)
+      {
+        const unsigned char *in = (const unsigned char *)
+          (from->data + y * from->bytes_per_line);
+        unsigned int *out = (unsigned int *)
+          (to->data + y * to->bytes_per_line);
+        int ri = (from->byte_order == LSBFirst ? 2 : 0);
+        int x;
+        for (x = 0; x < from->width; x++, in += 3)
+          out[x] = PACK_RGBA ((unsigned int) in[ri], (unsigned int) in[1],
+                              (unsigned int) in[2-ri]);
+      }
+
+  else if (from->bits_per_pixel == 16 && rgb565_p && native_p)
+    for (y = 0; y < from->height; y++)
+      {
+        const unsigned short *in = (const unsigned short *)
+          (from->data + y * from->bytes_per_line);
+        unsigned int *out = (unsigned int *)
+          (to->data + y * to->bytes_per_line);
+        int x = 0;
+# ifdef __SSE2__
+        x = convert_row_565_sse2 (in, out, from->width);
+# endif
+        for (; x < from->width; x++)
+          {
+            unsigned int p = in[x];
+            unsigned int r = p >> 11, g = (p >> 5) & 0x3F, b = p & 0x1F;
+            out[x] = PACK_RGBA ((r << 3) | (r >> 2),
+                                (g << 2) | (g >> 4),
+                                (b << 3) | (b >> 2));
+          }
+      }
+
+  else
+    return False;
+
+  return True;
+}
+
+#undef PACK_RGBA
+
+
+/* If the screen has a colormapped visual, returns its colors, which
+   convert_image_colors() needs.  Returns 0 for TrueColor.
+ */
+static XColor *
+query_image_colors (Screen *screen)
 {
   Display *dpy = DisplayOfScreen (screen);
   Visual *visual = DefaultVisualOfScreen (screen);
+  XColor *colors = 0;
+
+  if (visual_class (screen, visual) == PseudoColor ||
+      visual_class (screen, visual) == GrayScale)
+    {
+      Colormap cmap = DefaultColormapOfScreen (screen);
+      int ncolors = visual_cells (screen, visual);
+      int i;
+      colors = (XColor *) calloc (sizeof (*colors), ncolors+1);
+      for (i = 0; i < ncolors; i++)
+        colors[i].pixel = i;
+      XQueryColors (dpy, cmap, colors, ncolors);
+    }
+
+  return colors;
+}
+
 
+/* Converts the image to 32-bit RGBA, and frees `colors'.
+   This doesn't talk to the server, so it can run in another thread.
+ */
+static XImage *
+convert_image_colors (Display *dpy, Visual *visual, XImage *image,
+                      XColor *colors)
+{
   int x, y;
   unsigned int crpos=0, cgpos=0, cbpos=0, capos=0; /* bitfield positions */
   unsigned int srpos=0, sgpos=0, sbpos=0;
   unsigned int srmsk=0, sgmsk=0, sbmsk=0;
   unsigned int srsiz=0, sgsiz=0, sbsiz=0;
-  XColor *colors = 0;
   unsigned char spread_map[3][256];
 
   /* Note: height+2 in "to" to work around an array bounds overrun
@@ -166,18 +349,6 @@ convert_ximage_to_rgba32 (Screen *screen, XImage *image)
     to->byte_order =
     (bigendian() ? MSBFirst : LSBFirst);
 
-  if (visual_class (screen, visual) == PseudoColor ||
-      visual_class (screen, visual) == GrayScale)
-    {
-      Colormap cmap = DefaultColormapOfScreen (screen);
-      int ncolors = visual_cells (screen, visual);
-      int i;
-      colors = (XColor *) calloc (sizeof (*colors), ncolors+1);
-      for (i = 0; i < ncolors; i++)
-        colors[i].pixel = i;
-      XQueryColors (dpy, cmap, colors, ncolors);
-    }
-
   if (colors == 0)  /* truecolor */
     {
       srmsk = to->red_mask;
@@ -210,6 +381,9 @@ convert_ximage_to_rgba32 (Screen *screen, XImage *image)
   if (to->width  < from->width)  abort();
   if (to->height < from->height) abort();
 
+  if (colors == 0 && convert_ximage_fast (from, to, srmsk, sgmsk, sbmsk))
+    return to;
+
   for (y = 0; y < from->height; y++)
     for (x = 0; x < from->width; x++)
       {
@@ -247,8 +421,50 @@ convert_ximage_to_rgba32 (Screen *screen, XImage *image)
   return to;
 }
 
+
+static XImage *
+convert_ximage_to_rgba32 (Screen *screen, XImage *image)
+{
+  return convert_image_colors (DisplayOfScreen (screen),
+                               DefaultVisualOfScreen (screen),
+                               image, query_image_colors (screen));
+}
+
 #endif /* REFORMAT_IMAGE_DATA */
 
+/* Averages each 2x2 block of 32 bpp pixels, byte by byte, into one.
+ */
+static void
+halve_row_32 (const unsigned char *in0, const unsigned char *in1,
+              unsigned char *out, int w2)
+{
+  int x = 0, i;
+# ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two  = _mm_set1_epi16 (2);
+  for (; x+2 <= w2; x += 2)
+    {
+      /* 4 pixels from each row make 2 output pixels. */
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (in0 + x*8));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (in1 + x*8));
+      __m128i lo = _mm_add_epi16 (_mm_unpacklo_epi8 (a, zero),
+                                  _mm_unpacklo_epi8 (b, zero));
+      __m128i hi = _mm_add_epi16 (_mm_unpackhi_epi8 (a, zero),
+                                  _mm_unpackhi_epi8 (b, zero));
+      lo = _mm_add_epi16 (lo, _mm_srli_si128 (lo, 8));
+      hi = _mm_add_epi16 (hi, _mm_srli_si128 (hi, 8));
+      lo = _mm_srli_epi16 (_mm_add_epi16 (_mm_unpacklo_epi64 (lo, hi), two),
+                           2);
+      _mm_storel_epi64 ((__m128i *) (out + x*4), _mm_packus_epi16 (lo, lo));
+    }
+# endif /* __SSE2__ */
+  for (; x < w2; x++)
+    for (i = 0; i < 4; i++)
+      out[x*4+i] = (in0[x*8+i] + in0[x*8+4+i] +
+                    in1[x*8+i] + in1[x*8+4+i] + 2) >> 2;
+}
+
+
 /* Shrinks the XImage by a factor of two.
    We use this when mipmapping fails on large textures.
  */
@@ -283,9 +499,19 @@ halve_image (XImage *ximage, XRectangle *geom)
       exit (1);
     }
 
-  for (y = 0; y < h2; y++)
-    for (x = 0; x < w2; x++)
-      XPutPixel (ximage2, x, y, XGetPixel (ximage, x*2, y*2));
+  if (ximage->bits_per_pixel == 32)   /* box filter */
+    for (y = 0; y < h2; y++)
+      halve_row_32 ((unsigned char *)
+                    ximage->data + (y*2)   * ximage->bytes_per_line,
+                    (unsigned char *)
+                    ximage->data + (y*2+1) * ximage->bytes_per_line,
+                    (unsigned char *)
+                    ximage2->data + y * ximage2->bytes_per_line,
+                    w2);
+  else
+    for (y = 0; y < h2; y++)
+      for (x = 0; x < w2; x++)
+        XPutPixel (ximage2, x, y, XGetPixel (ximage, x*2, y*2));
 
   free (ximage->data);
   *ximage = *ximage2;
@@ -304,22 +530,26 @@ halve_image (XImage *ximage, XRectangle *geom)
 
 #ifdef REFORMAT_IMAGE_DATA
 
-/* Pulls the Pixmap bits from the server and returns an XImage
-   in some format acceptable to OpenGL.
+/* The Pixmap bits, in whatever form the server hands them to us.
  */
-static XImage *
-pixmap_to_gl_ximage (Screen *screen, Window window, Pixmap pixmap)
-{
-  Display *dpy = DisplayOfScreen (screen);
-  unsigned int width, height, depth;
-
+typedef struct {
+  XImage *ximage;
 # ifdef HAVE_XSHM_EXTENSION
-  Bool use_shm = get_boolean_resource (dpy, "useSHM", "Boolean");
+  Bool shm_p;
   XShmSegmentInfo shm_info;
 # endif /* HAVE_XSHM_EXTENSION */
+} server_image;
 
-  XImage *server_ximage = 0;
-  XImage *client_ximage = 0;
+
+/* Pulls the Pixmap bits from the server.  Returns False on error.
+ */
+static Bool
+read_server_image (Screen *screen, Pixmap pixmap, server_image *si)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  unsigned int width, height, depth;
+
+  memset (si, 0, sizeof(*si));
 
   {
     Window root;
@@ -329,36 +559,60 @@ pixmap_to_gl_ximage (Screen *screen, Window window, Pixmap pixmap)
   }
 
   if (width < 5 || height < 5)  /* something's gone wrong somewhere... */
-    return 0;
+    return False;
 
-  /* Convert the server-side Pixmap to a client-side GL-ordered XImage.
-   */
 # ifdef HAVE_XSHM_EXTENSION
-  if (use_shm)
+  if (get_boolean_resource (dpy, "useSHM", "Boolean"))
     {
       Visual *visual = DefaultVisualOfScreen (screen);
-      server_ximage = create_xshm_image (dpy, visual, depth,
-                                         ZPixmap, 0, &shm_info,
-                                         width, height);
-      if (server_ximage)
-        XShmGetImage (dpy, pixmap, server_ximage, 0, 0, ~0L);
-      else
-        use_shm = False;
+      si->ximage = create_xshm_image (dpy, visual, depth,
+                                      ZPixmap, 0, &si->shm_info,
+                                      width, height);
+      if (si->ximage)
+        {
+          XShmGetImage (dpy, pixmap, si->ximage, 0, 0, ~0L);
+          si->shm_p = True;
+        }
     }
 # endif /* HAVE_XSHM_EXTENSION */
 
-  if (!server_ximage)
-    server_ximage = XGetImage (dpy, pixmap, 0, 0, width, height, ~0L, ZPixmap);
+  if (!si->ximage)
+    si->ximage = XGetImage (dpy, pixmap, 0, 0, width, height, ~0L, ZPixmap);
+
+  return (si->ximage != 0);
+}
 
-  client_ximage = convert_ximage_to_rgba32 (screen, server_ximage);
 
+static void
+free_server_image (Display *dpy, server_image *si)
+{
+  if (!si->ximage) return;
 # ifdef HAVE_XSHM_EXTENSION
-  if (use_shm)
-    destroy_xshm_image (dpy, server_ximage, &shm_info);
+  if (si->shm_p)
+    destroy_xshm_image (dpy, si->ximage, &si->shm_info);
   else
 # endif /* HAVE_XSHM_EXTENSION */
-    XDestroyImage (server_ximage);
+    XDestroyImage (si->ximage);
+  si->ximage = 0;
+}
+
+
+/* Pulls the Pixmap bits from the server and returns an XImage
+   in some format acceptable to OpenGL.
+ */
+static XImage *
+pixmap_to_gl_ximage (Screen *screen, Window window, Pixmap pixmap)
+{
+  server_image si;
+  XImage *client_ximage;
+
+  if (! read_server_image (screen, pixmap, &si))
+    return 0;
 
+  /* Convert the server-side Pixmap to a client-side GL-ordered XImage.
+   */
+  client_ximage = convert_ximage_to_rgba32 (screen, si.ximage);
+  free_server_image (DisplayOfScreen (screen), &si);
   return client_ximage;
 }
 
@@ -704,6 +958,401 @@ load_texture_async (Screen *screen, Window window,
 }
 
 
+#ifdef BACKGROUND_TEXTURE_LOADING
+
+/* In asynchronous mode, all that happens between frames is reading the
+   Pixmap back from the server, and handing the finished pixels to GL.
+   Converting them to RGBA and making the mipmaps (which, in
+   gluBuild2DMipmaps, was most of the time) happens in another thread,
+   which writes a byte to a pipe when it's done.  Xt notices that in the
+   main loop, the same way it notices that xscreensaver-getimage exited.
+
+   Neither X nor GL is thread-safe here, so the other thread doesn't
+   touch either of them.
+ */
+
+#define MAX_MIPMAPS 32
+
+/* Whether GL can take mipmaps that aren't a power of 2.  If it can't,
+   we let gluBuild2DMipmaps scale the image, in the main thread.
+ */
+static Bool
+npot_textures_p (void)
+{
+  const char *version = (const char *) glGetString (GL_VERSION);
+  const char *ext = (const char *) glGetString (GL_EXTENSIONS);
+  if (version && atoi (version) >= 2)
+    return True;
+  return (ext && strstr (ext, "GL_ARB_texture_non_power_of_two") != 0);
+}
+
+
+/* Makes an RGBA image like `from', but w x h and uninitialized.
+ */
+static XImage *
+new_rgba_image (XImage *from, int w, int h)
+{
+  XImage *to = (XImage *) calloc (1, sizeof (*to));
+  if (to)
+    {
+      *to = *from;
+      to->width = w;
+      to->height = h;
+      to->bytes_per_line = 0;
+      to->data = 0;
+      to->obdata = 0;
+      XInitImage (to);
+      to->data = (char *) malloc (h * to->bytes_per_line);
+    }
+  if (!to || !to->data)
+    {
+      fprintf (stderr, "%s: out of memory (%dx%d mipmap)\n",
+               progname, w, h);
+      exit (1);
+    }
+  return to;
+}
+
+
+/* Fills in levels[1..] by averaging each one down from the one before,
+   the way GL wants them: each half the size of the last, rounded down,
+   until it's 1x1.  Returns the number of levels.
+ */
+static int
+make_mipmaps (XImage **levels, int max)
+{
+  int n = 1;
+  while (n < max && (levels[n-1]->width > 1 || levels[n-1]->height > 1))
+    {
+      XImage *from = levels[n-1];
+      int w2 = MAX (1, from->width  / 2);
+      int h2 = MAX (1, from->height / 2);
+      XImage *to = new_rgba_image (from, w2, h2);
+      int x, y;
+
+      for (y = 0; y < h2; y++)
+        {
+          const unsigned char *in0 = (unsigned char *)
+            from->data + (y*2) * from->bytes_per_line;
+          const unsigned char *in1 = (from->height > 1
+                                      ? in0 + from->bytes_per_line
+                                      : in0);
+          unsigned char *out = (unsigned char *)
+            to->data + y * to->bytes_per_line;
+
+          if (from->width > 1)
+            halve_row_32 (in0, in1, out, w2);
+          else
+            for (x = 0; x < 4; x++)
+              out[x] = (in0[x] + in1[x] + 1) >> 1;
+        }
+
+      if (debug_p)
+        fprintf (stderr, "%s: mipmap %d: %d x %d\n", progname, n, w2, h2);
+
+      levels[n++] = to;
+    }
+  return n;
+}
+
+
+/* Loads mipmaps made by make_mipmaps() into GL's texture memory.
+   If the card can't take the full-sized image, it tries again without
+   the biggest level, as ximage_to_texture() does with halve_image().
+   Returns the index of the level that is now the texture's base,
+   or -1 on error.
+ */
+static int
+mipmaps_to_texture (XImage **levels, int nlevels, XRectangle *geometry)
+{
+  int max_reduction = 7;
+  int base, i;
+  GLenum err = 0;
+  const char *s = 0;
+  char buf[100];
+
+  for (base = 0; base < nlevels && base <= max_reduction; base++)
+    {
+      if (base > 0 && geometry)
+        {
+          geometry->x /= 2;
+          geometry->y /= 2;
+          geometry->width  /= 2;
+          geometry->height /= 2;
+        }
+
+      for (i = base; i < nlevels; i++)
+        glTexImage2D (GL_TEXTURE_2D, i - base, 3,
+                      levels[i]->width, levels[i]->height, 0,
+                      GL_RGBA, GL_UNSIGNED_BYTE, levels[i]->data);
+      err = glGetError();
+      if (!err)
+        return base;
+
+      s = (char *) gluErrorString (err);
+      if (!s || !*s)
+        {
+          sprintf (buf, "unknown error %d", (int) err);
+          s = buf;
+        }
+
+      while (glGetError() != GL_NO_ERROR)
+        ;  /* clear any lingering errors */
+
+      if (debug_p)
+        fprintf (stderr, "%s: mipmap error (%dx%d): %s\n",
+                 progname, levels[base]->width, levels[base]->height, s);
+    }
+
+  fprintf (stderr,
+           "\n"
+           "%s: %dx%d texture failed, even after reducing to %dx%d:\n"
+           "%s: The error was: \"%s\".\n"
+           "%s: probably this means "
+           "\"your video card is worthless and weak\"?\n\n",
+           progname, levels[0]->width, levels[0]->height,
+           levels[base-1]->width, levels[base-1]->height,
+           progname, s,
+           progname);
+  return -1;
+}
+
+
+#endif /* BACKGROUND_TEXTURE_LOADING */
+
+
+/* Loads the converted image into the current texture, and runs the
+   caller's callback.  If nlevels is more than 1, the mipmaps have already
+   been made, and levels[1..] are the smaller ones.
+ */
+static void
+texture_loaded (img_closure *dd, const char *name, XRectangle *geometry,
+                XImage **levels, int nlevels, GLint type, GLint format,
+                double cvt_time, double tex_time)
+{
+  XImage *ximage = levels[0];
+  Bool ok;
+  int iw=0, ih=0, tw=0, th=0;
+  double done_time=0;
+
+  if (! ximage)
+    ok = False;
+  else
+    {
+      iw = ximage->width;
+      ih = ximage->height;
+      if (dd->texid != -1)
+        glBindTexture (GL_TEXTURE_2D, dd->texid);
+
+      glPixelStorei (GL_UNPACK_ALIGNMENT, ximage->bitmap_pad / 8);
+
+# ifdef BACKGROUND_TEXTURE_LOADING
+      if (nlevels > 1)
+        {
+          int base = mipmaps_to_texture (levels, nlevels, geometry);
+          ok = (base >= 0);
+          if (ok)
+            ximage = levels[base];
+          tw = iw = ximage->width;
+          th = ih = ximage->height;
+        }
+      else
+# endif /* BACKGROUND_TEXTURE_LOADING */
+        {
+          ok = ximage_to_texture (ximage, type, format, &tw, &th, geometry,
+                                  dd->mipmap_p);
+          if (ok)
+            {
+              iw = ximage->width;	/* in case the image was shrunk */
+              ih = ximage->height;
+            }
+        }
+    }
+
+  if (! ok)
+    iw = ih = tw = th = 0;
+
+  if (debug_p)
+    done_time = double_time();
+
+  if (debug_p)
+    fprintf (stderr,
+             /* prints: A + B + C = D
+                A = file I/O time (happens in background)
+                B = time to pull bits from server (this process), plus
+                    the conversion, if that's done in another thread
+                C = time to convert bits to GL textures (this process)
+                D = total elapsed time from "want image" to "see image"
+
+                B+C is responsible for any frame-rate glitches.
+              */
+             "%s: loading elapsed: %.2f + %.2f + %.2f = %.2f sec\n",
+             progname,
+             cvt_time  - dd->load_time,
+             tex_time  - cvt_time,
+             done_time - tex_time,
+             done_time - dd->load_time);
+
+  if (dd->callback)
+    /* asynchronous mode */
+    dd->callback (name, geometry, iw, ih, tw, th, dd->closure);
+  else
+    {
+      /* synchronous mode */
+      if (dd->filename_return)       *dd->filename_return     = (char *) name;
+      if (dd->geometry_return)       *dd->geometry_return     = *geometry;
+      if (dd->image_width_return)    *dd->image_width_return    = iw;
+      if (dd->image_height_return)   *dd->image_height_return   = ih;
+      if (dd->texture_width_return)  *dd->texture_width_return  = tw;
+      if (dd->texture_height_return) *dd->texture_height_return = th;
+    }
+}
+
+
+#ifdef BACKGROUND_TEXTURE_LOADING
+
+typedef struct {
+  img_closure dd;
+  Screen *screen;
+  Window window;
+  char *name;
+  XRectangle geometry;
+  double cvt_time;
+
+  server_image si;
+  Visual *visual;
+  XColor *colors;
+  Bool mipmap_p;	/* build the mipmaps too */
+
+  XImage *levels[MAX_MIPMAPS];
+  int nlevels;
+
+  int fds[2];
+  XtInputId id;
+  pthread_t thread;
+  Bool thread_p;
+} texture_job;
+
+
+/* Runs in the other thread.
+ */
+static void *
+texture_thread (void *arg)
+{
+  texture_job *job = (texture_job *) arg;
+  char c = 0;
+
+  job->levels[0] = convert_image_colors (DisplayOfScreen (job->screen),
+                                         job->visual, job->si.ximage,
+                                         job->colors);
+  job->colors = 0;  /* freed by convert_image_colors */
+  job->nlevels = 1;
+
+  if (job->mipmap_p)
+    job->nlevels = make_mipmaps (job->levels, MAX_MIPMAPS);
+
+  while (write (job->fds[1], &c, 1) < 0)
+    ;
+  return 0;
+}
+
+
+/* Runs in the main thread, when texture_thread() is done.
+ */
+static void
+texture_thread_done_cb (XtPointer closure, int *fd, XtInputId *id)
+{
+  texture_job *job = (texture_job *) closure;
+  Display *dpy = DisplayOfScreen (job->screen);
+  double tex_time = 0;
+  int i;
+
+  XtRemoveInput (*id);
+  if (job->thread_p)
+    pthread_join (job->thread, 0);
+
+  /* No need to read the byte that woke us up: closing the pipe discards
+     it. */
+  close (job->fds[0]);
+  close (job->fds[1]);
+
+  free_server_image (dpy, &job->si);
+
+  if (debug_p)
+    tex_time = double_time();
+
+  if (job->dd.glx_context)
+    glXMakeCurrent (dpy, job->window, job->dd.glx_context);
+
+  texture_loaded (&job->dd, job->name, &job->geometry,
+                  job->levels, job->nlevels, GL_UNSIGNED_BYTE, GL_RGBA,
+                  job->cvt_time, tex_time);
+
+  for (i = 0; i < job->nlevels; i++)
+    if (job->levels[i])
+      XDestroyImage (job->levels[i]);
+  if (job->name) free (job->name);
+  free (job);
+}
+
+
+/* Reads the Pixmap back from the server, and starts a thread that will
+   turn it into a texture.  Returns False if it couldn't, in which case
+   the caller should do it all itself.
+ */
+static Bool
+start_texture_thread (Screen *screen, Window window, img_closure *dd,
+                      const char *name, XRectangle *geometry,
+                      double cvt_time)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  XtAppContext app = XtDisplayToApplicationContext (dpy);
+  texture_job *job = (texture_job *) calloc (1, sizeof(*job));
+
+  if (!job) return False;
+  if (pipe (job->fds))
+    {
+      free (job);
+      return False;
+    }
+
+  job->dd       = *dd;
+  job->screen   = screen;
+  job->window   = window;
+  job->name     = (name ? strdup (name) : 0);
+  job->geometry = *geometry;
+  job->cvt_time = cvt_time;
+  job->visual   = DefaultVisualOfScreen (screen);
+  job->mipmap_p = (dd->mipmap_p && npot_textures_p());
+
+  if (read_server_image (screen, dd->pixmap, &job->si))
+    job->colors = query_image_colors (screen);
+
+  XFreePixmap (dpy, dd->pixmap);
+  job->dd.pixmap = 0;
+
+  job->id = XtAppAddInput (app, job->fds[0],
+                           (XtPointer) (XtInputReadMask | XtInputExceptMask),
+                           texture_thread_done_cb, (XtPointer) job);
+
+  if (! job->si.ximage)
+    {
+      /* Let the callback report the error, from the main loop. */
+      char c = 0;
+      while (write (job->fds[1], &c, 1) < 0)
+        ;
+    }
+  else if (! pthread_create (&job->thread, 0, texture_thread, job))
+    job->thread_p = True;
+  else
+    texture_thread (job);   /* couldn't make a thread: do it now */
+
+  return True;
+}
+
+#endif /* BACKGROUND_TEXTURE_LOADING */
+
+
 /* Once we have an XImage, this loads it into GL.
    This is used in both synchronous and asynchronous mode.
  */
@@ -712,11 +1361,9 @@ load_texture_async_cb (Screen *screen, Window window, Drawable drawable,
                        const char *name, XRectangle *geometry, void *closure)
 {
   Display *dpy = DisplayOfScreen (screen);
-  Bool ok;
   XImage *ximage;
   GLint type, format;
-  int iw=0, ih=0, tw=0, th=0;
-  double cvt_time=0, tex_time=0, done_time=0;
+  double cvt_time=0, tex_time=0;
   img_closure *data = (img_closure *) closure;
   /* copy closure data to stack and free the original before running cb */
   img_closure dd = *data;
@@ -743,6 +1390,12 @@ load_texture_async_cb (Screen *screen, Window window, Drawable drawable,
   if (debug_p)
     cvt_time = double_time();
 
+# ifdef BACKGROUND_TEXTURE_LOADING
+  if (dd.callback &&
+      start_texture_thread (screen, window, &dd, name, geometry, cvt_time))
+    return;
+# endif /* BACKGROUND_TEXTURE_LOADING */
+
 # ifdef REFORMAT_IMAGE_DATA
   ximage = pixmap_to_gl_ximage (screen, window, dd.pixmap);
   format = GL_RGBA;
@@ -779,61 +1432,8 @@ load_texture_async_cb (Screen *screen, Window window, Drawable drawable,
   if (debug_p)
     tex_time = double_time();
 
-  if (! ximage)
-    ok = False;
-  else
-    {
-      iw = ximage->width;
-      ih = ximage->height;
-      if (dd.texid != -1)
-        glBindTexture (GL_TEXTURE_2D, dd.texid);
-
-      glPixelStorei (GL_UNPACK_ALIGNMENT, ximage->bitmap_pad / 8);
-      ok = ximage_to_texture (ximage, type, format, &tw, &th, geometry,
-                              dd.mipmap_p);
-      if (ok)
-        {
-          iw = ximage->width;	/* in case the image was shrunk */
-          ih = ximage->height;
-        }
-    }
+  texture_loaded (&dd, name, geometry, &ximage, 1, type, format,
+                  cvt_time, tex_time);
 
   if (ximage) XDestroyImage (ximage);
-
-  if (! ok)
-    iw = ih = tw = th = 0;
-
-  if (debug_p)
-    done_time = double_time();
-
-  if (debug_p)
-    fprintf (stderr,
-             /* prints: A + B + C = D
-                A = file I/O time (happens in background)
-                B = time to pull bits from server (this process)
-                C = time to convert bits to GL textures (this process)
-                D = total elapsed time from "want image" to "see image"
-
-                B+C is responsible for any frame-rate glitches.
-              */
-             "%s: loading elapsed: %.2f + %.2f + %.2f = %.2f sec\n",
-             progname,
-             cvt_time  - dd.load_time,
-             tex_time  - cvt_time,
-             done_time - tex_time,
-             done_time - dd.load_time);
-
-  if (dd.callback)
-    /* asynchronous mode */
-    dd.callback (name, geometry, iw, ih, tw, th, dd.closure);
-  else
-    {
-      /* synchronous mode */
-      if (dd.filename_return)       *dd.filename_return       = (char *) name;
-      if (dd.geometry_return)       *dd.geometry_return       = *geometry;
-      if (dd.image_width_return)    *dd.image_width_return    = iw;
-      if (dd.image_height_return)   *dd.image_height_return   = ih;
-      if (dd.texture_width_return)  *dd.texture_width_return  = tw;
-      if (dd.texture_height_return) *dd.texture_height_return = th;
-    }
 }
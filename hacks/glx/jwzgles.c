@@ -1884,17 +1884,105 @@ jwzgles_glEnd (void)
    time of glEndList; and when running the list with glCallList, the
    values are already on the GPU and don't need to be sent over again.
 
+   Also, since every glBegin/glEnd turns into its own glDrawArrays, a list
+   that draws a mesh one quad at a time would still make one draw call per
+   quad.  So runs of glDrawArrays that draw independent primitives in the
+   same mode, with the same kinds of arrays, and with nothing but
+   glEnableClientState / glDisableClientState calls between them that
+   leave the arrays as they were, are compiled into a single call: their
+   arrays are laid out end to end in the VBO, and the calls and the
+   client-state noise between them are dropped from the list.
+
    The VBO persists in the GPU until the display list is deleted.
  */
+
+/* If this list entry is a glEnableClientState or glDisableClientState of
+   one of the arrays that glDrawArrays uses, returns its ISENABLED bit.
+ */
+static unsigned long
+client_state_toggle_p (const list_fn *F, int *enable_ret)
+{
+  if (F->fn == (list_fn_cb) &jwzgles_glEnableClientState)
+    *enable_ret = 1;
+  else if (F->fn == (list_fn_cb) &jwzgles_glDisableClientState)
+    *enable_ret = 0;
+  else
+    return 0;
+
+  switch (F->argv[0].i) {
+  case GL_VERTEX_ARRAY:        return ISENABLED_VERT_ARRAY;
+  case GL_NORMAL_ARRAY:        return ISENABLED_NORM_ARRAY;
+  case GL_TEXTURE_COORD_ARRAY: return ISENABLED_TEX_ARRAY;
+  case GL_COLOR_ARRAY:         return ISENABLED_COLOR_ARRAY;
+  default:                     return 0;
+  }
+}
+
+
+/* Whether the two glDrawArrays calls can be replaced with one call that
+   draws both sets of vertexes.
+ */
+static int
+arrays_mergeable_p (const list_fn *F1, const list_fn *F2)
+{
+  int mode = F1->argv[0].i;
+  int j;
+
+  if (mode != F2->argv[0].i) return 0;
+  if (mode != GL_POINTS && mode != GL_LINES && mode != GL_TRIANGLES)
+    return 0;  /* strips and fans aren't independent primitives */
+  if (F1->argv[1].i != 0 || F2->argv[1].i != 0)
+    return 0;  /* nonzero 'first' */
+
+  for (j = 0; j < 4; j++)
+    {
+      const draw_array *A1 = &F1->arrays[j];
+      const draw_array *A2 = &F2->arrays[j];
+      if (A1->size != A2->size) return 0;
+      if (! A1->size) continue;
+      if (A1->type != GL_FLOAT || A2->type != GL_FLOAT) return 0;
+      if (A1->binding || A2->binding) return 0;
+      if (! A1->data || ! A2->data) return 0;
+    }
+  return 1;
+}
+
+
+static void
+append_array_data (GLfloat **combo, int *combo_count, int *combo_size,
+                   draw_array *A)
+{
+  int ocount = *combo_count;
+
+  Assert (A->bytes > 0, "no bytes in draw_array");
+  Assert (((unsigned long) A->data > 0xFFFF),
+          "buffer data not a pointer");
+
+  *combo_count += A->bytes / sizeof(**combo);
+  make_room ("optimize_arrays",
+             (void **) combo, sizeof(**combo),
+             combo_count, combo_size);
+  memcpy (*combo + ocount, A->data, A->bytes);
+  free (A->data);
+  A->data = 0;
+}
+
+
 static void
 optimize_arrays (void)
 {
   list *L = &state->lists.lists[state->compiling_list-1];
-  int i, j;
+  int i, j, k, n;
   GLfloat *combo = 0;
   int combo_count = 0;
   int combo_size = 0;
   GLuint buf_name = 0;
+  int *owner;		/* index of the call that each call was merged into */
+  char *drop;		/* client-state calls made redundant by merging */
+  int head = -1;	/* call that later calls may be merged into */
+  int pending = 0;	/* first entry after 'head' or its last member */
+  unsigned long known = 0, value = 0;	/* simulated array enables */
+  unsigned long head_known = 0, head_value = 0;
 
   Assert (state->compiling_list, "not compiling a list");
   Assert (L, "no list");
@@ -1906,16 +1994,67 @@ optimize_arrays (void)
 
   L->buffer = buf_name;
 
-  /* Go through the list and dump the contents of the various saved arrays
-     into one large array.
+  owner = (int *) malloc (L->count * sizeof(*owner));
+  drop = (char *) calloc (L->count, sizeof(*drop));
+  Assert (owner && drop, "out of memory");
+
+  /* First, decide which calls to glDrawArrays can be merged.  While doing
+     that, keep track of which arrays are enabled, as far as we can tell
+     from inside this list: a run of calls can only be merged if they all
+     see the same arrays enabled.
    */
   for (i = 0; i < L->count; i++)
     {
       list_fn *F = &L->fns[i];
-/*      int count; */
-      if (! F->arrays)
+      int enable_p = 0;
+      unsigned long bit = client_state_toggle_p (F, &enable_p);
+
+      owner[i] = -1;
+
+      if (bit)
+        {
+          known |= bit;
+          if (enable_p) value |= bit;
+          else value &= ~bit;
+        }
+      else if (F->proto == PROTO_ARRAYS && F->arrays)
+        {
+          if (head >= 0 &&
+              known == head_known &&
+              value == head_value &&
+              arrays_mergeable_p (&L->fns[head], F))
+            {
+              owner[i] = head;
+              for (k = pending; k < i; k++)
+                drop[k] = 1;
+            }
+          else
+            {
+              head = i;
+              head_known = known;
+              head_value = value;
+            }
+          pending = i + 1;
+        }
+      else
+        {
+          /* Anything else might depend on or change the state.
+             A nested list might also change which arrays are enabled. */
+          head = -1;
+          if (F->fn == (list_fn_cb) &jwzgles_glCallList)
+            known = value = 0;
+        }
+    }
+
+  /* Now go through the list and dump the contents of the various saved
+     arrays into one large array.  Each array of a merged call is followed
+     by the same array of each of the calls that were merged into it.
+   */
+  for (i = 0; i < L->count; i++)
+    {
+      list_fn *F = &L->fns[i];
+      if (! F->arrays || owner[i] >= 0)
         continue;
-/*      count = F->argv[2].i;*/  /* 3rd arg to glDrawArrays */
 
       for (j = 0; j < 4; j++)
         {
@@ -1932,23 +2071,40 @@ optimize_arrays (void)
           if (! A->data)	/* No array. */
             continue;
 
-          Assert (A->bytes > 0, "no bytes in draw_array");
-          Assert (((unsigned long) A->data > 0xFFFF),
-                  "buffer data not a pointer");
+          append_array_data (&combo, &combo_count, &combo_size, A);
+          for (k = i+1; k < L->count && (owner[k] == i || drop[k]); k++)
+            if (owner[k] == i)
+              append_array_data (&combo, &combo_count, &combo_size,
+                                 &L->fns[k].arrays[j]);
 
-          combo_count += A->bytes / sizeof(*combo);
-          make_room ("optimize_arrays",
-                     (void **) &combo, sizeof(*combo),
-                     &combo_count, &combo_size);
-          memcpy (combo + ocount, A->data, A->bytes);
           A->binding = buf_name;
-          free (A->data);
+          A->bytes = (combo_count - ocount) * sizeof(*combo);
           /* 'data' is now the byte offset into the VBO. */
           A->data = (void *) (ocount * sizeof(*combo));
           /* LOG3("    loaded %lu floats to pos %d of buffer %d",
                A->bytes / sizeof(*combo), ocount, buf_name); */
         }
+
+      for (k = i+1; k < L->count && (owner[k] == i || drop[k]); k++)
+        if (owner[k] == i)
+          F->argv[2].i += L->fns[k].argv[2].i;	/* 3rd arg to glDrawArrays */
+    }
+
+  /* Remove the calls that were merged, and the ones between them. */
+  for (i = 0, n = 0; i < L->count; i++)
+    {
+      if (owner[i] >= 0)
+        free (L->fns[i].arrays);
+      else if (! drop[i])
+        L->fns[n++] = L->fns[i];
     }
+  if (n != L->count)
+    LOG3("  merged %d calls of list %d into %d",
+         L->count, state->compiling_list, n);
+  L->count = n;
+
+  free (owner);
+  free (drop);
 
   if (combo_count == 0)		/* Nothing to do! */
     {
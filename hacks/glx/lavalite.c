@@ -67,6 +67,7 @@
 #define DEFAULTS	"*delay:	30000       \n" \
 			"*showFPS:      False       \n" \
 			"*wireframe:    False       \n" \
+			"*useThreads:   True        \n" \
 			"*geometry:	600x900\n"      \
 			"*count:      " DEF_COUNT " \n" \
 
@@ -93,8 +94,13 @@
 #include "rotator.h"
 #include "gltrackball.h"
 #include "xpm-ximage.h"
+#include "thread_util.h"
 #include <ctype.h>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 #ifdef USE_GL /* whole file */
 
 
@@ -219,6 +225,8 @@ typedef struct {
   GLuint bottle_list;
   GLuint ball_list;
 
+  threadpool *threads;		   /* for marching-cubes */
+
   int bottle_poly_count;	   /* polygons in the bottle only */
 
 } lavalite_configuration;
@@ -270,6 +278,7 @@ static XrmOptionDescRec opts[] = {
   { "-fluid-texture",".fluidTexture",  XrmoptionSepArg, 0 },
   { "-base-texture", ".baseTexture",   XrmoptionSepArg, 0 },
   { "-table-texture",".tableTexture",  XrmoptionSepArg, 0 },
+  THREAD_OPTIONS
 };
 
 static argtype vars[] = {
@@ -1003,53 +1012,6 @@ move_balls (ModeInfo *mi)   /* for great justice */
 /* Rendering blobbies using marching cubes.
  */
 
-static double
-compute_metaball_influence (lavalite_configuration *bp,
-                            double x, double y, double z,
-                            int nballs, metaball *balls)
-{
-  double vv = 0;
-  int i;
-
-  for (i = 0; i < nballs; i++)
-    {
-      metaball *b = &balls[i];
-      double dx, dy, dz;
-      double d2, r, R, r2, R2;
-
-      if (!b->alive_p) continue;
-
-      dx = x - b->x;
-      dy = y - b->y;
-      dz = z - b->z;
-      R = b->R;
-
-      if (dx > R || dx < -R ||    /* quick check before multiplying */
-          dy > R || dy < -R ||
-          dz > R || dz < -R)
-        continue;
-
-      d2 = (dx*dx + dy*dy + dz*dz);
-      r = b->r;
-
-      r2 = r*r;
-      R2 = R*R;
-
-      if (d2 <= r2)             /* (d <= r)   inside the hard radius */
-        vv += 1;
-      else if (d2 > R2)         /* (d > R)   outside the radius of influence */
-        ;
-      else          /* somewhere in between: linear drop-off from r=1 to R=0 */
-        {
-          /* was: vv += 1 - ((d-r) / (R-r)); */
-          vv += 1 - ((d2-r2) / (R2-r2));
-        }
-    }
-
-  return vv;
-}
-
-
 /* callback for marching_cubes() */
 static void *
 obj_init (double grid_size, void *closure)
@@ -1098,25 +1060,157 @@ clipped_by_glass_p (double x, double y, double z,
 
 
 
-/* callback for marching_cubes() */
-static double
-obj_compute (double x, double y, double z, void *closure)
+/* A metaball that touches one row of the grid.  Along the row, only the
+   X distance varies; the rest is the same for every point.
+ */
+typedef struct {
+  double x;
+  double dy2, dz2;
+  double r2, R2;
+} row_ball;
+
+
+/* Computes the influence of the given balls on each point of a row of
+   the grid.  Inside a ball's hard radius, its influence is 1; from there
+   it drops off linearly (in d^2) to 0 at its radius of influence.
+ */
+static void
+compute_row_influence (const double *xs, double *row, int n,
+                       const row_ball *balls, int nballs)
+{
+  int i, j = 0;
+
+# ifdef __SSE2__
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d one  = _mm_set1_pd (1.0);
+  for (; j+2 <= n; j += 2)
+    {
+      __m128d x  = _mm_loadu_pd (xs + j);
+      __m128d vv = zero;
+      for (i = 0; i < nballs; i++)
+        {
+          const row_ball *b = &balls[i];
+          __m128d r2 = _mm_set1_pd (b->r2);
+          __m128d R2 = _mm_set1_pd (b->R2);
+          __m128d dx = _mm_sub_pd (x, _mm_set1_pd (b->x));
+          __m128d d2 = _mm_add_pd (_mm_add_pd (_mm_mul_pd (dx, dx),
+                                               _mm_set1_pd (b->dy2)),
+                                   _mm_set1_pd (b->dz2));
+          __m128d in  = _mm_cmple_pd (d2, r2);
+          __m128d out = _mm_cmpgt_pd (d2, R2);
+          __m128d v = _mm_sub_pd (one, _mm_div_pd (_mm_sub_pd (d2, r2),
+                                                   _mm_sub_pd (R2, r2)));
+          v = _mm_or_pd (_mm_and_pd (in, one),
+                         _mm_andnot_pd (in, _mm_andnot_pd (out, v)));
+          vv = _mm_add_pd (vv, v);
+        }
+      _mm_storeu_pd (row + j, vv);
+    }
+# endif /* __SSE2__ */
+
+  for (; j < n; j++)
+    {
+      double vv = 0;
+      for (i = 0; i < nballs; i++)
+        {
+          const row_ball *b = &balls[i];
+          double dx = xs[j] - b->x;
+          double d2 = (dx*dx + b->dy2 + b->dz2);
+          if (d2 <= b->r2)
+            vv += 1;
+          else if (d2 > b->R2)
+            ;
+          else
+            vv += 1 - ((d2 - b->r2) / (b->R2 - b->r2));
+        }
+      row[j] = vv;
+    }
+}
+
+
+/* callback for marching_cubes_layers(): the value of the field at each
+   point on one Z layer of the grid.  Balls that don't reach the layer
+   are skipped, then balls that don't reach each row.
+ */
+static void
+obj_compute_layer (int gz, double *values, void *closure)
 {
   lavalite_configuration *bp = (lavalite_configuration *) closure;
-  double clip;
+  int gs = bp->grid_size;
+  double or = bp->max_bottle_radius;
+  double *xs = (double *) malloc (gs * sizeof(*xs));
+  metaball **layer = (metaball **) malloc (bp->nballs * sizeof(*layer));
+  row_ball *row = (row_ball *) malloc (bp->nballs * sizeof(*row));
+  double z = gz;
+  int nlayer = 0;
+  int gx, gy, i;
+
+  if (!xs || !layer || !row)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      exit (1);
+    }
 
-  x /= bp->grid_size;	/* convert from 0-N to 0-1. */
-  y /= bp->grid_size;
-  z /= bp->grid_size;
+  z /= bp->grid_size;	/* convert from 0-N to 0-1. */
+  for (gx = 0; gx < gs; gx++)
+    {
+      double x = gx;
+      x /= bp->grid_size;
+      x -= 0.5;
+      xs[gx] = x;
+    }
 
-  x -= 0.5;	/* X and Y range from -.5 to +.5; z ranges from 0-1. */
-  y -= 0.5;
+  for (i = 0; i < bp->nballs; i++)
+    {
+      metaball *b = &bp->balls[i];
+      double dz = z - b->z;
+      if (b->alive_p && dz <= b->R && dz >= -b->R)
+        layer[nlayer++] = b;
+    }
+
+  for (gy = 0; gy < gs; gy++)
+    {
+      double *out = values + gy * gs;
+      double y = gy;
+      int nrow = 0;
+
+      y /= bp->grid_size;
+      y -= 0.5;	/* X and Y range from -.5 to +.5; z ranges from 0-1. */
+
+      if (y > or || y < -or)	/* the whole row is outside the glass */
+        {
+          for (gx = 0; gx < gs; gx++)
+            out[gx] = 0;
+          continue;
+        }
 
-  clip = clipped_by_glass_p (x, y, z, bp);
-  if (clip == 0) return 0;
+      for (i = 0; i < nlayer; i++)
+        {
+          metaball *b = layer[i];
+          double dy = y - b->y;
+          double dz = z - b->z;
+          if (dy > b->R || dy < -b->R)
+            continue;
+          row[nrow].x   = b->x;
+          row[nrow].dy2 = dy*dy;
+          row[nrow].dz2 = dz*dz;
+          row[nrow].r2  = b->r * b->r;
+          row[nrow].R2  = b->R * b->R;
+          nrow++;
+        }
+
+      compute_row_influence (xs, out, gs, row, nrow);
+
+      for (gx = 0; gx < gs; gx++)
+        {
+          double clip = clipped_by_glass_p (xs[gx], y, z, bp);
+          out[gx] = (clip == 0 ? 0 : clip * out[gx]);
+        }
+    }
 
-  return (clip *
-          compute_metaball_influence (bp, x, y, z, bp->nballs, bp->balls));
+  free (row);
+  free (layer);
+  free (xs);
 }
 
 
@@ -1219,9 +1313,10 @@ animate_lava (ModeInfo *mi)
     glPushMatrix();
     glTranslatef (-0.5, -0.5, 0);
     glScalef (s, s, s);
-    marching_cubes (resolution, isolevel, wire, do_smooth,
-                    obj_init, obj_compute, obj_free, bp,
-                    &mi->polygon_count);
+    marching_cubes_layers (bp->threads, resolution, isolevel,
+                           wire, do_smooth,
+                           obj_init, obj_compute_layer, obj_free, bp,
+                           &mi->polygon_count);
     glPopMatrix();
   }
 
@@ -1438,6 +1533,11 @@ init_lavalite (ModeInfo *mi)
   bp->bottle_list = glGenLists (1);
   bp->ball_list = glGenLists (1);
 
+  bp->threads = threadpool_create (get_boolean_resource (MI_DISPLAY (mi),
+                                                         "useThreads",
+                                                         "Boolean")
+                                   ? 0 : 1);
+
   generate_bottle (mi);
   generate_static_blobs (mi);
 }
@@ -19,6 +19,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #ifndef HAVE_COCOA
@@ -639,3 +640,430 @@ marching_cubes (int grid_size,     /* density of the mesh */
   if (polygon_count)
     *polygon_count = polys;
 }
+
+
+/* The threaded, vertex-sharing version.
+
+   First the whole field is computed into an array, with each thread
+   filling a slab of Z layers.  Then each thread turns its own slab of
+   cubes into triangles.  A vertex that lies on an edge shared by several
+   cubes is computed only once: the index of each edge's vertex is cached
+   for the two Z layers bounding the current row of cubes.  Vertex normals
+   come from the gradient of the field at the ends of the edge, which is
+   already known, rather than from calling compute_fn again.
+
+   Finally, the calling thread draws each slab's triangles, with a single
+   glDrawElements() if the surface is smooth and solid.
+ */
+
+struct mc_mesh {		/* the part of the surface made by one thread */
+  GLfloat *verts;		/* 3 per vertex */
+  GLfloat *norms;		/* 3 per vertex, if smoothing */
+  GLuint *tris;			/* 3 vertex indexes per triangle */
+  int nverts, verts_size, norms_size;
+  int ntris, tris_size;
+};
+
+struct mc_job {
+  int grid_size;
+  double isolevel;
+  int smooth_p;
+  double (*compute_fn) (double x, double y, double z, void *closure2);
+  void (*compute_layer_fn) (int z, double *values, void *closure2);
+  void *closure2;
+  double *field;		/* grid_size^3 values, X varying fastest */
+  struct mc_mesh *meshes;	/* one per thread */
+  int polygonize_p;		/* which half of the work to do */
+};
+
+
+/* Where each of the cube's edges lies, relative to its vertex 0:
+   the axis it runs along (0 = X, 1 = Y, 2 = Z) and its starting point.
+ */
+static const struct { char axis, dx, dy, dz; } edge_coords[12] = {
+  { 0, 0, 0, 0 }, { 1, 1, 0, 0 }, { 0, 0, 1, 0 }, { 1, 0, 0, 0 },
+  { 0, 0, 0, 1 }, { 1, 1, 0, 1 }, { 0, 0, 1, 1 }, { 1, 0, 0, 1 },
+  { 2, 0, 0, 0 }, { 2, 1, 0, 0 }, { 2, 1, 1, 0 }, { 2, 0, 1, 0 },
+};
+
+
+static void *
+mc_grow (void *array, int *size, int elt_size, int need)
+{
+  if (need <= *size) return array;
+  *size = (*size < 1024 ? 1024 : *size);
+  while (*size < need) *size *= 2;
+  array = realloc (array, *size * elt_size);
+  if (!array)
+    {
+      fprintf (stderr, "%s: out of memory for %d polygons\n",
+               progname, need);
+      exit (1);
+    }
+  return array;
+}
+
+
+/* The gradient of the field at a grid point, pointing outward, with the
+   same scale as do_function_normal().
+ */
+static void
+mc_gradient (const struct mc_job *job, int x, int y, int z, GLfloat *n)
+{
+  int gs = job->grid_size;
+  const double *f = job->field + (z * gs + y) * gs + x;
+  int planesize = gs * gs;
+
+# define DIFF(P,D) ((P) == 0      ? f[0]  - f[D] :	\
+                    (P) == gs - 1 ? f[-D] - f[0] :	\
+                    (f[-D] - f[D]) / 2)
+  n[0] = DIFF (x, 1);
+  n[1] = DIFF (y, gs);
+  n[2] = DIFF (z, planesize);
+# undef DIFF
+}
+
+
+/* Adds the vertex where the surface crosses the grid edge that starts at
+   the given point, and returns its index.
+ */
+static GLuint
+mc_edge_vertex (const struct mc_job *job, struct mc_mesh *m,
+                int x, int y, int z, int axis)
+{
+  int gs = job->grid_size;
+  int step = (axis == 0 ? 1 : axis == 1 ? gs : gs * gs);
+  const double *f = job->field + (z * gs + y) * gs + x;
+  double v0 = f[0], v1 = f[step];
+  double iso = job->isolevel;
+  double mu;
+  GLfloat *v;
+
+  /* Same as interp_vertex(). */
+  if (ABS(iso-v0) < 0.00001)
+    mu = 0;
+  else if (ABS(iso-v1) < 0.00001)
+    mu = 1;
+  else if (ABS(v0-v1) < 0.00001)
+    mu = 0;
+  else
+    mu = (iso - v0) / (v1 - v0);
+
+  m->verts = (GLfloat *)
+    mc_grow (m->verts, &m->verts_size, 3 * sizeof(*m->verts), m->nverts+1);
+  v = m->verts + m->nverts * 3;
+  v[0] = x; v[1] = y; v[2] = z;
+  v[axis] += mu;
+
+  if (job->smooth_p)
+    {
+      GLfloat n0[3], n1[3];
+      int i;
+      m->norms = (GLfloat *)
+        mc_grow (m->norms, &m->norms_size, 3 * sizeof(*m->norms),
+                 m->nverts+1);
+      mc_gradient (job, x, y, z, n0);
+      mc_gradient (job, x + (axis == 0), y + (axis == 1), z + (axis == 2),
+                   n1);
+      for (i = 0; i < 3; i++)
+        m->norms[m->nverts * 3 + i] = n0[i] + mu * (n1[i] - n0[i]);
+    }
+
+  return m->nverts++;
+}
+
+
+static void
+mc_fill_field (struct mc_job *job, unsigned index, unsigned count)
+{
+  int gs = job->grid_size;
+  int z0 = gs * index / count;
+  int z1 = gs * (index + 1) / count;
+  double *f = job->field + z0 * gs * gs;
+  int x, y, z;
+  for (z = z0; z < z1; z++)
+    if (job->compute_layer_fn)
+      {
+        job->compute_layer_fn (z, f, job->closure2);
+        f += gs * gs;
+      }
+    else
+      for (y = 0; y < gs; y++)
+        for (x = 0; x < gs; x++)
+          *f++ = job->compute_fn (x, y, z, job->closure2);
+}
+
+
+static void
+mc_polygonize (struct mc_job *job, unsigned index, unsigned count)
+{
+  int gs = job->grid_size;
+  int planesize = gs * gs;
+  int z0 = (gs - 1) * index / count;
+  int z1 = (gs - 1) * (index + 1) / count;
+  struct mc_mesh *m = &job->meshes[index];
+  GLint *cache, *xe[2], *ye[2], *ze;
+  int x, y, z, i;
+
+  m->nverts = m->ntris = 0;
+  if (z0 >= z1) return;
+
+  /* Vertex indexes of the X and Y edges on the bottom and top layers of
+     this row of cubes, and of the Z edges between them; -1 if unknown.
+   */
+  cache = (GLint *) malloc (5 * planesize * sizeof(*cache));
+  if (!cache)
+    {
+      fprintf (stderr, "%s: out of memory for %dx%d grid\n",
+               progname, gs, gs);
+      exit (1);
+    }
+  xe[0] = cache;
+  ye[0] = cache + planesize;
+  xe[1] = cache + planesize * 2;
+  ye[1] = cache + planesize * 3;
+  ze    = cache + planesize * 4;
+  for (i = 0; i < planesize * 4; i++)
+    cache[i] = -1;
+
+  for (z = z0; z < z1; z++)
+    {
+      const double *lo = job->field + z * planesize;
+      const double *hi = lo + planesize;
+
+      if (z > z0)
+        {
+          GLint *t;
+          t = xe[0]; xe[0] = xe[1]; xe[1] = t;
+          t = ye[0]; ye[0] = ye[1]; ye[1] = t;
+          for (i = 0; i < planesize; i++)
+            xe[1][i] = ye[1][i] = -1;
+        }
+      for (i = 0; i < planesize; i++)
+        ze[i] = -1;
+
+      for (y = 0; y < gs - 1; y++)
+        for (x = 0; x < gs - 1; x++)
+          {
+            int o = y * gs + x;
+            double iso = job->isolevel;
+            int cubeindex = 0;
+            int edges;
+            GLuint vertlist[12];
+
+            if (lo[o]        < iso) cubeindex |= 1;
+            if (lo[o+1]      < iso) cubeindex |= 2;
+            if (lo[o+gs+1]   < iso) cubeindex |= 4;
+            if (lo[o+gs]     < iso) cubeindex |= 8;
+            if (hi[o]        < iso) cubeindex |= 16;
+            if (hi[o+1]      < iso) cubeindex |= 32;
+            if (hi[o+gs+1]   < iso) cubeindex |= 64;
+            if (hi[o+gs]     < iso) cubeindex |= 128;
+
+            edges = edgeTable[cubeindex];
+            if (edges == 0) continue;
+
+            for (i = 0; i < 12; i++)
+              if (edges & (1 << i))
+                {
+                  int ex = x + edge_coords[i].dx;
+                  int ey = y + edge_coords[i].dy;
+                  int axis = edge_coords[i].axis;
+                  GLint *c = (axis == 2 ? ze :
+                              axis == 0 ? xe[(int) edge_coords[i].dz] :
+                                          ye[(int) edge_coords[i].dz]);
+                  c += ey * gs + ex;
+                  if (*c < 0)
+                    *c = mc_edge_vertex (job, m, ex, ey,
+                                         z + edge_coords[i].dz, axis);
+                  vertlist[i] = *c;
+                }
+
+            for (i = 0; triTable[cubeindex][i] != -1; i += 3)
+              {
+                GLuint *t;
+                m->tris = (GLuint *)
+                  mc_grow (m->tris, &m->tris_size, 3 * sizeof(*m->tris),
+                           m->ntris + 1);
+                t = m->tris + m->ntris * 3;
+                t[0] = vertlist[triTable[cubeindex][i  ]];
+                t[1] = vertlist[triTable[cubeindex][i+1]];
+                t[2] = vertlist[triTable[cubeindex][i+2]];
+                m->ntris++;
+              }
+          }
+    }
+
+  free (cache);
+}
+
+
+/* for threadpool_run() */
+static void
+mc_thread (void *closure, unsigned index, unsigned count)
+{
+  struct mc_job *job = (struct mc_job *) closure;
+  if (job->polygonize_p)
+    mc_polygonize (job, index, count);
+  else
+    mc_fill_field (job, index, count);
+}
+
+
+static void
+mc_draw_mesh (const struct mc_mesh *m, int wireframe_p, int smooth_p)
+{
+  int i, j;
+
+  if (m->ntris == 0) return;
+
+# ifndef HAVE_JWZGLES  /* jwzgles display lists don't know about these */
+  if (smooth_p && !wireframe_p)
+    {
+      glEnableClientState (GL_VERTEX_ARRAY);
+      glEnableClientState (GL_NORMAL_ARRAY);
+      glVertexPointer (3, GL_FLOAT, 0, m->verts);
+      glNormalPointer (GL_FLOAT, 0, m->norms);
+      glDrawElements (GL_TRIANGLES, m->ntris * 3, GL_UNSIGNED_INT, m->tris);
+      glDisableClientState (GL_NORMAL_ARRAY);
+      glDisableClientState (GL_VERTEX_ARRAY);
+      return;
+    }
+# endif /* !HAVE_JWZGLES */
+
+  /* Faceted normals can't be shared between triangles, so draw those
+     (and wireframes) the old way.
+   */
+  if (!wireframe_p)
+    glBegin (GL_TRIANGLES);
+  for (i = 0; i < m->ntris; i++)
+    {
+      const GLuint *t = m->tris + i * 3;
+      const GLfloat *p0 = m->verts + t[0] * 3;
+      const GLfloat *p1 = m->verts + t[1] * 3;
+      const GLfloat *p2 = m->verts + t[2] * 3;
+
+      if (wireframe_p) glBegin (GL_LINE_LOOP);
+      if (!smooth_p)
+        do_normal (p0[0], p0[1], p0[2],
+                   p1[0], p1[1], p1[2],
+                   p2[0], p2[1], p2[2]);
+      for (j = 0; j < 3; j++)
+        {
+          if (smooth_p)
+            glNormal3fv (m->norms + t[j] * 3);
+          glVertex3fv (m->verts + t[j] * 3);
+        }
+      if (wireframe_p) glEnd ();
+    }
+  if (!wireframe_p)
+    glEnd ();
+}
+
+
+/* Runs the job, and draws the result.
+ */
+static void
+mc_run (threadpool *pool, struct mc_job *job, int wireframe_p,
+        void * (*init_fn) (double grid_size, void *closure1),
+        void   (*free_fn) (void *closure2),
+        void *closure1,
+        unsigned long *polygon_count)
+{
+  int grid_size = job->grid_size;
+  unsigned count = (pool ? threadpool_count (pool) : 1);
+  unsigned long polys = 0;
+  unsigned i;
+
+  job->field = (double *)
+    malloc (grid_size * grid_size * grid_size * sizeof(*job->field));
+  job->meshes = (struct mc_mesh *) calloc (count, sizeof(*job->meshes));
+  if (!job->field || !job->meshes)
+    {
+      fprintf (stderr, "%s: out of memory for %dx%dx%d grid\n",
+               progname, grid_size, grid_size, grid_size);
+      exit (1);
+    }
+
+  if (init_fn)
+    job->closure2 = init_fn (grid_size, closure1);
+
+  for (job->polygonize_p = 0; job->polygonize_p < 2; job->polygonize_p++)
+    if (pool)
+      threadpool_run (pool, mc_thread, job);
+    else
+      mc_thread (job, 0, 1);
+
+  glFrontFace(GL_CCW);
+  for (i = 0; i < count; i++)
+    {
+      struct mc_mesh *m = &job->meshes[i];
+      mc_draw_mesh (m, wireframe_p, job->smooth_p);
+      polys += m->ntris;
+      if (m->verts) free (m->verts);
+      if (m->norms) free (m->norms);
+      if (m->tris)  free (m->tris);
+    }
+
+  free (job->meshes);
+  free (job->field);
+
+  if (free_fn)
+    free_fn (job->closure2);
+
+  if (polygon_count)
+    *polygon_count = polys;
+}
+
+
+void
+marching_cubes_threaded (threadpool *pool,
+                         int grid_size,
+                         double isolevel,
+                         int wireframe_p,
+                         int smooth_p,
+
+                         void * (*init_fn)    (double grid_size,
+                                               void *closure1),
+                         double (*compute_fn) (double x, double y, double z,
+                                               void *closure2),
+                         void   (*free_fn)    (void *closure2),
+                         void *closure1,
+
+                         unsigned long *polygon_count)
+{
+  struct mc_job job;
+  memset (&job, 0, sizeof(job));
+  job.grid_size  = grid_size;
+  job.isolevel   = isolevel;
+  job.smooth_p   = smooth_p;
+  job.compute_fn = compute_fn;
+  mc_run (pool, &job, wireframe_p, init_fn, free_fn, closure1,
+          polygon_count);
+}
+
+
+void
+marching_cubes_layers (threadpool *pool,
+                       int grid_size,
+                       double isolevel,
+                       int wireframe_p,
+                       int smooth_p,
+
+                       void * (*init_fn)  (double grid_size, void *closure1),
+                       void (*compute_layer_fn) (int z, double *values,
+                                                 void *closure2),
+                       void   (*free_fn)  (void *closure2),
+                       void *closure1,
+
+                       unsigned long *polygon_count)
+{
+  struct mc_job job;
+  memset (&job, 0, sizeof(job));
+  job.grid_size  = grid_size;
+  job.isolevel   = isolevel;
+  job.smooth_p   = smooth_p;
+  job.compute_layer_fn = compute_layer_fn;
+  mc_run (pool, &job, wireframe_p, init_fn, free_fn, closure1,
+          polygon_count);
+}
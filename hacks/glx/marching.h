@@ -13,6 +13,8 @@
 #ifndef __MARCHING_H__
 #define __MARCHING_H__
 
+#include "thread_util.h"
+
 /* Given a function capable of generating a value at any XYZ position,
    creates OpenGL faces for the solids defined.
 
@@ -45,4 +47,50 @@ marching_cubes (int grid_size,     /* density of the mesh */
 
                 unsigned long *polygon_count);
 
+/* The same, but faster: the field is computed into an array by all of
+   the threads in the pool (or just by this one, if pool is 0), and then
+   turned into an indexed mesh that shares each vertex between the cubes
+   that touch it.  Vertex normals are taken from the gradient of the
+   computed grid, so compute_fn is only ever called on grid points; but
+   it must be safe to call from several threads at once.
+
+   The mesh is drawn with vertex arrays, which may be compiled into a
+   display list.
+*/
+extern void
+marching_cubes_threaded (threadpool *pool,
+                         int grid_size,
+                         double isolevel,
+                         int wireframe_p,
+                         int smooth_p,
+
+                         void * (*init_fn)    (double grid_size,
+                                               void *closure1),
+                         double (*compute_fn) (double x, double y, double z,
+                                               void *closure2),
+                         void   (*free_fn)    (void *closure2),
+                         void *closure1,
+
+                         unsigned long *polygon_count);
+
+/* The same again, but the field is computed a whole XY layer at a time:
+   compute_layer_fn must fill in values[y * grid_size + x] for every X
+   and Y on the given Z layer.  Several layers may be computed at once,
+   on different threads.
+*/
+extern void
+marching_cubes_layers (threadpool *pool,
+                       int grid_size,
+                       double isolevel,
+                       int wireframe_p,
+                       int smooth_p,
+
+                       void * (*init_fn)  (double grid_size, void *closure1),
+                       void (*compute_layer_fn) (int z, double *values,
+                                                 void *closure2),
+                       void   (*free_fn)  (void *closure2),
+                       void *closure1,
+
+                       unsigned long *polygon_count);
+
 #endif /* __MARCHING_H__ */
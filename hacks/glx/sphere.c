@@ -35,9 +35,28 @@
 #include "sphere.h"
 
 typedef struct { GLfloat x, y, z; } XYZ;
+typedef struct { XYZ p; XYZ n; GLfloat s, t; } vertex;
 
-int
-unit_sphere (int stacks, int slices, int wire_p)
+
+/* Spheres are usually drawn over and over with the same arguments, so
+   the vertex arrays are computed once and kept around.  The most recently
+   used ones are at the front of the list.
+ */
+typedef struct sphere_mesh sphere_mesh;
+struct sphere_mesh {
+  int stacks, slices, wire_p;
+  int mode, count, polys;
+  vertex *array;
+  sphere_mesh *next;
+};
+
+#define MAX_CACHED_SPHERES 32
+
+static sphere_mesh *sphere_cache = 0;
+
+
+static sphere_mesh *
+make_sphere_mesh (int stacks, int slices, int wire_p)
 {
   int polys = 0;
   int i,j;
@@ -51,7 +70,8 @@ unit_sphere (int stacks, int slices, int wire_p)
   int mode = (wire_p ? GL_LINE_STRIP : GL_TRIANGLE_STRIP);
 
   int arraysize, out;
-  struct { XYZ p; XYZ n; GLfloat s, t; } *array;
+  vertex *array;
+  sphere_mesh *m;
 
   if (r < 0)
     r = -r;
@@ -59,7 +79,7 @@ unit_sphere (int stacks, int slices, int wire_p)
     slices = -slices;
 
   arraysize = (stacks+1) * (slices+1) * (wire_p ? 4 : 2);
-  array = (void *) calloc (arraysize, sizeof(*array));
+  array = (vertex *) calloc (arraysize, sizeof(*array));
   if (! array) abort();
   out = 0;
 
@@ -122,17 +142,60 @@ unit_sphere (int stacks, int slices, int wire_p)
 
  END:
 
+  m = (sphere_mesh *) calloc (1, sizeof(*m));
+  if (! m) abort();
+  m->mode  = mode;
+  m->count = out;
+  m->polys = polys;
+  m->array = array;
+  return m;
+}
+
+
+int
+unit_sphere (int stacks, int slices, int wire_p)
+{
+  sphere_mesh *m, *prev = 0, *prev2 = 0;
+  int n = 0;
+
+  for (m = sphere_cache; m; prev2 = prev, prev = m, m = m->next, n++)
+    if (m->stacks == stacks && m->slices == slices && m->wire_p == wire_p)
+      break;
+
+  if (m)
+    {
+      if (prev)			/* move it to the front */
+        {
+          prev->next = m->next;
+          m->next = sphere_cache;
+          sphere_cache = m;
+        }
+    }
+  else
+    {
+      if (n >= MAX_CACHED_SPHERES)	/* discard the least recently used */
+        {
+          prev2->next = 0;
+          free (prev->array);
+          free (prev);
+        }
+      m = make_sphere_mesh (stacks, slices, wire_p);
+      m->stacks = stacks;
+      m->slices = slices;
+      m->wire_p = wire_p;
+      m->next = sphere_cache;
+      sphere_cache = m;
+    }
+
   glEnableClientState (GL_VERTEX_ARRAY);
   glEnableClientState (GL_NORMAL_ARRAY);
   glEnableClientState (GL_TEXTURE_COORD_ARRAY);
 
-  glVertexPointer   (3, GL_FLOAT, sizeof(*array), &array[0].p);
-  glNormalPointer   (   GL_FLOAT, sizeof(*array), &array[0].n);
-  glTexCoordPointer (2, GL_FLOAT, sizeof(*array), &array[0].s);
-
-  glDrawArrays (mode, 0, out);
+  glVertexPointer   (3, GL_FLOAT, sizeof(*m->array), &m->array[0].p);
+  glNormalPointer   (   GL_FLOAT, sizeof(*m->array), &m->array[0].n);
+  glTexCoordPointer (2, GL_FLOAT, sizeof(*m->array), &m->array[0].s);
 
-  free (array);
+  glDrawArrays (m->mode, 0, m->count);
 
-  return polys;
+  return m->polys;
 }
@@ -54,6 +54,7 @@ static const char sccsid[] = "@(#)sproingies.c	4.04 97/07/28 xlockmore";
 
 #define FIRST_FRAME          0
 #define LAST_FRAME           5 
+#define BOOM_MODEL           (LAST_FRAME + 1)
 /*-
  * The sproingies have six "real" frames, (s1_1 to s1_6) that show a
  * sproingie jumping off a block, headed down and to the right. 
@@ -76,6 +77,7 @@ typedef struct {
 	const struct gllist *sproingies[6];
 	const struct gllist *SproingieBoom;
 	GLuint TopsSides;
+	GLuint Models;		/* display lists of sproingies[] and the boom */
 	struct sPosColor *positions;
 } sp_instance;
 
@@ -136,6 +138,39 @@ build_TopsSides(int wireframe)
 	return (dl_num);
 }
 
+/* The models are drawn many times per frame, so compile them into display
+   lists rather than sending their vertex arrays down every time. */
+static      GLuint
+build_Models(sp_instance * si)
+{
+	GLuint      dl_num;
+	int         t;
+
+	dl_num = glGenLists(BOOM_MODEL + 1);
+	if (!dl_num)
+		return (0);	/* 0 means out of display lists. */
+
+	for (t = 0; t < BOOM_MODEL; ++t) {
+		glNewList(dl_num + t, GL_COMPILE);
+		renderList(si->sproingies[t], si->wireframe);
+		glEndList();
+	}
+	glNewList(dl_num + BOOM_MODEL, GL_COMPILE);
+	renderList(si->SproingieBoom, si->wireframe);
+	glEndList();
+	return (dl_num);
+}
+
+static void
+DrawModel(sp_instance * si, int n)
+{
+	if (si->Models)
+		glCallList(si->Models + n);
+	else
+		renderList((n == BOOM_MODEL ? si->SproingieBoom : si->sproingies[n]),
+				   si->wireframe);
+}
+
 static void
 LayGround(int sx, int sy, int sz, int width, int height, sp_instance * si)
 {
@@ -545,7 +580,7 @@ RenderSproingie(int t, sp_instance * si)
 #endif
 
 /**		glCallList(si->sproingies[0]);*/
-/**/	renderList(si->sproingies[0], si->wireframe);
+		DrawModel(si, 0);
 		glDisable(GL_CLIP_PLANE0);
 	} else if (thisSproingie->frame >= BOOM_FRAME) {
 		glTranslatef((GLfloat) (thisSproingie->x) + 0.5,
@@ -565,7 +600,7 @@ RenderSproingie(int t, sp_instance * si)
  * PURIFY 4.0.1 reports an unitialized memory read on the next line when using
  * MesaGL 2.2.  This has been tracked to MesaGL 2.2 src/points.c line 313. */
 /**		glCallList(si->SproingieBoom);*/
-/**/	renderList(si->SproingieBoom, si->wireframe);
+		DrawModel(si, BOOM_MODEL);
 		glPointSize(1.0);
 		if (!si->wireframe) {
 			glEnable(GL_LIGHTING);
@@ -596,7 +631,7 @@ RenderSproingie(int t, sp_instance * si)
 		}
 /* 	} */
 /**		glCallList(si->sproingies[thisSproingie->frame]);*/
-/**/	renderList(si->sproingies[thisSproingie->frame], si->wireframe);
+		DrawModel(si, thisSproingie->frame);
 
 		/* Every 6 frame cycle... */
 		if (thisSproingie->frame == LAST_FRAME) {
@@ -776,6 +811,10 @@ CleanupSproingies(int screen)
 	if (si->TopsSides) {
 		glDeleteLists(si->TopsSides, 2);
 	}
+	if (si->Models) {
+		glDeleteLists(si->Models, BOOM_MODEL + 1);
+		si->Models = 0;
+	}
 	if (si->positions) {
 		(void) free((void *) (si->positions));
 		si->positions = NULL;
@@ -892,6 +931,9 @@ InitSproingies(int wfmode, int grnd, int mspr, int smrtspr,
 	si->sproingies[5]=s1_6;
 	si->SproingieBoom=s1_b;
 
+	if (!(si->Models = build_Models(si)))
+		(void) fprintf(stderr, "build_Models\n");
+
 	if (si->wireframe) {
 		glShadeModel(GL_FLAT);
 		glDisable(GL_LIGHTING);
@@ -17,6 +17,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef HAVE_COCOA
 # include <GL/gl.h>
@@ -29,10 +30,42 @@
 #include "tube.h"
 
 typedef struct { GLfloat x, y, z; } XYZ;
+typedef struct { XYZ p; XYZ n; GLfloat s, t; } vertex;
 
 
-static int
-unit_tube (int faces, int smooth, int caps_p, int wire_p)
+/* Tubes and cones are usually drawn over and over with the same number
+   of faces, so the vertex arrays of the unit shapes are computed once
+   and kept around.  The side walls and each end cap are drawn from
+   consecutive ranges of the same array.  The most recently used meshes
+   are at the front of the list.
+ */
+typedef struct tube_mesh tube_mesh;
+struct tube_mesh {
+  int cone_p, faces, smooth, caps_p, wire_p;
+  int polys;
+  int nparts;
+  struct { int mode, first, count; } parts[3];
+  vertex *array;
+  tube_mesh *next;
+};
+
+#define MAX_CACHED_TUBES 32
+
+static tube_mesh *tube_cache = 0;
+
+
+static void
+add_part (tube_mesh *m, int mode, int first, int count)
+{
+  m->parts[m->nparts].mode  = mode;
+  m->parts[m->nparts].first = first;
+  m->parts[m->nparts].count = count;
+  m->nparts++;
+}
+
+
+static void
+make_unit_tube (tube_mesh *m, int faces, int smooth, int caps_p, int wire_p)
 {
   int i;
   int polys = 0;
@@ -42,11 +75,11 @@ unit_tube (int faces, int smooth, int caps_p, int wire_p)
   GLfloat x, y, x0=0, y0=0;
   int z = 0;
 
-  int arraysize, out;
-  struct { XYZ p; XYZ n; GLfloat s, t; } *array;
+  int arraysize, out, first;
+  vertex *array;
 
-  arraysize = (faces+1) * 6;
-  array = (void *) calloc (arraysize, sizeof(*array));
+  arraysize = (faces+1) * 6 + (caps_p ? (faces+3) * 2 : 0);
+  array = (vertex *) calloc (arraysize, sizeof(*array));
   if (! array) abort();
   out = 0;
 
@@ -127,18 +160,9 @@ unit_tube (int faces, int smooth, int caps_p, int wire_p)
       if (out >= arraysize) abort();
     }
 
-  glEnableClientState (GL_VERTEX_ARRAY);
-  glEnableClientState (GL_NORMAL_ARRAY);
-  glEnableClientState (GL_TEXTURE_COORD_ARRAY);
-
-  glVertexPointer   (3, GL_FLOAT, sizeof(*array), &array[0].p);
-  glNormalPointer   (   GL_FLOAT, sizeof(*array), &array[0].n);
-  glTexCoordPointer (2, GL_FLOAT, sizeof(*array), &array[0].s);
-
-  glFrontFace(GL_CCW);
-  glDrawArrays ((wire_p ? GL_LINES :
-                 (smooth ? GL_TRIANGLE_STRIP : GL_TRIANGLES)),
-                0, out);
+  add_part (m, (wire_p ? GL_LINES :
+                (smooth ? GL_TRIANGLE_STRIP : GL_TRIANGLES)),
+            0, out);
 
 
   /* End caps
@@ -146,18 +170,14 @@ unit_tube (int faces, int smooth, int caps_p, int wire_p)
   if (caps_p)
     for (z = 0; z <= 1; z++)
       {
-        out = 0;
-        if (! wire_p)
-          {
-            array[out].p.x = 0;
-            array[out].p.y = z;
-            array[out].p.z = 0;
+        vertex center;
+        memset (&center, 0, sizeof(center));
+        center.p.y = z;
+        center.n.y = (z == 0 ? -1 : 1);
 
-            array[out].n.x = 0;
-            array[out].n.y = (z == 0 ? -1 : 1);
-            array[out].n.z = 0;
-            out++;
-          }
+        first = out;
+        if (! wire_p)
+          array[out++] = center;
 
         th = 0;
         for (i = (z == 0 ? 0 : faces);
@@ -166,7 +186,7 @@ unit_tube (int faces, int smooth, int caps_p, int wire_p)
             GLfloat x = cos (th);
             GLfloat y = sin (th);
 
-            array[out] = array[0];  /* same normal and texture */
+            array[out] = center;  /* same normal and texture */
             array[out].p.x = x;
             array[out].p.y = z;
             array[out].p.z = y;
@@ -178,22 +198,17 @@ unit_tube (int faces, int smooth, int caps_p, int wire_p)
             if (out >= arraysize) abort();
           }
 
-        glVertexPointer   (3, GL_FLOAT, sizeof(*array), &array[0].p);
-        glNormalPointer   (   GL_FLOAT, sizeof(*array), &array[0].n);
-        glTexCoordPointer (2, GL_FLOAT, sizeof(*array), &array[0].s);
-
-        glFrontFace(GL_CCW);
-        glDrawArrays ((wire_p ? GL_LINE_LOOP : GL_TRIANGLE_FAN), 0, out);
+        add_part (m, (wire_p ? GL_LINE_LOOP : GL_TRIANGLE_FAN),
+                  first, out - first);
       }
 
-  free(array);
-
-  return polys;
+  m->array = array;
+  m->polys = polys;
 }
 
 
-static int
-unit_cone (int faces, int smooth, int cap_p, int wire_p)
+static void
+make_unit_cone (tube_mesh *m, int faces, int smooth, int cap_p, int wire_p)
 {
   int i;
   int polys = 0;
@@ -202,11 +217,11 @@ unit_cone (int faces, int smooth, int cap_p, int wire_p)
   GLfloat th;
   GLfloat x, y, x0, y0;
 
-  int arraysize, out;
-  struct { XYZ p; XYZ n; GLfloat s, t; } *array;
+  int arraysize, out, first;
+  vertex *array;
 
-  arraysize = (faces+1) * 3;
-  array = (void *) calloc (arraysize, sizeof(*array));
+  arraysize = (faces+1) * 3 + (cap_p ? faces+2 : 0);
+  array = (vertex *) calloc (arraysize, sizeof(*array));
   if (! array) abort();
   out = 0;
 
@@ -271,42 +286,27 @@ unit_cone (int faces, int smooth, int cap_p, int wire_p)
       polys++;
     }
 
-  glEnableClientState (GL_VERTEX_ARRAY);
-  glEnableClientState (GL_NORMAL_ARRAY);
-  glEnableClientState (GL_TEXTURE_COORD_ARRAY);
-
-  glVertexPointer   (3, GL_FLOAT, sizeof(*array), &array[0].p);
-  glNormalPointer   (   GL_FLOAT, sizeof(*array), &array[0].n);
-  glTexCoordPointer (2, GL_FLOAT, sizeof(*array), &array[0].s);
-
-  glFrontFace(GL_CCW);
-  glDrawArrays ((wire_p ? GL_LINES : GL_TRIANGLES), 0, out);
+  add_part (m, (wire_p ? GL_LINES : GL_TRIANGLES), 0, out);
 
 
   /* End cap
    */
   if (cap_p)
     {
-      out = 0;
+      vertex center;
+      memset (&center, 0, sizeof(center));
+      center.n.y = -1;
 
+      first = out;
       if (! wire_p)
-        {
-          array[out].p.x = 0;
-          array[out].p.y = 0;
-          array[out].p.z = 0;
-
-          array[out].n.x = 0;
-          array[out].n.y = -1;
-          array[out].n.z = 0;
-          out++;
-        }
+        array[out++] = center;
 
       for (i = 0, th = 0; i <= faces; i++)
         {
           GLfloat x = cos (th);
           GLfloat y = sin (th);
 
-          array[out] = array[0];  /* same normal and texture */
+          array[out] = center;  /* same normal and texture */
           array[out].p.x = x;
           array[out].p.y = 0;
           array[out].p.z = y;
@@ -316,17 +316,71 @@ unit_cone (int faces, int smooth, int cap_p, int wire_p)
           if (out >= arraysize) abort();
         }
 
-      glVertexPointer   (3, GL_FLOAT, sizeof(*array), &array[0].p);
-      glNormalPointer   (   GL_FLOAT, sizeof(*array), &array[0].n);
-      glTexCoordPointer (2, GL_FLOAT, sizeof(*array), &array[0].s);
+      add_part (m, (wire_p ? GL_LINE_LOOP : GL_TRIANGLE_FAN),
+                first, out - first);
+    }
+
+  m->array = array;
+  m->polys = polys;
+}
 
-      glFrontFace(GL_CCW);
-      glDrawArrays ((wire_p ? GL_LINE_LOOP : GL_TRIANGLE_FAN), 0, out);
+
+static int
+unit_tube_or_cone (int faces, int smooth, int caps_p, int wire_p, int cone_p)
+{
+  tube_mesh *m, *prev = 0, *prev2 = 0;
+  int i, n = 0;
+
+  for (m = tube_cache; m; prev2 = prev, prev = m, m = m->next, n++)
+    if (m->cone_p == cone_p && m->faces == faces && m->smooth == smooth &&
+        m->caps_p == caps_p && m->wire_p == wire_p)
+      break;
+
+  if (m)
+    {
+      if (prev)			/* move it to the front */
+        {
+          prev->next = m->next;
+          m->next = tube_cache;
+          tube_cache = m;
+        }
+    }
+  else
+    {
+      if (n >= MAX_CACHED_TUBES)	/* discard the least recently used */
+        {
+          prev2->next = 0;
+          free (prev->array);
+          free (prev);
+        }
+      m = (tube_mesh *) calloc (1, sizeof(*m));
+      if (! m) abort();
+      m->cone_p = cone_p;
+      m->faces  = faces;
+      m->smooth = smooth;
+      m->caps_p = caps_p;
+      m->wire_p = wire_p;
+      if (cone_p)
+        make_unit_cone (m, faces, smooth, caps_p, wire_p);
+      else
+        make_unit_tube (m, faces, smooth, caps_p, wire_p);
+      m->next = tube_cache;
+      tube_cache = m;
     }
 
-  free (array);
+  glEnableClientState (GL_VERTEX_ARRAY);
+  glEnableClientState (GL_NORMAL_ARRAY);
+  glEnableClientState (GL_TEXTURE_COORD_ARRAY);
 
-  return polys;
+  glVertexPointer   (3, GL_FLOAT, sizeof(*m->array), &m->array[0].p);
+  glNormalPointer   (   GL_FLOAT, sizeof(*m->array), &m->array[0].n);
+  glTexCoordPointer (2, GL_FLOAT, sizeof(*m->array), &m->array[0].s);
+
+  glFrontFace(GL_CCW);
+  for (i = 0; i < m->nparts; i++)
+    glDrawArrays (m->parts[i].mode, m->parts[i].first, m->parts[i].count);
+
+  return m->polys;
 }
 
 
@@ -366,10 +420,7 @@ tube_1 (GLfloat x1, GLfloat y1, GLfloat z1,
       glScalef (1, 1+c+c, 1);
     }
 
-  if (cone_p)
-    polys = unit_cone (faces, smooth, caps_p, wire_p);
-  else
-    polys = unit_tube (faces, smooth, caps_p, wire_p);
+  polys = unit_tube_or_cone (faces, smooth, caps_p, wire_p, cone_p);
 
   glPopMatrix();
   return polys;
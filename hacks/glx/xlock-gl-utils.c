@@ -32,10 +32,22 @@
 static XErrorHandler orig_ehandler = 0;
 static Bool got_error = 0;
 
+/* When one process is drawing on several windows, all of their contexts
+   share one set of textures and display lists, so that the data can be
+   kept by the server once rather than once per window.  (Names from
+   glGenTextures() and glGenLists() stay unique across them, so hacks
+   that don't know about this aren't affected.)  This is the context
+   of the first window, and contexts with the same visual share it.
+ */
+static GLXContext shared_context = 0;
+static VisualID shared_visual = 0;
+static int shared_screen = -1;
+
 static int
 BadValue_ehandler (Display *dpy, XErrorEvent *error)
 {
-  if (error->error_code == BadValue)
+  if (error->error_code == BadValue ||
+      (shared_context && error->error_code == BadMatch))
     {
       got_error = True;
       return 0;
@@ -53,6 +65,7 @@ init_GL(ModeInfo * mi)
   Screen *screen = mi->xgwa.screen;
   Visual *visual = mi->xgwa.visual;
   GLXContext glx_context = 0;
+  GLXContext share = shared_context;
   XVisualInfo vi_in, *vi_out;
   int out_count;
 
@@ -62,15 +75,31 @@ init_GL(ModeInfo * mi)
 			   &vi_in, &out_count);
   if (! vi_out) abort ();
 
-  {
-    XSync (dpy, False);
-    orig_ehandler = XSetErrorHandler (BadValue_ehandler);
-    glx_context = glXCreateContext (dpy, vi_out, 0, GL_TRUE);
-    XSync (dpy, False);
-    XSetErrorHandler (orig_ehandler);
-    if (got_error)
-      glx_context = 0;
-  }
+  if (shared_context &&
+      (shared_screen != vi_in.screen || shared_visual != vi_in.visualid))
+    share = 0;
+
+  while (1)
+    {
+      XSync (dpy, False);
+      orig_ehandler = XSetErrorHandler (BadValue_ehandler);
+      glx_context = glXCreateContext (dpy, vi_out, share, GL_TRUE);
+      XSync (dpy, False);
+      XSetErrorHandler (orig_ehandler);
+      if (got_error)
+        glx_context = 0;
+      got_error = False;
+
+      if (glx_context || !share) break;
+      share = 0;   /* couldn't share with it?  Try again without. */
+    }
+
+  if (glx_context && !shared_context)
+    {
+      shared_context = glx_context;
+      shared_screen = vi_in.screen;
+      shared_visual = vi_in.visualid;
+    }
 
   XFree((char *) vi_out);
 
@@ -217,3 +246,74 @@ xlockmore_validate_gl_visual (Screen *screen, const char *name, Visual *visual)
 {
   return validate_gl_visual (stderr, screen, name, visual);
 }
+
+
+/* Callback in xscreensaver_function_table, via xlockmore.c.
+   Reads back the frame that was just drawn.  The program's own context
+   is still current, since draw_cb has only just returned.
+ */
+XImage *
+xlockmore_gl_snapshot (Display *dpy, Window window, void *closure)
+{
+  XWindowAttributes xgwa;
+  XImage *image;
+  unsigned char *rgba;
+  unsigned long masks[3];
+  int shifts[3], bits[3];
+  GLint align, buffer;
+  int x, y, i;
+
+  if (! glXGetCurrentContext())
+    return 0;
+
+  XGetWindowAttributes (dpy, window, &xgwa);
+  image = XCreateImage (dpy, xgwa.visual, xgwa.depth, ZPixmap, 0, 0,
+                        xgwa.width, xgwa.height, 32, 0);
+  rgba = (unsigned char *) malloc (xgwa.width * xgwa.height * 4);
+  if (!image || !rgba)
+    {
+      if (image) XDestroyImage (image);
+      free (rgba);
+      return 0;
+    }
+  image->data = (char *) malloc (image->height * image->bytes_per_line);
+
+  glFinish();
+  glGetIntegerv (GL_PACK_ALIGNMENT, &align);
+  glGetIntegerv (GL_READ_BUFFER, &buffer);
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  glReadBuffer (GL_FRONT);
+  glReadPixels (0, 0, xgwa.width, xgwa.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                rgba);
+  glReadBuffer (buffer);
+  glPixelStorei (GL_PACK_ALIGNMENT, align);
+
+  masks[0] = image->red_mask;
+  masks[1] = image->green_mask;
+  masks[2] = image->blue_mask;
+  for (i = 0; i < 3; i++)
+    {
+      unsigned long m = masks[i];
+      shifts[i] = bits[i] = 0;
+      if (!m) continue;
+      while (! (m & 1)) { m >>= 1; shifts[i]++; }
+      while (m & 1)     { m >>= 1; bits[i]++; }
+      if (bits[i] > 8) bits[i] = 8;
+    }
+
+  /* GL rows go from the bottom up. */
+  for (y = 0; y < xgwa.height; y++)
+    {
+      const unsigned char *in = rgba + (xgwa.height - y - 1) * xgwa.width * 4;
+      for (x = 0; x < xgwa.width; x++, in += 4)
+        {
+          unsigned long p = 0;
+          for (i = 0; i < 3; i++)
+            p |= (unsigned long) (in[i] >> (8 - bits[i])) << shifts[i];
+          XPutPixel (image, x, y, p);
+        }
+    }
+
+  free (rgba);
+  return image;
+}
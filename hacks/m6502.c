@@ -46,6 +46,9 @@ struct state {
   Window window;
   
   Bit8 pixels[32][32];
+  Bit32 dirty[32];/* pixels not yet painted into inp, one word per row */
+  Bool drawn;/* whether the tv is showing the current pixels */
+  int ntsc[16][4];/* the signal for each color index */
 
   machine_6502 *machine;
 
@@ -57,6 +60,7 @@ struct state {
   int topb;/* top boarder */
   int field_ntsc[4];/* used for clearing the screen*/ 
   int dt;/* how long to wait before changing the demo*/
+  int cycles;/* CPU cycles per frame, or 0 for 500 instructions */
   int which;/* the program to run*/
   int demos;/* number of demos included */
   struct timeval start_time; 
@@ -67,6 +71,17 @@ plot6502(Bit8 x, Bit8 y, Bit8 color, void *closure)
 {
   struct state *st = (struct state *) closure;
   st->pixels[x][y] = color;
+  st->dirty[y] |= (Bit32) 1 << x;
+}
+
+/* Forgets the old program's picture. */
+static void
+clear_pixels(struct state *st)
+{
+  int y;
+  memset (st->pixels, 0, sizeof(st->pixels));
+  for (y = 0; y < 32; y++)
+    st->dirty[y] = ~(Bit32) 0;
 }
 
 #undef countof
@@ -91,11 +106,7 @@ start_rand_bin_prog(machine_6502 *machine, struct state *st){
 static double get_time(struct state *st) {
   struct timeval t;
   float f;
-#if GETTIMEOFDAY_TWO_ARGS
-  gettimeofday(&t, NULL);
-#else
-  gettimeofday(&t);
-#endif
+  fps_gettimeofday(&t);
   t.tv_sec -= st->start_time.tv_sec;
   f = ((double)t.tv_sec) + t.tv_usec*1e-6;
   return f;
@@ -107,23 +118,61 @@ static double get_time(struct state *st) {
  * initialises the timing structures
  */
 static void init_time(struct state *st) {
-#if GETTIMEOFDAY_TWO_ARGS
-  gettimeofday(&st->start_time, NULL);
-#else
-  gettimeofday(&st->start_time);
-#endif
+  fps_gettimeofday(&st->start_time);
+}
+
+static void
+make_colors(struct state *st)
+{
+  static const double clr_tbl[16][3] = {
+    {  0,   0,   0},
+    {255, 255, 255},
+    {136,   0,   0},
+    {170, 255, 238},
+    {204,  68, 204},
+    {  0, 204,  85},
+    {  0,   0, 170},
+    {238, 238, 119},
+    {221, 136,  85},
+    {102,  68,   0},
+    {255, 119, 119},
+    { 51,  51,  51},
+    {119, 119, 119},
+    {170, 255, 102},
+    {  0, 136, 255},
+    {187, 187, 187}
+  };
+  int idx, i;
+  for (idx = 0; idx < 16; idx++) {
+    int *ntsc = st->ntsc[idx];
+    int rawy,rawi,rawq;
+    /* RGB conversion taken from analogtv draw xpm */
+    rawy=( 5*clr_tbl[idx][0] + 11*clr_tbl[idx][1] + 2*clr_tbl[idx][2]) / 64;
+    rawi=(10*clr_tbl[idx][0] -  4*clr_tbl[idx][1] - 5*clr_tbl[idx][2]) / 64;
+    rawq=( 3*clr_tbl[idx][0] -  8*clr_tbl[idx][1] + 5*clr_tbl[idx][2]) / 64;
+
+    ntsc[0]=rawy+rawq;
+    ntsc[1]=rawy-rawi;
+    ntsc[2]=rawy-rawq;
+    ntsc[3]=rawy+rawi;
+
+    for (i=0; i<4; i++) {
+      if (ntsc[i]>ANALOGTV_WHITE_LEVEL) ntsc[i]=ANALOGTV_WHITE_LEVEL;
+      if (ntsc[i]<ANALOGTV_BLACK_LEVEL) ntsc[i]=ANALOGTV_BLACK_LEVEL;
+    }
+  }
 }
 
 static void *
 m6502_init (Display *dpy, Window window)
 {
   struct state *st = (struct state *) calloc (1, sizeof(*st));
-  unsigned int x, y;
   int n = get_integer_resource(dpy, "displaytime", "Displaytime");
   int dh;
   st->demos = countof(demo_files);
   st->which = random() % st->demos;
   st->dt = n;
+  st->cycles = get_integer_resource(dpy, "cycles", "Integer");
   st->dpy = dpy;
   st->window = window;
   st->tv=analogtv_allocate(st->dpy, st->window);
@@ -143,6 +192,8 @@ m6502_init (Display *dpy, Window window)
   dh = SCREEN_H % 32;
   st->topb = dh / 2;
 
+  make_colors(st);
+  clear_pixels(st);
   init_time(st);
   
   {
@@ -162,83 +213,67 @@ m6502_init (Display *dpy, Window window)
                       ANALOGTV_TOP, ANALOGTV_BOT,
                       st->field_ntsc);
 
-  for(x = 0; x < 32; x++)
-    for(y = 0; y < 32; y++)
-      st->pixels[x][y] = 0;
-
   return st;
 }
 
 static void
 paint_pixel(struct state *st, int x, int y, int idx)
 {
-  double clr_tbl[16][3] = {
-    {  0,   0,   0},
-    {255, 255, 255},
-    {136,   0,   0},
-    {170, 255, 238},
-    {204,  68, 204},
-    {  0, 204,  85},
-    {  0,   0, 170},
-    {238, 238, 119},
-    {221, 136,  85},
-    {102,  68,   0},
-    {255, 119, 119},
-    { 51,  51,  51},
-    {119, 119, 119},
-    {170, 255, 102},
-    {  0, 136, 255},
-    {187, 187, 187}
-  };
-  int ntsc[4], i;
-  int rawy,rawi,rawq;
-  /* RGB conversion taken from analogtv draw xpm */
-  rawy=( 5*clr_tbl[idx][0] + 11*clr_tbl[idx][1] + 2*clr_tbl[idx][2]) / 64;
-  rawi=(10*clr_tbl[idx][0] -  4*clr_tbl[idx][1] - 5*clr_tbl[idx][2]) / 64;
-  rawq=( 3*clr_tbl[idx][0] -  8*clr_tbl[idx][1] + 5*clr_tbl[idx][2]) / 64;
-
-  ntsc[0]=rawy+rawq;
-  ntsc[1]=rawy-rawi;
-  ntsc[2]=rawy-rawq;
-  ntsc[3]=rawy+rawi;
-
-  for (i=0; i<4; i++) {
-    if (ntsc[i]>ANALOGTV_WHITE_LEVEL) ntsc[i]=ANALOGTV_WHITE_LEVEL;
-    if (ntsc[i]<ANALOGTV_BLACK_LEVEL) ntsc[i]=ANALOGTV_BLACK_LEVEL;
-  }
-
-      
   x *= st->pixw;
   y *= st->pixh;
   y += st->topb;
   analogtv_draw_solid(st->inp,
 		      ANALOGTV_VIS_START + x, ANALOGTV_VIS_START + x + st->pixw,
-		      ANALOGTV_TOP + y, ANALOGTV_TOP + y + st->pixh, ntsc);			      
+		      ANALOGTV_TOP + y, ANALOGTV_TOP + y + st->pixh,
+                      st->ntsc[idx]);
+}
+
+/* Paints the pixels that changed since the last frame into the input
+   signal.  Returns whether there were any. */
+static Bool
+paint_dirty_pixels(struct state *st)
+{
+  Bool any = False;
+  int x, y;
+  for (y = 0; y < 32; y++) {
+    Bit32 bits = st->dirty[y];
+    if (!bits) continue;
+    st->dirty[y] = 0;
+    any = True;
+    for (x = 0; bits; x++, bits >>= 1)
+      if (bits & 1)
+        paint_pixel(st,x,y,st->pixels[x][y]);
+  }
+  return any;
 }
 
 static unsigned long
 m6502_draw (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
-  unsigned int x = 0, y = 0;
   double te;
 
-  m6502_next_eval(st->machine,500);
-
-  for (x = 0; x < 32; x++)
-    for (y = 0; y < 32; y++)
-      paint_pixel(st,x,y,st->pixels[x][y]);
-  
-  analogtv_init_signal(st->tv, 0.04);
-  analogtv_reception_update(&st->reception);
-  analogtv_add_signal(st->tv, &st->reception);
-  analogtv_draw(st->tv);
+  if (st->cycles > 0)
+    m6502_next_eval_cycles(st->machine,st->cycles);
+  else
+    m6502_next_eval(st->machine,500);
+
+  if (paint_dirty_pixels(st))
+    st->drawn = False;
+
+  /* In incremental mode, the tv would redraw nothing for a picture that
+     hasn't changed (the snow freezes), so don't bother receiving it. */
+  if (!st->drawn || !st->tv->incremental || st->tv->need_clear) {
+    analogtv_init_signal(st->tv, 0.04);
+    analogtv_reception_update(&st->reception);
+    analogtv_add_signal(st->tv, &st->reception);
+    analogtv_draw(st->tv);
+    st->drawn = True;
+  }
   te = get_time(st);
   
   if (te > st->dt){ /* do something more interesting here XXX */
-    for(x = 0; x < 32; x++)
-      for(y = 0; y < 32; y++)
-	st->pixels[x][y] = 0;
+    clear_pixels(st);
     init_time(st);
     start_rand_bin_prog(st->machine,st);
   }
@@ -254,6 +289,7 @@ static const char *m6502_defaults [] = {
   ".foreground:      white",
   "*file:",
   "*displaytime:     20",
+  "*cycles:          0",
   ANALOGTV_DEFAULTS
   0
 };
@@ -261,6 +297,7 @@ static const char *m6502_defaults [] = {
 static XrmOptionDescRec m6502_options [] = {
   { "-file",           ".file",     XrmoptionSepArg, 0 },
   { "-displaytime",    ".displaytime", XrmoptionSepArg, 0},
+  { "-cycles",         ".cycles",   XrmoptionSepArg, 0 },
   ANALOGTV_OPTIONS
   { 0, 0, 0, 0 }
 };
@@ -271,6 +308,7 @@ m6502_reshape (Display *dpy, Window window, void *closure,
 {
   struct state *st = (struct state *) closure;
   analogtv_reconfigure (st->tv);
+  st->drawn = False;
 }
 
 static Bool
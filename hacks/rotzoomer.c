@@ -25,10 +25,7 @@
 
 #include <math.h>
 #include "screenhack.h"
-
-#ifdef HAVE_XSHM_EXTENSION
-#include "xshm.h"
-#endif
+#include "pixsurface.h"
 
 struct zoom_area {
   int w, h;		/* rectangle width and height */
@@ -49,7 +46,9 @@ struct state {
 
   GC gc;
   Visual *visual;
-  XImage *orig_map, *buffer_map;
+  unsigned int *orig_map;	/* pixel values of the loaded image */
+  pixel_surface *buffer_map;
+  unsigned int **rows;
   Colormap colormap;
 
   int width, height;
@@ -63,11 +62,7 @@ struct state {
   time_t start_time;
 
   async_load_state *img_loader;
-
-#ifdef HAVE_XSHM_EXTENSION
   Bool use_shm;
-  XShmSegmentInfo shm_info;
-#endif
 };
 
 
@@ -84,6 +79,7 @@ rotzoom (struct state *st, struct zoom_area *za)
   c = zoom * cos (M_PI * za->a1 / 8192);
   s = zoom * sin (M_PI * za->a1 / 8192);
   for (y = za->y; y <= y2; y++) {
+    unsigned int *row = st->rows[y];
     for (x = za->x; x <= x2; x++) {
       ox = (x * c + y * s) >> 13;
       oy = (-x * s + y * c) >> 13;
@@ -97,10 +93,12 @@ rotzoom (struct state *st, struct zoom_area *za)
       while (oy >= st->height)
         oy -= st->height;
 
-      XPutPixel (st->buffer_map, x, y, XGetPixel (st->orig_map, ox, oy));
+      row[x] = st->orig_map[oy * st->width + ox];
     }
   }
 
+  pixel_surface_dirty (st->buffer_map, za->x, za->y, za->w, za->h);
+
   za->a1 += za->inc1;		/* Rotation angle */
   za->a1 &= 0x3fff;;
 
@@ -248,35 +246,54 @@ update_position (struct zoom_area *za)
 }
 
 
+/* Grabs the image that was just loaded into the window.
+ */
 static void
-DisplayImage (struct state *st, int x, int y, int w, int h)
+load_orig_map (struct state *st)
 {
-#ifdef HAVE_XSHM_EXTENSION
-  if (st->use_shm)
-    XShmPutImage (st->dpy, st->window, st->gc, st->buffer_map, x, y, x, y,
-                  w, h, False);
-  else
-#endif /* HAVE_XSHM_EXTENSION */
-    XPutImage(st->dpy, st->window, st->gc, st->buffer_map, x, y, x, y, w, h);
+  XImage *image = XGetImage (st->dpy, st->window, 0, 0,
+                             st->width, st->height, ~0L, ZPixmap);
+  int x, y;
+
+  if (!st->orig_map)
+    st->orig_map = (unsigned int *)
+      calloc (st->width * st->height, sizeof(*st->orig_map));
+  if (!image) return;
+
+  for (y = 0; y < st->height; y++)
+    for (x = 0; x < st->width; x++)
+      st->orig_map[y * st->width + x] = XGetPixel (image, x, y);
+  XDestroyImage (image);
+}
+
+
+/* Seconds, from the clock that -frame-hashes can hold still. */
+static time_t
+now_secs (void)
+{
+  struct timeval tv;
+  fps_gettimeofday (&tv);
+  return tv.tv_sec;
 }
 
 
 static void
 init_hack (struct state *st)
 {
-  int i;
+  int i, y;
 
-  st->start_time = time ((time_t) 0);
+  st->start_time = now_secs ();
   st->zoom_box = calloc (st->num_zoom, sizeof (struct zoom_area *));
   for (i = 0; i < st->num_zoom; i++) {
     st->zoom_box[i] = create_zoom (st);
   }
 
-  if (st->height && st->orig_map->data)
-    memcpy (st->buffer_map->data, st->orig_map->data,
-	    st->height * st->buffer_map->bytes_per_line);
-
-  DisplayImage(st, 0, 0, st->width, st->height);
+  st->rows = pixel_surface_begin (st->buffer_map);
+  for (y = 0; y < st->height; y++)
+    memcpy (st->rows[y], st->orig_map + y * st->width,
+            st->width * sizeof(*st->orig_map));
+  pixel_surface_dirty (st->buffer_map, 0, 0, st->width, st->height);
+  pixel_surface_put (st->buffer_map, st->window, st->gc);
 }
 
 
@@ -291,23 +308,24 @@ rotzoomer_draw (Display *disp, Window win, void *closure)
     {
       st->img_loader = load_image_async_simple (st->img_loader, 0, 0, 0, 0, 0);
       if (! st->img_loader) {  /* just finished */
-	st->orig_map = XGetImage (st->dpy, st->window, 0, 0, 
-                                  st->width, st->height, ~0L, ZPixmap);
+        load_orig_map (st);
         init_hack (st);
       }
       return st->delay;
     }
 
   if (!st->img_loader &&
-      st->start_time + st->duration < time ((time_t) 0)) {
+      st->start_time + st->duration < now_secs ()) {
     XWindowAttributes xgwa;
     XGetWindowAttributes(st->dpy, st->window, &xgwa);
     st->img_loader = load_image_async_simple (0, xgwa.screen, st->window,
                                               st->window, 0, 0);
-    st->start_time = time ((time_t) 0);
+    st->start_time = now_secs ();
     return st->delay;
   }
 
+  st->rows = pixel_surface_begin (st->buffer_map);
+
   for (i = 0; i < st->num_zoom; i++) {
     if (st->move || st->sweep)
       update_position (st->zoom_box[i]);
@@ -324,10 +342,7 @@ rotzoomer_draw (Display *disp, Window win, void *closure)
     }
   }
 
-  for (i = 0; i < st->num_zoom; i++) {
-    DisplayImage(st, st->zoom_box[i]->x, st->zoom_box[i]->y,
-                 st->zoom_box[i]->w, st->zoom_box[i]->h);
-  }
+  pixel_surface_put (st->buffer_map, st->window, st->gc);
 
   return delay;
 }
@@ -362,25 +377,14 @@ setup_X (struct state *st)
   st->img_loader = load_image_async_simple (0, xgwa.screen, st->window,
                                             st->window, 0, 0);
 
-  st->buffer_map = 0;
-
-#ifdef HAVE_XSHM_EXTENSION
-  if (st->use_shm) {
-    st->buffer_map = create_xshm_image(st->dpy, xgwa.visual, depth,
-                                       ZPixmap, 0, &st->shm_info, st->width, st->height);
-    if (!st->buffer_map) {
-      st->use_shm = False;
-      fprintf(stderr, "create_xshm_image failed\n");
-    }
-  }
-#endif /* HAVE_XSHM_EXTENSION */
-
+  st->buffer_map = pixel_surface_create (st->dpy, xgwa.visual, depth,
+                                         st->width, st->height, st->use_shm);
   if (!st->buffer_map) {
-    st->buffer_map = XCreateImage(st->dpy, xgwa.visual,
-                                  depth, ZPixmap, 0, 0, st->width, st->height, 8, 0);
-    st->buffer_map->data = (char *)calloc (st->buffer_map->height,
-                                           st->buffer_map->bytes_per_line);
+    fprintf (stderr, "%s: out of memory\n", progname);
+    exit (1);
   }
+  if (st->use_shm && !pixel_surface_shm_p (st->buffer_map))
+    fprintf(stderr, "create_xshm_image failed\n");
 }
 
 
@@ -391,9 +395,7 @@ rotzoomer_init (Display *dpy, Window window)
   char *s;
   st->dpy = dpy;
   st->window = window;
-#ifdef HAVE_XSHM_EXTENSION
   st->use_shm = get_boolean_resource (st->dpy, "useSHM", "Boolean");
-#endif
   st->num_zoom = get_integer_resource (st->dpy, "numboxes", "Integer");
 
   s = get_string_resource (dpy, "mode", "Mode");
@@ -420,7 +422,7 @@ rotzoomer_init (Display *dpy, Window window)
   if (!st->anim)
     st->sweep = 0;
 
-  st->start_time = time ((time_t) 0);
+  st->start_time = now_secs ();
 
   setup_X (st);
 
@@ -443,6 +445,8 @@ static void
 rotzoomer_free (Display *dpy, Window window, void *closure)
 {
   struct state *st = (struct state *) closure;
+  pixel_surface_destroy (st->buffer_map);
+  if (st->orig_map) free (st->orig_map);
   free (st);
 }
 
@@ -83,8 +83,6 @@
         of your screen saver module.  See .../hacks/config/README for details.
  */
 
-#define DEBUG_PAIR
-
 #include <stdio.h>
 #include <X11/Intrinsic.h>
 #include <X11/IntrinsicP.h>
@@ -112,6 +110,19 @@
 #include "vroot.h"
 #include "fps.h"
 
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+#ifdef HAVE_GETRUSAGE
+# include <sys/resource.h>	/* for getrusage() */
+#endif
+
 #ifndef _XSCREENSAVER_VROOT_H_
 # error Error!  You have an old version of vroot.h!  Check -I args.
 #endif /* _XSCREENSAVER_VROOT_H_ */
@@ -132,6 +143,7 @@ extern struct xscreensaver_function_table *xscreensaver_function_table;
 const char *progname;   /* used by hacks in error messages */
 const char *progclass;  /* used by ../utils/resources.c */
 Bool mono_p;		/* used by hacks */
+int screenhack_window_count = 1;  /* used by xlockmore.c */
 
 
 static XrmOptionDescRec default_options [] = {
@@ -144,10 +156,12 @@ static XrmOptionDescRec default_options [] = {
   { "-window-id", ".windowID",		XrmoptionSepArg, 0 },
   { "-fps",	".doFPS",		XrmoptionNoArg, "True" },
   { "-no-fps",  ".doFPS",		XrmoptionNoArg, "False" },
-
-# ifdef DEBUG_PAIR
+  { "-fps-target", ".fpsTarget",	XrmoptionSepArg, 0 },
+  { "-fps-timing", ".fpsTiming",	XrmoptionNoArg, "True" },
+  { "-benchmark", ".benchmark",		XrmoptionSepArg, 0 },
+  { "-seed",	".seed",		XrmoptionSepArg, 0 },
+  { "-frame-hashes", ".frameHashes",	XrmoptionSepArg, 0 },
   { "-pair",	".pair",		XrmoptionNoArg, "True" },
-# endif /* DEBUG_PAIR */
   { 0, 0, 0, 0 }
 };
 
@@ -157,6 +171,11 @@ static char *default_defaults[] = {
   "*mono:		false",
   "*installColormap:	false",
   "*doFPS:		false",
+  "*fpsTarget:		0",
+  "*fpsTiming:		false",
+  "*benchmark:		0",
+  "*seed:		0",
+  "*frameHashes:	",
   "*multiSample:	false",
   "*visualID:		default",
   "*windowID:		",
@@ -423,13 +442,10 @@ fix_fds (void)
 static Boolean
 screenhack_table_handle_events (Display *dpy,
                                 const struct xscreensaver_function_table *ft,
-                                Window window, void *closure
-#ifdef DEBUG_PAIR
-                                , Window window2, void *closure2
-#endif
-                                )
+                                int nwindows, Window *windows, void **closures)
 {
   XtAppContext app = XtDisplayToApplicationContext (dpy);
+  int i;
 
   if (XtAppPending (app) & (XtIMTimer|XtIMAlternateInput))
     XtAppProcessEvent (app, XtIMTimer|XtIMAlternateInput);
@@ -441,25 +457,26 @@ screenhack_table_handle_events (Display *dpy,
 
       if (event.xany.type == ConfigureNotify)
         {
-          if (event.xany.window == window)
-            ft->reshape_cb (dpy, window, closure,
-                            event.xconfigure.width, event.xconfigure.height);
-#ifdef DEBUG_PAIR
-          if (window2 && event.xany.window == window2)
-            ft->reshape_cb (dpy, window2, closure2,
-                            event.xconfigure.width, event.xconfigure.height);
-#endif
+          for (i = 0; i < nwindows; i++)
+            if (event.xany.window == windows[i])
+              ft->reshape_cb (dpy, windows[i], closures[i],
+                              event.xconfigure.width,
+                              event.xconfigure.height);
+        }
+      else
+        {
+          Bool handled = False;
+          if (event.xany.type != ClientMessage)
+            for (i = 0; i < nwindows; i++)
+              if (event.xany.window == windows[i])
+                {
+                  handled = ft->event_cb (dpy, windows[i], closures[i],
+                                          &event);
+                  break;
+                }
+          if (!handled && ! screenhack_handle_event_1 (dpy, &event))
+            return False;
         }
-      else if (event.xany.type == ClientMessage ||
-               (! (event.xany.window == window
-                   ? ft->event_cb (dpy, window, closure, &event)
-#ifdef DEBUG_PAIR
-                   : (window2 && event.xany.window == window2)
-                   ? ft->event_cb (dpy, window2, closure2, &event)
-#endif
-                   : 0)))
-        if (! screenhack_handle_event_1 (dpy, &event))
-          return False;
 
       if (XtAppPending (app) & (XtIMTimer|XtIMAlternateInput))
         XtAppProcessEvent (app, XtIMTimer|XtIMAlternateInput);
@@ -468,40 +485,83 @@ screenhack_table_handle_events (Display *dpy,
 }
 
 
+/* Waits until there is input on the X connection, or until the given
+   number of microseconds have passed, whichever comes first.
+ */
+static void
+wait_for_x_input (Display *dpy, unsigned long usecs)
+{
+# if defined(HAVE_POLL) && defined(HAVE_POLL_H)
+  struct pollfd fds[1];
+  fds[0].fd = ConnectionNumber (dpy);
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  poll (fds, 1, (int) ((usecs + 999) / 1000));
+# elif defined(HAVE_SELECT)
+  fd_set rset;
+  struct timeval tv;
+  int fd = ConnectionNumber (dpy);
+  FD_ZERO (&rset);
+  FD_SET (fd, &rset);
+  tv.tv_sec  = usecs / 1000000;
+  tv.tv_usec = usecs % 1000000;
+  select (fd + 1, &rset, 0, 0, &tv);
+# else
+  usleep (usecs);
+# endif
+}
+
+
+/* Sleeps until the absolute time `deadline' (from fps_clock), handling
+   events as soon as they arrive rather than only once per frame.
+   Returns False if the screen saver should now terminate.
+ */
 static Boolean
-usleep_and_process_events (Display *dpy,
-                           const struct xscreensaver_function_table *ft,
-                           Window window, fps_state *fpst, void *closure,
-                           unsigned long delay
-#ifdef DEBUG_PAIR
-                         , Window window2, fps_state *fpst2, void *closure2,
-                           unsigned long delay2
-#endif
-                           )
+sleep_until_and_process_events (Display *dpy,
+                                const struct xscreensaver_function_table *ft,
+                                int nwindows, Window *windows,
+                                fps_state **fpsts, void **closures,
+                                double deadline)
 {
-  do {
-    unsigned long quantum = 100000;  /* 1/10th second */
-    if (quantum > delay) 
-      quantum = delay;
-    delay -= quantum;
+  int i;
 
+  /* Once per frame, wait for the server to catch up with what we drew,
+     so that we can't get more than a frame ahead of it. */
+  {
+    double start = fps_clock();
     XSync (dpy, False);
-    if (quantum > 0)
-      {
-        usleep (quantum);
-        if (fpst) fps_slept (fpst, quantum);
-#ifdef DEBUG_PAIR
-        if (fpst2) fps_slept (fpst2, quantum);
-#endif
-      }
+    start = fps_clock() - start;
+    for (i = 0; i < nwindows; i++)
+      fps_phase_time (fpsts[i], FPS_PHASE_SYNC, start);
+  }
 
-    if (! screenhack_table_handle_events (dpy, ft, window, closure
-#ifdef DEBUG_PAIR
-                                          , window2, closure2
-#endif
-                                          ))
-      return False;
-  } while (delay > 0);
+  while (1)
+    {
+      double now;
+      unsigned long quantum = 100000;  /* 1/10th second */
+      double remaining;
+
+      if (! screenhack_table_handle_events (dpy, ft,
+                                            nwindows, windows, closures))
+        return False;
+
+      now = fps_clock();
+      remaining = deadline - now;
+      if (remaining <= 0)
+        break;
+
+      /* Don't sleep for more than a quantum at a time, so that Xt timers
+         and alternate inputs are still noticed promptly. */
+      if (remaining * 1000000 < quantum)
+        quantum = remaining * 1000000;
+
+      XFlush (dpy);
+      wait_for_x_input (dpy, quantum);
+
+      now = fps_clock() - now;
+      for (i = 0; i < nwindows; i++)
+        if (fpsts[i]) fps_slept (fpsts[i], now * 1000000);
+    }
 
   return True;
 }
@@ -515,12 +575,245 @@ screenhack_do_fps (Display *dpy, Window w, fps_state *fpst, void *closure)
 }
 
 
+/* The -seed option.  When checking -frame-hashes, the random numbers must
+   be the same every time, so 0 doesn't mean "use the time" there.
+ */
+static unsigned int
+screenhack_seed (Display *dpy)
+{
+  unsigned int seed = get_integer_resource (dpy, "seed", "Seed");
+  if (seed == 0)
+    {
+      char *s = get_string_resource (dpy, "frameHashes", "FrameHashes");
+      if (s && *s) seed = 1;
+      if (s) free (s);
+    }
+  return seed;
+}
+
+
+/* CPU time used by this process so far, in seconds, and its peak resident
+   set size in kilobytes (or 0 if we can't tell.)
+ */
 static void
-run_screenhack_table (Display *dpy, 
-                      Window window,
-# ifdef DEBUG_PAIR
-                      Window window2,
+benchmark_usage (double *user, double *sys, long *maxrss)
+{
+# ifdef HAVE_GETRUSAGE
+  struct rusage ru;
+  if (getrusage (RUSAGE_SELF, &ru) == 0)
+    {
+      *user   = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 0.000001;
+      *sys    = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 0.000001;
+      *maxrss = ru.ru_maxrss;
+      return;
+    }
 # endif
+  *user = *sys = 0;
+  *maxrss = 0;
+}
+
+
+/* With -benchmark, prints one line to stdout describing how long the
+   given number of frames took, in a form that's easy to parse.
+ */
+static void
+benchmark_report (Display *dpy, int frames, double init_secs,
+                  double secs, double user0, double sys0)
+{
+  double user, sys;
+  long maxrss;
+  unsigned int seed = screenhack_seed (dpy);
+  benchmark_usage (&user, &sys, &maxrss);
+  printf ("%s: benchmark: frames=%d init=%.3f secs=%.3f fps=%.2f"
+          " user=%.3f sys=%.3f maxrss=%ld seed=%u\n",
+          progname, frames, init_secs, secs,
+          (secs > 0 ? frames / secs : 0),
+          user - user0, sys - sys0, maxrss, seed);
+  fflush (stdout);
+}
+
+
+/* With -frame-hashes FILE, a checksum of every frame is compared against
+   the one in FILE, or written there if FILE doesn't exist yet.  This is
+   for making sure that optimizations don't change what is drawn.  Hacks
+   that animate by the clock read it with fps_gettimeofday(), which runs
+   on frame delays instead of real time while this is on.
+ */
+typedef struct {
+  char *file;
+  FILE *golden;		/* hashes to compare against, or */
+  FILE *out;		/* where to write them */
+  int frames, mismatches;
+} frame_hashes;
+
+
+static void
+frame_hashes_open (Display *dpy, frame_hashes *fh)
+{
+  memset (fh, 0, sizeof(*fh));
+  fh->file = get_string_resource (dpy, "frameHashes", "FrameHashes");
+  if (fh->file && !*fh->file)
+    {
+      free (fh->file);
+      fh->file = 0;
+    }
+  if (!fh->file) return;
+
+  fps_advance_clock (0);
+
+  fh->golden = fopen (fh->file, "r");
+  if (!fh->golden)
+    {
+      fh->out = fopen (fh->file, "w");
+      if (!fh->out)
+        {
+          char buf[1024];
+          sprintf (buf, "%.100s: %.800s", progname, fh->file);
+          perror (buf);
+          exit (1);
+        }
+    }
+}
+
+
+/* Hashes the pixel values rather than the bytes, so that the result
+   doesn't depend on the byte order or padding of the image.
+ */
+static unsigned long
+ximage_hash (XImage *image)
+{
+  unsigned long hash = 2166136261UL;	/* FNV-1a */
+  unsigned long mask = (image->red_mask | image->green_mask |
+                        image->blue_mask);
+  union { int i; char c[sizeof(int)]; } u;
+  int local_byte_order;
+  int x, y;
+
+  u.i = 1;
+  local_byte_order = (u.c[0] ? LSBFirst : MSBFirst);
+
+  if (!mask)
+    mask = (image->depth >= 32 ? 0xFFFFFFFFUL
+            : (1UL << image->depth) - 1);
+
+  for (y = 0; y < image->height; y++)
+    {
+      const unsigned int *row = (const unsigned int *)
+        (image->data + y * image->bytes_per_line);
+      for (x = 0; x < image->width; x++)
+        {
+          unsigned long p = (image->bits_per_pixel == 32 &&
+                             sizeof(*row) == 4 &&
+                             image->byte_order == local_byte_order
+                             ? row[x]
+                             : XGetPixel (image, x, y));
+          p &= mask;
+          hash = ((hash ^ (p & 0xFF))         * 16777619UL) & 0xFFFFFFFFUL;
+          hash = ((hash ^ ((p >> 8)  & 0xFF)) * 16777619UL) & 0xFFFFFFFFUL;
+          hash = ((hash ^ ((p >> 16) & 0xFF)) * 16777619UL) & 0xFFFFFFFFUL;
+          hash = ((hash ^ ((p >> 24) & 0xFF)) * 16777619UL) & 0xFFFFFFFFUL;
+        }
+    }
+  return hash;
+}
+
+
+static void
+frame_hashes_check (Display *dpy, Window window, void *closure,
+                    const struct xscreensaver_function_table *ft,
+                    frame_hashes *fh)
+{
+  XImage *image;
+  unsigned long hash;
+
+  if (!fh->file) return;
+
+  if (ft->snapshot_hook)
+    image = ft->snapshot_hook (dpy, window, closure);
+  else
+    {
+      XWindowAttributes xgwa;
+      XGetWindowAttributes (dpy, window, &xgwa);
+      image = XGetImage (dpy, window, 0, 0, xgwa.width, xgwa.height,
+                         ~0L, ZPixmap);
+    }
+  if (!image)
+    {
+      fprintf (stderr, "%s: unable to read back frame %d\n",
+               progname, fh->frames);
+      exit (1);
+    }
+
+  hash = ximage_hash (image);
+  XDestroyImage (image);
+
+  if (fh->out)
+    fprintf (fh->out, "%d %08lx\n", fh->frames, hash);
+  else
+    {
+      int frame;
+      unsigned long expected;
+      if (fscanf (fh->golden, "%d %lx", &frame, &expected) != 2 ||
+          frame != fh->frames)
+        {
+          fprintf (stderr, "%s: %s: no hash for frame %d\n",
+                   progname, fh->file, fh->frames);
+          fh->mismatches++;
+        }
+      else if (hash != expected)
+        {
+          if (fh->mismatches == 0)
+            fprintf (stderr, "%s: frame %d: hash %08lx, expected %08lx\n",
+                     progname, fh->frames, hash, expected);
+          fh->mismatches++;
+        }
+    }
+
+  fh->frames++;
+}
+
+
+/* Returns False if any frame didn't match.
+ */
+static Bool
+frame_hashes_close (frame_hashes *fh)
+{
+  Bool ok = True;
+  if (!fh->file) return ok;
+
+  if (fh->out)
+    {
+      fclose (fh->out);
+      printf ("%s: frame-hashes: wrote %d frames to %s\n",
+              progname, fh->frames, fh->file);
+    }
+  else
+    {
+      fclose (fh->golden);
+      if (fh->mismatches)
+        {
+          printf ("%s: frame-hashes: %d of %d frames differ from %s\n",
+                  progname, fh->mismatches, fh->frames, fh->file);
+          ok = False;
+        }
+      else
+        printf ("%s: frame-hashes: %d frames match %s\n",
+                progname, fh->frames, fh->file);
+    }
+  fflush (stdout);
+  free (fh->file);
+  return ok;
+}
+
+
+/* Runs the hack on each of the windows.  They share this process, its X
+   connection, and its resource database; each one has its own closure,
+   and its own frame deadline, since draw_cb may ask for a different delay
+   on each of them.  The first window is the one that -frame-hashes and
+   -benchmark look at.  Returns False if -frame-hashes found differences.
+ */
+static Bool
+run_screenhack_table (Display *dpy, int nwindows, Window *windows,
                       const struct xscreensaver_function_table *ft)
 {
 
@@ -533,50 +826,140 @@ run_screenhack_table (Display *dpy,
 
   void (*fps_cb) (Display *, Window, fps_state *, void *) = ft->fps_cb;
 
-  void *closure = init_cb (dpy, window, ft->setup_arg);
-  fps_state *fpst = fps_init (dpy, window);
+  double init_start = fps_clock();
+  void **closures = (void **) calloc (nwindows, sizeof(*closures));
+  fps_state **fpsts = (fps_state **) calloc (nwindows, sizeof(*fpsts));
+  double *deadlines = (double *) calloc (nwindows, sizeof(*deadlines));
+  Bool *drawn = (Bool *) calloc (nwindows, sizeof(*drawn));
+  double fps_target;
+  int benchmark, frames = 0;
+  double bench_start = 0, bench_user = 0, bench_sys = 0;
+  frame_hashes fh;
+  int i;
 
-#ifdef DEBUG_PAIR
-  void *closure2 = 0;
-  fps_state *fpst2 = 0;
-  if (window2) closure2 = init_cb (dpy, window2, ft->setup_arg);
-  if (window2) fpst2 = fps_init (dpy, window2);
-#endif
+  if (!closures || !fpsts || !deadlines || !drawn) abort();
+
+  /* Before init_cb, which may read the clock. */
+  frame_hashes_open (dpy, &fh);
 
-  if (! closure)  /* if it returns nothing, it can't possibly be re-entrant. */
-    abort();
+  for (i = 0; i < nwindows; i++)
+    {
+      closures[i] = init_cb (dpy, windows[i], ft->setup_arg);
+      if (! closures[i])  /* if it returns nothing, it can't possibly be */
+        abort();          /* re-entrant. */
+      fpsts[i] = fps_init (dpy, windows[i]);
+    }
 
   if (! fps_cb) fps_cb = screenhack_do_fps;
 
+  fps_target = get_float_resource (dpy, "fpsTarget", "FPSTarget");
+  for (i = 0; i < nwindows; i++)
+    deadlines[i] = fps_clock();
+
+  /* With -benchmark N, draw N frames as fast as possible and then exit.
+     The server is still synced once per frame, so that its share of the
+     drawing is counted too. */
+  benchmark = get_integer_resource (dpy, "benchmark", "Benchmark");
+  if (fh.file && benchmark <= 0)
+    benchmark = 100;
+  if (benchmark > 0)
+    {
+      long maxrss;
+      XSync (dpy, False);
+      bench_start = fps_clock();
+      benchmark_usage (&bench_user, &bench_sys, &maxrss);
+    }
+
   while (1)
     {
-      unsigned long delay = ft->draw_cb (dpy, window, closure);
-#ifdef DEBUG_PAIR
-      unsigned long delay2 = 0;
-      if (window2) delay2 = ft->draw_cb (dpy, window2, closure2);
-#endif
+      double now = fps_clock();
+      double next = 0;
+      unsigned long delay0 = 0;
 
-      if (fpst) fps_cb (dpy, window, fpst, closure);
-#ifdef DEBUG_PAIR
-      if (fpst2) fps_cb (dpy, window, fpst2, closure);
-#endif
+      /* Draw a frame on each window whose time has come.  A hack pausing
+         between phases on one monitor doesn't hold up the others. */
+      for (i = 0; i < nwindows; i++)
+        {
+          unsigned long delay;
+          double start;
+
+          drawn[i] = (benchmark > 0 || deadlines[i] <= now);
+          if (! drawn[i]) continue;
+
+          start = fps_clock();
+          delay = ft->draw_cb (dpy, windows[i], closures[i]);
+          fps_phase_time (fpsts[i], FPS_PHASE_DRAW, fps_clock() - start);
+
+          /* Before the next window draws, which would change the current
+             GL context, and before the Xlib FPS display is drawn on top. */
+          if (i == 0)
+            frame_hashes_check (dpy, windows[0], closures[0], ft, &fh);
+
+          if (fpsts[i]) fps_cb (dpy, windows[i], fpsts[i], closures[i]);
+
+          /* The delay is measured from the start of this frame, not from
+             the end of it, so that the time spent drawing is subtracted
+             from it.  Frames are scheduled at absolute deadlines so the
+             rate doesn't drift; but if we've fallen more than a frame
+             behind, start counting again from now rather than trying to
+             catch up.
+
+             With -fps-target, the hack's own frame delay is overridden,
+             but delays of more than a second are taken to be deliberate
+             pauses and are still honored.
+           */
+          if (fps_target > 0 && delay < 1000000)
+            delay = 1000000 / fps_target;
+
+          deadlines[i] += delay * 0.000001;
+          if (deadlines[i] < start)
+            deadlines[i] = start + delay * 0.000001;
+          if (i == 0)
+            delay0 = delay;
+        }
 
-      if (! usleep_and_process_events (dpy, ft,
-                                       window, fpst, closure, delay
-#ifdef DEBUG_PAIR
-                                       , window2, fpst2, closure2, delay2
-#endif
-                                       ))
+      /* With -frame-hashes, the virtual clock moves on as if the first
+         window had slept for as long as it asked to. */
+      if (fh.file)
+        fps_advance_clock (delay0);
+
+      /* Sleep until the soonest of the windows is due. */
+      if (benchmark <= 0)
+        {
+          next = deadlines[0];
+          for (i = 1; i < nwindows; i++)
+            if (deadlines[i] < next)
+              next = deadlines[i];
+        }
+
+      if (! sleep_until_and_process_events (dpy, ft, nwindows, windows,
+                                            fpsts, closures, next))
         break;
+
+      for (i = 0; i < nwindows; i++)
+        if (drawn[i])
+          fps_frame_done (fpsts[i]);
+
+      if (benchmark > 0 && ++frames >= benchmark)
+        {
+          benchmark_report (dpy, frames, bench_start - init_start,
+                            fps_clock() - bench_start,
+                            bench_user, bench_sys);
+          break;
+        }
     }
 
-  ft->free_cb (dpy, window, closure);
-  if (fpst) fps_free (fpst);
+  for (i = 0; i < nwindows; i++)
+    {
+      ft->free_cb (dpy, windows[i], closures[i]);
+      if (fpsts[i]) fps_free (fpsts[i]);
+    }
+  free (closures);
+  free (fpsts);
+  free (deadlines);
+  free (drawn);
 
-#ifdef DEBUG_PAIR
-  if (window2) ft->free_cb (dpy, window2, closure2);
-  if (fpst2) fps_free (fpst2);
-#endif
+  return frame_hashes_close (&fh);
 }
 
 
@@ -664,6 +1047,133 @@ init_window (Display *dpy, Widget toplevel, const char *title)
 }
 
 
+/* Tells xscreensaver that we know about $XSCREENSAVER_PREFORK, below, so
+   that it may launch us ahead of time in future.  Other programs ignore
+   $XSCREENSAVER_ACK, and it never does that to them.
+ */
+static void
+acknowledge_xscreensaver (void)
+{
+  const char *s = getenv ("XSCREENSAVER_ACK");
+  int fd;
+
+  if (!s || !*s) return;
+  fd = atoi (s);
+  if (write (fd, "+", 1) != 1)
+    {
+      char buf[255];
+      sprintf (buf, "%.100s: $XSCREENSAVER_ACK", progname);
+      perror (buf);
+    }
+  close (fd);
+
+# ifdef HAVE_PUTENV
+  putenv ("XSCREENSAVER_ACK=");
+# endif
+}
+
+
+/* If xscreensaver launched us ahead of time (its "warmSpawn" option) then
+   $XSCREENSAVER_PREFORK is a file descriptor, and the ID of the window to
+   draw on will be written there when it's our turn (or the IDs of several
+   windows, as for $XSCREENSAVER_WINDOWS.)  Until then, we sit here with
+   the display open and the resources parsed.  If the pipe is closed
+   instead, we weren't needed after all.
+ */
+static void
+wait_for_window (Display *dpy)
+{
+  const char *s = getenv ("XSCREENSAVER_PREFORK");
+  char buf[1024];
+  int fd, i = 0;
+
+  if (!s || !*s) return;
+  fd = atoi (s);
+  XSync (dpy, False);
+
+  while (i < sizeof(buf)-1 && read (fd, buf + i, 1) == 1 && buf[i] != '\n')
+    i++;
+  buf[i] = 0;
+  close (fd);
+
+  if (i == 0)
+    exit (0);
+
+# ifdef HAVE_PUTENV
+  {
+    char *nssw = (char *) malloc (strlen (buf) + 40);
+    char *nssws = (char *) malloc (strlen (buf) + 40);
+    sprintf (nssws, "XSCREENSAVER_WINDOWS=%s", buf);
+    putenv (nssws);
+    sprintf (nssw, "XSCREENSAVER_WINDOW=%s", buf);
+    if (strchr (nssw, ' '))
+      *strchr (nssw, ' ') = 0;
+    putenv (nssw);
+    putenv ("XSCREENSAVER_PREFORK=");
+  }
+# endif /* HAVE_PUTENV */
+}
+
+
+/* When xscreensaver runs one copy of a hack across several monitors,
+   $XSCREENSAVER_WINDOWS lists all of their windows, starting with the
+   one in $XSCREENSAVER_WINDOW.  Returns them, or 0 if there's just the
+   one window.
+ */
+static Window *
+saver_windows (Display *dpy, Window window, int *count_ret)
+{
+  const char *s = getenv ("XSCREENSAVER_WINDOWS");
+  Window *windows;
+  int n = 1;
+  char *tok, *copy;
+
+  if (!s || !*s) return 0;
+
+  copy = strdup (s);
+  windows = (Window *) calloc (strlen (s) / 2 + 2, sizeof(*windows));
+  if (!copy || !windows) abort();
+  windows[0] = window;
+
+  for (tok = strtok (copy, " \t"); tok; tok = strtok (0, " \t"))
+    {
+      unsigned long id = 0;
+      char c;
+      XWindowAttributes xgwa;
+      int i;
+
+      if (1 != sscanf (tok, "0x%lx %c", &id, &c) &&
+          1 != sscanf (tok, "%lu %c",   &id, &c))
+        {
+          fprintf (stderr, "%s: unparsable window ID in "
+                   "$XSCREENSAVER_WINDOWS: %s\n", progname, tok);
+          continue;
+        }
+
+      for (i = 0; i < n; i++)
+        if (windows[i] == (Window) id) break;
+      if (i < n) continue;
+
+      windows[n++] = (Window) id;
+      XGetWindowAttributes (dpy, (Window) id, &xgwa);
+      XSelectInput (dpy, (Window) id,
+                    xgwa.your_event_mask | StructureNotifyMask);
+      visual_warning (xgwa.screen, (Window) id, xgwa.visual, xgwa.colormap,
+                      False);
+    }
+  free (copy);
+
+  if (n == 1)
+    {
+      free (windows);
+      return 0;
+    }
+
+  *count_ret = n;
+  return windows;
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -673,15 +1183,14 @@ main (int argc, char **argv)
   Widget toplevel;
   Display *dpy;
   Window window;
-# ifdef DEBUG_PAIR
-  Window window2 = 0;
-  Widget toplevel2 = 0;
-# endif
+  Window *windows = 0;
+  int nwindows = 0;
   XtAppContext app;
   Bool root_p;
   Window on_window = 0;
   XEvent event;
   Boolean dont_clear;
+  Bool ok;
   char version[255];
 
   fix_fds();
@@ -829,6 +1338,9 @@ main (int argc, char **argv)
   if (CellsOfScreen (DefaultScreenOfDisplay (dpy)) <= 2)
     mono_p = True;
 
+  acknowledge_xscreensaver ();
+  wait_for_window (dpy);
+
   root_p = get_boolean_resource (dpy, "root", "Boolean");
 
   {
@@ -883,31 +1395,44 @@ main (int argc, char **argv)
       window = XtWindow (toplevel);
       XGetWindowAttributes (dpy, window, &xgwa);
 
-# ifdef DEBUG_PAIR
+      /* For debugging re-entrancy: run two copies in one process. */
       if (get_boolean_resource (dpy, "pair", "Boolean"))
         {
-          toplevel2 = make_shell (xgwa.screen, 0,
-                                  toplevel->core.width,
-                                  toplevel->core.height);
+          Widget toplevel2 = make_shell (xgwa.screen, 0,
+                                         toplevel->core.width,
+                                         toplevel->core.height);
           init_window (dpy, toplevel2, version);
-          window2 = XtWindow (toplevel2);
+          windows = (Window *) calloc (2, sizeof(*windows));
+          windows[0] = window;
+          windows[1] = XtWindow (toplevel2);
+          nwindows = 2;
         }
-# endif /* DEBUG_PAIR */
     }
 
+  if (root_p && !on_window)
+    windows = saver_windows (dpy, window, &nwindows);
+
+  if (!windows)
+    {
+      windows = (Window *) calloc (1, sizeof(*windows));
+      windows[0] = window;
+      nwindows = 1;
+    }
+  screenhack_window_count = nwindows;
+
   if (!dont_clear)
     {
-      unsigned int bg = get_pixel_resource (dpy, xgwa.colormap,
-                                            "background", "Background");
-      XSetWindowBackground (dpy, window, bg);
-      XClearWindow (dpy, window);
-# ifdef DEBUG_PAIR
-      if (window2)
+      int i;
+      for (i = 0; i < nwindows; i++)
         {
-          XSetWindowBackground (dpy, window2, bg);
-          XClearWindow (dpy, window2);
+          unsigned int bg;
+          if (i > 0)
+            XGetWindowAttributes (dpy, windows[i], &xgwa);
+          bg = get_pixel_resource (dpy, xgwa.colormap,
+                                   "background", "Background");
+          XSetWindowBackground (dpy, windows[i], bg);
+          XClearWindow (dpy, windows[i]);
         }
-# endif
     }
 
   if (!root_p && !on_window)
@@ -918,18 +1443,16 @@ main (int argc, char **argv)
 
   /* This is the one and only place that the random-number generator is
      seeded in any screenhack.  You do not need to seed the RNG again,
-     it is done for you before your code is invoked. */
+     it is done for you before your code is invoked.  With -seed, every
+     run makes the same choices. */
 # undef ya_rand_init
-  ya_rand_init (0);
+  ya_rand_init (screenhack_seed (dpy));
 
-  run_screenhack_table (dpy, window, 
-# ifdef DEBUG_PAIR
-                        window2,
-# endif
-                        ft);
+  ok = run_screenhack_table (dpy, nwindows, windows, ft);
+  free (windows);
 
   XtDestroyWidget (toplevel);
   XtDestroyApplicationContext (app);
 
-  return 0;
+  return (ok ? 0 : 1);
 }
@@ -52,7 +52,7 @@
 	   PREFIX ## _reshape,					\
 	   PREFIX ## _event,					\
 	   PREFIX ## _free,					\
-           0, 0, 0 };						\
+           0, 0, 0, 0 };					\
   XSCREENSAVER_LINK (NAME ## _xscreensaver_function_table)
 
 #define XSCREENSAVER_MODULE(CLASS,PREFIX)			\
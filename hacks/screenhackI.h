@@ -131,8 +131,16 @@ struct xscreensaver_function_table {
   Visual *       (*pick_visual_hook) (Screen *);
   Bool           (*validate_visual_hook) (Screen *, const char *, Visual *);
 
+  /* Returns what was just drawn in the window, for -frame-hashes.
+     If this is 0, XGetImage is used. */
+  XImage *       (*snapshot_hook) (Display *, Window, void *);
+
 };
 
 extern const char *progname;
 
+/* How many windows this process is running the hack on: usually 1, but
+   see saver_windows() in screenhack.c. */
+extern int screenhack_window_count;
+
 #endif /* __SCREENHACK_I_H__ */
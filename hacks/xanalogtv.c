@@ -266,7 +266,7 @@ static int
 getticks(struct state *st)
 {
   struct timeval tv;
-  gettimeofday(&tv,NULL);
+  fps_gettimeofday(&tv);
   return ((tv.tv_sec - st->basetime.tv_sec)*1000 +
           (tv.tv_usec - st->basetime.tv_usec)/1000);
 }
@@ -509,7 +509,7 @@ xanalogtv_init (Display *dpy, Window window)
     }
   }
 
-  gettimeofday(&st->basetime,NULL);
+  fps_gettimeofday(&st->basetime);
 
   st->curinputi=0;
   st->cs = &st->chansettings[st->curinputi];
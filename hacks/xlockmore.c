@@ -317,17 +317,16 @@ xlockmore_init (Display *dpy, Window window,
 #else /* !HAVE_COCOA -- real Xlib */
   
   /* In Xlib-based xscreensaver, each hack runs in its own address space,
-     so each one only needs to be aware of one screen.
+     so it only needs to be aware of the windows that it was given: usually
+     one, but more with -pair or when one process is drawing on several
+     monitors.  The windows are initialized in order, so a counter will do.
    */
-  mi->num_screens = 1;
-  mi->screen_number = 0;
-  
-  {  /* kludge for DEBUG_PAIR */
+  {
     static int screen_tick = 0;
-    mi->num_screens++;
-    if (screen_tick)
-      mi->screen_number++;
-    screen_tick++;
+    mi->num_screens = screenhack_window_count;
+    mi->screen_number = screen_tick++;
+    if (mi->screen_number >= mi->num_screens)
+      abort();
   }
 
   root_p = (window == RootWindowOfScreen (mi->xgwa.screen));
@@ -445,7 +444,8 @@ xlockmore_init (Display *dpy, Window window,
 #ifdef HAVE_XSHM_EXTENSION
   mi->use_shm = get_boolean_resource (dpy, "useSHM", "Boolean");
 #endif /* !HAVE_XSHM_EXTENSION */
-  mi->fps_p = get_boolean_resource (dpy, "doFPS", "DoFPS");
+  mi->fps_p = (get_boolean_resource (dpy, "doFPS", "DoFPS") ||
+               get_boolean_resource (dpy, "fpsTiming", "FPSTiming"));
   mi->recursion_depth = -1;  /* see fps.c */
 
   if (mi->pause < 0)
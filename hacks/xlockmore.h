@@ -126,6 +126,7 @@ ERROR!  Sorry, xlockmore.h requires ANSI C (gcc, for example.)
 # if !defined(USE_GL) || defined(HAVE_COCOA)
 #  define xlockmore_pick_gl_visual 0
 #  define xlockmore_validate_gl_visual 0
+#  define xlockmore_gl_snapshot 0
 # endif  /* !USE_GL || HAVE_COCOA */
 
 # ifdef USE_GL
@@ -190,7 +191,8 @@ ERROR!  Sorry, xlockmore.h requires ANSI C (gcc, for example.)
 	   0, 0, 0, 0, 0,						\
            XLOCKMORE_FPS,						\
            xlockmore_pick_gl_visual,					\
-	   xlockmore_validate_gl_visual };				\
+	   xlockmore_validate_gl_visual,				\
+	   xlockmore_gl_snapshot };					\
 									\
   XSCREENSAVER_LINK (NAME ## _xscreensaver_function_table)
 
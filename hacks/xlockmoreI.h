@@ -63,6 +63,7 @@ typedef struct ModeInfo ModeInfo;
 
   extern Visual *xlockmore_pick_gl_visual (Screen *);
   extern Bool xlockmore_validate_gl_visual (Screen *, const char *, Visual *);
+  extern XImage *xlockmore_gl_snapshot (Display *, Window, void *);
 
 #endif /* !USE_GL */
 
@@ -50,6 +50,10 @@
 #include "visual.h"
 #include "resources.h"
 
+#ifdef HAVE_XSHM_EXTENSION
+# include "xshm.h"
+#endif
+
 #include "vroot.h"
 #undef RootWindowOfScreen
 #undef RootWindow
@@ -66,7 +70,6 @@ static void copy_default_colormap_contents (Screen *, Colormap, Visual *);
 
 #ifdef HAVE_READ_DISPLAY_EXTENSION
 static void allocate_cubic_colormap (Screen *, Window, Visual *);
-void remap_image (Screen *, Window, Colormap, XImage *);
 #endif
 
 
@@ -208,6 +211,23 @@ BadWindow_ehandler (Display *dpy, XErrorEvent *error)
     return (*old_ehandler) (dpy, error);
 }
 
+static int
+BadMatch_ehandler (Display *dpy, XErrorEvent *error)
+{
+  if (error->error_code == BadMatch)
+    {
+      error_handler_hit_p = True;
+      return 0;
+    }
+  else if (!old_ehandler)
+    {
+      abort();
+      return 0;
+    }
+  else
+    return (*old_ehandler) (dpy, error);
+}
+
 
 /* XCopyArea seems not to work right on SGI O2s if you draw in SubwindowMode
    on a window whose depth is not the maximal depth of the screen?  Or
@@ -524,6 +544,310 @@ copy_default_colormap_contents (Screen *screen,
    when one tries to grab the screen image.
  */
 
+/* Reads the contents of the window into a new XImage.  If the server
+   supports MIT-SHM, the pixels are read straight into shared memory,
+   instead of being copied through the X connection.
+
+   This can fail with BadMatch if the window is not fully on screen, in
+   which case it returns 0.  (Note that this only happens with XGetImage,
+   not with XCopyArea: yet another totally gratuitous inconsistency in X,
+   thanks.)
+ */
+XImage *
+grab_window_ximage (Screen *screen, Window window)
+{
+  Display *dpy = DisplayOfScreen (screen);
+  XWindowAttributes xgwa;
+  XImage *image = 0;
+#ifdef HAVE_XSHM_EXTENSION
+  XShmSegmentInfo *shm_info;
+#endif
+
+  XGetWindowAttributes (dpy, window, &xgwa);
+
+#ifdef HAVE_XSHM_EXTENSION
+  /* free_window_ximage() finds this again through image->obdata, which
+     is where XShmCreateImage() keeps it. */
+  shm_info = (XShmSegmentInfo *) calloc (1, sizeof(*shm_info));
+  if (shm_info)
+    image = create_xshm_image (dpy, xgwa.visual, xgwa.depth, ZPixmap, 0,
+                               shm_info, xgwa.width, xgwa.height);
+  if (image)
+    image->obdata = (char *) shm_info;
+  else if (shm_info)
+    free (shm_info);
+#endif /* HAVE_XSHM_EXTENSION */
+
+  XSync (dpy, False);
+  old_ehandler = XSetErrorHandler (BadMatch_ehandler);
+  error_handler_hit_p = False;
+
+#ifdef HAVE_XSHM_EXTENSION
+  if (image)
+    XShmGetImage (dpy, window, image, 0, 0, ~0L);
+  else
+#endif /* HAVE_XSHM_EXTENSION */
+    image = XGetImage (dpy, window, 0, 0, xgwa.width, xgwa.height,
+                       ~0L, ZPixmap);
+
+  XSync (dpy, False);
+  XSetErrorHandler (old_ehandler);
+  XSync (dpy, False);
+
+  if (error_handler_hit_p)
+    {
+      if (grab_verbose_p)
+        fprintf (stderr, "%s: BadMatch reading window 0x%x contents!\n",
+                 progname, (unsigned int) window);
+      if (image)
+        free_window_ximage (dpy, image);
+      return 0;
+    }
+
+  if (grab_verbose_p && image)
+    fprintf (stderr, "%s: read %dx%d image%s\n", progname,
+             image->width, image->height,
+             (image->obdata ? " with MIT-SHM" : ""));
+
+  return image;
+}
+
+
+void
+free_window_ximage (Display *dpy, XImage *image)
+{
+#ifdef HAVE_XSHM_EXTENSION
+  if (image->obdata)
+    {
+      XShmSegmentInfo *shm_info = (XShmSegmentInfo *) image->obdata;
+      destroy_xshm_image (dpy, image, shm_info);
+      free (shm_info);
+      return;
+    }
+#endif /* HAVE_XSHM_EXTENSION */
+  XDestroyImage (image);
+}
+
+
+/* Mapping colors to the nearest entry in a colormap.
+
+   Rather than searching the whole colormap for each color, we label
+   every cell of a 64x64x64 cube spanning RGB space with the index of the
+   colormap entry nearest to it.  Each entry is first dropped into the
+   cell that contains it; then the labels are spread across the cube one
+   axis at a time, forward and back.  The distance is a weighted sum of
+   the distances along each axis (green counting twice as much as red,
+   and red twice as much as blue) so three such passes find the nearest
+   labelled cell exactly, and a lookup is then just an array reference.
+ */
+
+#define CUBE_BITS 6
+#define CUBE_SIZE (1 << CUBE_BITS)
+#define CUBE_CELL(R,G,B) (((R) >> (16 - CUBE_BITS)) |			\
+                          (((G) >> (16 - CUBE_BITS)) << CUBE_BITS) |	\
+                          (((B) >> (16 - CUBE_BITS)) << (CUBE_BITS * 2)))
+
+#define RED_WEIGHT   2
+#define GREEN_WEIGHT 4
+#define BLUE_WEIGHT  1
+
+static unsigned long
+color_distance (unsigned long r1, unsigned long g1, unsigned long b1,
+                unsigned long r2, unsigned long g2, unsigned long b2)
+{
+  long rd = r1 - r2, gd = g1 - g2, bd = b1 - b2;
+  if (rd < 0) rd = -rd;
+  if (gd < 0) gd = -gd;
+  if (bd < 0) bd = -bd;
+  return rd * RED_WEIGHT + gd * GREEN_WEIGHT + bd * BLUE_WEIGHT;
+}
+
+static void
+spread_cube_line (unsigned short *label, unsigned int *dist,
+                  int start, int stride, unsigned int weight)
+{
+  int i, p;
+  for (i = 1, p = start + stride; i < CUBE_SIZE; i++, p += stride)
+    if (dist[p - stride] + weight < dist[p])
+      {
+        dist[p]  = dist[p - stride] + weight;
+        label[p] = label[p - stride];
+      }
+  for (i = CUBE_SIZE - 2, p = start + i * stride; i >= 0; i--, p -= stride)
+    if (dist[p + stride] + weight < dist[p])
+      {
+        dist[p]  = dist[p + stride] + weight;
+        label[p] = label[p + stride];
+      }
+}
+
+/* Returns a cube of CUBE_SIZE^3 colormap indexes, or 0 if out of memory.
+ */
+static unsigned short *
+make_color_cube (XColor *colors, int ncolors)
+{
+  int ncells = CUBE_SIZE * CUBE_SIZE * CUBE_SIZE;
+  unsigned short *label = (unsigned short *)
+    calloc (ncells, sizeof(*label));
+  unsigned int *dist = (unsigned int *) malloc (ncells * sizeof(*dist));
+  int half = 1 << (15 - CUBE_BITS);
+  int i, j, k;
+
+  if (!label || !dist)
+    {
+      if (label) free (label);
+      if (dist) free (dist);
+      return 0;
+    }
+
+  for (i = 0; i < ncells; i++)
+    dist[i] = 0x0FFFFFFF;
+
+  /* Seed each entry into its own cell.  If several land in the same one,
+     keep the one nearest its center. */
+  for (i = 0; i < ncolors; i++)
+    {
+      int c = CUBE_CELL (colors[i].red, colors[i].green, colors[i].blue);
+      if (dist[c] != 0)
+        {
+          dist[c] = 0;
+          label[c] = i;
+        }
+      else
+        {
+          XColor *o = &colors[label[c]];
+          unsigned long cr = (colors[i].red   & ~(2*half-1)) + half;
+          unsigned long cg = (colors[i].green & ~(2*half-1)) + half;
+          unsigned long cb = (colors[i].blue  & ~(2*half-1)) + half;
+          if (color_distance (colors[i].red, colors[i].green, colors[i].blue,
+                              cr, cg, cb) <
+              color_distance (o->red, o->green, o->blue, cr, cg, cb))
+            label[c] = i;
+        }
+    }
+
+  for (j = 0; j < CUBE_SIZE; j++)
+    for (k = 0; k < CUBE_SIZE; k++)
+      spread_cube_line (label, dist, (j + k * CUBE_SIZE) * CUBE_SIZE,
+                        1, RED_WEIGHT);
+  for (j = 0; j < CUBE_SIZE; j++)
+    for (k = 0; k < CUBE_SIZE; k++)
+      spread_cube_line (label, dist, j + k * CUBE_SIZE * CUBE_SIZE,
+                        CUBE_SIZE, GREEN_WEIGHT);
+  for (j = 0; j < CUBE_SIZE; j++)
+    for (k = 0; k < CUBE_SIZE; k++)
+      spread_cube_line (label, dist, j + k * CUBE_SIZE,
+                        CUBE_SIZE * CUBE_SIZE, BLUE_WEIGHT);
+
+  free (dist);
+  return label;
+}
+
+
+/* Given an XImage with 8-bit or 12-bit RGB data, convert it to be 
+   displayable with the given X colormap.  The farther from a perfect
+   color cube the contents of the colormap are, the lossier the 
+   transformation will be.  No dithering is done.
+ */
+void
+remap_image_to_colormap (Display *dpy, Colormap cmap, XImage *image,
+                         Bool verbose_p)
+{
+  unsigned long map[4097];
+  int x, y, i;
+  int cells;
+  XColor colors[4097];
+  unsigned short *cube;
+
+  if (image->depth == 8)
+    cells = 256;
+  else if (image->depth == 12)
+    cells = 4096;
+  else
+    abort();
+
+  memset(map,    -1, sizeof(*map));
+  memset(colors, -1, sizeof(*colors));
+
+  for (i = 0; i < cells; i++)
+    colors[i].pixel = i;
+  XQueryColors (dpy, cmap, colors, cells);
+
+  if (verbose_p)
+    fprintf(stderr, "%s: building color cube for %d bit image\n",
+            progname, image->depth);
+
+  cube = make_color_cube (colors, cells);
+  if (!cube)
+    {
+      fprintf (stderr, "%s: out of memory remapping image\n", progname);
+      return;
+    }
+
+  for (i = 0; i < cells; i++)
+    {
+      unsigned short r, g, b;
+
+      if (cells == 256)
+        {
+          /* "RRR GGG BB" In an 8 bit map.  Convert that to
+             "RRR RRR RR" "GGG GGG GG" "BB BB BB BB" to give
+             an even spread. */
+          r = (i & 0x07);
+          g = (i & 0x38) >> 3;
+          b = (i & 0xC0) >> 6;
+
+          r = ((r << 13) | (r << 10) | (r << 7) | (r <<  4) | (r <<  1));
+          g = ((g << 13) | (g << 10) | (g << 7) | (g <<  4) | (g <<  1));
+          b = ((b << 14) | (b << 12) | (b << 10) | (b <<  8) |
+               (b <<  6) | (b <<  4) | (b <<  2) | b);
+        }
+      else
+        {
+          /* "RRRR GGGG BBBB" In a 12 bit map.  Convert that to
+             "RRRR RRRR" "GGGG GGGG" "BBBB BBBB" to give an even
+             spread. */
+          r = (i & 0x00F);
+          g = (i & 0x0F0) >> 4;
+          b = (i & 0xF00) >> 8;
+
+          r = (r << 12) | (r << 8) | (r << 4) | r;
+          g = (g << 12) | (g << 8) | (g << 4) | g;
+          b = (b << 12) | (b << 8) | (b << 4) | b;
+        }
+
+      map[i] = colors[cube[CUBE_CELL (r, g, b)]].pixel;
+    }
+
+  free (cube);
+
+  if (verbose_p)
+    fprintf(stderr, "%s: remapping colors in %d bit image\n",
+            progname, image->depth);
+
+  if (image->bits_per_pixel == 8)
+    for (y = 0; y < image->height; y++)
+      {
+        unsigned char *row = (unsigned char *)
+          image->data + y * image->bytes_per_line;
+        for (x = 0; x < image->width; x++)
+          row[x] = map[row[x]];
+      }
+  else
+    for (y = 0; y < image->height; y++)
+      for (x = 0; x < image->width; x++)
+        {
+          unsigned long pixel = XGetPixel(image, x, y);
+          if (pixel >= cells) abort();
+          XPutPixel(image, x, y, map[pixel]);
+        }
+}
+
+#undef CUBE_CELL
+#undef CUBE_SIZE
+#undef CUBE_BITS
+
+
 #ifdef HAVE_READ_DISPLAY_EXTENSION
 
 static Bool
@@ -679,7 +1003,7 @@ read_display (Screen *screen, Window window, Pixmap into_pixmap,
   if (remap_p)
     {
       allocate_cubic_colormap (screen, window, xgwa.visual);
-      remap_image (screen, window, xgwa.colormap, image);
+      remap_image_to_colormap (dpy, xgwa.colormap, image, grab_verbose_p);
     }
 
   /* Now actually put the bits into the window or pixmap -- note the design
@@ -799,127 +1123,4 @@ allocate_cubic_colormap (Screen *screen, Window window, Visual *visual)
   }
 }
 
-/* Find the pixel index that is closest to the given color
-   (using linear distance in RGB space -- which is far from the best way.)
-
-   #### Duplicated in driver/xscreensaver-getimage.c
- */
-static unsigned long
-find_closest_pixel (XColor *colors, int ncolors,
-                    unsigned long r, unsigned long g, unsigned long b)
-{
-  unsigned long distance = ~0;
-  int i, found = 0;
-
-  if (ncolors == 0)
-    abort();
-  for (i = 0; i < ncolors; i++)
-    {
-      unsigned long d;
-      int rd, gd, bd;
-
-      rd = r - colors[i].red;
-      gd = g - colors[i].green;
-      bd = b - colors[i].blue;
-      if (rd < 0) rd = -rd;
-      if (gd < 0) gd = -gd;
-      if (bd < 0) bd = -bd;
-      d = (rd << 1) + (gd << 2) + bd;
-      
-      if (d < distance)
-	{
-	  distance = d;
-	  found = i;
-          if (distance == 0)
-              break;
-	}
-    }
-
-  return found;
-}
-
-
-/* Given an XImage with 8-bit or 12-bit RGB data, convert it to be 
-   displayable with the given X colormap.  The farther from a perfect
-   color cube the contents of the colormap are, the lossier the 
-   transformation will be.  No dithering is done.
-
-   #### Duplicated in driver/xscreensaver-getimage.c
- */
-void
-remap_image (Screen *screen, Window window, Colormap cmap, XImage *image)
-{
-  Display *dpy = DisplayOfScreen (screen);
-  unsigned long map[4097];
-  int x, y, i;
-  int cells;
-  XColor colors[4097];
-
-  if (image->depth == 8)
-    cells = 256;
-  else if (image->depth == 12)
-    cells = 4096;
-  else
-    abort();
-
-  memset(map,    -1, sizeof(*map));
-  memset(colors, -1, sizeof(*colors));
-
-  for (i = 0; i < cells; i++)
-    colors[i].pixel = i;
-  XQueryColors (dpy, cmap, colors, cells);
-
-  if (grab_verbose_p)
-    fprintf(stderr, "%s: building table for %d bit image\n",
-            progname, image->depth);
-
-  for (i = 0; i < cells; i++)
-    {
-      unsigned short r, g, b;
-
-      if (cells == 256)
-        {
-          /* "RRR GGG BB" In an 8 bit map.  Convert that to
-             "RRR RRR RR" "GGG GGG GG" "BB BB BB BB" to give
-             an even spread. */
-          r = (i & 0x07);
-          g = (i & 0x38) >> 3;
-          b = (i & 0xC0) >> 6;
-
-          r = ((r << 13) | (r << 10) | (r << 7) | (r <<  4) | (r <<  1));
-          g = ((g << 13) | (g << 10) | (g << 7) | (g <<  4) | (g <<  1));
-          b = ((b << 14) | (b << 12) | (b << 10) | (b <<  8) |
-               (b <<  6) | (b <<  4) | (b <<  2) | b);
-        }
-      else
-        {
-          /* "RRRR GGGG BBBB" In a 12 bit map.  Convert that to
-             "RRRR RRRR" "GGGG GGGG" "BBBB BBBB" to give an even
-             spread. */
-          r = (i & 0x00F);
-          g = (i & 0x0F0) >> 4;
-          b = (i & 0xF00) >> 8;
-
-          r = (r << 12) | (r << 8) | (r << 4) | r;
-          g = (g << 12) | (g << 8) | (g << 4) | g;
-          b = (b << 12) | (b << 8) | (b << 4) | b;
-        }
-
-      map[i] = find_closest_pixel (colors, cells, r, g, b);
-    }
-
-  if (grab_verbose_p)
-    fprintf(stderr, "%s: remapping colors in %d bit image\n",
-            progname, image->depth);
-
-  for (y = 0; y < image->height; y++)
-    for (x = 0; x < image->width; x++)
-      {
-        unsigned long pixel = XGetPixel(image, x, y);
-        if (pixel >= cells) abort();
-        XPutPixel(image, x, y, map[pixel]);
-      }
-}
-
-
 #endif /* HAVE_READ_DISPLAY_EXTENSION */
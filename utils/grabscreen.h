@@ -76,6 +76,17 @@ extern Bool top_level_window_p(Screen *screen, Window window);
 /* Don't call this: this is for the "xscreensaver-getimage" program only. */
 extern void grab_screen_image_internal (Screen *, Window);
 
+/* Nor these.  Reads the window's contents into an XImage, using MIT-SHM
+   if possible; returns 0 if the window is not entirely on screen.  Free
+   the image with free_window_ximage(), not XDestroyImage(). */
+extern XImage *grab_window_ximage (Screen *, Window);
+extern void free_window_ximage (Display *, XImage *);
+
+/* Nor this.  Converts an XImage with 8-bit or 12-bit RGB data to use the
+   nearest colors in the given colormap. */
+extern void remap_image_to_colormap (Display *, Colormap, XImage *,
+                                     Bool verbose_p);
+
 /* Don't use these: this is how "xscreensaver-getimage" and "grabclient.c"
    pass the file name around. */
 #define XA_XSCREENSAVER_IMAGE_FILENAME "_SCREENSAVER_IMAGE_FILENAME"
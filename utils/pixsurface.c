@@ -0,0 +1,399 @@
+/* xscreensaver, Copyright (c) 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * Double-buffered pixel surfaces.  See pixsurface.h.
+ */
+
+#include "utils.h"
+
+#ifdef HAVE_XSHM_EXTENSION
+# include "xshm.h"
+#endif
+
+#include "pixsurface.h"
+
+/* If more rectangles than this are dirty, they are merged into one. */
+#define MAX_DIRTY 32
+
+struct pixel_surface_buffer {
+  XImage *image;
+  unsigned int **rows;		/* into image->data, if direct_p */
+#ifdef HAVE_XSHM_EXTENSION
+  XShmSegmentInfo shm_info;
+  unsigned long serial;		/* of the last XShmPutImage from it */
+  Bool busy;			/* the server may still be reading it */
+#endif
+};
+
+struct pixel_surface {
+  Display *dpy;
+  int width, height;
+  Bool shm_p;
+  Bool direct_p;		/* 32 bpp, native byte order */
+
+  /* If !direct_p, the hack draws here instead, and the dirty parts are
+     converted into the XImage by pixel_surface_put(). */
+  unsigned int *pixels;
+  unsigned int **rows;
+
+  int nbuffers;			/* 2 if shm_p && direct_p, else 1 */
+  int back;			/* the one being drawn into */
+  struct pixel_surface_buffer buffers[2];
+
+  XRectangle dirty[MAX_DIRTY];	/* drawn since the last put */
+  int ndirty;
+  XRectangle stale[MAX_DIRTY];	/* put from the other buffer last time */
+  int nstale;
+  Bool synced;			/* back buffer already brought up to date */
+
+#ifdef HAVE_XSHM_EXTENSION
+  int completion_type;
+#endif
+};
+
+
+static Bool
+native_32bpp_p (XImage *image)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  u.i = 1;
+  return (image->bits_per_pixel == 32 &&
+          sizeof(unsigned int) == 4 &&
+          image->bytes_per_line % 4 == 0 &&
+          image->byte_order == (u.c[0] ? LSBFirst : MSBFirst));
+}
+
+
+static unsigned int **
+make_rows (unsigned int *data, int height, int stride)
+{
+  unsigned int **rows = (unsigned int **) malloc (height * sizeof(*rows));
+  int y;
+  if (!rows) return 0;
+  for (y = 0; y < height; y++)
+    rows[y] = data + y * stride;
+  return rows;
+}
+
+
+static void
+free_buffer (pixel_surface *s, struct pixel_surface_buffer *b)
+{
+  if (b->rows) free (b->rows);
+  b->rows = 0;
+  if (!b->image) return;
+#ifdef HAVE_XSHM_EXTENSION
+  if (s->shm_p)
+    destroy_xshm_image (s->dpy, b->image, &b->shm_info);
+  else
+#endif
+    XDestroyImage (b->image);
+  b->image = 0;
+}
+
+
+static Bool
+make_buffer (pixel_surface *s, struct pixel_surface_buffer *b,
+             Visual *visual, unsigned int depth)
+{
+#ifdef HAVE_XSHM_EXTENSION
+  if (s->shm_p)
+    {
+      b->image = create_xshm_image (s->dpy, visual, depth, ZPixmap, 0,
+                                    &b->shm_info, s->width, s->height);
+      return (b->image != 0);
+    }
+#endif /* HAVE_XSHM_EXTENSION */
+
+  b->image = XCreateImage (s->dpy, visual, depth, ZPixmap, 0, 0,
+                           s->width, s->height, 32, 0);
+  if (!b->image) return False;
+  b->image->data = (char *) calloc (b->image->height,
+                                    b->image->bytes_per_line);
+  if (!b->image->data)
+    {
+      XDestroyImage (b->image);
+      b->image = 0;
+      return False;
+    }
+  return True;
+}
+
+
+pixel_surface *
+pixel_surface_create (Display *dpy, Visual *visual, unsigned int depth,
+                      int width, int height, Bool use_shm)
+{
+  pixel_surface *s = (pixel_surface *) calloc (1, sizeof(*s));
+  int i;
+  if (!s) return 0;
+  if (width  < 1) width  = 1;
+  if (height < 1) height = 1;
+
+  s->dpy = dpy;
+  s->width = width;
+  s->height = height;
+  s->nbuffers = 1;
+
+#ifdef HAVE_XSHM_EXTENSION
+  s->shm_p = use_shm;
+  if (s->shm_p && !make_buffer (s, &s->buffers[0], visual, depth))
+    s->shm_p = False;
+  if (s->shm_p)
+    s->completion_type = XShmGetEventBase (dpy) + ShmCompletion;
+#endif /* HAVE_XSHM_EXTENSION */
+
+  if (!s->buffers[0].image &&
+      !make_buffer (s, &s->buffers[0], visual, depth))
+    goto FAIL;
+
+  s->direct_p = native_32bpp_p (s->buffers[0].image);
+
+  /* Double-buffering only helps if we draw straight into the images.
+     Otherwise, the conversion is the only thing that touches them. */
+  if (s->shm_p && s->direct_p)
+    {
+      if (make_buffer (s, &s->buffers[1], visual, depth))
+        {
+          s->nbuffers = 2;
+          memcpy (s->buffers[1].image->data, s->buffers[0].image->data,
+                  s->height * s->buffers[0].image->bytes_per_line);
+        }
+    }
+
+  if (s->direct_p)
+    for (i = 0; i < s->nbuffers; i++)
+      {
+        XImage *image = s->buffers[i].image;
+        s->buffers[i].rows = make_rows ((unsigned int *) image->data,
+                                        s->height, image->bytes_per_line / 4);
+        if (!s->buffers[i].rows) goto FAIL;
+      }
+  else
+    {
+      s->pixels = (unsigned int *)
+        calloc (s->width * s->height, sizeof(*s->pixels));
+      if (!s->pixels) goto FAIL;
+      s->rows = make_rows (s->pixels, s->height, s->width);
+      if (!s->rows) goto FAIL;
+    }
+
+  return s;
+
+ FAIL:
+  pixel_surface_destroy (s);
+  return 0;
+}
+
+
+void
+pixel_surface_destroy (pixel_surface *s)
+{
+  int i;
+  if (!s) return;
+  for (i = 0; i < 2; i++)
+    free_buffer (s, &s->buffers[i]);
+  if (s->rows) free (s->rows);
+  if (s->pixels) free (s->pixels);
+  free (s);
+}
+
+
+Bool
+pixel_surface_shm_p (const pixel_surface *s)
+{
+  return s->shm_p;
+}
+
+
+#ifdef HAVE_XSHM_EXTENSION
+
+static Bool
+completion_event_p (Display *dpy, XEvent *event, XPointer arg)
+{
+  return (event->type == ((pixel_surface *) arg)->completion_type);
+}
+
+/* Waits until the server has finished reading the given image.
+
+   The completion event for it may already have been read and discarded
+   by the main event loop; but in that case, Xlib will already know that
+   the request has been processed, so there's no need to wait for it.
+ */
+static void
+wait_for_buffer (pixel_surface *s, struct pixel_surface_buffer *b)
+{
+  if (!b->busy) return;
+  while ((long) (LastKnownRequestProcessed (s->dpy) - b->serial) < 0)
+    {
+      XEvent event;
+      XIfEvent (s->dpy, &event, completion_event_p, (XPointer) s);
+    }
+  b->busy = False;
+}
+
+#endif /* HAVE_XSHM_EXTENSION */
+
+
+static void
+copy_rect (XImage *to, XImage *from, const XRectangle *r)
+{
+  int bpl = r->width * 4;
+  int y;
+  for (y = r->y; y < r->y + r->height; y++)
+    memcpy (to->data + y * to->bytes_per_line + r->x * 4,
+            from->data + y * from->bytes_per_line + r->x * 4,
+            bpl);
+}
+
+
+unsigned int **
+pixel_surface_begin (pixel_surface *s)
+{
+  struct pixel_surface_buffer *b = &s->buffers[s->back];
+
+  if (!s->direct_p)
+    return s->rows;
+
+  if (!s->synced)
+    {
+#ifdef HAVE_XSHM_EXTENSION
+      wait_for_buffer (s, b);
+#endif
+      if (s->nbuffers > 1)
+        {
+          XImage *front = s->buffers[!s->back].image;
+          int i;
+          for (i = 0; i < s->nstale; i++)
+            copy_rect (b->image, front, &s->stale[i]);
+        }
+      s->nstale = 0;
+      s->synced = True;
+    }
+
+  return b->rows;
+}
+
+
+void
+pixel_surface_dirty (pixel_surface *s, int x, int y, int w, int h)
+{
+  XRectangle *r;
+
+  if (x < 0) { w += x; x = 0; }
+  if (y < 0) { h += y; y = 0; }
+  if (x + w > s->width)  w = s->width  - x;
+  if (y + h > s->height) h = s->height - y;
+  if (w <= 0 || h <= 0) return;
+
+  if (s->ndirty >= MAX_DIRTY)
+    {
+      /* Too many: merge everything into one bounding box. */
+      int x1 = x, y1 = y, x2 = x + w, y2 = y + h;
+      int i;
+      for (i = 0; i < s->ndirty; i++)
+        {
+          r = &s->dirty[i];
+          if (r->x < x1) x1 = r->x;
+          if (r->y < y1) y1 = r->y;
+          if (r->x + r->width  > x2) x2 = r->x + r->width;
+          if (r->y + r->height > y2) y2 = r->y + r->height;
+        }
+      s->ndirty = 0;
+      x = x1; y = y1; w = x2 - x1; h = y2 - y1;
+    }
+
+  r = &s->dirty[s->ndirty++];
+  r->x = x;
+  r->y = y;
+  r->width = w;
+  r->height = h;
+}
+
+
+/* Copies a rectangle of the private pixel buffer into the XImage, for
+   visuals that aren't 32 bits per pixel.
+ */
+static void
+convert_rect (pixel_surface *s, XImage *image, const XRectangle *r)
+{
+  union { int i; char c[sizeof(int)]; } u;
+  int x, y;
+  u.i = 1;
+
+  if (image->bits_per_pixel == 16 && sizeof(unsigned short) == 2 &&
+      image->byte_order == (u.c[0] ? LSBFirst : MSBFirst))
+    for (y = r->y; y < r->y + r->height; y++)
+      {
+        const unsigned int *in = s->rows[y] + r->x;
+        unsigned short *out = (unsigned short *)
+          (image->data + y * image->bytes_per_line) + r->x;
+        for (x = 0; x < r->width; x++)
+          out[x] = in[x];
+      }
+  else
+    for (y = r->y; y < r->y + r->height; y++)
+      {
+        const unsigned int *in = s->rows[y];
+        for (x = r->x; x < r->x + r->width; x++)
+          XPutPixel (image, x, y, in[x]);
+      }
+}
+
+
+void
+pixel_surface_put (pixel_surface *s, Drawable d, GC gc)
+{
+  struct pixel_surface_buffer *b = &s->buffers[s->back];
+  int i;
+
+  if (s->ndirty == 0) return;
+
+  if (s->direct_p)
+    pixel_surface_begin (s);   /* in case the caller didn't */
+#ifdef HAVE_XSHM_EXTENSION
+  else
+    wait_for_buffer (s, b);
+#endif
+
+  for (i = 0; i < s->ndirty; i++)
+    {
+      XRectangle *r = &s->dirty[i];
+      if (!s->direct_p)
+        convert_rect (s, b->image, r);
+#ifdef HAVE_XSHM_EXTENSION
+      if (s->shm_p)
+        XShmPutImage (s->dpy, d, gc, b->image, r->x, r->y, r->x, r->y,
+                      r->width, r->height, (i == s->ndirty - 1));
+      else
+#endif /* HAVE_XSHM_EXTENSION */
+        XPutImage (s->dpy, d, gc, b->image, r->x, r->y, r->x, r->y,
+                   r->width, r->height);
+    }
+
+#ifdef HAVE_XSHM_EXTENSION
+  if (s->shm_p)
+    {
+      /* Only the last request asks for a completion event: the server
+         handles them in order, so when it's done, they all are. */
+      b->serial = NextRequest (s->dpy) - 1;
+      b->busy = True;
+    }
+#endif /* HAVE_XSHM_EXTENSION */
+
+  if (s->nbuffers > 1)
+    {
+      memcpy (s->stale, s->dirty, s->ndirty * sizeof(*s->dirty));
+      s->nstale = s->ndirty;
+      s->back = !s->back;
+    }
+  s->ndirty = 0;
+  s->synced = False;
+}
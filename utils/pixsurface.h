@@ -0,0 +1,61 @@
+/* xscreensaver, Copyright (c) 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+/* A "pixel surface" is an off-screen image that a hack draws into one
+   pixel at a time, and then copies to the window.  It takes care of the
+   usual XImage and MIT-SHM boiler-plate:
+
+   - Each row is an array of 32-bit pixel values (as from XAllocColor or
+     the visual's masks), whatever the depth of the window.  On 32 bpp
+     visuals, the rows point directly into the XImage; otherwise they are
+     converted when the image is copied to the window.
+
+   - Only the rectangles that were marked as dirty are copied.
+
+   - With MIT-SHM, there are two images: while the X server is reading
+     from one, the hack draws into the other.  Rather than calling XSync,
+     pixel_surface_begin() waits for the server to finish with the image
+     that is about to be drawn on, and then brings it up to date with the
+     changes that were made in the other one.
+
+   Usage, once per frame:
+
+       unsigned int **rows = pixel_surface_begin (s);
+       rows[y][x] = pixel; ...
+       pixel_surface_dirty (s, x, y, w, h);
+       pixel_surface_put (s, window, gc);
+
+   The rows returned by pixel_surface_begin() are valid only until the
+   next call to pixel_surface_put().
+ */
+
+#ifndef __XSCREENSAVER_PIXSURFACE_H__
+#define __XSCREENSAVER_PIXSURFACE_H__
+
+typedef struct pixel_surface pixel_surface;
+
+/* If use_shm is false, or MIT-SHM can't be used, the surface is a plain
+   XImage.  Returns 0 if out of memory.
+ */
+extern pixel_surface *pixel_surface_create (Display *, Visual *,
+                                            unsigned int depth,
+                                            int width, int height,
+                                            Bool use_shm);
+extern void pixel_surface_destroy (pixel_surface *);
+
+extern unsigned int **pixel_surface_begin (pixel_surface *);
+extern void pixel_surface_dirty (pixel_surface *, int x, int y, int w, int h);
+extern void pixel_surface_put (pixel_surface *, Drawable, GC);
+
+/* Whether MIT-SHM is being used. */
+extern Bool pixel_surface_shm_p (const pixel_surface *);
+
+#endif /* __XSCREENSAVER_PIXSURFACE_H__ */
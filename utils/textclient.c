@@ -77,6 +77,11 @@ struct text_data {
 
   const char *out_buffer;
   int out_column;
+
+  /* Output of the subprocess that has been read but not yet returned.
+     It's read in large chunks, since one read() per character adds up. */
+  unsigned char in_buffer[4096];
+  int in_start, in_end;
 };
 
 
@@ -255,6 +260,7 @@ textclient_reshape (text_data *d,
       if (d->pipe)
         pclose (d->pipe);
       d->input_available_p = False;
+      d->in_start = d->in_end = 0;
       relaunch_generator_timer (d, 0);
     }
 }
@@ -328,26 +334,30 @@ textclient_close (text_data *d)
   free (d);
 }
 
-int
-textclient_getc (text_data *d)
+/* Makes sure there is something in out_buffer or in_buffer, if the
+   subprocess has written anything.  Returns False if not.
+ */
+static Bool
+textclient_fill (text_data *d)
 {
-  XtAppContext app = XtDisplayToApplicationContext (d->dpy);
-  int ret = -1;
+  XtAppContext app;
 
+  if ((d->out_buffer && *d->out_buffer) || d->in_start < d->in_end)
+    return True;
+
+  app = XtDisplayToApplicationContext (d->dpy);
   if (XtAppPending (app) & (XtIMTimer|XtIMAlternateInput))
     XtAppProcessEvent (app, XtIMTimer|XtIMAlternateInput);
 
-  if (d->out_buffer && *d->out_buffer)
-    {
-      ret = *d->out_buffer;
-      d->out_buffer++;
-    }
-  else if (d->input_available_p && d->pipe)
+  if (d->input_available_p && d->pipe)
     {
-      unsigned char s[2];
-      int n = read (fileno (d->pipe), (void *) s, 1);
+      int n = read (fileno (d->pipe), (void *) d->in_buffer,
+                    sizeof (d->in_buffer));
       if (n > 0)
-        ret = s[0];
+        {
+          d->in_start = 0;
+          d->in_end = n;
+        }
       else		/* EOF */
         {
           if (d->pipe_id)
@@ -394,10 +404,37 @@ textclient_getc (text_data *d)
       d->input_available_p = False;
     }
 
-  if (ret == '\r' || ret == '\n')
+  return ((d->out_buffer && *d->out_buffer) || d->in_start < d->in_end);
+}
+
+
+static void
+track_column (text_data *d, int c)
+{
+  if (c == '\r' || c == '\n')
     d->out_column = 0;
-  else if (ret > 0)
+  else if (c > 0)
     d->out_column++;
+}
+
+
+int
+textclient_getc (text_data *d)
+{
+  int ret = -1;
+
+  if (textclient_fill (d))
+    {
+      if (d->out_buffer && *d->out_buffer)
+        {
+          ret = *d->out_buffer;
+          d->out_buffer++;
+        }
+      else
+        ret = d->in_buffer[d->in_start++];
+    }
+
+  track_column (d, ret);
 
 # ifdef DEBUG
   if (ret <= 0)
@@ -412,6 +449,31 @@ textclient_getc (text_data *d)
 }
 
 
+int
+textclient_read (text_data *d, char *buf, int n)
+{
+  int i = 0;
+
+  while (i < n && textclient_fill (d))
+    {
+      int c;
+      if (d->out_buffer && *d->out_buffer)
+        c = *d->out_buffer++;
+      else
+        c = d->in_buffer[d->in_start++];
+      track_column (d, c);
+      if (c)			/* NULs would end the string early */
+        buf[i++] = c;
+    }
+
+# ifdef DEBUG
+  fprintf (stderr, "%s: textclient: read: %d\n", progname, i);
+# endif
+
+  return i;
+}
+
+
 /* The interpretation of the ModN modifiers is dependent on what keys
    are bound to them: Mod1 does not necessarily mean "meta".  It only
    means "meta" if Meta_L or Meta_R are bound to it.  If Meta_L is on
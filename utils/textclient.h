@@ -26,6 +26,12 @@ extern void textclient_reshape (text_data *,
                                 int pix_w, int pix_h,
                                 int char_w, int char_h);
 extern int textclient_getc (text_data *);
+
+/* Copies up to n bytes of whatever output is available into buf, without
+   waiting for more, and returns how many there were.  NUL bytes are
+   dropped.
+ */
+extern int textclient_read (text_data *, char *buf, int n);
 extern Bool textclient_putc (text_data *, XKeyEvent *);
 
 #endif /* __TEXTCLIENT_H__ */
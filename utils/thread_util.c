@@ -0,0 +1,212 @@
+/* xscreensaver, Copyright (c) 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *
+ * A tiny pool of worker threads.  See thread_util.h.
+ */
+
+#include "utils.h"
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "thread_util.h"
+
+extern char *progname;
+
+struct threadpool_worker {
+  threadpool *pool;
+  unsigned index;
+};
+
+struct threadpool {
+  unsigned count;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t start_cond;	/* a new job was posted, or we're quitting */
+  pthread_cond_t done_cond;	/* the last worker finished the current job */
+  pthread_t *threads;		/* count-1 of these; index 0 is the caller */
+  struct threadpool_worker *workers;
+
+  threadpool_fn fn;
+  void *closure;
+  unsigned long generation;	/* bumped once per threadpool_run() */
+  unsigned pending;		/* workers that haven't finished this job */
+  Bool quit;
+#endif /* HAVE_PTHREAD */
+};
+
+
+unsigned
+hardware_concurrency (void)
+{
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n > 0) return (unsigned) n;
+#endif
+  return 1;
+}
+
+
+#ifdef HAVE_PTHREAD
+
+static void *
+threadpool_thread (void *arg)
+{
+  struct threadpool_worker *w = (struct threadpool_worker *) arg;
+  threadpool *pool = w->pool;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock (&pool->mutex);
+  for (;;)
+    {
+      threadpool_fn fn;
+      void *closure;
+
+      while (pool->generation == seen && !pool->quit)
+        pthread_cond_wait (&pool->start_cond, &pool->mutex);
+      if (pool->quit)
+        break;
+      seen = pool->generation;
+      fn = pool->fn;
+      closure = pool->closure;
+      pthread_mutex_unlock (&pool->mutex);
+
+      fn (closure, w->index, pool->count);
+
+      pthread_mutex_lock (&pool->mutex);
+      if (--pool->pending == 0)
+        pthread_cond_signal (&pool->done_cond);
+    }
+  pthread_mutex_unlock (&pool->mutex);
+  return 0;
+}
+
+#endif /* HAVE_PTHREAD */
+
+
+threadpool *
+threadpool_create (unsigned count)
+{
+  threadpool *pool = (threadpool *) calloc (1, sizeof(*pool));
+  if (!pool) return 0;
+
+  if (count == 0)
+    count = hardware_concurrency();
+
+#ifdef HAVE_PTHREAD
+  pool->count = 1;
+  if (count > 1)
+    {
+      unsigned i;
+      pool->threads = (pthread_t *) calloc (count - 1, sizeof(pthread_t));
+      pool->workers = (struct threadpool_worker *)
+        calloc (count - 1, sizeof(*pool->workers));
+      if (!pool->threads || !pool->workers)
+        {
+          free (pool->threads);
+          free (pool->workers);
+          free (pool);
+          return 0;
+        }
+
+      pthread_mutex_init (&pool->mutex, 0);
+      pthread_cond_init (&pool->start_cond, 0);
+      pthread_cond_init (&pool->done_cond, 0);
+
+      for (i = 0; i < count - 1; i++)
+        {
+          int err;
+          pool->workers[i].pool = pool;
+          pool->workers[i].index = i + 1;
+          err = pthread_create (&pool->threads[i], 0, threadpool_thread,
+                                &pool->workers[i]);
+          if (err)
+            {
+              fprintf (stderr, "%s: pthread_create: %s\n", progname,
+                       strerror (err));
+              break;
+            }
+          pool->count++;
+        }
+    }
+#else  /* !HAVE_PTHREAD */
+  pool->count = 1;
+#endif /* !HAVE_PTHREAD */
+
+  return pool;
+}
+
+
+void
+threadpool_destroy (threadpool *pool)
+{
+  if (!pool) return;
+#ifdef HAVE_PTHREAD
+  if (pool->threads)
+    {
+      unsigned i;
+      pthread_mutex_lock (&pool->mutex);
+      pool->quit = True;
+      pthread_cond_broadcast (&pool->start_cond);
+      pthread_mutex_unlock (&pool->mutex);
+
+      for (i = 0; i < pool->count - 1; i++)
+        pthread_join (pool->threads[i], 0);
+
+      pthread_cond_destroy (&pool->done_cond);
+      pthread_cond_destroy (&pool->start_cond);
+      pthread_mutex_destroy (&pool->mutex);
+      free (pool->threads);
+      free (pool->workers);
+    }
+#endif /* HAVE_PTHREAD */
+  free (pool);
+}
+
+
+unsigned
+threadpool_count (const threadpool *pool)
+{
+  return pool->count;
+}
+
+
+void
+threadpool_run (threadpool *pool, threadpool_fn fn, void *closure)
+{
+#ifdef HAVE_PTHREAD
+  if (pool->count > 1)
+    {
+      pthread_mutex_lock (&pool->mutex);
+      pool->fn = fn;
+      pool->closure = closure;
+      pool->pending = pool->count - 1;
+      pool->generation++;
+      pthread_cond_broadcast (&pool->start_cond);
+      pthread_mutex_unlock (&pool->mutex);
+
+      fn (closure, 0, pool->count);
+
+      pthread_mutex_lock (&pool->mutex);
+      while (pool->pending)
+        pthread_cond_wait (&pool->done_cond, &pool->mutex);
+      pthread_mutex_unlock (&pool->mutex);
+      return;
+    }
+#endif /* HAVE_PTHREAD */
+
+  fn (closure, 0, 1);
+}
@@ -0,0 +1,57 @@
+/* xscreensaver, Copyright (c) 2026 Jamie Zawinski <jwz@jwz.org>
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation.  No representations are made about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ */
+
+/* A tiny pool of worker threads, for hacks that want to split the
+   rendering of each frame into independent pieces and run them on all
+   of the CPUs at once.
+
+   The pool is created once, and then threadpool_run() is called once per
+   frame: it calls the given function 'count' times in parallel, once on
+   each thread (including the calling thread), and returns only when all
+   of them have finished.  The workers must not touch the X connection,
+   and must not call random().
+
+   If POSIX threads are not available, or "useThreads" is false, the pool
+   has a single member and threadpool_run() is just a function call.
+ */
+
+#ifndef __XSCREENSAVER_THREAD_UTIL_H__
+#define __XSCREENSAVER_THREAD_UTIL_H__
+
+typedef struct threadpool threadpool;
+
+/* Called with index in [0, count).  Index 0 runs on the calling thread. */
+typedef void (*threadpool_fn) (void *closure, unsigned index, unsigned count);
+
+/* Returns the number of CPUs that are currently online, or 1. */
+extern unsigned hardware_concurrency (void);
+
+/* Creates a pool of 'count' workers, including the calling thread.
+   A count of 0 means one per CPU.  Returns 0 only if out of memory;
+   if threads can't be created, the pool just has fewer of them.
+ */
+extern threadpool *threadpool_create (unsigned count);
+extern void threadpool_destroy (threadpool *);
+extern unsigned threadpool_count (const threadpool *);
+extern void threadpool_run (threadpool *, threadpool_fn, void *closure);
+
+#ifdef HAVE_PTHREAD
+# define THREAD_DEFAULTS \
+  "*useThreads:      True",
+# define THREAD_OPTIONS \
+  { "-threads",    ".useThreads", XrmoptionNoArg, "True"  }, \
+  { "-no-threads", ".useThreads", XrmoptionNoArg, "False" },
+#else
+# define THREAD_DEFAULTS
+# define THREAD_OPTIONS
+#endif
+
+#endif /* __XSCREENSAVER_THREAD_UTIL_H__ */
@@ -59,6 +59,7 @@
 # include <unistd.h>  /* for getpid() */
 #endif
 #include <sys/time.h> /* for gettimeofday() */
+#include <string.h>   /* for memcpy() */
 
 #include "yarandom.h"
 # undef ya_rand_init
@@ -86,6 +87,11 @@ static unsigned int a[VectorSize] = {
 
 static int i1, i2;
 
+/* A copy of the table as it was before the first ya_rand_init(), so that
+   seeding it again with the same number gives the same sequence. */
+static unsigned int a_orig[VectorSize];
+static int a_saved = 0;
+
 unsigned int
 ya_random (void)
 {
@@ -100,6 +106,15 @@ void
 ya_rand_init(unsigned int seed)
 {
   int i;
+
+  if (! a_saved)
+    {
+      memcpy (a_orig, a, sizeof(a));
+      a_saved = 1;
+    }
+  else
+    memcpy (a, a_orig, sizeof(a));
+
   if (seed == 0)
     {
       struct timeval tp;